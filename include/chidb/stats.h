@@ -0,0 +1,82 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  I/O statistics
+ *
+ *  The Pager counts the pages it reads and writes, how well its buffer
+ *  pool is doing, and how long it spends waiting on the file.
+ *  chidb_stats returns those counters for a database, and
+ *  chidb_stats_reset sets them back to zero (e.g., before running a
+ *  statement, to see what that statement alone did).
+ *
+ *  The counters are updated atomically, so they can be read from
+ *  another thread while the database is in use.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef CHIDB_STATS_H_
+#define CHIDB_STATS_H_
+
+#include <stdint.h>
+#include <chidb/chidb.h>
+
+typedef struct chidb_stats
+{
+    /* Buffer pool */
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t evictions;            /* Pages evicted to make room for others */
+
+    /* Reads (from the file or the write-ahead log) */
+    uint64_t pages_read;
+    uint64_t bytes_read;
+    uint64_t read_calls;           /* Calls into the backend (a batch is one call) */
+    uint64_t read_ns;              /* Time spent in those calls */
+
+    /* Writes (to the file or the write-ahead log) */
+    uint64_t pages_written;
+    uint64_t bytes_written;
+    uint64_t write_calls;          /* Write system calls */
+    uint64_t write_ns;
+
+    /* Syncs (including the ones done by a background thread) */
+    uint64_t syncs;
+    uint64_t sync_ns;
+} chidb_stats_t;
+
+int chidb_stats(chidb *db, chidb_stats_t *stats);
+int chidb_stats_reset(chidb *db);
+
+#endif /* CHIDB_STATS_H_ */
@@ -43,6 +43,8 @@
 
 #include <stdlib.h>
 #include <chidb/chidb.h>
+#include <chidb/serialize.h>
+#include <chidb/stats.h>
 #include "dbm.h"
 #include "btree.h"
 #include "record.h"
@@ -60,10 +62,18 @@ int chidb_stmt_optimize(chidb *db,
 
 int chidb_open(const char *file, chidb **db)
 {
+    int rc;
+
     *db = malloc(sizeof(chidb));
     if (*db == NULL)
         return CHIDB_ENOMEM;
-    chidb_Btree_open(file, *db, &(*db)->bt);
+
+    /* file can also be ":memory:" or a "file:" URI (see chidb_Pager_open) */
+    if ((rc = chidb_Btree_open(file, *db, &(*db)->bt)) != CHIDB_OK)
+    {
+        free(*db);
+        return rc;
+    }
 
     /* Additional initialization code goes here */
     return CHIDB_OK;
@@ -79,6 +89,26 @@ int chidb_close(chidb *db)
     return CHIDB_OK;
 }
 
+/* Save the database (typically, a ":memory:" one) to a file
+ * that can later be opened with chidb_open (see chidb/serialize.h) */
+int chidb_serialize(chidb *db, const char *file)
+{
+    return chidb_Pager_serialize(db->bt->pager, file);
+}
+
+/* I/O statistics (see chidb/stats.h) */
+int chidb_stats(chidb *db, chidb_stats_t *stats)
+{
+    chidb_Pager_getStats(db->bt->pager, stats);
+    return CHIDB_OK;
+}
+
+int chidb_stats_reset(chidb *db)
+{
+    chidb_Pager_resetStats(db->bt->pager);
+    return CHIDB_OK;
+}
+
 int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
 {
     int rc;
@@ -137,7 +167,11 @@ int chidb_step(chidb_stmt *stmt)
 
 int chidb_finalize(chidb_stmt *stmt)
 {
-    return chidb_stmt_free(stmt);
+    /* Statement is done; write back the pages it modified */
+    int rc = chidb_Pager_flush(stmt->db->bt->pager);
+    int free_rc = chidb_stmt_free(stmt);
+
+    return rc != CHIDB_OK? rc : free_rc;
 }
 
 int chidb_column_count(chidb_stmt *stmt)
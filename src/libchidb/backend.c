@@ -0,0 +1,1905 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module contains the backends that the Pager can use to access a
+ * file. A backend is a table of operations (open, read, write, size,
+ * sync, close, etc.; see backend.h) and the Pager only ever goes
+ * through it, so a different way of doing I/O can be plugged in without
+ * changing the Pager or the B-Tree module. The backend is picked when
+ * the file is opened, with the "backend" option of a "file:" URI
+ * (see chidb_Pager_open). The available backends are:
+ *
+ * - file: The default. Accesses the file through a file descriptor,
+ *         with pread and pwritev.
+ * - mmap: Like "file", but reads are served from a shared, read-only
+ *         mapping of the file (and so, without a system call). Writes
+ *         still use pwritev. Not to be confused with the "mmap" option,
+ *         which makes the Pager hand out pages that point straight into
+ *         a private mapping of the file, and works with both.
+ * - memory: Keeps the file in memory. Nothing is ever read from or
+ *           written to disk, so the contents are lost when the file
+ *           is closed. The filename is ignored.
+ * - counting: Accesses the file like "file", but counts the operations
+ *             done on it, and can add latency to them (the
+ *             "read_latency", "write_latency" and "sync_latency"
+ *             options, in microseconds) to simulate a slow disk.
+ * - uring: Like "file", but batches of reads (see readBatch, and
+ *          chidb_Pager_prefetchPages) are submitted to an io_uring, so
+ *          the device can work on up to "queue_depth" of them at once.
+ *          The ring is set up with the raw system calls (liburing is
+ *          not needed). If the kernel does not support io_uring, or
+ *          chidb was built without <linux/io_uring.h>, the backend
+ *          falls back to one pread at a time.
+ *
+ * The file, counting and uring backends can also do direct I/O
+ * (O_DIRECT) when the file is opened with PAGER_OPEN_DIRECT (the
+ * Pager's "direct" option), so pages are not cached twice: once by the
+ * OS and once in the Pager's buffer pool. Direct I/O must be done in
+ * whole blocks of the device, from buffers aligned to them. The
+ * alignment is asked to the file system (statx), and kept in the file's
+ * direct_align, so the Pager can lay out its buffers accordingly. A read
+ * or write that is not aligned anyway (e.g., reading the 100-byte file
+ * header) goes through an aligned bounce buffer. If the file system
+ * does not support direct I/O (some refuse O_DIRECT, others only fail
+ * the first read), the file quietly goes back to buffered I/O.
+ *
+ * Finally, a file opened with any backend can be accessed through the
+ * compressed layer (chidb_Backend_compress; the Pager's "compress"
+ * option), which compresses each block (page) with the LZ codec in lz.c
+ * before writing it. A compressed block takes a variable number of
+ * units (a sixteenth of a block), so the file is laid out as:
+ *
+ * - A 64-byte header, in the first unit: magic, version, block size,
+ *   size of the uncompressed file, and the offset and number of entries
+ *   of the page map.
+ * - The page map: for each block, the offset and length of its extent
+ *   (the length is the block size if the block did not compress, and
+ *   the offset is 0 if the block has never been written). The map is
+ *   split into chunks of PAGER_COMPRESSED_CHUNK entries, each followed
+ *   by its checksum.
+ * - The extents of the blocks, anywhere after the header.
+ *
+ * Opening a compressed file only reads its header. Each chunk of the
+ * page map is read the first time one of its blocks is read, and the
+ * whole map (which is needed to find free space) only once the file is
+ * first modified. A block that still fits in its extent is rewritten in
+ * place; otherwise it moves to a new extent. The page map is kept in
+ * memory, and written (to a new extent, followed by the header that
+ * points to it) on every sync. Space that is freed is only reused once a sync has made a map
+ * that no longer refers to it durable. The compressed layer does not
+ * provide map or allocate, so the Pager does not use mmap or
+ * preallocation with it.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include <chidb/log.h>
+
+#include "chidbInt.h"
+
+#include "backend.h"
+#include "lz.h"
+#include "util.h"
+
+
+/*
+ * file: pread/pwritev on a file descriptor
+ */
+
+#define directAligned(f, x) (((uintptr_t) (x) & ((f)->base.direct_align - 1)) == 0)
+
+/* Stop doing direct I/O on a file, which then goes through the page cache */
+static void chidb_Backend_fileBuffered(PagerFdFile *f)
+{
+    chilog(WARNING, "Direct I/O is not supported on %s. Using the page cache.", f->filename);
+    fcntl(f->fd, F_SETFL, fcntl(f->fd, F_GETFL) & ~O_DIRECT);
+    __atomic_store_n(&f->base.direct_align, 0, __ATOMIC_RELAXED);
+}
+
+/* Find out the alignment that direct I/O on a file opened with O_DIRECT
+ * needs, or go back to buffered I/O if the file system cannot do it */
+static void chidb_Backend_fileSetupDirect(PagerFdFile *f)
+{
+    uint32_t align = PAGER_DIRECT_ALIGN;
+
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+
+    if (statx(f->fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN))
+    {
+        if (stx.stx_dio_offset_align == 0)
+        {
+            chidb_Backend_fileBuffered(f);
+            return;
+        }
+        align = (stx.stx_dio_offset_align > stx.stx_dio_mem_align)? stx.stx_dio_offset_align : stx.stx_dio_mem_align;
+    }
+#endif
+
+    f->base.direct_align = align;
+    chilog(TRACE, "Direct I/O on %s, in blocks of %u bytes", f->filename, align);
+}
+
+static int chidb_Backend_fileOpen(const PagerBackend *backend, const char *filename, int flags,
+                                  const PagerBackendOptions *options, PagerFile **file)
+{
+    int oflags = (flags & PAGER_OPEN_CREATE)? O_RDWR | O_CREAT : O_RDWR;
+    PagerFdFile *f;
+
+    f = calloc(1, sizeof(PagerFdFile));
+    if (f == NULL)
+        return CHIDB_ENOMEM;
+    f->base.backend = backend;
+
+    f->filename = strdup(filename);
+    if (f->filename == NULL)
+    {
+        free(f);
+        return CHIDB_ENOMEM;
+    }
+
+    f->fd = open(filename, oflags | ((flags & PAGER_OPEN_DIRECT)? O_DIRECT : 0), 0644);
+    if (f->fd < 0 && errno == EINVAL && (flags & PAGER_OPEN_DIRECT))
+    {
+        chilog(WARNING, "%s cannot be opened with O_DIRECT. Using the page cache.", filename);
+        flags &= ~PAGER_OPEN_DIRECT;
+        f->fd = open(filename, oflags, 0644);
+    }
+    if (f->fd < 0)
+    {
+        int rc = (errno == ENOENT)? CHIDB_ENOFILE : CHIDB_EIO;
+        free(f->filename);
+        free(f);
+        return rc;
+    }
+
+    if (flags & PAGER_OPEN_DIRECT)
+        chidb_Backend_fileSetupDirect(f);
+
+    *file = &f->base;
+
+    return CHIDB_OK;
+}
+
+/* Read from a file opened with O_DIRECT
+ *
+ * Unless buf, count and offset are all aligned, the blocks that cover
+ * the range are read into a bounce buffer, and the range is copied
+ * from it. A direct read only comes up short at the end of the file
+ * (after which the rest of the range cannot be read with an aligned
+ * offset anyway), so this does not retry short reads like chidb_pread.
+ */
+static ssize_t chidb_Backend_directRead(PagerFdFile *f, void *buf, size_t count, off_t offset)
+{
+    size_t align = f->base.direct_align;
+    off_t start = offset & ~((off_t) align - 1);
+    size_t len = ((offset + count + align - 1) & ~((off_t) align - 1)) - start;
+    uint8_t *dst = buf, *bounce = NULL;
+    ssize_t n;
+
+    if (!directAligned(f, buf) || start != offset || len != count)
+    {
+        if (posix_memalign((void **) &bounce, align, len) != 0)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        dst = bounce;
+    }
+
+    while ((n = pread(f->fd, dst, len, start)) < 0 && errno == EINTR)
+        ;
+
+    /* Some file systems accept O_DIRECT, and only refuse the reads */
+    if (n < 0 && errno == EINVAL)
+    {
+        free(bounce);
+        chidb_Backend_fileBuffered(f);
+        return chidb_pread(f->fd, buf, count, offset);
+    }
+
+    if (bounce != NULL)
+    {
+        n = (n < offset - start)? (n < 0? -1 : 0) : n - (offset - start);
+        if (n > (ssize_t) count)
+            n = count;
+        if (n > 0)
+            memcpy(buf, bounce + (offset - start), n);
+        free(bounce);
+    }
+
+    return n;
+}
+
+/* Write to a file opened with O_DIRECT
+ *
+ * Buffers that are not aligned are gathered into an aligned bounce
+ * buffer. The offset and the size must be aligned (the Pager makes
+ * sure its pages are, see chidb_Pager_setPageSize): if they are not,
+ * the file goes back to buffered I/O.
+ */
+static int chidb_Backend_directWrite(PagerFdFile *f, struct iovec *iov, int iovcnt, off_t offset)
+{
+    struct iovec bounce;
+    size_t len = 0;
+    bool aligned = true;
+    int calls;
+
+    for(int i = 0; i < iovcnt; i++)
+    {
+        len += iov[i].iov_len;
+        aligned = aligned && directAligned(f, iov[i].iov_base) && directAligned(f, iov[i].iov_len);
+    }
+
+    if (!directAligned(f, offset) || !directAligned(f, len))
+    {
+        chidb_Backend_fileBuffered(f);
+        return chidb_pwritev(f->fd, iov, iovcnt, offset);
+    }
+    if (aligned)
+        return chidb_pwritev(f->fd, iov, iovcnt, offset);
+
+    if (posix_memalign(&bounce.iov_base, f->base.direct_align, len) != 0)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    bounce.iov_len = 0;
+    for(int i = 0; i < iovcnt; i++)
+    {
+        memcpy((uint8_t *) bounce.iov_base + bounce.iov_len, iov[i].iov_base, iov[i].iov_len);
+        bounce.iov_len += iov[i].iov_len;
+    }
+    calls = chidb_pwritev(f->fd, &bounce, 1, offset);
+    free(bounce.iov_base);
+
+    return calls;
+}
+
+static ssize_t chidb_Backend_fileRead(PagerFile *file, void *buf, size_t count, off_t offset)
+{
+    PagerFdFile *f = (PagerFdFile *) file;
+
+    /* A sharded Pager reads from several threads, one of which may
+     * turn direct I/O off */
+    if (__atomic_load_n(&file->direct_align, __ATOMIC_RELAXED) != 0)
+        return chidb_Backend_directRead(f, buf, count, offset);
+
+    return chidb_pread(f->fd, buf, count, offset);
+}
+
+static void chidb_Backend_fileWillNeed(PagerFile *file, off_t offset, off_t len)
+{
+    /* The kernel reads the range in the background (into the page
+     * cache, so this is of no use with direct I/O) */
+    if (file->direct_align == 0)
+        posix_fadvise(((PagerFdFile *) file)->fd, offset, len, POSIX_FADV_WILLNEED);
+}
+
+static int chidb_Backend_fileWrite(PagerFile *file, struct iovec *iov, int iovcnt, off_t offset)
+{
+    if (file->direct_align != 0)
+        return chidb_Backend_directWrite((PagerFdFile *) file, iov, iovcnt, offset);
+
+    return chidb_pwritev(((PagerFdFile *) file)->fd, iov, iovcnt, offset);
+}
+
+static int chidb_Backend_fileSize(PagerFile *file, off_t *size)
+{
+    struct stat buf;
+
+    if (fstat(((PagerFdFile *) file)->fd, &buf) != 0)
+        return CHIDB_EIO;
+    *size = buf.st_size;
+
+    return CHIDB_OK;
+}
+
+static int chidb_Backend_fileAllocate(PagerFile *file, off_t offset, off_t len)
+{
+    /* posix_fallocate returns an error number instead of setting errno */
+    int err = posix_fallocate(((PagerFdFile *) file)->fd, offset, len);
+
+    if (err != 0)
+    {
+        errno = err;
+        return CHIDB_EIO;
+    }
+
+    return CHIDB_OK;
+}
+
+static int chidb_Backend_fileTruncate(PagerFile *file, off_t size)
+{
+    return (ftruncate(((PagerFdFile *) file)->fd, size) == 0)? CHIDB_OK : CHIDB_EIO;
+}
+
+static int chidb_Backend_fileSync(PagerFile *file)
+{
+    return (fdatasync(((PagerFdFile *) file)->fd) == 0)? CHIDB_OK : CHIDB_EIO;
+}
+
+static int chidb_Backend_fileMap(PagerFile *file, size_t size, uint8_t **addr)
+{
+    void *m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, ((PagerFdFile *) file)->fd, 0);
+
+    if (m == MAP_FAILED)
+        return CHIDB_ENOMEM;
+    *addr = m;
+
+    return CHIDB_OK;
+}
+
+static void chidb_Backend_fileUnmap(PagerFile *file, uint8_t *addr, size_t size)
+{
+    munmap(addr, size);
+}
+
+static int chidb_Backend_fileClose(PagerFile *file, bool remove)
+{
+    PagerFdFile *f = (PagerFdFile *) file;
+    int rc = CHIDB_OK;
+
+    if (f->map != NULL)
+        munmap(f->map, f->map_size);
+    if (remove && unlink(f->filename) != 0)
+        rc = CHIDB_EIO;
+    if (close(f->fd) != 0)
+        rc = CHIDB_EIO;
+    free(f->filename);
+    free(f);
+
+    return rc;
+}
+
+const PagerBackend chidb_Backend_file =
+{
+    "file",
+    chidb_Backend_fileOpen,
+    chidb_Backend_fileRead,
+    NULL,
+    chidb_Backend_fileWillNeed,
+    chidb_Backend_fileWrite,
+    chidb_Backend_fileSize,
+    chidb_Backend_fileAllocate,
+    chidb_Backend_fileTruncate,
+    chidb_Backend_fileSync,
+    chidb_Backend_fileMap,
+    chidb_Backend_fileUnmap,
+    chidb_Backend_fileClose
+};
+
+
+/*
+ * mmap: like file, but reads are copied from a shared mapping
+ */
+
+static int chidb_Backend_mmapOpen(const PagerBackend *backend, const char *filename, int flags,
+                                  const PagerBackendOptions *options, PagerFile **file)
+{
+    /* Reads are served from the page cache, so direct I/O is of no use */
+    return chidb_Backend_fileOpen(backend, filename, flags & ~PAGER_OPEN_DIRECT, options, file);
+}
+
+/* Map the whole file (if it has grown since it was last mapped) */
+static void chidb_Backend_mmapRemap(PagerFdFile *f)
+{
+    off_t size;
+    void *m;
+
+    if (chidb_Backend_fileSize(&f->base, &size) != CHIDB_OK || (size_t) size == f->map_size)
+        return;
+
+    if (f->map != NULL)
+        munmap(f->map, f->map_size);
+    f->map = NULL;
+    f->map_size = 0;
+    if (size == 0)
+        return;
+
+    m = mmap(NULL, size, PROT_READ, MAP_SHARED, f->fd, 0);
+    if (m == MAP_FAILED)
+        return;
+    f->map = m;
+    f->map_size = size;
+}
+
+static ssize_t chidb_Backend_mmapRead(PagerFile *file, void *buf, size_t count, off_t offset)
+{
+    PagerFdFile *f = (PagerFdFile *) file;
+
+    if ((size_t) offset + count > f->map_size)
+        chidb_Backend_mmapRemap(f);
+
+    /* Anything that is not mapped (e.g., if mmap failed) is read
+     * with pread */
+    if ((size_t) offset + count > f->map_size)
+        return chidb_pread(f->fd, buf, count, offset);
+
+    memcpy(buf, f->map + offset, count);
+
+    return count;
+}
+
+static int chidb_Backend_mmapTruncate(PagerFile *file, off_t size)
+{
+    PagerFdFile *f = (PagerFdFile *) file;
+
+    /* Reading a mapped page past the end of the file is a SIGBUS */
+    if (f->map != NULL)
+        munmap(f->map, f->map_size);
+    f->map = NULL;
+    f->map_size = 0;
+
+    return chidb_Backend_fileTruncate(file, size);
+}
+
+const PagerBackend chidb_Backend_mmap =
+{
+    "mmap",
+    chidb_Backend_mmapOpen,
+    chidb_Backend_mmapRead,
+    NULL,
+    chidb_Backend_fileWillNeed,
+    chidb_Backend_fileWrite,
+    chidb_Backend_fileSize,
+    chidb_Backend_fileAllocate,
+    chidb_Backend_mmapTruncate,
+    chidb_Backend_fileSync,
+    chidb_Backend_fileMap,
+    chidb_Backend_fileUnmap,
+    chidb_Backend_fileClose
+};
+
+
+/*
+ * memory: the file is a buffer in memory
+ */
+
+static int chidb_Backend_memoryOpen(const PagerBackend *backend, const char *filename, int flags,
+                                    const PagerBackendOptions *options, PagerFile **file)
+{
+    PagerMemoryFile *f;
+
+    /* There is never an existing file to open */
+    if (!(flags & PAGER_OPEN_CREATE))
+        return CHIDB_ENOFILE;
+
+    f = calloc(1, sizeof(PagerMemoryFile));
+    if (f == NULL)
+        return CHIDB_ENOMEM;
+    f->base.backend = backend;
+    *file = &f->base;
+
+    return CHIDB_OK;
+}
+
+static ssize_t chidb_Backend_memoryRead(PagerFile *file, void *buf, size_t count, off_t offset)
+{
+    PagerMemoryFile *f = (PagerMemoryFile *) file;
+
+    if ((size_t) offset >= f->size)
+        return 0;
+    if (count > f->size - offset)
+        count = f->size - offset;
+    memcpy(buf, f->data + offset, count);
+
+    return count;
+}
+
+/* Make sure the buffer can hold size bytes */
+static int chidb_Backend_memoryReserve(PagerMemoryFile *f, size_t size)
+{
+    size_t capacity = f->capacity? f->capacity : 4096;
+    uint8_t *data;
+
+    if (size <= f->capacity)
+        return CHIDB_OK;
+
+    while (capacity < size)
+        capacity *= 2;
+    data = realloc(f->data, capacity);
+    if (data == NULL)
+        return CHIDB_ENOMEM;
+    f->data = data;
+    f->capacity = capacity;
+
+    return CHIDB_OK;
+}
+
+static int chidb_Backend_memoryWrite(PagerFile *file, struct iovec *iov, int iovcnt, off_t offset)
+{
+    PagerMemoryFile *f = (PagerMemoryFile *) file;
+    size_t end = offset;
+
+    for(int i = 0; i < iovcnt; i++)
+        end += iov[i].iov_len;
+    if (chidb_Backend_memoryReserve(f, end) != CHIDB_OK)
+        return -1;
+
+    /* Writing past the end leaves a hole of zeroes */
+    if ((size_t) offset > f->size)
+        memset(f->data + f->size, 0, offset - f->size);
+
+    for(int i = 0; i < iovcnt; i++)
+    {
+        memcpy(f->data + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+    if (end > f->size)
+        f->size = end;
+
+    return 0;
+}
+
+static int chidb_Backend_memorySize(PagerFile *file, off_t *size)
+{
+    *size = ((PagerMemoryFile *) file)->size;
+
+    return CHIDB_OK;
+}
+
+static int chidb_Backend_memoryTruncate(PagerFile *file, off_t size)
+{
+    PagerMemoryFile *f = (PagerMemoryFile *) file;
+
+    if (chidb_Backend_memoryReserve(f, size) != CHIDB_OK)
+        return CHIDB_EIO;
+    if ((size_t) size > f->size)
+        memset(f->data + f->size, 0, size - f->size);
+    f->size = size;
+
+    return CHIDB_OK;
+}
+
+static int chidb_Backend_memorySync(PagerFile *file)
+{
+    return CHIDB_OK;
+}
+
+static int chidb_Backend_memoryClose(PagerFile *file, bool remove)
+{
+    PagerMemoryFile *f = (PagerMemoryFile *) file;
+
+    free(f->data);
+    free(f);
+
+    return CHIDB_OK;
+}
+
+const PagerBackend chidb_Backend_memory =
+{
+    "memory",
+    chidb_Backend_memoryOpen,
+    chidb_Backend_memoryRead,
+    NULL,
+    NULL,
+    chidb_Backend_memoryWrite,
+    chidb_Backend_memorySize,
+    NULL,
+    chidb_Backend_memoryTruncate,
+    chidb_Backend_memorySync,
+    NULL,
+    NULL,
+    chidb_Backend_memoryClose
+};
+
+
+/*
+ * counting: the file backend, with counters and added latency
+ */
+
+static void chidb_Backend_delay(uint32_t usec)
+{
+    struct timespec ts = {usec / 1000000, (long) (usec % 1000000) * 1000};
+
+    if (usec > 0)
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+            ;
+}
+
+static int chidb_Backend_countingOpen(const PagerBackend *backend, const char *filename, int flags,
+                                      const PagerBackendOptions *options, PagerFile **file)
+{
+    PagerCountingFile *f;
+    int rc;
+
+    f = calloc(1, sizeof(PagerCountingFile));
+    if (f == NULL)
+        return CHIDB_ENOMEM;
+    f->base.backend = backend;
+    if (options != NULL)
+        f->latency = *options;
+
+    if ((rc = chidb_Backend_file.open(&chidb_Backend_file, filename, flags, options, &f->inner)) != CHIDB_OK)
+    {
+        free(f);
+        return rc;
+    }
+    f->base.direct_align = f->inner->direct_align;
+    *file = &f->base;
+
+    return CHIDB_OK;
+}
+
+static ssize_t chidb_Backend_countingRead(PagerFile *file, void *buf, size_t count, off_t offset)
+{
+    PagerCountingFile *f = (PagerCountingFile *) file;
+    ssize_t n;
+
+    chidb_Backend_delay(f->latency.read_latency);
+    n = f->inner->backend->read(f->inner, buf, count, offset);
+
+    /* The threads of a sharded pool read pages at the same time */
+    __atomic_add_fetch(&f->reads, 1, __ATOMIC_RELAXED);
+    if (n > 0)
+        __atomic_add_fetch(&f->bytes_read, n, __ATOMIC_RELAXED);
+
+    return n;
+}
+
+static void chidb_Backend_countingWillNeed(PagerFile *file, off_t offset, off_t len)
+{
+    PagerFile *inner = ((PagerCountingFile *) file)->inner;
+
+    inner->backend->willNeed(inner, offset, len);
+}
+
+static int chidb_Backend_countingWrite(PagerFile *file, struct iovec *iov, int iovcnt, off_t offset)
+{
+    PagerCountingFile *f = (PagerCountingFile *) file;
+
+    chidb_Backend_delay(f->latency.write_latency);
+    __atomic_add_fetch(&f->writes, 1, __ATOMIC_RELAXED);
+    for(int i = 0; i < iovcnt; i++)
+        __atomic_add_fetch(&f->bytes_written, iov[i].iov_len, __ATOMIC_RELAXED);
+
+    return f->inner->backend->write(f->inner, iov, iovcnt, offset);
+}
+
+static int chidb_Backend_countingSize(PagerFile *file, off_t *size)
+{
+    PagerFile *inner = ((PagerCountingFile *) file)->inner;
+
+    return inner->backend->size(inner, size);
+}
+
+static int chidb_Backend_countingAllocate(PagerFile *file, off_t offset, off_t len)
+{
+    PagerFile *inner = ((PagerCountingFile *) file)->inner;
+
+    return inner->backend->allocate(inner, offset, len);
+}
+
+static int chidb_Backend_countingTruncate(PagerFile *file, off_t size)
+{
+    PagerFile *inner = ((PagerCountingFile *) file)->inner;
+
+    return inner->backend->truncate(inner, size);
+}
+
+static int chidb_Backend_countingSync(PagerFile *file)
+{
+    PagerCountingFile *f = (PagerCountingFile *) file;
+
+    /* The Pager's syncer thread can call this while the file
+     * is being used by the Pager */
+    chidb_Backend_delay(f->latency.sync_latency);
+    __atomic_add_fetch(&f->syncs, 1, __ATOMIC_RELAXED);
+
+    return f->inner->backend->sync(f->inner);
+}
+
+static int chidb_Backend_countingMap(PagerFile *file, size_t size, uint8_t **addr)
+{
+    PagerFile *inner = ((PagerCountingFile *) file)->inner;
+
+    return inner->backend->map(inner, size, addr);
+}
+
+static void chidb_Backend_countingUnmap(PagerFile *file, uint8_t *addr, size_t size)
+{
+    PagerFile *inner = ((PagerCountingFile *) file)->inner;
+
+    inner->backend->unmap(inner, addr, size);
+}
+
+static int chidb_Backend_countingClose(PagerFile *file, bool remove)
+{
+    PagerCountingFile *f = (PagerCountingFile *) file;
+    int rc;
+
+    chilog(INFO, "%" PRIu64 " reads (%" PRIu64 " bytes), %" PRIu64 " writes (%" PRIu64 " bytes), %" PRIu64 " syncs",
+           f->reads, f->bytes_read, f->writes, f->bytes_written, f->syncs);
+    rc = f->inner->backend->close(f->inner, remove);
+    free(f);
+
+    return rc;
+}
+
+const PagerBackend chidb_Backend_counting =
+{
+    "counting",
+    chidb_Backend_countingOpen,
+    chidb_Backend_countingRead,
+    NULL,
+    chidb_Backend_countingWillNeed,
+    chidb_Backend_countingWrite,
+    chidb_Backend_countingSize,
+    chidb_Backend_countingAllocate,
+    chidb_Backend_countingTruncate,
+    chidb_Backend_countingSync,
+    chidb_Backend_countingMap,
+    chidb_Backend_countingUnmap,
+    chidb_Backend_countingClose
+};
+
+
+/*
+ * uring: like file, but batches of reads go through an io_uring
+ */
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#define ringField(ring, offset, type) ((type *) ((uint8_t *) (ring) + (offset)))
+
+/* Set up the ring. On failure, the file is left with ring_fd == -1 */
+static void chidb_Backend_uringSetup(PagerUringFile *f)
+{
+    struct io_uring_params p;
+    void *m;
+
+    memset(&p, 0, sizeof(p));
+    f->ring_fd = syscall(__NR_io_uring_setup, f->depth, &p);
+    if (f->ring_fd < 0)
+    {
+        chilog(WARNING, "io_uring is not available (%s). Reading one page at a time.", strerror(errno));
+        f->ring_fd = -1;
+        return;
+    }
+    f->depth = p.sq_entries;
+
+    f->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    f->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) && f->cq_ring_size > f->sq_ring_size)
+        f->sq_ring_size = f->cq_ring_size;
+
+    m = mmap(NULL, f->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, f->ring_fd, IORING_OFF_SQ_RING);
+    if (m == MAP_FAILED)
+        goto fail;
+    f->sq_ring = m;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        f->cq_ring = f->sq_ring;
+        f->cq_ring_size = 0;
+    }
+    else
+    {
+        m = mmap(NULL, f->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, f->ring_fd, IORING_OFF_CQ_RING);
+        if (m == MAP_FAILED)
+            goto fail;
+        f->cq_ring = m;
+    }
+
+    m = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             f->ring_fd, IORING_OFF_SQES);
+    if (m == MAP_FAILED)
+        goto fail;
+    f->sqes = m;
+
+    f->iovs = calloc(p.sq_entries, sizeof(struct iovec));
+    if (f->iovs == NULL)
+        goto fail;
+
+    f->sq_head = ringField(f->sq_ring, p.sq_off.head, uint32_t);
+    f->sq_tail = ringField(f->sq_ring, p.sq_off.tail, uint32_t);
+    f->sq_mask = *ringField(f->sq_ring, p.sq_off.ring_mask, uint32_t);
+    f->sq_array = ringField(f->sq_ring, p.sq_off.array, uint32_t);
+    f->cq_head = ringField(f->cq_ring, p.cq_off.head, uint32_t);
+    f->cq_tail = ringField(f->cq_ring, p.cq_off.tail, uint32_t);
+    f->cq_mask = *ringField(f->cq_ring, p.cq_off.ring_mask, uint32_t);
+    f->cqes = ringField(f->cq_ring, p.cq_off.cqes, struct io_uring_cqe);
+
+    chilog(TRACE, "Set up an io_uring with %u entries", f->depth);
+    return;
+
+fail:
+    chilog(WARNING, "Could not map the io_uring. Reading one page at a time.");
+    if (f->sqes != NULL)
+        munmap(f->sqes, f->depth * sizeof(struct io_uring_sqe));
+    if (f->cq_ring != NULL && f->cq_ring != f->sq_ring)
+        munmap(f->cq_ring, f->cq_ring_size);
+    if (f->sq_ring != NULL)
+        munmap(f->sq_ring, f->sq_ring_size);
+    f->sqes = NULL;
+    f->sq_ring = f->cq_ring = NULL;
+    close(f->ring_fd);
+    f->ring_fd = -1;
+}
+
+static void chidb_Backend_uringTeardown(PagerUringFile *f)
+{
+    if (f->ring_fd < 0)
+        return;
+
+    free(f->iovs);
+    munmap(f->sqes, f->depth * sizeof(struct io_uring_sqe));
+    if (f->cq_ring != f->sq_ring)
+        munmap(f->cq_ring, f->cq_ring_size);
+    munmap(f->sq_ring, f->sq_ring_size);
+    close(f->ring_fd);
+    f->ring_fd = -1;
+}
+
+/* Submit up to depth reads, and wait for all of them to complete */
+static int chidb_Backend_uringSubmit(PagerUringFile *f, PagerReadRequest *reqs, uint32_t n)
+{
+    uint32_t tail = *f->sq_tail, head, submitted = 0, done = 0;
+
+    for(uint32_t i = 0; i < n; i++)
+    {
+        uint32_t idx = tail & f->sq_mask;
+        struct io_uring_sqe *sqe = &f->sqes[idx];
+
+        f->iovs[idx].iov_base = reqs[i].buf;
+        f->iovs[idx].iov_len = reqs[i].count;
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = f->base.fd;
+        sqe->addr = (uint64_t) (uintptr_t) &f->iovs[idx];
+        sqe->len = 1;
+        sqe->off = reqs[i].offset;
+        sqe->user_data = i;
+        f->sq_array[idx] = idx;
+        tail++;
+    }
+    /* The kernel must see the entries before the new tail */
+    __atomic_store_n(f->sq_tail, tail, __ATOMIC_RELEASE);
+
+    while (done < n)
+    {
+        int ret = syscall(__NR_io_uring_enter, f->ring_fd, n - submitted, n - done, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            /* Reads already submitted may still complete, so the ring
+             * cannot be used anymore */
+            chilog(ERROR, "io_uring_enter failed: %s", strerror(errno));
+            return CHIDB_EIO;
+        }
+        f->submits++;
+        submitted += ret;
+
+        head = *f->cq_head;
+        while (head != __atomic_load_n(f->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &f->cqes[head & f->cq_mask];
+            PagerReadRequest *req = &reqs[cqe->user_data];
+
+            if (cqe->res < 0)
+            {
+                errno = -cqe->res;
+                req->result = -1;
+            }
+            else
+                req->result = cqe->res;
+            head++;
+            done++;
+        }
+        __atomic_store_n(f->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return CHIDB_OK;
+}
+
+#endif
+
+static int chidb_Backend_uringOpen(const PagerBackend *backend, const char *filename, int flags,
+                                   const PagerBackendOptions *options, PagerFile **file)
+{
+    PagerUringFile *f;
+    PagerFile *fd_file;
+    int rc;
+
+    /* Open the file like the file backend, and move it into a larger struct */
+    if ((rc = chidb_Backend_file.open(&chidb_Backend_file, filename, flags, options, &fd_file)) != CHIDB_OK)
+        return rc;
+
+    f = calloc(1, sizeof(PagerUringFile));
+    if (f == NULL)
+    {
+        chidb_Backend_file.close(fd_file, false);
+        return CHIDB_ENOMEM;
+    }
+    f->base = *(PagerFdFile *) fd_file;
+    f->base.base.backend = backend;
+    free(fd_file);
+
+    f->ring_fd = -1;
+    f->depth = (options != NULL && options->queue_depth > 0)? options->queue_depth : DEFAULT_QUEUE_DEPTH;
+#ifdef HAVE_LINUX_IO_URING_H
+    chidb_Backend_uringSetup(f);
+#else
+    chilog(WARNING, "Built without io_uring support. Reading one page at a time.");
+#endif
+
+    *file = &f->base.base;
+
+    return CHIDB_OK;
+}
+
+static int chidb_Backend_uringReadBatch(PagerFile *file, PagerReadRequest *reqs, uint32_t n)
+{
+    PagerUringFile *f = (PagerUringFile *) file;
+
+    f->batches++;
+
+#ifdef HAVE_LINUX_IO_URING_H
+    if (f->ring_fd >= 0)
+    {
+        for(uint32_t i = 0; i < n; i += f->depth)
+        {
+            uint32_t count = (n - i < f->depth)? n - i : f->depth;
+            if (chidb_Backend_uringSubmit(f, reqs + i, count) != CHIDB_OK)
+            {
+                chidb_Backend_uringTeardown(f);
+                return CHIDB_EIO;
+            }
+        }
+        f->reads += n;
+
+        /* A read can come up short (other than at the end of the file),
+         * so finish those one at a time. Reads refused with direct I/O are
+         * done again the same way, which can go back to buffered I/O. */
+        for(uint32_t i = 0; i < n; i++)
+            if (reqs[i].result < 0 && file->direct_align != 0)
+                reqs[i].result = chidb_Backend_fileRead(file, reqs[i].buf, reqs[i].count, reqs[i].offset);
+            else if (reqs[i].result > 0 && (size_t) reqs[i].result < reqs[i].count)
+            {
+                ssize_t rest = chidb_Backend_fileRead(file, (uint8_t *) reqs[i].buf + reqs[i].result,
+                                                      reqs[i].count - reqs[i].result, reqs[i].offset + reqs[i].result);
+                reqs[i].result = (rest < 0)? -1 : reqs[i].result + rest;
+            }
+
+        return CHIDB_OK;
+    }
+#endif
+
+    for(uint32_t i = 0; i < n; i++)
+        reqs[i].result = chidb_Backend_fileRead(file, reqs[i].buf, reqs[i].count, reqs[i].offset);
+
+    return CHIDB_OK;
+}
+
+static int chidb_Backend_uringClose(PagerFile *file, bool remove)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+    chidb_Backend_uringTeardown((PagerUringFile *) file);
+#endif
+
+    /* A PagerUringFile starts with a PagerFdFile, which is what this frees */
+    return chidb_Backend_fileClose(file, remove);
+}
+
+const PagerBackend chidb_Backend_uring =
+{
+    "uring",
+    chidb_Backend_uringOpen,
+    chidb_Backend_fileRead,
+    chidb_Backend_uringReadBatch,
+    chidb_Backend_fileWillNeed,
+    chidb_Backend_fileWrite,
+    chidb_Backend_fileSize,
+    chidb_Backend_fileAllocate,
+    chidb_Backend_fileTruncate,
+    chidb_Backend_fileSync,
+    chidb_Backend_fileMap,
+    chidb_Backend_fileUnmap,
+    chidb_Backend_uringClose
+};
+
+
+/*
+ * compressed: blocks compressed with the LZ codec, over another backend
+ */
+
+#define unitsOf(f, len) ((uint32_t) (((len) + (f)->unit - 1) / (f)->unit))
+#define validBlockSize(bs) ((bs) >= MIN_PAGE_SIZE && (bs) <= MAX_PAGE_SIZE && ((bs) & ((bs) - 1)) == 0)
+
+/* Checksum (FNV-1a) of the page map and the header of a compressed file */
+static uint32_t chidb_Backend_checksum(const uint8_t *data, size_t n)
+{
+    uint32_t h = 2166136261u;
+
+    for(size_t i = 0; i < n; i++)
+        h = (h ^ data[i]) * 16777619u;
+
+    return h;
+}
+
+/* Add an extent to a list. If there is no memory for it, the space is
+ * simply not reused. */
+static void chidb_Backend_extentPush(PagerExtentList *list, off_t offset, uint32_t length)
+{
+    if (list->n == list->capacity)
+    {
+        uint32_t capacity = list->capacity? 2 * list->capacity : 16;
+        PagerExtent *extents = realloc(list->extents, capacity * sizeof(PagerExtent));
+
+        if (extents == NULL)
+            return;
+        list->extents = extents;
+        list->capacity = capacity;
+    }
+    list->extents[list->n].offset = offset;
+    list->extents[list->n].length = length;
+    list->n++;
+}
+
+static int chidb_Backend_compareExtents(const void *a, const void *b)
+{
+    off_t x = ((PagerExtent *) a)->offset, y = ((PagerExtent *) b)->offset;
+
+    return (x > y) - (x < y);
+}
+
+
+/* Make free space available for new extents, in pieces of at most
+ * a block (the space is a whole number of units) */
+static void chidb_Backend_compressedRelease(PagerCompressedFile *f, off_t offset, off_t length)
+{
+    while (length > 0)
+    {
+        uint32_t units = unitsOf(f, length);
+
+        if (units > PAGER_COMPRESSED_UNITS)
+            units = PAGER_COMPRESSED_UNITS;
+        chidb_Backend_extentPush(&f->free[units], offset, units * f->unit);
+        f->free_bytes += units * f->unit;
+        offset += units * f->unit;
+        length -= units * f->unit;
+    }
+}
+
+/* Find room for an extent of the given number of units: free space of
+ * that size, or else a larger piece of free space, or else the end of
+ * the file */
+static off_t chidb_Backend_compressedNewExtent(PagerCompressedFile *f, uint32_t units)
+{
+    off_t offset;
+
+    for(uint32_t k = units; k <= PAGER_COMPRESSED_UNITS; k++)
+        if (f->free[k].n > 0)
+        {
+            offset = f->free[k].extents[--f->free[k].n].offset;
+            f->free_bytes -= k * f->unit;
+            if (k > units)
+                chidb_Backend_compressedRelease(f, offset + (off_t) units * f->unit, (k - units) * f->unit);
+            return offset;
+        }
+
+    offset = f->end;
+    f->end += (off_t) units * f->unit;
+
+    return offset;
+}
+
+/* Offset (from the start of the map) and length of a chunk of the page map */
+#define chunkOffset(c) ((off_t) (c) * (PAGER_COMPRESSED_CHUNK * PAGER_COMPRESSED_ENTRY_SIZE + 4))
+#define chunkEntries(f, c) (((c) + 1) * PAGER_COMPRESSED_CHUNK <= (f)->n_blocks? \
+                            PAGER_COMPRESSED_CHUNK : (f)->n_blocks - (c) * PAGER_COMPRESSED_CHUNK)
+
+/* Read the header of an existing compressed file. The page map itself
+ * is read a chunk at a time, as blocks are read (see loadChunk), so
+ * opening a file does not depend on its size. */
+static int chidb_Backend_compressedLoadHeader(PagerCompressedFile *f)
+{
+    uint8_t header[PAGER_COMPRESSED_HEADER_SIZE];
+    uint32_t n_chunks;
+
+    if (f->inner->backend->read(f->inner, header, sizeof(header), 0) != sizeof(header)
+        || memcmp(header, PAGER_COMPRESSED_MAGIC, 16) != 0
+        || get4byte(header + 16) != PAGER_COMPRESSED_VERSION
+        || get4byte(header + 60) != chidb_Backend_checksum(header, 60)
+        || !validBlockSize(get4byte(header + 20))
+        || get4byte(header + 44) != PAGER_COMPRESSED_CHUNK)
+    {
+        chilog(ERROR, "The header of the compressed file is not valid");
+        return CHIDB_EIO;
+    }
+
+    f->block_size = get4byte(header + 20);
+    f->unit = f->block_size / PAGER_COMPRESSED_UNITS;
+    f->size = (off_t) get4byte(header + 24) << 32 | get4byte(header + 28);
+    f->map_extent.offset = (off_t) get4byte(header + 32) << 32 | get4byte(header + 36);
+    f->n_blocks = f->map_capacity = get4byte(header + 40);
+    n_chunks = (f->n_blocks + PAGER_COMPRESSED_CHUNK - 1) / PAGER_COMPRESSED_CHUNK;
+    f->map_extent.length = unitsOf(f, (size_t) f->n_blocks * PAGER_COMPRESSED_ENTRY_SIZE + 4 * n_chunks) * f->unit;
+    if (f->n_blocks == 0)
+        return CHIDB_OK;
+
+    /* (An entry is only used once its chunk has been read) */
+    f->map = malloc(f->n_blocks * sizeof(PagerExtent));
+    f->chunk_loaded = calloc(n_chunks, sizeof(bool));
+    if (f->map == NULL || f->chunk_loaded == NULL)
+        return CHIDB_ENOMEM;
+
+    return CHIDB_OK;
+}
+
+/* Read a chunk of the page map, if it has not been read yet. The lock
+ * must be held. */
+static int chidb_Backend_compressedLoadChunk(PagerCompressedFile *f, uint32_t c)
+{
+    uint8_t chunk[PAGER_COMPRESSED_CHUNK * PAGER_COMPRESSED_ENTRY_SIZE + 4];
+    uint32_t n = chunkEntries(f, c);
+    size_t length = (size_t) n * PAGER_COMPRESSED_ENTRY_SIZE;
+
+    if (f->chunk_loaded == NULL || f->chunk_loaded[c])
+        return CHIDB_OK;
+
+    if (f->inner->backend->read(f->inner, chunk, length + 4, f->map_extent.offset + chunkOffset(c)) != length + 4
+        || get4byte(chunk + length) != chidb_Backend_checksum(chunk, length))
+        goto corrupt;
+
+    for(uint32_t i = 0; i < n; i++)
+    {
+        PagerExtent *extent = &f->map[c * PAGER_COMPRESSED_CHUNK + i];
+
+        extent->offset = (off_t) get4byte(chunk + i * PAGER_COMPRESSED_ENTRY_SIZE) << 32 |
+                         get4byte(chunk + i * PAGER_COMPRESSED_ENTRY_SIZE + 4);
+        extent->length = get4byte(chunk + i * PAGER_COMPRESSED_ENTRY_SIZE + 8);
+        if (extent->offset != 0 &&
+            (extent->offset % f->unit != 0 || extent->length == 0 || extent->length > f->block_size))
+            goto corrupt;
+    }
+    f->chunk_loaded[c] = true;
+
+    return CHIDB_OK;
+
+corrupt:
+    chilog(ERROR, "Chunk %u of the page map of the compressed file is not valid", c);
+    memset(&f->map[c * PAGER_COMPRESSED_CHUNK], 0, n * sizeof(PagerExtent));
+    return CHIDB_EIO;
+}
+
+/* Work out the free space from the extents that are in use (by the
+ * blocks, the map, and the extents that are pending), and give back the
+ * free space at the end. Since freed extents are never merged with
+ * their neighbours, this is also how free space is defragmented. The
+ * lock must be held. */
+static int chidb_Backend_compressedFindFree(PagerCompressedFile *f)
+{
+    PagerExtent *used;
+    uint32_t nused = 0;
+    off_t pos = f->unit;
+
+    if ((used = malloc((f->n_blocks + f->pending.n + 2) * sizeof(PagerExtent))) == NULL)
+        return CHIDB_ENOMEM;
+    if (f->map_extent.offset != 0)
+        used[nused++] = f->map_extent;
+    if (f->map_spare.offset != 0)
+        used[nused++] = f->map_spare;
+    for(uint32_t i = 0; i < f->pending.n; i++)
+        used[nused++] = f->pending.extents[i];
+    for(uint32_t i = 0; i < f->n_blocks; i++)
+        if (f->map[i].offset != 0)
+        {
+            used[nused].offset = f->map[i].offset;
+            used[nused++].length = unitsOf(f, f->map[i].length) * f->unit;
+        }
+
+    for(int k = 0; k <= PAGER_COMPRESSED_UNITS; k++)
+        f->free[k].n = 0;
+    f->free_bytes = 0;
+
+    qsort(used, nused, sizeof(PagerExtent), chidb_Backend_compareExtents);
+    for(uint32_t i = 0; i < nused; i++)
+    {
+        if (used[i].offset > pos)
+            chidb_Backend_compressedRelease(f, pos, used[i].offset - pos);
+        if (used[i].offset + used[i].length > pos)
+            pos = used[i].offset + used[i].length;
+    }
+    f->end = pos;
+    free(used);
+
+    return CHIDB_OK;
+}
+
+/* Read whatever is left of the page map, and work out the free space.
+ * This is done before the file is first modified (the lock must be
+ * held), so a file that is only read never needs the whole map. */
+static int chidb_Backend_compressedLoadAll(PagerCompressedFile *f)
+{
+    uint32_t n_chunks = (f->n_blocks + PAGER_COMPRESSED_CHUNK - 1) / PAGER_COMPRESSED_CHUNK;
+    int rc;
+
+    if (f->chunk_loaded == NULL)
+        return CHIDB_OK;
+
+    for(uint32_t c = 0; c < n_chunks; c++)
+        if ((rc = chidb_Backend_compressedLoadChunk(f, c)) != CHIDB_OK)
+            return rc;
+    if ((rc = chidb_Backend_compressedFindFree(f)) != CHIDB_OK)
+        return rc;
+
+    free(f->chunk_loaded);
+    f->chunk_loaded = NULL;
+
+    return CHIDB_OK;
+}
+
+
+/* Read a block (block_size bytes) into dst. Blocks that have never been
+ * written read as zeroes. cbuf is a buffer of block_size bytes for the
+ * compressed data. The lock must not be held, unless locked is true. */
+static int chidb_Backend_compressedReadBlock(PagerCompressedFile *f, uint32_t n, uint8_t *dst, uint8_t *cbuf, bool locked)
+{
+    PagerExtent extent = {0, 0};
+    int rc = CHIDB_OK;
+
+    if (!locked)
+        pthread_mutex_lock(&f->lock);
+    if (n < f->n_blocks && (rc = chidb_Backend_compressedLoadChunk(f, n / PAGER_COMPRESSED_CHUNK)) == CHIDB_OK)
+        extent = f->map[n];
+    if (!locked)
+        pthread_mutex_unlock(&f->lock);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if (extent.offset == 0)
+    {
+        memset(dst, 0, f->block_size);
+        return CHIDB_OK;
+    }
+
+    if (extent.length == f->block_size)
+        return (f->inner->backend->read(f->inner, dst, f->block_size, extent.offset) == f->block_size)? CHIDB_OK : CHIDB_EIO;
+
+    if (f->inner->backend->read(f->inner, cbuf, extent.length, extent.offset) != extent.length
+        || chidb_LZ_decompress(cbuf, extent.length, dst, f->block_size) != f->block_size)
+    {
+        chilog(ERROR, "Could not read block %u of a compressed file", n);
+        return CHIDB_EIO;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Compress a block and write it, in place if it still fits in its
+ * extent, or else in a new one. The lock must be held. Returns the
+ * number of system calls it took, or -1 on error. */
+static int chidb_Backend_compressedWriteBlock(PagerCompressedFile *f, uint32_t n, const uint8_t *src, uint8_t *cbuf)
+{
+    size_t length = chidb_LZ_compress(src, f->block_size, cbuf, f->block_size - 1);
+    const uint8_t *data = cbuf;
+    PagerExtent *extent;
+    struct iovec iov;
+    uint32_t units, old_units;
+    off_t offset;
+    int calls;
+
+    /* A block that does not compress is stored as it is */
+    if (length == 0)
+    {
+        length = f->block_size;
+        data = src;
+    }
+    units = unitsOf(f, length);
+
+    if (n >= f->map_capacity)
+    {
+        uint32_t capacity = (n + 1 > 2 * f->map_capacity)? n + 1 : 2 * f->map_capacity;
+        PagerExtent *map = realloc(f->map, capacity * sizeof(PagerExtent));
+
+        if (map == NULL)
+            return -1;
+        memset(map + f->map_capacity, 0, (capacity - f->map_capacity) * sizeof(PagerExtent));
+        f->map = map;
+        f->map_capacity = capacity;
+    }
+    extent = &f->map[n];
+    old_units = (extent->offset != 0)? unitsOf(f, extent->length) : 0;
+    offset = (old_units >= units)? extent->offset : chidb_Backend_compressedNewExtent(f, units);
+
+    iov.iov_base = (void *) data;
+    iov.iov_len = length;
+    if ((calls = f->inner->backend->write(f->inner, &iov, 1, offset)) < 0)
+        return -1;
+
+    /* Whatever the block no longer uses can be reused after the next commit */
+    if (offset != extent->offset && old_units > 0)
+        chidb_Backend_extentPush(&f->pending, extent->offset, old_units * f->unit);
+    else if (old_units > units)
+        chidb_Backend_extentPush(&f->pending, offset + (off_t) units * f->unit, (old_units - units) * f->unit);
+
+    extent->offset = offset;
+    extent->length = length;
+    if (n >= f->n_blocks)
+        f->n_blocks = n + 1;
+    f->dirty = true;
+    f->blocks_written++;
+    f->bytes_in += f->block_size;
+    f->bytes_out += length;
+
+    return calls;
+}
+
+/* Write the page map, and then the header that points to it (the
+ * header is only ever written after the map it points to is durable).
+ * The extents freed since the last commit are moved to committing:
+ * they can be reused once the header is durable too. The previous map
+ * becomes the spare extent, for the next map. The commit lock must be
+ * held. */
+static int chidb_Backend_compressedCommit(PagerCompressedFile *f, PagerExtentList *committing)
+{
+    uint8_t header[PAGER_COMPRESSED_HEADER_SIZE];
+    PagerExtent extent = {0, 0}, old;
+    struct iovec iov;
+    size_t map_length;
+    uint32_t n_chunks;
+    uint8_t *map;
+    int rc = CHIDB_OK;
+
+    pthread_mutex_lock(&f->lock);
+    if (!f->dirty)
+    {
+        pthread_mutex_unlock(&f->lock);
+        return CHIDB_OK;
+    }
+
+    n_chunks = (f->n_blocks + PAGER_COMPRESSED_CHUNK - 1) / PAGER_COMPRESSED_CHUNK;
+    map_length = (size_t) f->n_blocks * PAGER_COMPRESSED_ENTRY_SIZE + 4 * n_chunks;
+    if ((map = malloc(map_length + 1)) == NULL)
+    {
+        pthread_mutex_unlock(&f->lock);
+        return CHIDB_EIO;
+    }
+    for(uint32_t c = 0; c < n_chunks; c++)
+    {
+        uint8_t *chunk = map + chunkOffset(c);
+        uint32_t n = chunkEntries(f, c);
+
+        for(uint32_t i = 0; i < n; i++)
+        {
+            PagerExtent *extent = &f->map[c * PAGER_COMPRESSED_CHUNK + i];
+
+            put4byte(chunk + i * PAGER_COMPRESSED_ENTRY_SIZE, (uint64_t) extent->offset >> 32);
+            put4byte(chunk + i * PAGER_COMPRESSED_ENTRY_SIZE + 4, (uint32_t) extent->offset);
+            put4byte(chunk + i * PAGER_COMPRESSED_ENTRY_SIZE + 8, extent->length);
+        }
+        put4byte(chunk + n * PAGER_COMPRESSED_ENTRY_SIZE, chidb_Backend_checksum(chunk, n * PAGER_COMPRESSED_ENTRY_SIZE));
+    }
+
+    /* The new map never overwrites the old one, but it can go where the
+     * map before that was (the spare extent), if it fits */
+    if (map_length > 0 && f->map_spare.length >= map_length)
+        extent = f->map_spare;
+    else if (map_length > 0)
+    {
+        if (f->map_spare.offset != 0)
+            chidb_Backend_compressedRelease(f, f->map_spare.offset, f->map_spare.length);
+        extent.offset = f->end;
+        extent.length = unitsOf(f, map_length) * f->unit;
+        f->end += extent.length;
+    }
+    f->map_spare.offset = 0;
+    f->map_spare.length = 0;
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, PAGER_COMPRESSED_MAGIC, 16);
+    put4byte(header + 16, PAGER_COMPRESSED_VERSION);
+    put4byte(header + 20, f->block_size);
+    put4byte(header + 24, (uint64_t) f->size >> 32);
+    put4byte(header + 28, (uint32_t) f->size);
+    put4byte(header + 32, (uint64_t) extent.offset >> 32);
+    put4byte(header + 36, (uint32_t) extent.offset);
+    put4byte(header + 40, f->n_blocks);
+    put4byte(header + 44, PAGER_COMPRESSED_CHUNK);
+    put4byte(header + 60, chidb_Backend_checksum(header, 60));
+
+    old = f->map_extent;
+    *committing = f->pending;
+    memset(&f->pending, 0, sizeof(PagerExtentList));
+    f->dirty = false;
+    pthread_mutex_unlock(&f->lock);
+
+    /* The Pager can keep writing blocks in the meantime */
+    iov.iov_base = map;
+    iov.iov_len = map_length;
+    if (map_length > 0 && f->inner->backend->write(f->inner, &iov, 1, extent.offset) < 0)
+        rc = CHIDB_EIO;
+    if (rc == CHIDB_OK && f->inner->backend->sync(f->inner) != CHIDB_OK)
+        rc = CHIDB_EIO;
+    iov.iov_base = header;
+    iov.iov_len = sizeof(header);
+    if (rc == CHIDB_OK && f->inner->backend->write(f->inner, &iov, 1, 0) < 0)
+        rc = CHIDB_EIO;
+    free(map);
+
+    pthread_mutex_lock(&f->lock);
+    if (rc == CHIDB_OK)
+    {
+        f->map_extent = extent;
+        f->map_spare = old;
+    }
+    else
+    {
+        f->dirty = true;
+        if (extent.offset != 0)
+            chidb_Backend_extentPush(&f->pending, extent.offset, extent.length);
+    }
+    pthread_mutex_unlock(&f->lock);
+
+    return rc;
+}
+
+static void chidb_Backend_compressedFree(PagerCompressedFile *f)
+{
+    for(int k = 0; k <= PAGER_COMPRESSED_UNITS; k++)
+        free(f->free[k].extents);
+    free(f->pending.extents);
+    free(f->map);
+    free(f->chunk_loaded);
+    pthread_mutex_destroy(&f->lock);
+    pthread_mutex_destroy(&f->commit_lock);
+    free(f);
+}
+
+/* Check if a file is a compressed file
+ *
+ * Parameters
+ * - file: A file opened with any backend
+ *
+ * Return
+ * - true if the file starts with the header of a compressed file
+ */
+bool chidb_Backend_isCompressed(PagerFile *file)
+{
+    uint8_t magic[16];
+
+    return file->backend->read(file, magic, sizeof(magic), 0) == sizeof(magic)
+           && !memcmp(magic, PAGER_COMPRESSED_MAGIC, sizeof(magic));
+}
+
+/* Access a file through the compressed layer
+ *
+ * The file must be empty (it will then be created with blocks of
+ * DEFAULT_PAGE_SIZE, unless chidb_Backend_setBlockSize is called before
+ * it is written) or a compressed file. From then on, the file must only
+ * be accessed through the returned file, which closes it when it is
+ * closed.
+ *
+ * Parameters
+ * - inner: A file opened with any backend
+ * - file: Out parameter. Used to return the compressed file.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EMISUSE: The file is not empty, and is not a compressed file
+ * - CHIDB_EIO: An I/O error has occurred, or the file is corrupt
+ */
+int chidb_Backend_compress(PagerFile *inner, PagerFile **file)
+{
+    PagerCompressedFile *f;
+    off_t size;
+    int rc = CHIDB_OK;
+
+    f = calloc(1, sizeof(PagerCompressedFile));
+    if (f == NULL)
+        return CHIDB_ENOMEM;
+    f->base.backend = &chidb_Backend_compressed;
+    f->inner = inner;
+    f->block_size = DEFAULT_PAGE_SIZE;
+    f->unit = f->block_size / PAGER_COMPRESSED_UNITS;
+    f->end = f->unit;
+    pthread_mutex_init(&f->lock, NULL);
+    pthread_mutex_init(&f->commit_lock, NULL);
+
+    if (inner->backend->size(inner, &size) != CHIDB_OK)
+        rc = CHIDB_EIO;
+    else if (size > 0 && !chidb_Backend_isCompressed(inner))
+    {
+        chilog(ERROR, "Only a new file can be compressed");
+        rc = CHIDB_EMISUSE;
+    }
+    else if (size > 0)
+        rc = chidb_Backend_compressedLoadHeader(f);
+
+    if (rc != CHIDB_OK)
+    {
+        chidb_Backend_compressedFree(f);
+        return rc;
+    }
+    *file = &f->base;
+
+    return CHIDB_OK;
+}
+
+/* Set the block size of a new compressed file
+ *
+ * Only has an effect if nothing has been written to the file yet, and
+ * the block size is a valid page size (see MIN_PAGE_SIZE and
+ * MAX_PAGE_SIZE). Blocks should be the size of the pages, since a block
+ * is compressed (and written) as a whole.
+ *
+ * Parameters
+ * - file: A file returned by chidb_Backend_compress
+ * - block_size: Size of a block
+ */
+void chidb_Backend_setBlockSize(PagerFile *file, uint32_t block_size)
+{
+    PagerCompressedFile *f = (PagerCompressedFile *) file;
+
+    pthread_mutex_lock(&f->lock);
+    if (f->size == 0 && f->n_blocks == 0 && f->end == f->unit && validBlockSize(block_size))
+    {
+        f->block_size = block_size;
+        f->unit = block_size / PAGER_COMPRESSED_UNITS;
+        f->end = f->unit;
+    }
+    pthread_mutex_unlock(&f->lock);
+}
+
+static int chidb_Backend_compressedOpen(const PagerBackend *backend, const char *filename, int flags,
+                                        const PagerBackendOptions *options, PagerFile **file)
+{
+    PagerFile *inner;
+    int rc;
+
+    /* Extents are not aligned to blocks of the device */
+    rc = chidb_Backend_file.open(&chidb_Backend_file, filename, flags & ~PAGER_OPEN_DIRECT, options, &inner);
+    if (rc != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_Backend_compress(inner, file)) != CHIDB_OK)
+        inner->backend->close(inner, false);
+
+    return rc;
+}
+
+static ssize_t chidb_Backend_compressedRead(PagerFile *file, void *buf, size_t count, off_t offset)
+{
+    PagerCompressedFile *f = (PagerCompressedFile *) file;
+    uint32_t block_size = f->block_size;
+    uint8_t *cbuf, *block;
+    size_t done = 0;
+    off_t size;
+
+    pthread_mutex_lock(&f->lock);
+    size = f->size;
+    pthread_mutex_unlock(&f->lock);
+
+    if (offset >= size)
+        return 0;
+    if (count > size - offset)
+        count = size - offset;
+
+    if ((cbuf = malloc(2 * block_size)) == NULL)
+        return -1;
+    block = cbuf + block_size;
+
+    /* Whole blocks are decompressed straight into buf */
+    while (done < count)
+    {
+        uint32_t n = (offset + done) / block_size;
+        size_t start = (offset + done) % block_size;
+        size_t len = (count - done < block_size - start)? count - done : block_size - start;
+        uint8_t *dst = (len == block_size)? (uint8_t *) buf + done : block;
+
+        if (chidb_Backend_compressedReadBlock(f, n, dst, cbuf, false) != CHIDB_OK)
+        {
+            free(cbuf);
+            return -1;
+        }
+        if (dst == block)
+            memcpy((uint8_t *) buf + done, block + start, len);
+        done += len;
+    }
+    free(cbuf);
+
+    return count;
+}
+
+static int chidb_Backend_compressedWrite(PagerFile *file, struct iovec *iov, int iovcnt, off_t offset)
+{
+    PagerCompressedFile *f = (PagerCompressedFile *) file;
+    size_t total = 0, done = 0, iov_offset = 0;
+    uint8_t *cbuf, *block;
+    int i = 0, calls = 0, rc;
+
+    for(int j = 0; j < iovcnt; j++)
+        total += iov[j].iov_len;
+
+    pthread_mutex_lock(&f->lock);
+    if (chidb_Backend_compressedLoadAll(f) != CHIDB_OK || (cbuf = malloc(2 * f->block_size)) == NULL)
+    {
+        pthread_mutex_unlock(&f->lock);
+        return -1;
+    }
+    block = cbuf + f->block_size;
+
+    while (done < total)
+    {
+        uint32_t n = (offset + done) / f->block_size;
+        size_t start = (offset + done) % f->block_size;
+        size_t len = (total - done < f->block_size - start)? total - done : f->block_size - start;
+        const uint8_t *src = block;
+
+        while (iov_offset == iov[i].iov_len)
+        {
+            i++;
+            iov_offset = 0;
+        }
+
+        if (len == f->block_size && iov[i].iov_len - iov_offset >= len)
+        {
+            /* A whole block in a single buffer is compressed from there */
+            src = (uint8_t *) iov[i].iov_base + iov_offset;
+            iov_offset += len;
+        }
+        else
+        {
+            /* Otherwise, the block is put together (with what was already
+             * in it, if it is not all being written) */
+            if (len < f->block_size && chidb_Backend_compressedReadBlock(f, n, block, cbuf, true) != CHIDB_OK)
+                goto error;
+            for(size_t copied = 0; copied < len; )
+            {
+                size_t m = iov[i].iov_len - iov_offset;
+
+                if (m == 0)
+                {
+                    i++;
+                    iov_offset = 0;
+                    continue;
+                }
+                if (m > len - copied)
+                    m = len - copied;
+                memcpy(block + start + copied, (uint8_t *) iov[i].iov_base + iov_offset, m);
+                iov_offset += m;
+                copied += m;
+            }
+        }
+
+        if ((rc = chidb_Backend_compressedWriteBlock(f, n, src, cbuf)) < 0)
+            goto error;
+        calls += rc;
+        done += len;
+    }
+
+    if (offset + (off_t) total > f->size)
+    {
+        f->size = offset + total;
+        f->dirty = true;
+    }
+    pthread_mutex_unlock(&f->lock);
+    free(cbuf);
+
+    return calls;
+
+error:
+    pthread_mutex_unlock(&f->lock);
+    free(cbuf);
+    return -1;
+}
+
+static int chidb_Backend_compressedSize(PagerFile *file, off_t *size)
+{
+    PagerCompressedFile *f = (PagerCompressedFile *) file;
+
+    pthread_mutex_lock(&f->lock);
+    *size = f->size;
+    pthread_mutex_unlock(&f->lock);
+
+    return CHIDB_OK;
+}
+
+static int chidb_Backend_compressedTruncate(PagerFile *file, off_t size)
+{
+    PagerCompressedFile *f = (PagerCompressedFile *) file;
+    uint32_t nblocks = (size + f->block_size - 1) / f->block_size;
+    uint32_t last = size / f->block_size;
+    int rc;
+
+    pthread_mutex_lock(&f->lock);
+    if ((rc = chidb_Backend_compressedLoadAll(f)) != CHIDB_OK)
+    {
+        pthread_mutex_unlock(&f->lock);
+        return CHIDB_EIO;
+    }
+    for(uint32_t n = nblocks; n < f->n_blocks; n++)
+        if (f->map[n].offset != 0)
+        {
+            chidb_Backend_extentPush(&f->pending, f->map[n].offset, unitsOf(f, f->map[n].length) * f->unit);
+            f->map[n].offset = 0;
+            f->map[n].length = 0;
+        }
+    if (nblocks < f->n_blocks)
+        f->n_blocks = nblocks;
+
+    /* The rest of the last block must read as zeroes if the file grows again */
+    if (size < f->size && size % f->block_size != 0 && last < f->n_blocks && f->map[last].offset != 0)
+    {
+        uint8_t *cbuf = malloc(2 * f->block_size), *block = cbuf + f->block_size;
+
+        if (cbuf == NULL || chidb_Backend_compressedReadBlock(f, last, block, cbuf, true) != CHIDB_OK)
+            rc = CHIDB_EIO;
+        else
+        {
+            memset(block + size % f->block_size, 0, f->block_size - size % f->block_size);
+            if (chidb_Backend_compressedWriteBlock(f, last, block, cbuf) < 0)
+                rc = CHIDB_EIO;
+        }
+        free(cbuf);
+    }
+
+    if (rc == CHIDB_OK)
+        f->size = size;
+    f->dirty = true;
+    pthread_mutex_unlock(&f->lock);
+
+    return rc;
+}
+
+static int chidb_Backend_compressedSync(PagerFile *file)
+{
+    PagerCompressedFile *f = (PagerCompressedFile *) file;
+    PagerExtentList committing = {NULL, 0, 0};
+    int rc;
+
+    pthread_mutex_lock(&f->commit_lock);
+    rc = chidb_Backend_compressedCommit(f, &committing);
+    if (rc == CHIDB_OK && f->inner->backend->sync(f->inner) != CHIDB_OK)
+        rc = CHIDB_EIO;
+
+    pthread_mutex_lock(&f->lock);
+    for(uint32_t i = 0; i < committing.n; i++)
+        if (rc == CHIDB_OK)
+            chidb_Backend_compressedRelease(f, committing.extents[i].offset, committing.extents[i].length);
+        else
+            chidb_Backend_extentPush(&f->pending, committing.extents[i].offset, committing.extents[i].length);
+
+    /* Pieces of free space may be too small for new blocks */
+    if (rc == CHIDB_OK && f->free_bytes > f->end / 2)
+        chidb_Backend_compressedFindFree(f);
+    pthread_mutex_unlock(&f->lock);
+    pthread_mutex_unlock(&f->commit_lock);
+    free(committing.extents);
+
+    return rc;
+}
+
+static int chidb_Backend_compressedClose(PagerFile *file, bool remove)
+{
+    PagerCompressedFile *f = (PagerCompressedFile *) file;
+    off_t end = f->unit;
+    int rc = CHIDB_OK;
+
+    if (!remove && f->dirty)
+        rc = chidb_Backend_compressedSync(file);
+
+    /* Give back the free space at the end of the file (if it was
+     * modified: otherwise, the map may not have been read) */
+    if (!remove && rc == CHIDB_OK && f->chunk_loaded == NULL && (f->n_blocks > 0 || f->map_extent.offset != 0))
+    {
+        if (f->map_extent.offset + f->map_extent.length > end)
+            end = f->map_extent.offset + f->map_extent.length;
+        for(uint32_t n = 0; n < f->n_blocks; n++)
+            if (f->map[n].offset + unitsOf(f, f->map[n].length) * f->unit > end)
+                end = f->map[n].offset + unitsOf(f, f->map[n].length) * f->unit;
+        if (end < f->end && f->inner->backend->truncate(f->inner, end) != CHIDB_OK)
+            rc = CHIDB_EIO;
+    }
+
+    chilog(INFO, "%" PRIu64 " blocks written (%" PRIu64 " bytes, compressed to %" PRIu64 ")",
+           f->blocks_written, f->bytes_in, f->bytes_out);
+    if (f->inner->backend->close(f->inner, remove) != CHIDB_OK)
+        rc = CHIDB_EIO;
+    chidb_Backend_compressedFree(f);
+
+    return rc;
+}
+
+const PagerBackend chidb_Backend_compressed =
+{
+    "compressed",
+    chidb_Backend_compressedOpen,
+    chidb_Backend_compressedRead,
+    NULL,
+    NULL,
+    chidb_Backend_compressedWrite,
+    chidb_Backend_compressedSize,
+    NULL,
+    chidb_Backend_compressedTruncate,
+    chidb_Backend_compressedSync,
+    NULL,
+    NULL,
+    chidb_Backend_compressedClose
+};
+
+
+static const PagerBackend *backends[] =
+{
+    &chidb_Backend_file,
+    &chidb_Backend_mmap,
+    &chidb_Backend_memory,
+    &chidb_Backend_counting,
+    &chidb_Backend_uring,
+    NULL
+};
+
+/* Find a backend by name
+ *
+ * Parameters
+ * - name: Name of the backend
+ *
+ * Return
+ * - The backend, or NULL if there is no backend with that name
+ */
+const PagerBackend *chidb_Backend_find(const char *name)
+{
+    for(const PagerBackend **b = backends; *b != NULL; b++)
+        if (!strcmp((*b)->name, name))
+            return *b;
+
+    return NULL;
+}
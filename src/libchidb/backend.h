@@ -0,0 +1,286 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Pager backends header. See backend.c for more details.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef BACKEND_H_
+#define BACKEND_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include "chidbInt.h"
+
+/* Flags for a backend's open */
+#define PAGER_OPEN_CREATE (1)
+#define PAGER_OPEN_DIRECT (2)      /* Bypass the OS page cache, if the backend can */
+
+/* Compressed files (see the "compressed" layer in backend.c) */
+#define PAGER_COMPRESSED_MAGIC "chidb compressed"
+#define PAGER_COMPRESSED_VERSION (1)
+#define PAGER_COMPRESSED_HEADER_SIZE (64)
+#define PAGER_COMPRESSED_ENTRY_SIZE (12)
+#define PAGER_COMPRESSED_UNITS (16)  /* Allocation units in a block */
+#define PAGER_COMPRESSED_CHUNK (256)  /* Entries in a chunk of the page map */
+
+/* Alignment assumed for direct I/O when the file system cannot tell
+ * what it needs (the logical block size of most devices) */
+#define PAGER_DIRECT_ALIGN (512)
+
+typedef struct PagerFile PagerFile;
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/* Backend settings (only used by some backends) */
+typedef struct PagerBackendOptions
+{
+    uint32_t read_latency;         /* Added to every read, in microseconds ("counting") */
+    uint32_t write_latency;        /* Added to every write, in microseconds ("counting") */
+    uint32_t sync_latency;         /* Added to every sync, in microseconds ("counting") */
+    uint32_t queue_depth;          /* Reads in flight at once ("uring") */
+} PagerBackendOptions;
+
+/* One of the reads in a batch (see readBatch) */
+typedef struct PagerReadRequest
+{
+    void *buf;
+    size_t count;
+    off_t offset;
+    ssize_t result;                /* Set by readBatch: bytes read, or -1 */
+} PagerReadRequest;
+
+/* A Pager backend: the operations used by the Pager (and the write-ahead
+ * log) to access a file. Offsets and sizes are in bytes. Unless noted
+ * otherwise, operations return CHIDB_OK or CHIDB_EIO. */
+typedef struct PagerBackend
+{
+    const char *name;
+
+    /* Open (or create, with PAGER_OPEN_CREATE) a file. With
+     * PAGER_OPEN_DIRECT, the backend may do direct I/O on the file, in
+     * which case it sets the file's direct_align. Can also return
+     * CHIDB_ENOMEM, CHIDB_ENOFILE or CHIDB_EMISUSE. */
+    int (*open)(const struct PagerBackend *backend, const char *filename, int flags,
+                const PagerBackendOptions *options, PagerFile **file);
+
+    /* Read up to count bytes. Returns the number of bytes read (less
+     * than count only at the end of the file), or -1 on error */
+    ssize_t (*read)(PagerFile *file, void *buf, size_t count, off_t offset);
+
+    /* Do several reads at once, setting the result of each request
+     * (as read would return it). Optional (NULL if the backend can only
+     * do one read at a time). Returns CHIDB_EIO only if the batch could
+     * not be done at all. */
+    int (*readBatch)(PagerFile *file, PagerReadRequest *reqs, uint32_t n);
+
+    /* Tell the backend that a range of the file will be read soon, so
+     * it can start reading it in the background. Optional. */
+    void (*willNeed)(PagerFile *file, off_t offset, off_t len);
+
+    /* Write a run of buffers. Returns the number of system calls it
+     * took (0 if the backend does not make any), or -1 on error. The
+     * iovec array may be modified. */
+    int (*write)(PagerFile *file, struct iovec *iov, int iovcnt, off_t offset);
+
+    int (*size)(PagerFile *file, off_t *size);
+
+    /* Reserve space for len bytes starting at offset, extending the
+     * file if needed. Optional (NULL if not supported) */
+    int (*allocate)(PagerFile *file, off_t offset, off_t len);
+
+    int (*truncate)(PagerFile *file, off_t size);
+
+    /* Make the writes done so far durable. Must be safe to call from
+     * another thread while the file is being written. */
+    int (*sync)(PagerFile *file);
+
+    /* Map the first size bytes of the file into memory, as a private
+     * (copy-on-write) mapping, and unmap it. Optional (NULL if not
+     * supported). map can also return CHIDB_ENOMEM. */
+    int (*map)(PagerFile *file, size_t size, uint8_t **addr);
+    void (*unmap)(PagerFile *file, uint8_t *addr, size_t size);
+
+    /* Close the file, and delete it if remove is true */
+    int (*close)(PagerFile *file, bool remove);
+} PagerBackend;
+
+/* An open file. Backends extend this struct with their own fields. */
+struct PagerFile
+{
+    const PagerBackend *backend;
+
+    /* If the file is accessed with direct I/O, the alignment (in bytes)
+     * that buffers, offsets and sizes should have for reads and writes
+     * to skip the backend's bounce buffer. 0 if it goes through the OS
+     * page cache. */
+    uint32_t direct_align;
+};
+
+/* File accessed through a file descriptor ("file" and "mmap" backends) */
+typedef struct PagerFdFile
+{
+    PagerFile base;
+    int fd;
+    char *filename;
+    uint8_t *map;                  /* Shared mapping used for reads ("mmap" only) */
+    size_t map_size;
+} PagerFdFile;
+
+/* File accessed through a file descriptor, with reads submitted to an
+ * io_uring ("uring" backend). If the ring cannot be set up (e.g., the
+ * kernel does not support io_uring), ring_fd is -1, and reads are done
+ * with pread. */
+typedef struct PagerUringFile
+{
+    PagerFdFile base;
+    int ring_fd;
+    uint32_t depth;                /* Submission queue entries */
+
+    /* Submission queue */
+    void *sq_ring;
+    size_t sq_ring_size;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t sq_mask;
+    uint32_t *sq_array;
+    struct io_uring_sqe *sqes;
+
+    /* Completion queue */
+    void *cq_ring;
+    size_t cq_ring_size;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe *cqes;
+
+    struct iovec *iovs;            /* One per submission queue entry */
+
+    /* Counters */
+    uint64_t batches;
+    uint64_t submits;              /* io_uring_enter calls */
+    uint64_t reads;                /* Reads done through the ring */
+} PagerUringFile;
+
+/* File kept in memory ("memory" backend) */
+typedef struct PagerMemoryFile
+{
+    PagerFile base;
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} PagerMemoryFile;
+
+/* File that counts (and slows down) the operations done on a file
+ * accessed with the "file" backend ("counting" backend) */
+typedef struct PagerCountingFile
+{
+    PagerFile base;
+    PagerFile *inner;
+    PagerBackendOptions latency;
+    /* Updated atomically: pages can be read by several threads, and
+     * synced by the Pager's syncer thread */
+    uint64_t reads;
+    uint64_t bytes_read;
+    uint64_t writes;
+    uint64_t bytes_written;
+    uint64_t syncs;
+} PagerCountingFile;
+
+/* Where a block of a compressed file is, in the underlying file. Also
+ * used for free space, in which case length is the size of the extent. */
+typedef struct PagerExtent
+{
+    off_t offset;                  /* 0: the block has never been written */
+    uint32_t length;               /* Compressed length (block_size: not compressed) */
+} PagerExtent;
+
+typedef struct PagerExtentList
+{
+    PagerExtent *extents;
+    uint32_t n;
+    uint32_t capacity;
+} PagerExtentList;
+
+/* File whose blocks are compressed, on top of a file opened with any
+ * other backend ("compressed" layer) */
+typedef struct PagerCompressedFile
+{
+    PagerFile base;
+    PagerFile *inner;
+    uint32_t block_size;           /* Uncompressed size of a block */
+    uint32_t unit;                 /* Extents are a whole number of units */
+    off_t size;                    /* Size of the (uncompressed) file */
+    off_t end;                     /* End of the last extent in the inner file */
+
+    /* Page map: where each block is (block i at i) */
+    PagerExtent *map;
+    uint32_t n_blocks;
+    uint32_t map_capacity;
+    bool dirty;                    /* Changed since it was last written */
+    PagerExtent map_extent;        /* Where it was last written */
+    PagerExtent map_spare;         /* Where it was written before that (now unused) */
+    bool *chunk_loaded;            /* Chunks read so far, or NULL once they all are */
+
+    /* Free extents, by size in units (free[1] to free[PAGER_COMPRESSED_UNITS]).
+     * Extents freed since the map was last written are pending until
+     * the new map is durable, since the old one may still use them. */
+    PagerExtentList free[PAGER_COMPRESSED_UNITS + 1];
+    off_t free_bytes;
+    PagerExtentList pending;
+
+    pthread_mutex_t lock;          /* Everything above */
+    pthread_mutex_t commit_lock;   /* One commit (see sync) at a time */
+
+    /* Counters */
+    uint64_t blocks_written;
+    uint64_t bytes_in;             /* Uncompressed bytes written */
+    uint64_t bytes_out;            /* Compressed bytes written */
+} PagerCompressedFile;
+
+extern const PagerBackend chidb_Backend_file;
+extern const PagerBackend chidb_Backend_mmap;
+extern const PagerBackend chidb_Backend_memory;
+extern const PagerBackend chidb_Backend_counting;
+extern const PagerBackend chidb_Backend_uring;
+extern const PagerBackend chidb_Backend_compressed;
+
+const PagerBackend *chidb_Backend_find(const char *name);
+bool chidb_Backend_isCompressed(PagerFile *file);
+int chidb_Backend_compress(PagerFile *inner, PagerFile **file);
+void chidb_Backend_setBlockSize(PagerFile *file, uint32_t block_size);
+
+#endif /*BACKEND_H_*/
@@ -64,6 +64,11 @@
 #define isHeaderPage(npage) (npage == 1)
 #define nodeIsEmpty(node_p) (node_p->n_cells <= 0)
 
+/* Forward declarations of auxiliary functions */
+static int chidb_Btree_insertInPath(BTree *bt, BTreePath *path, BTreeCell *btc, bool grow_root);
+static int chidb_Btree_loadCell(BTreeLoader *loader, uint32_t level, BTreeCell *btc);
+static int chidb_Btree_loadEntry(BTreeLoader *loader, BTreeCell *btc);
+
 /* Pack a BTree file's header
  *
  * This function takes a buffer representing a page
@@ -72,18 +77,18 @@
  *
  * Parameters
  * - buff_p: Pointer to the start of the buffer that holds the file header in memory 
- * - page_size: The physical size of the page
+ * - page_size: The physical size of the page (MAX_PAGE_SIZE is stored as 1)
  *
  * Return
  * - void
  */
-static void chidb_Btree_packFileHeader(uint8_t* buff_p, uint16_t page_size)
+static void chidb_Btree_packFileHeader(uint8_t* buff_p, uint32_t page_size)
 {
 	enum 
 	{
 		file_change_ctr = 0,
 		schema_version = 0,
-		page_cache_size = 20000,
+		page_cache_size = DEFAULT_CACHE_SIZE,
 		user_cookie = 0
 	};
 
@@ -95,7 +100,7 @@ static void chidb_Btree_packFileHeader(uint8_t* buff_p, uint16_t page_size)
 	}
 
 	uint8_t* page_size_pos = buff_p + 16;
-	put2byte(page_size_pos, page_size);
+	put2byte(page_size_pos, (page_size == MAX_PAGE_SIZE)? 1 : page_size);
 
 	uint8_t* fchange_ctr_pos = buff_p + 24;
 	put4byte(fchange_ctr_pos, file_change_ctr);
@@ -125,7 +130,8 @@ static void chidb_Btree_packFileHeader(uint8_t* buff_p, uint16_t page_size)
  * header is correct. If the file is empty (which will happen
  * if the pager is given a filename for a file that does not exist)
  * then this function will (1) initialize the file header using
- * the default page size and (2) create an empty table leaf node
+ * the page size given with the "page_size" open option (or the
+ * default page size) and (2) create an empty table leaf node
  * in page 1.
  *
  * Parameters
@@ -165,6 +171,8 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
         //Fill in default values for the new btree 
 		bt_p -> pager = pgr_p;
 		bt_p -> db = db;
+		bt_p -> free_nodes = NULL;
+		bt_p -> node_slabs = NULL;
 		db -> bt = bt_p;
 		(*bt) = bt_p;
 		assert((*bt) == bt_p);
@@ -174,7 +182,11 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
 		if(chidb_Pager_readHeader(pgr_p, header_buff) 
 			== CHIDB_NOHEADER)
 		{
-			chidb_Pager_setPageSize(pgr_p, DEFAULT_PAGE_SIZE);			
+			int size_msg;
+			if((size_msg = chidb_Pager_setPageSize(pgr_p, pgr_p->new_page_size)) != CHIDB_OK)
+			{
+				return size_msg;
+			}
 			npage_t init_page_num;
 			chidb_Btree_newNode(bt_p, &init_page_num, PGTYPE_TABLE_LEAF);
 			assert(init_page_num == 1);
@@ -206,24 +218,48 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
         else 
         {
         	//Read the page size from the header and set chidb_pager_set_page size
-            uint16_t page_size = get2byte(header_buff + 16);
-            chidb_Pager_setPageSize(pgr_p, page_size);
+            uint32_t page_size = get2byte(header_buff + 16);
+            if(page_size == 1)
+            {
+                page_size = MAX_PAGE_SIZE;
+            }
+            if(page_size < MIN_PAGE_SIZE || page_size > MAX_PAGE_SIZE || (page_size & (page_size - 1)) != 0)
+            {
+                return CHIDB_ECORRUPTHEADER;
+            }
+            int size_msg;
+            if((size_msg = chidb_Pager_setPageSize(pgr_p, page_size)) != CHIDB_OK)
+            {
+                return size_msg;
+            }
             
             //Check for headers that don't follow the template
             if (strcmp("SQLite format 3", (char*)header_buff) != 0 ||
-            	get4byte(header_buff+32)!=0 || get4byte(header_buff+36)!=0 ||
             	get4byte(header_buff+52)!=0 || get4byte(header_buff+64)!=0 ||
             	get4byte(header_buff+44)!=1 || get4byte(header_buff+56)!=1 ||
             	getByte(header_buff+18)!=1 || getByte(header_buff+19)!=1   ||
             	getByte(header_buff+20)!=0 || getByte(header_buff+21)!=0x40||
             	getByte(header_buff+22)!=0x20 || getByte(header_buff+23)!=0x20 ||
-            	get4byte(header_buff+48)!=20000)
+            	get4byte(header_buff+48)!=DEFAULT_CACHE_SIZE)
             {
         		return CHIDB_ECORRUPTHEADER;
     		}
+
+            //Size the buffer pool from the header, unless it was set when opening the file
+            if(pgr_p->cache_size == 0)
+            {
+                chidb_Pager_setCacheSize(pgr_p, get4byte(header_buff+48));
+            }
        	}
+
+        //The header is valid, so the pager can use the freelist in it
+        int freelist_msg;
+        if((freelist_msg = chidb_Pager_initFreelist(pgr_p)) != CHIDB_OK)
+        {
+            return freelist_msg;
+        }
     }
-	return CHIDB_OK;
+	return open_msg;
 }
 
 
@@ -248,12 +284,56 @@ int chidb_Btree_close(BTree *bt)
 	int close_msg;
 	if((close_msg = chidb_Pager_close(bt -> pager)) == CHIDB_OK)
 	{
+        BTreeNodeSlab *slab, *next;
+        for(slab = bt->node_slabs; slab != NULL; slab = next)
+        {
+            next = slab->next;
+            free(slab);
+        }
 		free(bt);
 	}
     return close_msg;
 }
 
 
+/* Get a BTreeNode that is not in use
+ *
+ * BTreeNodes are loaded and freed on every page access, so they are not
+ * allocated one by one: they come from slabs of BTREE_NODE_SLAB nodes,
+ * and chidb_Btree_freeMemNode puts them back in the BTree's free list.
+ * The slabs are only freed when the BTree is closed.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - The node, or NULL if it could not be allocated.
+ */
+static BTreeNode *chidb_Btree_allocNode(BTree *bt)
+{
+    BTreeNode *btn;
+
+    if(bt->free_nodes == NULL)
+    {
+        BTreeNodeSlab *slab = malloc(sizeof(BTreeNodeSlab));
+        if(slab == NULL)
+            return NULL;
+
+        slab->next = bt->node_slabs;
+        bt->node_slabs = slab;
+        for(int i = BTREE_NODE_SLAB - 1; i >= 0; i--)
+        {
+            slab->nodes[i].next_free = bt->free_nodes;
+            bt->free_nodes = &slab->nodes[i];
+        }
+    }
+
+    btn = bt->free_nodes;
+    bt->free_nodes = btn->next_free;
+    return btn;
+}
+
+
 /* Loads a B-Tree node from disk
  *
  * Reads a B-Tree node from a page in the disk. All the information regarding
@@ -277,7 +357,31 @@ int chidb_Btree_close(BTree *bt)
  */
 int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **btn)
 {
-    /* Your code goes here */
+    return chidb_Btree_getNodeByPageHint(bt, npage, PAGER_HINT_NONE, btn);
+}
+
+
+/* Loads a B-Tree node from disk, with a hint on how it will be used
+ *
+ * Same as chidb_Btree_getNodeByPage, but passes a hint on to the pager
+ * (see chidb_Pager_readPageHint). Cursors that walk over a whole tree
+ * should use PAGER_HINT_SCAN, so the scan does not evict the pages
+ * that other lookups depend on.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Page of node to load
+ * - hint: PAGER_HINT_NONE or PAGER_HINT_SCAN
+ * - btn: Out parameter. Used to return a pointer to newly creater BTreeNode
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_getNodeByPageHint(BTree *bt, npage_t npage, pager_hint_t hint, BTreeNode **btn)
+{
 	if(bt==NULL || btn == NULL)
 	{
 		return CHIDB_EMISUSE;
@@ -285,16 +389,17 @@ int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **btn)
 
 	//Read in a mempage
 	MemPage* mem_page_p = NULL;
-	int read_msg = chidb_Pager_readPage(bt->pager, npage, &mem_page_p);
+	int read_msg = chidb_Pager_readPageHint(bt->pager, npage, hint, &mem_page_p);
 	if(read_msg != CHIDB_OK)
 	{
 		return read_msg;
 	}
 	assert(mem_page_p != NULL);
 	
-	BTreeNode* btn_p = malloc(sizeof(BTreeNode));
+	BTreeNode* btn_p = chidb_Btree_allocNode(bt);
 	if(btn_p == NULL)
 	{
+		chidb_Pager_releaseMemPage(bt->pager, mem_page_p);
 		return CHIDB_ENOMEM;
 	}
 	//Pack the BTree Node with info from the read-in MemPage
@@ -304,6 +409,11 @@ int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **btn)
 	btn_p -> free_offset = get2byte(node_start + 1);
 	btn_p -> n_cells = get2byte(node_start + 3);
 	btn_p -> cells_offset = get2byte(node_start + 5);
+	if(btn_p -> cells_offset == 0)
+	{
+		//An empty node in a page of MAX_PAGE_SIZE bytes
+		btn_p -> cells_offset = MAX_PAGE_SIZE;
+	}
 	if(isInternal(btn_p -> type))
     {
         btn_p -> right_page = get4byte(node_start + 8);
@@ -320,6 +430,55 @@ int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **btn)
 	return read_msg;
 }
 
+/* Read the children of an internal node into the buffer pool
+ *
+ * Asks the pager to read all the children of an internal node (starting
+ * with the ncell-th one, and including the right page) with a single
+ * batch of reads (see chidb_Pager_prefetchPages). Used by cursors, which
+ * are about to visit all of them. This is only a hint: the children can
+ * be loaded with chidb_Btree_getNodeByPage whether or not it succeeds.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - btn: An internal node
+ * - ncell: First child to read
+ * - hint: PAGER_HINT_NONE or PAGER_HINT_SCAN
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The node is not an internal node
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_prefetchChildren(BTree *bt, BTreeNode *btn, ncell_t ncell, pager_hint_t hint)
+{
+    npage_t *children;
+    uint32_t n = 0;
+    BTreeCell cell;
+    int rc;
+
+    if (!isInternal(btn->type))
+        return CHIDB_EMISUSE;
+
+    children = malloc((btn->n_cells + 1) * sizeof(npage_t));
+    if (children == NULL)
+        return CHIDB_ENOMEM;
+
+    for(ncell_t i = ncell; i < btn->n_cells; i++)
+    {
+        chidb_Btree_getCell(btn, i, &cell);
+        children[n++] = (btn->type == PGTYPE_TABLE_INTERNAL)? cell.fields.tableInternal.child_page
+                                                            : cell.fields.indexInternal.child_page;
+    }
+    children[n++] = btn->right_page;
+
+    rc = chidb_Pager_prefetchPages(bt->pager, children, n, hint);
+    free(children);
+
+    return rc;
+}
+
+
 /* Frees the memory allocated to an in-memory B-Tree node
  *
  * Frees the memory allocated to an in-memory B-Tree node, and
@@ -342,7 +501,8 @@ int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn)
         return free_msg;
     }
 
-    free(btn);
+    btn->next_free = bt->free_nodes;
+    bt->free_nodes = btn;
     return CHIDB_OK;
 }
 
@@ -382,6 +542,28 @@ int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type)
 }
 
 
+/* Turn a loaded node into an empty node of the given type
+ *
+ * Clears the node's page (after the file header, in page 1) and the
+ * fields of the BTreeNode. The page header is only updated by
+ * chidb_Btree_writeNode.
+ */
+static void chidb_Btree_resetNode(BTree *bt, BTreeNode *btn, uint8_t type)
+{
+    uint8_t *data = btn->page->data;
+    uint8_t *node_start = isHeaderPage(btn->page->npage)? data + FILE_HEADER_SIZE : data;
+    uint32_t header_size = isInternal(type)? INTPG_CELLSOFFSET_OFFSET : LEAFPG_CELLSOFFSET_OFFSET;
+
+    memset(node_start, 0, bt->pager->page_size - (node_start - data));
+    btn->type = type;
+    btn->free_offset = (node_start - data) + header_size;
+    btn->n_cells = 0;
+    btn->cells_offset = bt->pager->page_size;
+    btn->right_page = 0;
+    btn->celloffset_array = node_start + header_size;
+}
+
+
 /* Initialize a B-Tree node
  *
  * Initializes a database page to contain an empty B-Tree node. The
@@ -406,40 +588,19 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
     {
     	return CHIDB_EMISUSE;
     }
-    bool isInternal = isInternal(type);
-    bool isHeaderPage = (npage == 1);
-
-    const uint16_t page_size = bt->pager->page_size;
-    uint8_t page_buff[page_size];
-    uint8_t* node_start = isHeaderPage ? page_buff+FILE_HEADER_SIZE : page_buff;
 
-    uint8_t* type_p = node_start;
-    uint8_t* free_off_p = node_start + 1;
-    uint8_t* num_cells_p = node_start + 3;
-    uint8_t* cell_off_p = node_start + 5;
-    // if(isInternal)
-    // {
-    //     uint8_t* rt_page_p = node_start + 8;
-    // }
-    putByte(type_p, type);
-    if(isInternal)
-    {
-        (isHeaderPage) ? put2byte(free_off_p, 112) : put2byte(free_off_p, 12);
-    }
-    else
+    //Format the page in place, so the file header (if any) is left untouched
+    BTreeNode *btn;
+    int read_msg;
+    if((read_msg = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
     {
-        (isHeaderPage) ? put2byte(free_off_p, 108) : put2byte(free_off_p, 8);
+        return read_msg;
     }
-    put2byte(num_cells_p, 0);
-    put2byte(cell_off_p, bt->pager->page_size);
-    putByte(node_start+7, 0);
+    chidb_Btree_resetNode(bt, btn, type);
 
-    MemPage new_page;	//is it ok for mem_page and for the buffer below to be on the stack?
-    new_page.npage = npage;
-    new_page.data = page_buff;
-    
-    int write_msg;
-    if((write_msg = chidb_Pager_writePage(bt->pager, &new_page))!=CHIDB_OK)
+    int write_msg = chidb_Btree_writeNode(bt, btn);
+    chidb_Btree_freeMemNode(bt, btn);
+    if(write_msg != CHIDB_OK)
     {
         return write_msg;
     }
@@ -448,6 +609,38 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
 }
 
 
+/* Create a new B-Tree node, and keep it loaded
+ *
+ * Same as chidb_Btree_newNode, but returns the node instead of its page
+ * number, so the caller can fill it in without reading the page again.
+ * The node is only initialized in memory: it has to be written with
+ * chidb_Btree_writeNode.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - type: Type of B-Tree node
+ * - btn: Out parameter. Used to return the new node.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_Btree_newMemNode(BTree *bt, uint8_t type, BTreeNode **btn)
+{
+    npage_t npage;
+    int rc;
+
+    if ((rc = chidb_Pager_allocatePage(bt->pager, &npage)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_Btree_getNodeByPage(bt, npage, btn)) != CHIDB_OK)
+        return rc;
+
+    chidb_Btree_resetNode(bt, *btn, type);
+    return CHIDB_OK;
+}
+
+
 /* Write an in-memory B-Tree node to disk
  *
  * Writes an in-memory B-Tree node to disk. To do this, we need to update
@@ -564,6 +757,90 @@ int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
     return CHIDB_OK;
 }
 
+
+/* Read the key of a cell
+ *
+ * Reads only the key field of a cell, straight from the in-memory page,
+ * without decoding the rest of the cell (as chidb_Btree_getCell does).
+ * This is all that searching a node needs.
+ *
+ * Parameters
+ * - btn: BTreeNode where cell is contained
+ * - ncell: Cell number (must be smaller than btn->n_cells)
+ *
+ * Return
+ * - The key of the cell
+ */
+chidb_key_t chidb_Btree_getCellKey(BTreeNode *btn, ncell_t ncell)
+{
+    uint8_t *cell_p = btn->page->data + get2byte(btn->celloffset_array + 2 * ncell);
+    chidb_key_t key;
+
+    switch (btn->type)
+    {
+        case PGTYPE_TABLE_INTERNAL:
+            getVarint32(cell_p + TABLEINTCELL_KEY_OFFSET, &key);
+            return key;
+        case PGTYPE_TABLE_LEAF:
+            getVarint32(cell_p + TABLELEAFCELL_KEY_OFFSET, &key);
+            return key;
+        case PGTYPE_INDEX_INTERNAL:
+            return get4byte(cell_p + INDEXINTCELL_KEYIDX_OFFSET);
+        default:
+            return get4byte(cell_p + INDEXLEAFCELL_KEYIDX_OFFSET);
+    }
+}
+
+
+/* Search for a key in a B-Tree node
+ *
+ * The cells of a node are sorted by key, so this does a binary search
+ * over the cell offset array, reading only the key of each cell it
+ * visits (see chidb_Btree_getCellKey). It finds the first cell whose
+ * key is greater than or equal to the given key, which is where the key
+ * is (or would be inserted) in a leaf, and the child to descend into in
+ * an internal node (n_cells meaning the right page).
+ *
+ * Parameters
+ * - btn: BTreeNode to search in
+ * - key: Key to search for
+ * - found: Out parameter. Set to true if the returned cell has the
+ *          given key.
+ *
+ * Return
+ * - Number of the first cell with a key >= key (btn->n_cells if there
+ *   is no such cell)
+ */
+ncell_t chidb_Btree_searchNode(BTreeNode *btn, chidb_key_t key, bool *found)
+{
+    ncell_t lo = 0, hi = btn->n_cells;
+
+    /* Cells before lo have smaller keys; cells from hi on do not */
+    while (lo < hi)
+    {
+        ncell_t mid = lo + (hi - lo) / 2;
+        if (chidb_Btree_getCellKey(btn, mid) < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *found = (lo < btn->n_cells && chidb_Btree_getCellKey(btn, lo) == key);
+    return lo;
+}
+
+
+/* Page number of the ncell-th child of an internal node (the right
+ * page if ncell is n_cells). Both kinds of internal cells start with
+ * the child's page number. */
+static npage_t chidb_Btree_getChildPage(BTreeNode *btn, ncell_t ncell)
+{
+    if (ncell == btn->n_cells)
+        return btn->right_page;
+
+    return get4byte(btn->page->data + get2byte(btn->celloffset_array + 2 * ncell));
+}
+
 /* Insert a new cell into a B-Tree node
  *
  * Inserts a new cell into a B-Tree node at a specified position ncell.
@@ -651,7 +928,7 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
     }
     
     //assert(new_cell_p > data_p);
-    uint16_t cell_offset = (new_cell_p - data_p);
+    uint32_t cell_offset = (new_cell_p - data_p);
     if(ncell >= btn -> n_cells)
     {
         uint8_t *cell_offset_p = data_p + (btn -> free_offset);
@@ -664,9 +941,7 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
         memmove(insert_point + 2, insert_point,  2*(btn->n_cells - ncell));
         put2byte(insert_point, cell_offset);
     }
-    put2byte(data_p + 1, get2byte(data_p + 1)+2);
-    put2byte(data_p + 3, get2byte(data_p + 3)+1);
-    put2byte(data_p + 5, cell_offset);
+    //The page header itself is updated by chidb_Btree_writeNode
     btn -> free_offset = btn -> free_offset + 2;
     btn -> n_cells = btn -> n_cells + 1;
     btn -> cells_offset = cell_offset;
@@ -674,92 +949,125 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
     return CHIDB_OK;
 }
 
-/* Recursively searches for the node in the tree containing the data
+/* Load a node and add it to the end of a path
  *
- * Takes a page number and a key, and returns a pointer to the node containing
- *  the data being searched for by recursively calling itself 
+ * The node is added with ncell set to 0.
  *
  * Parameters
  * - bt: B-Tree file
- * - subRoot: Page number of the node of the BTree to be searched
- * - key: Entry key
- * - ncell: Out-parameter where the cell number is held if an internalIndex page 
-        contains the actual data being searced for. This occurs b/c indeces are stored
-        in B-trees as opposed to B+ trees
- * - flag: Out-parameter where any error codes are placed. Meant for debugging purposes
+ * - path: Path to add the node to
+ * - npage: Page of the node
+ * - hint: PAGER_HINT_NONE or PAGER_HINT_SCAN (see chidb_Btree_getNodeByPageHint)
  *
  * Return
- * - BTreeNode*: A pointer to the btree node in memory that contains the data
- *     Is NULL on error
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The provided page number is not valid, or the path
+ *                  is already BTREE_MAX_DEPTH levels deep (which only
+ *                  a corrupt file, with a loop in it, can cause)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-static BTreeNode* chidb_Btree_findDataPage(BTree *bt, npage_t subRoot, chidb_key_t key, ncell_t* ncell, int*flag)
+int chidb_Btree_pushPath(BTree *bt, BTreePath *path, npage_t npage, pager_hint_t hint)
 {
-    //Read in node from provided page
-    BTreeNode *node_p = NULL;
-    if(chidb_Btree_getNodeByPage(bt, subRoot, &node_p) != CHIDB_OK)
-    {
-        *flag = CHIDB_ENOMEM;
-        return NULL;
-    }
-    
-    uint8_t node_type = node_p -> type;
-    
-    //If the node is a leaf, return a ptr to the page
-    if(isLeaf(node_type))
-    {
-        return node_p;
-    }
-    
-    //Cycle through the keys that the internal node stores
-    for(int i = 0; i < node_p -> n_cells; i++)
+    BTreePathEntry *level;
+    int rc;
+
+    if (path->depth == BTREE_MAX_DEPTH)
+        return CHIDB_EPAGENO;
+
+    level = &path->levels[path->depth];
+    if ((rc = chidb_Btree_getNodeByPageHint(bt, npage, hint, &level->btn)) != CHIDB_OK)
+        return rc;
+
+    level->npage = npage;
+    level->ncell = 0;
+    path->depth++;
+
+    return CHIDB_OK;
+}
+
+
+/* Find the path from the root of a B-Tree to a key
+ *
+ * Walks down from the root, searching every node on the way with
+ * chidb_Btree_searchNode, and records the path it takes (see
+ * BTreePath). It stops at the leaf where the key is, or would be
+ * inserted, unless the key is found in an internal index node first:
+ * index B-Trees store entries in internal nodes too. Every node on the
+ * path stays loaded until chidb_Btree_releasePath is called, so finds,
+ * insertions (and the splits they cause) and cursors use the nodes on
+ * the path instead of reading them again.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - key: Key to search for
+ * - path: Out parameter. Used to return the path. If this function
+ *         fails, the path is empty.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (path->found tells whether the key
+ *             was found)
+ * - CHIDB_EPAGENO: The B-Tree contains an invalid page number
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_descend(BTree *bt, npage_t nroot, chidb_key_t key, BTreePath *path)
+{
+    BTreePathEntry *level;
+    npage_t npage = nroot;
+    int rc;
+
+    path->depth = 0;
+    path->found = false;
+
+    for(;;)
     {
-        BTreeCell cell;
-        int cell_err;
-        if((cell_err = chidb_Btree_getCell(node_p, i, &cell))!=CHIDB_OK)
-        {
-            *flag = cell_err;
-            return NULL;
-        }
-        
-        //if the index internal page contains a record
-        if(key == cell.key && node_type == PGTYPE_INDEX_INTERNAL)
-        {
-            *ncell = i;
-            return node_p;
-        }
-        //if the internal page holds the next page
-        else if(key <= cell.key)
+        if ((rc = chidb_Btree_pushPath(bt, path, npage, PAGER_HINT_NONE)) != CHIDB_OK)
         {
-            npage_t child_page = (node_type == PGTYPE_TABLE_INTERNAL)?
-                                cell.fields.tableInternal.child_page:
-                                cell.fields.indexInternal.child_page;
-            
-            int free_err;
-            if((free_err = chidb_Btree_freeMemNode(bt, node_p))!=CHIDB_OK)
-            {
-                *flag = free_err;
-                return NULL;
-            }            
-            return chidb_Btree_findDataPage(bt, child_page, key, ncell, flag);
+            chidb_Btree_releasePath(bt, path);
+            return rc;
         }
+
+        level = &path->levels[path->depth - 1];
+        level->ncell = chidb_Btree_searchNode(level->btn, key, &path->found);
+
+        if (isLeaf(level->btn->type) || (path->found && level->btn->type == PGTYPE_INDEX_INTERNAL))
+            return CHIDB_OK;
+
+        //The key is in the ncell-th child (the right page if the key is
+        // greater than all of the keys stored)
+        npage = chidb_Btree_getChildPage(level->btn, level->ncell);
     }
-    //This point is reached when the key is greater than all of the keys stored
-    //Hence we go to the page stored in the node's "rightpage" ptr
-    
-    npage_t child_page = node_p -> right_page;
-    int free_err;
-    if((free_err = chidb_Btree_freeMemNode(bt, node_p))!=CHIDB_OK)
+}
+
+
+/* Release all the nodes on a path
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - path: Path to release. It is left empty.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Btree_releasePath(BTree *bt, BTreePath *path)
+{
+    while (path->depth > 0)
     {
-        *flag = free_err;
-        return NULL;
+        path->depth--;
+        chidb_Btree_freeMemNode(bt, path->levels[path->depth].btn);
+        path->levels[path->depth].btn = NULL;
     }
-    return chidb_Btree_findDataPage(bt, child_page, key, ncell, flag);
 
+    return CHIDB_OK;
 }
 
 /* Find an entry in a table B-Tree
  *
- * Finds the data associated for a given key in a table B-Tree
+ * Finds the data associated for a given key in a table B-Tree. This is
+ * chidb_Btree_findView followed by a copy of the data, so the page can
+ * be released right away.
  *
  * Parameters
  * - bt: B-Tree file
@@ -782,110 +1090,183 @@ int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data,
         return CHIDB_EMISUSE;
     }
 
-    //This value holds cell number in the case that we come across an indexInternal page
-    // that holds a record for our key
-    ncell_t ncell;
-    int flag = CHIDB_OK;
-    BTreeNode *node_p = chidb_Btree_findDataPage(bt, nroot, key, &ncell, &flag);
-    if(node_p == NULL)
+    BTreeView view;
+    int rc = chidb_Btree_findView(bt, nroot, key, &view);
+    if(rc != CHIDB_OK)
     {
-        return CHIDB_ENOMEM;
+        return rc;
     }
-    else if(isInternal(node_p -> type))
+
+    if(view.btn->type == PGTYPE_TABLE_LEAF)
     {
-        BTreeCell cell;
-        chidb_Btree_getCell(node_p, ncell, &cell);
-        size_t data_size = sizeof(chidb_key_t);
-        *data = malloc(data_size);
-        if(*data == NULL)
+        *size = view.size;
+        *data = malloc(*size);
+        if(*data != NULL)
         {
-            return CHIDB_ENOMEM;
+            memmove(*data, view.data, *size);
         }
-        *size = (uint16_t)data_size;
-        memmove(*data, &(cell.fields.indexInternal.keyPk), data_size);
-        chidb_Btree_freeMemNode(bt, node_p);
-        return CHIDB_OK;
-
     }
     else
     {
-        assert(node_p->type == PGTYPE_TABLE_LEAF);
-        
-        for(int i = 0; i < node_p -> n_cells; i++)
+        //Index entries hold a KeyPk, which is returned as a chidb_key_t
+        chidb_key_t keyPk = get4byte(view.data);
+        *size = (uint16_t)sizeof(chidb_key_t);
+        *data = malloc(*size);
+        if(*data != NULL)
         {
-            BTreeCell cell;
-            chidb_Btree_getCell(node_p, i, &cell);
-            if(key == cell.key)
-            {
-                *size = cell.fields.tableLeaf.data_size;
-                *data = malloc(*size);
-                if(*data == NULL)
-                {
-                    fprintf(log, "CHIDB_ENOMEM 860\n");
-                    fflush(log);
-                    return CHIDB_ENOMEM;
-                }
-                memmove(*data, cell.fields.tableLeaf.data, *size);
-                chidb_Btree_freeMemNode(bt, node_p);
-                return CHIDB_OK;
-            }
+            memmove(*data, &keyPk, *size);
         }
-        chidb_Btree_freeMemNode(bt, node_p);
-        return CHIDB_ENOTFOUND;
     }
+    chidb_Btree_releaseView(bt, &view);
+
+    if(*data == NULL)
+    {
+        fprintf(log, "CHIDB_ENOMEM 860\n");
+        fflush(log);
+        return CHIDB_ENOMEM;
+    }
+    return CHIDB_OK;
 }
 
 
-/* Insert an entry into a table B-Tree
+/* Find an entry in a B-Tree, without copying it
  *
- * This is a convenience function that wraps around chidb_Btree_insert.
- * It takes a key and data, and creates a BTreeCell that can be passed
- * along to chidb_Btree_insert.
+ * Finds the entry with a given key, and returns a view of its data:
+ * a pointer into the page that holds it, which stays pinned in the
+ * buffer pool until chidb_Btree_releaseView is called. In a table
+ * B-Tree, the data is the entry's record (which can be read in place
+ * with chidb_DBRecord_unpackView). In an index B-Tree, it is the
+ * 4-byte KeyPk, as stored in the page (see get4byte).
+ *
+ * The view must be released before the B-Tree is modified.
  *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this entry in.
+ * - nroot: Page number of the root node of the B-Tree we want search in
  * - key: Entry key
- * - data: Pointer to data we want to insert
- * - size: Number of bytes of data
+ * - view: Out parameter. Used to return the view.
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ENOTFOUND: No entry with the given key way found
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size)
+int chidb_Btree_findView(BTree *bt, npage_t nroot, chidb_key_t key, BTreeView *view)
 {
-    /* Your code goes here */
-    if(size > DEFAULT_PAGE_SIZE)
+    BTreePath path;
+    BTreePathEntry *level;
+    BTreeCell cell;
+    int rc;
+
+    if ((rc = chidb_Btree_descend(bt, nroot, key, &path)) != CHIDB_OK)
+        return rc;
+    if (!path.found)
     {
-        return CHIDB_ENOMEM;
+        chidb_Btree_releasePath(bt, &path);
+        return CHIDB_ENOTFOUND;
     }
-    BTreeCell cell;
-    cell.type = PGTYPE_TABLE_LEAF;
-    cell.key = key;
-    cell.fields.tableLeaf.data_size = size;
-    cell.fields.tableLeaf.data = data;
 
-    int val = chidb_Btree_insert(bt, nroot, &cell);
-    return val;
-    //return CHIDB_OK;
+    /* Keep only the last node, which holds the entry (a table leaf, or
+     * an index node: indexes are B-Trees, not B+Trees) */
+    level = &path.levels[--path.depth];
+    chidb_Btree_releasePath(bt, &path);
+
+    chidb_Btree_getCell(level->btn, level->ncell, &cell);
+    view->btn = level->btn;
+    if (level->btn->type == PGTYPE_TABLE_LEAF)
+    {
+        view->data = cell.fields.tableLeaf.data;
+        view->size = cell.fields.tableLeaf.data_size;
+    }
+    else
+    {
+        uint8_t *cell_p = level->btn->page->data + get2byte(level->btn->celloffset_array + 2 * level->ncell);
+        view->data = cell_p + (level->btn->type == PGTYPE_INDEX_INTERNAL? INDEXINTCELL_KEYPK_OFFSET
+                                                                        : INDEXLEAFCELL_KEYPK_OFFSET);
+        view->size = sizeof(uint32_t);
+    }
+
+    return CHIDB_OK;
 }
 
 
-/* Insert an entry into an index B-Tree
- *
- * This is a convenience function that wraps around chidb_Btree_insert.
- * It takes a KeyIdx and a KeyPk, and creates a BTreeCell that can be passed
- * along to chidb_Btree_insert.
+/* Release a view returned by chidb_Btree_findView
  *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this entry in.
- * - keyIdx: See The chidb File Format.
+ * - view: The view. Its data cannot be used after this.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Btree_releaseView(BTree *bt, BTreeView *view)
+{
+    if (view->btn != NULL)
+        chidb_Btree_freeMemNode(bt, view->btn);
+
+    view->btn = NULL;
+    view->data = NULL;
+    view->size = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Insert an entry into a table B-Tree
+ *
+ * This is a convenience function that wraps around chidb_Btree_insert.
+ * It takes a key and data, and creates a BTreeCell that can be passed
+ * along to chidb_Btree_insert.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this entry in.
+ * - key: Entry key
+ * - data: Pointer to data we want to insert
+ * - size: Number of bytes of data. Splitting a leaf can leave a cell
+ *         with just one other cell, so two cells of this size have to fit
+ *         in a leaf node in page 1 (after the file header): this can be
+ *         up to (page size - 108) / 2 - 10 bytes.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ENOMEM: Could not allocate memory, or the data does not fit in a page
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size)
+{
+    /* Your code goes here */
+    if(size > (bt->pager->page_size - FILE_HEADER_SIZE - LEAFPG_CELLSOFFSET_OFFSET) / 2
+              - TABLELEAFCELL_SIZE_WITHOUTDATA - 2)
+    {
+        return CHIDB_ENOMEM;
+    }
+    BTreeCell cell;
+    cell.type = PGTYPE_TABLE_LEAF;
+    cell.key = key;
+    cell.fields.tableLeaf.data_size = size;
+    cell.fields.tableLeaf.data = data;
+
+    int val = chidb_Btree_insert(bt, nroot, &cell);
+    return val;
+    //return CHIDB_OK;
+}
+
+
+/* Insert an entry into an index B-Tree
+ *
+ * This is a convenience function that wraps around chidb_Btree_insert.
+ * It takes a KeyIdx and a KeyPk, and creates a BTreeCell that can be passed
+ * along to chidb_Btree_insert.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this entry in.
+ * - keyIdx: See The chidb File Format.
  * - keyPk: See The chidb File Format.
  *
  * Return
@@ -907,43 +1288,41 @@ int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chid
     return CHIDB_OK;
 }
 
-static bool chidb_Btree_isNodeFull(BTreeNode *node, BTreeCell *btc)
+/* Number of bytes a cell takes up in a node of the given type (not
+ * counting its entry in the cell offset array) */
+static uint32_t chidb_Btree_cellSize(uint8_t type, BTreeCell *btc)
 {
-    bool isFull;
-
-    assert(node -> cells_offset > node -> free_offset);
-    size_t free_space = (node -> cells_offset) - (node -> free_offset);
-    switch(node -> type)
+    switch(type)
     {
         case PGTYPE_TABLE_LEAF:
-            isFull = (btc -> fields.tableLeaf.data_size + 8 + 2)  > free_space;
-            break;
+            return TABLELEAFCELL_SIZE_WITHOUTDATA + btc->fields.tableLeaf.data_size;
         case PGTYPE_TABLE_INTERNAL:
-            isFull = (8 + 2)  > free_space;
-            break;
+            return TABLEINTCELL_SIZE;
         case PGTYPE_INDEX_LEAF:
-            isFull = (12 + 2)  > free_space;
-            break;
-        case PGTYPE_INDEX_INTERNAL:
-            isFull = (16 + 2)  > free_space;
-            break;
+            return INDEXLEAFCELL_SIZE;
         default:
-            return false;
-            break;
+            return INDEXINTCELL_SIZE;
     }
-    return isFull;
+}
+
+static bool chidb_Btree_isNodeFull(BTreeNode *node, BTreeCell *btc)
+{
+    assert(node -> cells_offset >= node -> free_offset);
+    size_t free_space = (node -> cells_offset) - (node -> free_offset);
+
+    return chidb_Btree_cellSize(node->type, btc) + 2 > free_space;
 }
 
 
 /* Insert a BTreeCell into a B-Tree
  *
- * The chidb_Btree_insert and chidb_Btree_insertNonFull functions
- * are responsible for inserting new entries into a B-Tree, although
- * chidb_Btree_insertNonFull is the one that actually does the
- * insertion. chidb_Btree_insert, however, first checks if the root
- * has to be split (a splitting operation that is different from
- * splitting any other node). If so, chidb_Btree_split is called
- * before calling chidb_Btree_insertNonFull.
+ * Finds the leaf the cell belongs in with chidb_Btree_descend, and
+ * inserts it there. If the leaf is full, it is split, and so is every
+ * full node above it (see chidb_Btree_insertInPath). The nodes on the
+ * path stay loaded the whole time, so no page is read more than once.
+ * If the root itself has to be split (a splitting operation that is
+ * different from splitting any other node), its contents are moved to
+ * a new node first, so the root stays in the same page.
  *
  * Parameters
  * - bt: B-Tree file
@@ -960,128 +1339,41 @@ static bool chidb_Btree_isNodeFull(BTreeNode *node, BTreeCell *btc)
 int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
 {
     /* Your code goes here */
-/*
- *     InitNewNode: takes a page num--reads in what is currently stored ON DISK, and then writes back the new
- *     page that it inits:
- *      
- */
-
     if(bt == NULL || btc == NULL)
     {
         return CHIDB_EMISUSE;
     }
 
-    BTreeNode *root_p;
-    int rd_msg = chidb_Btree_getNodeByPage(bt, nroot, &root_p);
-    if(rd_msg !=CHIDB_OK)
+    BTreePath path;
+    int rc = chidb_Btree_descend(bt, nroot, btc->key, &path);
+    if(rc != CHIDB_OK)
     {
-        return rd_msg;
+        return rc;
     }
 
-    if(chidb_Btree_isNodeFull(root_p, btc))
-    {
-        //This node is going to become the root
-        uint8_t new_node_type = (root_p->type == PGTYPE_TABLE_INTERNAL || 
-                                root_p->type == PGTYPE_TABLE_LEAF)? 
-                                PGTYPE_TABLE_INTERNAL:PGTYPE_INDEX_INTERNAL;
-        npage_t new_node_npage;
-        int alloc_msg = chidb_Btree_newNode(bt, &new_node_npage, new_node_type);
-        BTreeNode *new_node_p;
-        int rd_msg = chidb_Btree_getNodeByPage(bt, new_node_npage, &new_node_p);
-        if(rd_msg !=CHIDB_OK)
-        {
-            return rd_msg;
-        }
-        if(isHeaderPage(nroot))
-        {   
-            root_p -> page -> npage = new_node_npage;
-            new_node_p -> page -> npage = nroot;
-            
-            //Switch the new node and root node pages. Init both of these pages
-            //  and then read the values of the full_root (which has been cleared
-            //  on disk but remains in memory) into the now empty child
-            chidb_Btree_writeNode(bt, root_p);
-            chidb_Btree_writeNode(bt, new_node_p);
-            chidb_Btree_freeMemNode(bt, new_node_p);
-            chidb_Btree_initEmptyNode(bt, nroot, new_node_type);
-            chidb_Btree_initEmptyNode(bt, root_p -> page -> npage, root_p->type);
-
-            BTreeNode *new_child_p;
-            chidb_Btree_getNodeByPage(bt, new_node_npage, &new_child_p);
-            for(ncell_t i = 0; i<root_p->n_cells; i++)
-            {
-                BTreeCell cell;
-                chidb_Btree_getCell(root_p, i, &cell);
-                chidb_Btree_insertCell(new_child_p, i, &cell);
-            }
-            
-            new_child_p -> right_page = root_p -> right_page; 
-
-            chidb_Btree_writeNode(bt, new_child_p);
-            chidb_Btree_freeMemNode(bt, root_p);
-            chidb_Btree_freeMemNode(bt, new_child_p);
-        }
-        else
-        {
-            root_p -> page -> npage = new_node_npage;
-            new_node_p -> page -> npage = nroot;
-            chidb_Btree_writeNode(bt, root_p);
-            chidb_Btree_writeNode(bt, new_node_p);
-            chidb_Btree_freeMemNode(bt, new_node_p);
-            chidb_Btree_freeMemNode(bt, root_p);
-        }
-        //Note that because the page nums have been flipped, nroot is now the empty parent node,
-        // and new_node_npage is the node that is full with data
-        npage_t new_child_page;
-        int split_msg = chidb_Btree_split(bt, nroot, new_node_npage, 0, &new_child_page);
-        if(split_msg != CHIDB_OK)
-        {
-            return split_msg;
-        }
-
-        //Get the parent page(the root) and make sure that the right page points to the
-        // old full node
-        BTreeNode *new_root_p;
-        rd_msg = chidb_Btree_getNodeByPage(bt, nroot, &new_root_p);
-        if(rd_msg !=CHIDB_OK)
-        {
-            return rd_msg;
-        }
-        new_root_p -> right_page = new_node_npage;
-        chidb_Btree_writeNode(bt, new_root_p);
-        chidb_Btree_freeMemNode(bt, new_root_p);
-        return chidb_Btree_insertNonFull(bt, nroot, btc);
-    }
-
-    else
-    {
-        chidb_Btree_freeMemNode(bt, root_p);
-        return chidb_Btree_insertNonFull(bt, nroot, btc);
-    }
-    return CHIDB_OK;
+    rc = path.found? CHIDB_EDUPLICATE : chidb_Btree_insertInPath(bt, &path, btc, true);
+    chidb_Btree_releasePath(bt, &path);
+    return rc;
 }
 
 
 /* Insert a BTreeCell into a non-full B-Tree node
  *
- * chidb_Btree_insertNonFull inserts a BTreeCell into a node that is
- * assumed not to be full (i.e., does not require splitting). If the
- * node is a leaf node, the cell is directly added in the appropriate
- * position according to its key. If the node is an internal node, the
- * function will determine what child node it must insert it in, and
- * calls itself recursively on that child node. However, before doing so
- * it will check if the child node is full or not. If it is, then it will
- * have to be split first.
+ * Same as chidb_Btree_insert, but for a node that is assumed not to be
+ * full (i.e., it has room for one more cell), so the splits caused by
+ * the insertion can stop at it. Unlike chidb_Btree_insert, this never
+ * moves the contents of the node to a new page.
  *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this cell in.
+ * - npage: Page number of the node to insert this cell in (or in one
+ *          of its descendants).
  * - btc: BTreeCell to insert into B-Tree
  *
  * Return
  * - CHIDB_OK: Operation successful
  * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_EMISUSE: The node is full
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
@@ -1089,127 +1381,16 @@ int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
 int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc)
 {
     /* Your code goes here */
-    BTreeNode *node_p;
-    int rd_msg = chidb_Btree_getNodeByPage(bt, npage, &node_p);
-    if(rd_msg != CHIDB_OK)
-    {
-        return rd_msg;
-    }
-    
-    int node_type = node_p -> type;
-    if(isLeaf(node_type))
+    BTreePath path;
+    int rc = chidb_Btree_descend(bt, npage, btc->key, &path);
+    if(rc != CHIDB_OK)
     {
-        ncell_t insert_point = 0;
-        //If node has any cells--otherwise, the insert_point stays at 0
-        if(!(nodeIsEmpty(node_p)))
-        {
-            BTreeCell cell;
-            int cell_msg = chidb_Btree_getCell(node_p,(node_p -> n_cells - 1),&cell);
-            if(cell_msg != CHIDB_OK)
-            {
-                return cell_msg;
-            }
-            
-            if(btc->key > cell.key)
-            {
-                insert_point = node_p -> n_cells;
-            }
-            else
-            {
-                for(int i = 0; i < node_p -> n_cells; i++)
-                {
-                    BTreeCell icell;
-                    cell_msg = chidb_Btree_getCell(node_p, i ,&icell);
-                    if(cell_msg != CHIDB_OK)
-                    {
-                        return cell_msg;
-                    }
-                    if(btc->key == icell.key)
-                    {
-                        chidb_Btree_freeMemNode(bt, node_p);
-                        return CHIDB_EDUPLICATE;
-                    }
-                    else if(btc->key < icell.key)
-                    {
-                        insert_point = i;
-                        break;
-                    }
-                }
-            }
-        }
-        chidb_Btree_insertCell(node_p, insert_point, btc);
-        chidb_Btree_writeNode(bt, node_p);
-        chidb_Btree_freeMemNode(bt, node_p);
-        return CHIDB_OK;
-    }
-    else if(isInternal(node_type))
-    {
-        npage_t child_page = 0;
-        ncell_t insert_point = 0;
-        
-        //Check to see if its greater than the last cell
-        BTreeCell cell; 
-        int cell_msg = chidb_Btree_getCell(node_p,(node_p -> n_cells - 1),&cell);
-        if(cell_msg != CHIDB_OK)
-        {
-            return cell_msg;
-        }
-        if(btc->key > cell.key)
-        {
-            insert_point = node_p -> n_cells;
-            child_page = node_p -> right_page;
-        }
-        else
-        {
-            for(int i = 0; i < node_p -> n_cells; i++)
-            {
-                BTreeCell icell;
-                cell_msg = chidb_Btree_getCell(node_p, i ,&icell);
-                if(cell_msg != CHIDB_OK)
-                {
-                    return cell_msg;
-                }
-                if(btc->key == icell.key)
-                {
-                    chidb_Btree_freeMemNode(bt, node_p);
-                    return CHIDB_EDUPLICATE;
-                }
-                else if(btc->key < icell.key)
-                {
-                    child_page = (node_type == PGTYPE_TABLE_INTERNAL)?
-                            icell.fields.tableInternal.child_page:
-                            icell.fields.indexInternal.child_page;
-                    insert_point = i;
-                    break;
-                }
-            }
-        }
-        chidb_Btree_freeMemNode(bt, node_p);
-        //Read in child, check if split, split it, free it, insert into it
-        BTreeNode *child_node_p;
-        int rd_msg = chidb_Btree_getNodeByPage(bt, child_page, &child_node_p);
-        if(rd_msg != CHIDB_OK)
-        {
-            chidb_Btree_freeMemNode(bt, child_node_p);
-            return rd_msg;
-        }
-        
-        if(chidb_Btree_isNodeFull(child_node_p, btc))
-        {
-            npage_t child2;
-            chidb_Btree_split(bt,npage, child_page, insert_point, &child2);
-            chidb_Btree_freeMemNode(bt, child_node_p);
-            return chidb_Btree_insertNonFull(bt, npage, btc);
-        }
-        else
-        {
-            chidb_Btree_freeMemNode(bt, child_node_p);
-            return chidb_Btree_insertNonFull(bt, child_page, btc);
-        }
-        
+        return rc;
     }
-    //Control should never reach this point
-    return CHIDB_EIO;
+
+    rc = path.found? CHIDB_EDUPLICATE : chidb_Btree_insertInPath(bt, &path, btc, false);
+    chidb_Btree_releasePath(bt, &path);
+    return rc;
 }
 
 /*
@@ -1251,10 +1432,10 @@ static int chidb_Btree_removeBlockFromNode(BTreeNode *btn, ncell_t ncell)
     btn -> cells_offset = cell_block_p - node_start_p;
 
 
-    uint16_t rem_cell_offset = rem_cell_p - node_start_p;
+    uint32_t rem_cell_offset = rem_cell_p - node_start_p;
     for(int i = ncell+1; i < btn->n_cells; i++)
     {
-        uint16_t icell_offset = get2byte(btn->celloffset_array + (2 * i));
+        uint32_t icell_offset = get2byte(btn->celloffset_array + (2 * i));
         if(icell_offset < rem_cell_offset)
         {
             uint8_t *icell_offset_p = btn->celloffset_array + (2 * i);
@@ -1265,63 +1446,39 @@ static int chidb_Btree_removeBlockFromNode(BTreeNode *btn, ncell_t ncell)
 
 }
 
-/* Split a B-Tree node
+/* Split a loaded B-Tree node
  *
- * Splits a B-Tree node N. This involves the following:
- * - Find the median cell in N.
- * - Create a new B-Tree node M.
- * - Move the cells before the median cell to M (if the
- *   cell is a table leaf cell, the median cell is moved too)
- * - Add a cell to the parent (which, by definition, will be an
- *   internal page) with the median key and the page number of M.
+ * Does the work of chidb_Btree_split on nodes that are already loaded,
+ * and writes all three of them (see chidb_Btree_writeNode), but does
+ * not release any of them.
  *
  * Parameters
  * - bt: B-Tree file
- * - npage_parent: Page number of the parent node
- * - npage_child: Page number of the node to split
+ * - parent_p: Parent node (must not be full)
  * - parent_ncell: Position in the parent where the new cell will
- *                 be inserted.
- * - npage_child2: Out parameter. Used to return the page of the new child node.
+ *                 be inserted (the child's position in the parent).
+ * - child_p: Node to split. It keeps the cells after the median cell.
+ * - new_child: Out parameter. Used to return the new node, which holds
+ *              the cells before the median cell.
+ * - middle: Out parameter. Used to return the position of the median
+ *           cell in the child before the split.
  *
  * Return
  * - CHIDB_OK: Operation successful
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-
-int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell, npage_t *npage_child2)
+static int chidb_Btree_splitNode(BTree *bt, BTreeNode *parent_p, ncell_t parent_ncell, BTreeNode *child_p,
+                                 BTreeNode **new_child, ncell_t *middle)
 {
-    BTreeNode *parent_p, *child_p, *new_child_p;
-    int rd_msg = chidb_Btree_getNodeByPage(bt, npage_parent, &parent_p);
-    if(rd_msg != CHIDB_OK)
-    {
-        return rd_msg;
-    }
-    rd_msg = chidb_Btree_getNodeByPage(bt, npage_child, &child_p);
-    if(rd_msg != CHIDB_OK)
-    {
-        return rd_msg;
-    }
-    npage_t npage_new_child;
-    int alloc_msg = chidb_Btree_newNode(bt, &npage_new_child, child_p -> type);
+    BTreeNode *new_child_p;
+    int alloc_msg = chidb_Btree_newMemNode(bt, child_p -> type, &new_child_p);
     if(alloc_msg != CHIDB_OK)
     {
         return alloc_msg;
     }
-    *npage_child2 = npage_new_child;
-    rd_msg = chidb_Btree_getNodeByPage(bt, npage_new_child, &new_child_p);
-    if(rd_msg != CHIDB_OK)
-    {
-        return rd_msg;
-    }
-
-    //Insert nonfull ---if the full node is the right page, make sure to call the splitFunc with
-    //the parent ncell being 1 past the current index of the last offset cell. In other words, make sure 
-    //the value of that argument is the node_ncells. Make sure that this is done manually for the root
-    //node in the insert function
+    npage_t npage_new_child = new_child_p -> page -> npage;
 
-//Assumes that the parent node is not full. Begins packing the new cell with the first half of child node
-    
     /*
      *  Get the middle cell (or one past the middle cell in the case of an even node size)
      *  Then take the information from that cell and put it in a new cell (new_parent_cell),
@@ -1333,6 +1490,7 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
     int gcell = chidb_Btree_getCell(child_p, index_middle, &middle_cell);
     if(gcell != CHIDB_OK)
     {
+        chidb_Btree_freeMemNode(bt, new_child_p);
         return gcell;
     }
     BTreeCell new_parent_cell;
@@ -1347,8 +1505,6 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
         new_parent_cell.fields.indexInternal.keyPk = 
                 middle_cell.fields.indexInternal.keyPk;
         new_parent_cell.fields.indexInternal.child_page = npage_new_child;
-        //chidb_Btree_removeBlockFromNode(child_p, mid_index);
-        //remove the cell block here?
     }
 
     /*
@@ -1359,6 +1515,7 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
     int incell_msg = chidb_Btree_insertCell(parent_p, parent_ncell, &new_parent_cell);
     if(incell_msg != CHIDB_OK)
     {
+        chidb_Btree_freeMemNode(bt, new_child_p);
         return incell_msg;
     }
 
@@ -1366,7 +1523,6 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
     for(int i = 0; i<index_middle; i++)
     {
         BTreeCell cell;
-        //printf("INSERTING THIS CELL: %d\n",cell.key);
         chidb_Btree_getCell(child_p, i, &cell);
         chidb_Btree_insertCell(new_child_p, i, &cell);
         chidb_Btree_removeBlockFromNode(child_p, i);
@@ -1376,7 +1532,6 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
         BTreeCell cell;
         chidb_Btree_getCell(child_p, index_middle, &cell);
         chidb_Btree_insertCell(new_child_p, index_middle, &cell);
-        // chidb_Btree_removeBlockFromNode(child_p, index_middle);
     }
     else if(isInternal(new_child_p -> type))
     {
@@ -1396,14 +1551,545 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
     child_p -> free_offset = child_p -> free_offset - nbytes_removed;
 
     chidb_Btree_writeNode(bt, parent_p);
-    chidb_Btree_freeMemNode(bt, parent_p);
     chidb_Btree_writeNode(bt, child_p);
-    chidb_Btree_freeMemNode(bt, child_p);
     chidb_Btree_writeNode(bt, new_child_p);
-    chidb_Btree_freeMemNode(bt, new_child_p);
+
+    *new_child = new_child_p;
+    *middle = index_middle;
     return CHIDB_OK;
 }
 
+
+/* Split a B-Tree node
+ *
+ * Splits a B-Tree node N. This involves the following:
+ * - Find the median cell in N.
+ * - Create a new B-Tree node M.
+ * - Move the cells before the median cell to M (if the
+ *   cell is a table leaf cell, the median cell is moved too)
+ * - Add a cell to the parent (which, by definition, will be an
+ *   internal page) with the median key and the page number of M.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage_parent: Page number of the parent node
+ * - npage_child: Page number of the node to split
+ * - parent_ncell: Position in the parent where the new cell will
+ *                 be inserted.
+ * - npage_child2: Out parameter. Used to return the page of the new child node.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+
+int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell, npage_t *npage_child2)
+{
+    BTreeNode *parent_p, *child_p, *new_child_p;
+    int rd_msg = chidb_Btree_getNodeByPage(bt, npage_parent, &parent_p);
+    if(rd_msg != CHIDB_OK)
+    {
+        return rd_msg;
+    }
+    rd_msg = chidb_Btree_getNodeByPage(bt, npage_child, &child_p);
+    if(rd_msg != CHIDB_OK)
+    {
+        chidb_Btree_freeMemNode(bt, parent_p);
+        return rd_msg;
+    }
+
+    ncell_t index_middle;
+    int split_msg = chidb_Btree_splitNode(bt, parent_p, parent_ncell, child_p, &new_child_p, &index_middle);
+    if(split_msg == CHIDB_OK)
+    {
+        *npage_child2 = new_child_p -> page -> npage;
+        chidb_Btree_freeMemNode(bt, new_child_p);
+    }
+    chidb_Btree_freeMemNode(bt, parent_p);
+    chidb_Btree_freeMemNode(bt, child_p);
+    return split_msg;
+}
+
+
+/* Move the contents of the root to a new node
+ *
+ * The root of a B-Tree never moves, so before it can be split, its
+ * contents are moved to a new node, which becomes the only child (the
+ * right page) of the now empty root. The path gets one level deeper:
+ * the root is still its first level, and the new node is the second.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - path: Path starting at the root
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The path is already BTREE_MAX_DEPTH levels deep
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_Btree_growRoot(BTree *bt, BTreePath *path)
+{
+    BTreeNode *root_p = path->levels[0].btn, *new_child_p;
+    int rc;
+
+    if (path->depth == BTREE_MAX_DEPTH)
+        return CHIDB_EPAGENO;
+    if ((rc = chidb_Btree_newMemNode(bt, root_p->type, &new_child_p)) != CHIDB_OK)
+        return rc;
+
+    //Copy cell by cell, since the root might be the header page (where
+    // the node starts at a different offset)
+    for(ncell_t i = 0; i < root_p->n_cells; i++)
+    {
+        BTreeCell cell;
+        chidb_Btree_getCell(root_p, i, &cell);
+        chidb_Btree_insertCell(new_child_p, i, &cell);
+    }
+    new_child_p->right_page = root_p->right_page;
+
+    chidb_Btree_resetNode(bt, root_p, (root_p->type == PGTYPE_TABLE_INTERNAL || root_p->type == PGTYPE_TABLE_LEAF)?
+                                      PGTYPE_TABLE_INTERNAL : PGTYPE_INDEX_INTERNAL);
+    root_p->right_page = new_child_p->page->npage;
+
+    if ((rc = chidb_Btree_writeNode(bt, new_child_p)) != CHIDB_OK
+        || (rc = chidb_Btree_writeNode(bt, root_p)) != CHIDB_OK)
+    {
+        chidb_Btree_freeMemNode(bt, new_child_p);
+        return rc;
+    }
+
+    memmove(&path->levels[1], &path->levels[0], path->depth * sizeof(BTreePathEntry));
+    path->depth++;
+    path->levels[0].ncell = 0;
+    path->levels[1].npage = new_child_p->page->npage;
+    path->levels[1].btn = new_child_p;
+
+    return CHIDB_OK;
+}
+
+
+/* Split the node at a level of a path
+ *
+ * The parent of the node (the previous level) must have room for one
+ * more cell. After the split, the path goes through whichever half of
+ * the node holds the cell (or child) it went through before.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - path: Path
+ * - level: Level of the node to split (not the root)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_Btree_splitPath(BTree *bt, BTreePath *path, uint32_t level)
+{
+    BTreePathEntry *parent = &path->levels[level - 1], *child = &path->levels[level];
+    BTreeNode *new_child_p;
+    ncell_t middle;
+    int rc;
+
+    rc = chidb_Btree_splitNode(bt, parent->btn, parent->ncell, child->btn, &new_child_p, &middle);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    /* The cells (or children) up to the median one are now in the new
+     * node, which the new cell in the parent points to. The rest stay
+     * in the child, which the parent's next cell points to. */
+    if (child->ncell <= middle)
+    {
+        chidb_Btree_freeMemNode(bt, child->btn);
+        child->btn = new_child_p;
+        child->npage = new_child_p->page->npage;
+    }
+    else
+    {
+        chidb_Btree_freeMemNode(bt, new_child_p);
+        child->ncell -= middle + 1;
+        parent->ncell++;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Insert a cell in the leaf at the end of a path
+ *
+ * If the leaf is full, it has to be split, which adds a cell to its
+ * parent, which may have to be split too, and so on. The nodes are
+ * split from the highest full one down, so every node's parent has
+ * room for the cell its split adds, and the path is kept pointing at
+ * the half where the new cell goes. A half can still be too full for a
+ * large cell, in which case the leaf is split again.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - path: Path from chidb_Btree_descend (that did not find the key)
+ * - btc: BTreeCell to insert
+ * - grow_root: Whether the first node of the path may be split (see
+ *              chidb_Btree_growRoot). If not, and it is full, the
+ *              insertion fails with CHIDB_EMISUSE.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The first node of the path is full
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_Btree_insertInPath(BTree *bt, BTreePath *path, BTreeCell *btc, bool grow_root)
+{
+    BTreePathEntry *leaf;
+    uint32_t level;
+    int rc;
+
+    while (chidb_Btree_isNodeFull(path->levels[path->depth - 1].btn, btc))
+    {
+        level = path->depth - 1;
+        while (level > 0 && chidb_Btree_isNodeFull(path->levels[level - 1].btn, btc))
+            level--;
+
+        if (level == 0)
+        {
+            if (!grow_root)
+                return CHIDB_EMISUSE;
+            if ((rc = chidb_Btree_growRoot(bt, path)) != CHIDB_OK)
+                return rc;
+            level = 1;
+        }
+
+        for(; level < path->depth; level++)
+            if ((rc = chidb_Btree_splitPath(bt, path, level)) != CHIDB_OK)
+                return rc;
+    }
+
+    leaf = &path->levels[path->depth - 1];
+    chidb_Btree_insertCell(leaf->btn, leaf->ncell, btc);
+    return chidb_Btree_writeNode(bt, leaf->btn);
+}
+
+
+/* Start loading a B-Tree from sorted entries
+ *
+ * Inserting entries one by one with chidb_Btree_insert leaves most
+ * nodes half full (which is how a split leaves them), and moves the
+ * contents of the root every time it is split. When the entries are
+ * already sorted, a bulk load builds the B-Tree bottom-up instead: it
+ * fills a leaf up to a given fraction of its page, moves on to a new
+ * leaf, and adds a cell for the full leaf to the node being filled at
+ * the level above, which is filled in the same way. The whole B-Tree
+ * is built in a single pass, without splitting (or reading) any node,
+ * and every new node is added at the end of the file (see
+ * chidb_Pager_appendPage), so each level is laid out mostly in key
+ * order.
+ *
+ * The B-Tree must be empty (a leaf with no cells, as created by
+ * chidb_Btree_newNode). Its entries are then added, in increasing key
+ * order, with chidb_Btree_loadInTable or chidb_Btree_loadInIndex, and
+ * the load is completed with chidb_Btree_loadFinish. The B-Tree must
+ * not be used in any other way in the meantime.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree to load
+ * - fill_percent: How full to make each node (1-100). Every node gets
+ *                 at least as many cells as it needs to keep the
+ *                 B-Tree valid, however low this is.
+ * - loader: Out parameter. Used to return the loader.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Invalid fill_percent, or the B-Tree is not empty
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_loadInit(BTree *bt, npage_t nroot, uint8_t fill_percent, BTreeLoader *loader)
+{
+    BTreeNode *root;
+    int rc;
+
+    if (bt == NULL || loader == NULL || fill_percent == 0 || fill_percent > 100)
+        return CHIDB_EMISUSE;
+    if ((rc = chidb_Btree_getNodeByPage(bt, nroot, &root)) != CHIDB_OK)
+        return rc;
+    if (!isLeaf(root->type) || root->n_cells > 0)
+    {
+        chidb_Btree_freeMemNode(bt, root);
+        return CHIDB_EMISUSE;
+    }
+
+    loader->bt = bt;
+    loader->nroot = nroot;
+    loader->leaf_type = root->type;
+    loader->fill_bytes = (uint32_t) ((uint64_t) bt->pager->page_size * fill_percent / 100);
+    loader->nentries = 0;
+    loader->last_key = 0;
+    loader->depth = 1;
+    loader->levels[0] = root;
+
+    return CHIDB_OK;
+}
+
+
+/* Load an entry into a table B-Tree
+ *
+ * Parameters
+ * - loader: Loader returned by chidb_Btree_loadInit
+ * - key: Entry key (larger than that of the previous entry)
+ * - data: Pointer to data we want to insert
+ * - size: Number of bytes of data
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: The key is the same as the previous entry's
+ * - CHIDB_EMISUSE: The key is smaller than the previous entry's, or the
+ *                  B-Tree is an index
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_loadInTable(BTreeLoader *loader, chidb_key_t key, uint8_t *data, uint16_t size)
+{
+    BTreeCell btc;
+
+    if (loader->leaf_type != PGTYPE_TABLE_LEAF)
+        return CHIDB_EMISUSE;
+
+    btc.type = PGTYPE_TABLE_LEAF;
+    btc.key = key;
+    btc.fields.tableLeaf.data_size = size;
+    btc.fields.tableLeaf.data = data;
+
+    return chidb_Btree_loadEntry(loader, &btc);
+}
+
+
+/* Load an entry into an index B-Tree
+ *
+ * Parameters
+ * - loader: Loader returned by chidb_Btree_loadInit
+ * - keyIdx: See The chidb File Format (larger than that of the
+ *           previous entry)
+ * - keyPk: See The chidb File Format.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: The key is the same as the previous entry's
+ * - CHIDB_EMISUSE: The key is smaller than the previous entry's, or the
+ *                  B-Tree is a table
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_loadInIndex(BTreeLoader *loader, chidb_key_t keyIdx, chidb_key_t keyPk)
+{
+    BTreeCell btc;
+
+    if (loader->leaf_type != PGTYPE_INDEX_LEAF)
+        return CHIDB_EMISUSE;
+
+    btc.type = PGTYPE_INDEX_LEAF;
+    btc.key = keyIdx;
+    btc.fields.indexLeaf.keyPk = keyPk;
+
+    return chidb_Btree_loadEntry(loader, &btc);
+}
+
+
+/* Complete a bulk load
+ *
+ * The last node of each level becomes the right page of the last node
+ * of the level above, and they are all written and released. This must
+ * be called even if loading an entry failed, in which case the B-Tree
+ * is left in an undefined state.
+ *
+ * Parameters
+ * - loader: Loader returned by chidb_Btree_loadInit
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_loadFinish(BTreeLoader *loader)
+{
+    int rc = CHIDB_OK;
+
+    for(uint32_t level = 0; level < loader->depth; level++)
+    {
+        BTreeNode *btn = loader->levels[level];
+
+        if (level + 1 < loader->depth)
+            loader->levels[level + 1]->right_page = btn->page->npage;
+        if (rc == CHIDB_OK)
+            rc = chidb_Btree_writeNode(loader->bt, btn);
+        chidb_Btree_freeMemNode(loader->bt, btn);
+    }
+    loader->depth = 0;
+
+    return rc;
+}
+
+
+/* Create a node at the end of the file for a bulk load (see
+ * chidb_Btree_newMemNode) */
+static int chidb_Btree_loadNewNode(BTree *bt, uint8_t type, BTreeNode **btn)
+{
+    npage_t npage;
+    int rc;
+
+    if ((rc = chidb_Pager_appendPage(bt->pager, &npage)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_Btree_getNodeByPage(bt, npage, btn)) != CHIDB_OK)
+        return rc;
+
+    chidb_Btree_resetNode(bt, *btn, type);
+    return CHIDB_OK;
+}
+
+
+/* Move on from the node being filled at a level of a bulk load
+ *
+ * The node gets a cell for itself added to the node being filled at
+ * the level above, with the node's largest key. A table leaf keeps the
+ * entry with that key, but any other node gives up its last cell for
+ * it (in an internal node, the child of that cell becomes its right
+ * page). The node is then written, and replaced by a new, empty node.
+ *
+ * The root never moves, so it is only filled until it is full for the
+ * first time. Its contents are then moved to a new node (as in
+ * chidb_Btree_growRoot), and it becomes the node being filled at a new
+ * level above.
+ *
+ * Parameters
+ * - loader: Loader
+ * - level: Level of the node (0 for the leaves)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The B-Tree would be more than BTREE_MAX_DEPTH levels deep
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_Btree_loadNextNode(BTreeLoader *loader, uint32_t level)
+{
+    BTree *bt = loader->bt;
+    BTreeNode *btn = loader->levels[level], *new_p;
+    BTreeCell cell, parent_cell;
+    int rc;
+
+    if (btn->page->npage == loader->nroot)
+    {
+        if (loader->depth == BTREE_MAX_DEPTH)
+            return CHIDB_EPAGENO;
+        if ((rc = chidb_Btree_loadNewNode(bt, btn->type, &new_p)) != CHIDB_OK)
+            return rc;
+
+        //Copy cell by cell, since the root might be the header page
+        for(ncell_t i = 0; i < btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &cell);
+            chidb_Btree_insertCell(new_p, i, &cell);
+        }
+        chidb_Btree_resetNode(bt, btn, (loader->leaf_type == PGTYPE_TABLE_LEAF)?
+                                       PGTYPE_TABLE_INTERNAL : PGTYPE_INDEX_INTERNAL);
+
+        loader->levels[level] = new_p;
+        loader->levels[level + 1] = btn;
+        loader->depth++;
+        btn = new_p;
+    }
+
+    chidb_Btree_getCell(btn, btn->n_cells - 1, &cell);
+    switch (btn->type)
+    {
+        case PGTYPE_TABLE_LEAF:
+            parent_cell.type = PGTYPE_TABLE_INTERNAL;
+            parent_cell.key = cell.key;
+            break;
+        case PGTYPE_TABLE_INTERNAL:
+            parent_cell = cell;
+            btn->right_page = cell.fields.tableInternal.child_page;
+            break;
+        case PGTYPE_INDEX_LEAF:
+            parent_cell.type = PGTYPE_INDEX_INTERNAL;
+            parent_cell.key = cell.key;
+            parent_cell.fields.indexInternal.keyPk = cell.fields.indexLeaf.keyPk;
+            break;
+        default:
+            parent_cell = cell;
+            btn->right_page = cell.fields.indexInternal.child_page;
+            break;
+    }
+    if (parent_cell.type == PGTYPE_TABLE_INTERNAL)
+        parent_cell.fields.tableInternal.child_page = btn->page->npage;
+    else
+        parent_cell.fields.indexInternal.child_page = btn->page->npage;
+
+    //The last cell is the one at the start of the cell area
+    if (btn->type != PGTYPE_TABLE_LEAF)
+    {
+        btn->n_cells--;
+        btn->free_offset -= 2;
+        btn->cells_offset += chidb_Btree_cellSize(btn->type, &cell);
+    }
+
+    if ((rc = chidb_Btree_writeNode(bt, btn)) != CHIDB_OK
+        || (rc = chidb_Btree_loadNewNode(bt, btn->type, &new_p)) != CHIDB_OK)
+        return rc;
+    chidb_Btree_freeMemNode(bt, btn);
+    loader->levels[level] = new_p;
+
+    return chidb_Btree_loadCell(loader, level + 1, &parent_cell);
+}
+
+
+/* Add a cell to the node being filled at a level of a bulk load,
+ * moving on to a new node first if it is as full as it should get */
+static int chidb_Btree_loadCell(BTreeLoader *loader, uint32_t level, BTreeCell *btc)
+{
+    BTreeNode *btn = loader->levels[level];
+    uint32_t used = loader->bt->pager->page_size - (btn->cells_offset - btn->free_offset);
+    ncell_t min_cells = (btn->type == PGTYPE_TABLE_LEAF)? 1 : 2;
+    int rc;
+
+    if (chidb_Btree_isNodeFull(btn, btc)
+        || used + chidb_Btree_cellSize(btn->type, btc) + 2 > loader->fill_bytes)
+    {
+        /* Every node but a table leaf gives up a cell when it is left
+         * behind, so it needs at least two */
+        if (btn->n_cells >= min_cells)
+        {
+            if ((rc = chidb_Btree_loadNextNode(loader, level)) != CHIDB_OK)
+                return rc;
+            btn = loader->levels[level];
+        }
+        else if (chidb_Btree_isNodeFull(btn, btc))
+            return CHIDB_EMISUSE;
+    }
+
+    chidb_Btree_insertCell(btn, btn->n_cells, btc);
+    return CHIDB_OK;
+}
+
+
+/* Load an entry into the leaves of a bulk load */
+static int chidb_Btree_loadEntry(BTreeLoader *loader, BTreeCell *btc)
+{
+    int rc;
+
+    if (loader->nentries > 0 && btc->key <= loader->last_key)
+        return (btc->key == loader->last_key)? CHIDB_EDUPLICATE : CHIDB_EMISUSE;
+
+    if ((rc = chidb_Btree_loadCell(loader, 0, btc)) != CHIDB_OK)
+        return rc;
+
+    loader->nentries++;
+    loader->last_key = btc->key;
+    return CHIDB_OK;
+}
+
+
 void chidb_Btree_printNode(BTreeNode *btn, FILE *log)
 {
 //      MemPage *page;             /* In-memory page returned by the Pager */
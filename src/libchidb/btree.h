@@ -83,17 +83,29 @@
 #define INDEXINTCELL_SIZE (16)
 #define INDEXLEAFCELL_SIZE (12)
 
+/* Number of BTreeNodes allocated at once (see chidb_Btree_allocNode) */
+#define BTREE_NODE_SLAB (64)
+
+/* Deepest path chidb_Btree_descend can record. Even with 1 KiB pages,
+ * internal nodes have dozens of children, so a valid B-Tree is never
+ * more than about ten levels deep. */
+#define BTREE_MAX_DEPTH (20)
+
 // Advance declarations
 typedef struct BTreeCell BTreeCell;
 typedef struct BTreeNode BTreeNode;
+typedef struct BTreeNodeSlab BTreeNodeSlab;
 
 /* The BTree struct represent a "B-Tree file". It contains a pointer to the
  * chidb database it is a part of, and a pointer to a Pager, which it will
- * use to access pages on the file */
+ * use to access pages on the file. It also keeps the BTreeNodes that are
+ * not in use, so loading a node does not have to allocate memory. */
 typedef struct BTree
 {
     chidb *db;
     Pager *pager;
+    BTreeNode *free_nodes;     /* BTreeNodes not in use */
+    BTreeNodeSlab *node_slabs; /* Memory for all the BTreeNodes */
 } Btree;
 
 /* The BTreeNode struct is an in-memory representation of a B-Tree node. Thus,
@@ -112,11 +124,19 @@ struct BTreeNode
 {
     MemPage *page;             /* In-memory page returned by the Pager */
     uint8_t type;              /* Type of page  */
-    uint16_t free_offset;      /* Byte offset of free space in page */
+    uint32_t free_offset;      /* Byte offset of free space in page */
     ncell_t n_cells;           /* Number of cells */
-    uint16_t cells_offset;     /* Byte offset of start of cells in page */
+    uint32_t cells_offset;     /* Byte offset of start of cells in page (up to 65536) */
     npage_t right_page;        /* Right page (internal nodes only) */
     uint8_t *celloffset_array; /* Pointer to start of cell offset array in the in-memory page */
+    BTreeNode *next_free;      /* Next node in the BTree's free_nodes list */
+};
+
+/* BTreeNodes are allocated BTREE_NODE_SLAB at a time */
+struct BTreeNodeSlab
+{
+    BTreeNodeSlab *next;
+    BTreeNode nodes[BTREE_NODE_SLAB];
 };
 
 /* BTreeCell is an in-memory representation of a cell. See The chidb File Format
@@ -148,12 +168,62 @@ struct BTreeCell
     } fields;
 };
 
+/* BTreePath is a path from the root of a B-Tree down to a leaf (or to
+ * the internal index node holding a key), as recorded by
+ * chidb_Btree_descend. Each level holds its node, which stays loaded
+ * until the path is released with chidb_Btree_releasePath, so the
+ * operation that walks down the tree can work its way back up without
+ * reading any page again. In an internal node, ncell is the child the
+ * path goes into (n_cells meaning the right page). In the last node, it
+ * is the first cell with a key >= the one searched for. */
+typedef struct BTreePathEntry
+{
+    npage_t npage;             /* Page number of the node */
+    ncell_t ncell;             /* Cell (or child) the path goes through */
+    BTreeNode *btn;            /* The node */
+} BTreePathEntry;
+
+typedef struct BTreePath
+{
+    uint32_t depth;            /* Number of levels in the path */
+    bool found;                /* True if the last level's cell has the key */
+    BTreePathEntry levels[BTREE_MAX_DEPTH];
+} BTreePath;
+
+/* BTreeView is an entry found with chidb_Btree_findView. Its data
+ * points into the page of the node holding it, which stays loaded (so
+ * the data stays valid) until the view is released with
+ * chidb_Btree_releaseView. */
+typedef struct BTreeView
+{
+    BTreeNode *btn;            /* Node holding the entry */
+    uint8_t *data;             /* The entry's data, in the node's page */
+    uint16_t size;             /* Number of bytes of data */
+} BTreeView;
+
+/* BTreeLoader builds a B-Tree bottom-up from entries given in increasing
+ * key order (see chidb_Btree_loadInit). It keeps the node being filled
+ * at every level loaded, from the leaves up to the root. */
+typedef struct BTreeLoader
+{
+    BTree *bt;
+    npage_t nroot;             /* Root of the B-Tree being loaded */
+    uint8_t leaf_type;         /* PGTYPE_TABLE_LEAF or PGTYPE_INDEX_LEAF */
+    uint32_t fill_bytes;       /* Bytes of a page to fill before moving on to the next one */
+    uint32_t nentries;         /* Number of entries loaded so far */
+    chidb_key_t last_key;      /* Key of the last entry loaded */
+    uint32_t depth;            /* Number of levels (the root is the last one) */
+    BTreeNode *levels[BTREE_MAX_DEPTH]; /* Node being filled at each level (leaves first) */
+} BTreeLoader;
+
 
 int chidb_Btree_open(const char *filename, chidb *db, BTree **bt);
 int chidb_Btree_close(BTree *bt);
 
 int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **node);
+int chidb_Btree_getNodeByPageHint(BTree *bt, npage_t npage, pager_hint_t hint, BTreeNode **node);
 int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn);
+int chidb_Btree_prefetchChildren(BTree *bt, BTreeNode *btn, ncell_t ncell, pager_hint_t hint);
 
 int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type);
 int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type);
@@ -161,8 +231,16 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *node);
 
 int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
 int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
+chidb_key_t chidb_Btree_getCellKey(BTreeNode *btn, ncell_t ncell);
+ncell_t chidb_Btree_searchNode(BTreeNode *btn, chidb_key_t key, bool *found);
+
+int chidb_Btree_pushPath(BTree *bt, BTreePath *path, npage_t npage, pager_hint_t hint);
+int chidb_Btree_descend(BTree *bt, npage_t nroot, chidb_key_t key, BTreePath *path);
+int chidb_Btree_releasePath(BTree *bt, BTreePath *path);
 
 int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size);
+int chidb_Btree_findView(BTree *bt, npage_t nroot, chidb_key_t key, BTreeView *view);
+int chidb_Btree_releaseView(BTree *bt, BTreeView *view);
 
 int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size);
 int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk);
@@ -170,5 +248,10 @@ int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc);
 int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc);
 int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_cell, npage_t *npage_child2);
 
+int chidb_Btree_loadInit(BTree *bt, npage_t nroot, uint8_t fill_percent, BTreeLoader *loader);
+int chidb_Btree_loadInTable(BTreeLoader *loader, chidb_key_t key, uint8_t *data, uint16_t size);
+int chidb_Btree_loadInIndex(BTreeLoader *loader, chidb_key_t keyIdx, chidb_key_t keyPk);
+int chidb_Btree_loadFinish(BTreeLoader *loader);
+
 
 #endif /*BTREE_H_*/
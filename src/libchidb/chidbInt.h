@@ -60,10 +60,50 @@
 #define CHIDB_EDUPLICATE (8)
 #define CHIDB_EEMPTY (9)
 #define CHIDB_EPARSE (10)
+#define CHIDB_ENOFILE (11)
 
 
 #define DEFAULT_PAGE_SIZE (1024)
 
+/* Range of page sizes (powers of two) a file can be created with, using
+ * the "page_size" open option. The page size takes two bytes in the file
+ * header, so 65536 is stored as 1 (as in SQLite). Likewise, in a node of
+ * that size, a cells offset of 65536 (an empty node) is stored as 0. */
+#define MIN_PAGE_SIZE (1024)
+#define MAX_PAGE_SIZE (65536)
+
+/* Number of frames in the Pager's buffer pool, unless overridden
+ * when opening the file. This is also the value stored in the
+ * page_cache_size field of the file header. */
+#define DEFAULT_CACHE_SIZE (20000)
+
+/* Minimum number of bytes the Pager grows the file by, unless
+ * overridden when opening the file */
+#define DEFAULT_EXTENT_SIZE (1024 * 1024)
+
+/* Number of frames in the write-ahead log that trigger a checkpoint,
+ * unless overridden when opening the file */
+#define DEFAULT_WAL_AUTOCHECKPOINT (1000)
+
+/* Maximum time (in microseconds) a commit can wait for its data to be
+ * synced to disk with synchronous=normal, unless overridden when opening
+ * the file. Commits made within this window share a single fdatasync. */
+#define DEFAULT_SYNC_DELAY (2000)
+
+/* Number of reads the "uring" Pager backend keeps in flight at once,
+ * unless overridden when opening the file */
+#define DEFAULT_QUEUE_DEPTH (32)
+
+/* Largest readahead window of the Pager, in pages, unless overridden
+ * when opening the file */
+#define DEFAULT_READAHEAD (128)
+
+/* Statistics counters (see chidb/stats.h) can be read from another
+ * thread while the database is in use, so they are updated atomically */
+#define STAT_ADD(counter, n) __atomic_add_fetch(&(counter), (n), __ATOMIC_RELAXED)
+#define STAT_LOAD(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#define STAT_RESET(counter) __atomic_store_n(&(counter), 0, __ATOMIC_RELAXED)
+
 #define MAX_STR_LEN (256)
 
 typedef uint16_t ncell_t;
@@ -40,5 +40,270 @@
 
 #include "dbm-cursor.h"
 
-/* Your code goes here */
+
+/* Cursors visit the entries of a B-Tree in key order, holding on to every
+ * node on the path from the root to the current entry. Since a cursor
+ * reads every page in the tree exactly once per pass, pages are requested
+ * from the pager with PAGER_HINT_SCAN, so a full scan does not push the
+ * pages used by other lookups out of the buffer pool. For the same
+ * reason, when the cursor moves into an internal node, all of its
+ * children are read at once (chidb_Btree_prefetchChildren), which lets
+ * backends that can have several reads in flight (e.g., "uring") keep
+ * the device busy. */
+
+
+/* Page number of the child the cursor is in (or about to move into) */
+static npage_t chidb_dbm_cursor_childPage(BTreePathEntry *level)
+{
+    BTreeCell cell;
+
+    if (level->ncell == level->btn->n_cells)
+        return level->btn->right_page;
+
+    chidb_Btree_getCell(level->btn, level->ncell, &cell);
+    if (level->btn->type == PGTYPE_TABLE_INTERNAL)
+        return cell.fields.tableInternal.child_page;
+    else
+        return cell.fields.indexInternal.child_page;
+}
+
+
+static void chidb_dbm_cursor_pop(chidb_dbm_cursor_t *cursor)
+{
+    BTreePath *path = &cursor->path;
+
+    path->depth--;
+    chidb_Btree_freeMemNode(cursor->bt, path->levels[path->depth].btn);
+    path->levels[path->depth].btn = NULL;
+}
+
+
+/* Push npage and the leftmost path below it onto the cursor's path */
+static int chidb_dbm_cursor_descend(chidb_dbm_cursor_t *cursor, npage_t npage)
+{
+    BTreePath *path = &cursor->path;
+    BTreeNode *btn;
+    int rc;
+
+    for(;;)
+    {
+        if ((rc = chidb_Btree_pushPath(cursor->bt, path, npage, PAGER_HINT_SCAN)) != CHIDB_OK)
+            return rc;
+
+        btn = path->levels[path->depth - 1].btn;
+        if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
+            return CHIDB_OK;
+
+        /* Only a hint: if it fails, the children are read one at a time */
+        chidb_Btree_prefetchChildren(cursor->bt, btn, 0, PAGER_HINT_SCAN);
+
+        npage = chidb_dbm_cursor_childPage(&path->levels[path->depth - 1]);
+    }
+}
+
+
+/* Move up the path until the cursor is positioned on an entry
+ *
+ * On entry, the node at the top of the path is either a leaf (and ncell
+ * may be past its last cell), or an internal node whose ncell-th child
+ * has just been completely visited.
+ */
+static int chidb_dbm_cursor_settle(chidb_dbm_cursor_t *cursor)
+{
+    int rc;
+
+    while (cursor->path.depth > 0)
+    {
+        BTreePathEntry *top = &cursor->path.levels[cursor->path.depth - 1];
+
+        if (top->btn->type == PGTYPE_TABLE_LEAF || top->btn->type == PGTYPE_INDEX_LEAF)
+        {
+            if (top->ncell < top->btn->n_cells)
+                return CHIDB_OK;
+            chidb_dbm_cursor_pop(cursor);
+        }
+        else if (top->btn->type == PGTYPE_INDEX_INTERNAL && top->ncell < top->btn->n_cells)
+        {
+            /* Index B-Trees store entries in internal nodes too */
+            return CHIDB_OK;
+        }
+        else if (top->ncell < top->btn->n_cells)
+        {
+            top->ncell++;
+            if ((rc = chidb_dbm_cursor_descend(cursor, chidb_dbm_cursor_childPage(top))) != CHIDB_OK)
+                return rc;
+        }
+        else
+            chidb_dbm_cursor_pop(cursor);
+    }
+
+    return CHIDB_DONE;
+}
+
+
+/* Open a cursor on a B-Tree
+ *
+ * The cursor is not positioned on any entry until
+ * chidb_dbm_cursor_rewind is called.
+ *
+ * Parameters
+ * - cursor: Cursor to initialize
+ * - type: CURSOR_READ or CURSOR_WRITE
+ * - bt: B-Tree file
+ * - root: Page number of the root of the B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_cursor_open(chidb_dbm_cursor_t *cursor, chidb_dbm_cursor_type_t type, BTree *bt, npage_t root)
+{
+    cursor->type = type;
+    cursor->bt = bt;
+    cursor->root = root;
+    cursor->path.depth = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Position the cursor on the first entry of the B-Tree
+ *
+ * Parameters
+ * - cursor: An open cursor
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_DONE: The B-Tree is empty
+ * - CHIDB_EPAGENO: The B-Tree contains an invalid page number
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_dbm_cursor_rewind(chidb_dbm_cursor_t *cursor)
+{
+    int rc;
+
+    chidb_Btree_releasePath(cursor->bt, &cursor->path);
+
+    if ((rc = chidb_dbm_cursor_descend(cursor, cursor->root)) != CHIDB_OK)
+        return rc;
+
+    return chidb_dbm_cursor_settle(cursor);
+}
+
+
+/* Move the cursor to the next entry of the B-Tree
+ *
+ * Parameters
+ * - cursor: A cursor positioned on an entry
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_DONE: There are no more entries. The cursor is no longer
+ *               positioned on an entry.
+ * - CHIDB_EPAGENO: The B-Tree contains an invalid page number
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_dbm_cursor_next(chidb_dbm_cursor_t *cursor)
+{
+    BTreePathEntry *top;
+    int rc;
+
+    if (cursor->path.depth == 0)
+        return CHIDB_DONE;
+
+    top = &cursor->path.levels[cursor->path.depth - 1];
+    top->ncell++;
+    if (top->btn->type == PGTYPE_INDEX_INTERNAL)
+    {
+        /* Move from an entry of an internal index node to the
+         * smallest entry in the subtree to its right */
+        if ((rc = chidb_dbm_cursor_descend(cursor, chidb_dbm_cursor_childPage(top))) != CHIDB_OK)
+            return rc;
+    }
+
+    return chidb_dbm_cursor_settle(cursor);
+}
+
+
+/* Position the cursor on the first entry with a key >= key
+ *
+ * Finds the path to the key with chidb_Btree_descend, as
+ * chidb_Btree_find does, and keeps it as the cursor's path. Unlike a
+ * rewind, this is a point lookup, so pages are read without
+ * PAGER_HINT_SCAN and no children are prefetched.
+ *
+ * Parameters
+ * - cursor: An open cursor
+ * - key: Key to search for
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_DONE: All the keys in the B-Tree are smaller than key. The
+ *               cursor is not positioned on an entry.
+ * - CHIDB_EPAGENO: The B-Tree contains an invalid page number
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_dbm_cursor_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key)
+{
+    BTreePathEntry *top;
+    int rc;
+
+    chidb_Btree_releasePath(cursor->bt, &cursor->path);
+    if ((rc = chidb_Btree_descend(cursor->bt, cursor->root, key, &cursor->path)) != CHIDB_OK)
+        return rc;
+
+    /* Index B-Trees store entries in internal nodes too */
+    top = &cursor->path.levels[cursor->path.depth - 1];
+    if (top->btn->type == PGTYPE_INDEX_INTERNAL)
+        return CHIDB_OK;
+
+    /* If every key in the leaf is smaller, the entry is the next one
+     * after the leaf */
+    return chidb_dbm_cursor_settle(cursor);
+}
+
+
+/* Get the cell the cursor is positioned on
+ *
+ * The cell may point into pages held by the cursor, so it is only
+ * valid until the cursor is moved or closed.
+ *
+ * Parameters
+ * - cursor: A cursor positioned on an entry
+ * - cell: Out parameter. Used to return the cell.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECELLNO: The cursor is not positioned on an entry
+ */
+int chidb_dbm_cursor_getCell(chidb_dbm_cursor_t *cursor, BTreeCell *cell)
+{
+    BTreePathEntry *top;
+
+    if (cursor->path.depth == 0)
+        return CHIDB_ECELLNO;
+
+    top = &cursor->path.levels[cursor->path.depth - 1];
+    return chidb_Btree_getCell(top->btn, top->ncell, cell);
+}
+
+
+/* Close a cursor, releasing all the pages it holds
+ *
+ * Parameters
+ * - cursor: An open cursor
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_cursor_close(chidb_dbm_cursor_t *cursor)
+{
+    chidb_Btree_releasePath(cursor->bt, &cursor->path);
+
+    cursor->type = CURSOR_UNSPECIFIED;
+
+    return CHIDB_OK;
+}
 
@@ -55,11 +55,24 @@ typedef struct chidb_dbm_cursor
 {
     chidb_dbm_cursor_type_t type;
 
-    /* Your code goes here */
+    BTree *bt;
+    npage_t root;
 
+    /* Path from the root to the current entry (see BTreePath). Its
+     * depth is zero if the cursor is not positioned on an entry. In a
+     * leaf node, ncell is the current cell. In an internal node, ncell
+     * is the child the cursor is in (n_cells means the right page),
+     * except when the cursor is positioned on an entry of an internal
+     * index node, in which case ncell is that entry. */
+    BTreePath path;
 } chidb_dbm_cursor_t;
 
-/* Cursor function definitions go here */
+int chidb_dbm_cursor_open(chidb_dbm_cursor_t *cursor, chidb_dbm_cursor_type_t type, BTree *bt, npage_t root);
+int chidb_dbm_cursor_rewind(chidb_dbm_cursor_t *cursor);
+int chidb_dbm_cursor_next(chidb_dbm_cursor_t *cursor);
+int chidb_dbm_cursor_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key);
+int chidb_dbm_cursor_getCell(chidb_dbm_cursor_t *cursor, BTreeCell *cell);
+int chidb_dbm_cursor_close(chidb_dbm_cursor_t *cursor);
 
 
 #endif /* DBM_CURSOR_H_ */
@@ -0,0 +1,248 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module contains the codec that compressed files (see backend.c)
+ * use for their pages: a small member of the LZ77 family, with the same
+ * block format as LZ4. It has no dictionary and no entropy coding, so it
+ * is fast enough to run on every page read, and it does well on what
+ * B-Tree pages are full of: records with repeated text and zeroed-out
+ * free space.
+ *
+ * A compressed block is a series of sequences. Each sequence has a
+ * token byte, whose high 4 bits are a number of literals and low 4 bits
+ * the length of a match (minus LZ_MIN_MATCH); a value of 15 in either
+ * means the length goes on in the bytes that follow (each one added to
+ * it, until one that is not 255). Then come the literals, copied as is,
+ * and the offset of the match (two bytes, little-endian): how far back
+ * in the output the bytes to copy start. The match can overlap the bytes
+ * it produces, so a run of a single byte is one literal and one match
+ * at offset 1. The last sequence only has literals, and the last
+ * LZ_LAST_LITERALS bytes of the input are always literals.
+ *
+ * Matches are found with a hash table of the last position where each
+ * 4-byte sequence was seen, so the compressor makes a single pass over
+ * the input.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <string.h>
+#include "lz.h"
+
+#define LZ_MIN_MATCH (4)
+#define LZ_LAST_LITERALS (5)
+#define LZ_HASH_BITS (12)
+
+#define lzRead32(p) ((uint32_t) (p)[0] | (uint32_t) (p)[1] << 8 | (uint32_t) (p)[2] << 16 | (uint32_t) (p)[3] << 24)
+#define lzHash(v) (((v) * 2654435761u) >> (32 - LZ_HASH_BITS))
+
+
+/* Write a sequence
+ *
+ * Parameters
+ * - op: Where to write the sequence
+ * - oend: End of the output buffer
+ * - lit: Literals
+ * - nlit: Number of literals
+ * - offset: Offset of the match
+ * - mlen: Length of the match (0 for the last sequence, which has no match)
+ *
+ * Return
+ * - The end of the sequence in the output, or NULL if it does not fit
+ */
+static uint8_t *chidb_LZ_putSequence(uint8_t *op, uint8_t *oend, const uint8_t *lit, size_t nlit,
+                                     uint32_t offset, size_t mlen)
+{
+    size_t mcode = (mlen > 0)? mlen - LZ_MIN_MATCH : 0;
+    size_t need = 1 + (nlit / 255 + 1) + nlit + ((mlen > 0)? 2 + (mcode / 255 + 1) : 0);
+    size_t len;
+
+    if ((size_t) (oend - op) < need)
+        return NULL;
+
+    *op++ = ((nlit >= 15)? 15 : nlit) << 4 | ((mlen > 0 && mcode >= 15)? 15 : mcode);
+    if (nlit >= 15)
+    {
+        for(len = nlit - 15; len >= 255; len -= 255)
+            *op++ = 255;
+        *op++ = len;
+    }
+    memcpy(op, lit, nlit);
+    op += nlit;
+
+    if (mlen > 0)
+    {
+        *op++ = offset & 0xff;
+        *op++ = offset >> 8;
+        if (mcode >= 15)
+        {
+            for(len = mcode - 15; len >= 255; len -= 255)
+                *op++ = 255;
+            *op++ = len;
+        }
+    }
+
+    return op;
+}
+
+
+/* Compress a buffer
+ *
+ * Parameters
+ * - src: Data to compress
+ * - n: Number of bytes of data
+ * - dst: Buffer for the compressed data
+ * - cap: Size of dst
+ *
+ * Return
+ * - The size of the compressed data, or 0 if it does not fit in cap
+ *   bytes (that is, the data does not compress well enough)
+ */
+size_t chidb_LZ_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    const uint8_t *ip = src, *anchor = src, *end = src + n;
+    uint8_t *op = dst, *oend = dst + cap;
+
+    memset(table, 0, sizeof(table));
+
+    if (n >= LZ_MIN_MATCH + LZ_LAST_LITERALS)
+    {
+        const uint8_t *mflimit = end - LZ_LAST_LITERALS - LZ_MIN_MATCH;
+        const uint8_t *mlimit = end - LZ_LAST_LITERALS;
+
+        while (ip <= mflimit)
+        {
+            uint32_t seq = lzRead32(ip);
+            uint32_t h = lzHash(seq);
+            const uint8_t *ref = src + table[h];
+
+            table[h] = ip - src;
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lzRead32(ref) != seq)
+            {
+                ip++;
+                continue;
+            }
+
+            /* Extend the match forwards, and then backwards over
+             * the literals before it */
+            const uint8_t *mend = ip + LZ_MIN_MATCH, *rend = ref + LZ_MIN_MATCH;
+            while (mend < mlimit && *mend == *rend)
+                mend++, rend++;
+            while (ip > anchor && ref > src && ip[-1] == ref[-1])
+                ip--, ref--;
+
+            op = chidb_LZ_putSequence(op, oend, anchor, ip - anchor, ip - ref, mend - ip);
+            if (op == NULL)
+                return 0;
+            ip = anchor = mend;
+        }
+    }
+
+    op = chidb_LZ_putSequence(op, oend, anchor, end - anchor, 0, 0);
+    if (op == NULL)
+        return 0;
+
+    return op - dst;
+}
+
+
+/* Decompress a buffer
+ *
+ * Parameters
+ * - src: Compressed data
+ * - n: Number of bytes of compressed data
+ * - dst: Buffer for the decompressed data
+ * - cap: Size of dst
+ *
+ * Return
+ * - The size of the decompressed data, or -1 if the compressed data is
+ *   not valid (or decompresses to more than cap bytes)
+ */
+ssize_t chidb_LZ_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap)
+{
+    const uint8_t *ip = src, *iend = src + n;
+    uint8_t *op = dst, *oend = dst + cap;
+
+    while (ip < iend)
+    {
+        uint8_t token = *ip++, b;
+        size_t nlit = token >> 4, mlen = token & 15;
+        uint32_t offset;
+
+        if (nlit == 15)
+            do
+            {
+                if (ip == iend)
+                    return -1;
+                b = *ip++;
+                nlit += b;
+            } while (b == 255);
+        if (nlit > (size_t) (iend - ip) || nlit > (size_t) (oend - op))
+            return -1;
+        memcpy(op, ip, nlit);
+        ip += nlit;
+        op += nlit;
+
+        /* The last sequence has no match */
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t) (op - dst))
+            return -1;
+
+        if (mlen == 15)
+            do
+            {
+                if (ip == iend)
+                    return -1;
+                b = *ip++;
+                mlen += b;
+            } while (b == 255);
+        mlen += LZ_MIN_MATCH;
+        if (mlen > (size_t) (oend - op))
+            return -1;
+
+        /* Byte by byte, since the match can overlap what it copies */
+        for(const uint8_t *m = op - offset; mlen > 0; mlen--)
+            *op++ = *m++;
+    }
+
+    return op - dst;
+}
@@ -9,12 +9,177 @@
  * modify the page returned by the pager and instruct the pager to
  * write it back to disk.
  *
- * The default pager is very simple and always creates an in-memory copy
- * of any page that is read (even if that page has already been read before).
- * More specifically, pages are read into a MemPage structure, which must
- * be freed (using the releaseMemPage function) once they are not needed.
- * In a real database, the pager component typically does some caching
- * of pages to reduce the number of disk accesses.
+ * The pager keeps a buffer pool of recently used pages, so reading a page
+ * that is already in memory does not touch the file. The pool is a fixed
+ * array of frames (sized with chidb_Pager_setCacheSize or the "cache_size"
+ * open option) indexed by a hash table on the page number. Each frame has
+ * a pin count: chidb_Pager_readPage pins the frame and returns a MemPage
+ * that points into it, and chidb_Pager_releaseMemPage unpins it. Unpinned
+ * frames stay cached until their frame is needed for another page. If
+ * every frame is pinned, the page is read into a private MemPage that is
+ * freed on release.
+ *
+ * Frames are replaced using 2Q, so that a single pass over a large B-Tree
+ * does not flush the pages that are used over and over (typically the
+ * internal nodes that every lookup goes through). A page that is read for
+ * the first time goes into A1in, a FIFO that holds about a quarter of the
+ * pool. Pages are only promoted to Am, an LRU holding the rest of the
+ * pool, when they are referenced again: either while they are in A1in, or
+ * shortly after being evicted from it (the pager remembers the page
+ * numbers recently evicted from A1in in a "ghost" list, A1out). Pages
+ * read with PAGER_HINT_SCAN, which B-Tree cursors use when doing a
+ * sequential scan, are not promoted when they are re-read by the scan
+ * and are not remembered in A1out, so a scan can only ever take over the
+ * A1in part of the pool.
+ *
+ * The pool can be split into shards with the "shards" option, so several
+ * threads can read pages at once: chidb_Pager_readPage(Hint) and
+ * chidb_Pager_releaseMemPage can then be called concurrently (every other
+ * function, including the ones that write pages, still needs the Pager
+ * to itself). A sharded pool is created as soon as the page size is set,
+ * rather than by the first read, so the first readers do not race to
+ * create it. Each page number hashes to a shard, which
+ * has its own frames, page table and 2Q queues, and its own lock, which
+ * is only taken on a miss. A hit takes no lock at all: the page table is
+ * searched with atomic loads and the frame is pinned with a
+ * compare-and-swap on its pin count, so frames stay in their queue while
+ * pinned, and hits only flag them as referenced. Each shard applies the
+ * flags (with the same promotions as 2Q) when it looks for a frame to
+ * evict, skipping pinned and dirty frames. A sharded pool does not use
+ * mmap or readahead, whose state is shared by every reader (and it cannot
+ * be used with the mmap backend, for the same reason).
+ *
+ * With the "huge_pages" option, the frames (their page buffers, and the
+ * frame array and page table that lead to them) are laid out in a single
+ * region of memory backed by huge pages, so a pool of several GB does
+ * not need a TLB entry for every 4 KB of it. The
+ * region is mapped with MAP_HUGETLB if the system has huge pages reserved
+ * and, failing that, as a regular mapping with MADV_HUGEPAGE (so the
+ * kernel backs it with transparent huge pages when it can). Either way,
+ * memory is only used as frames are first used. If neither works, the
+ * buffers are allocated as usual: PAGER_FRAME_SLAB at a time.
+ *
+ * The file is accessed through a raw file descriptor with pread and pwrite,
+ * so there is no stdio buffering (and no extra copy of each page), and
+ * reads do not depend on a shared file position.
+ *
+ * With the "direct" option, the file is opened with O_DIRECT, so pages
+ * are read straight from the device into the buffer pool (and written
+ * straight from it), instead of also being cached by the OS. Direct I/O
+ * is done in blocks of the device's logical block size (as reported by
+ * the file system, see backend.c): the page size must be a multiple of
+ * it (chidb_Pager_setPageSize checks this), and every buffer that pages
+ * are read into or written from is aligned to it. Where direct I/O is not
+ * supported (e.g., on some tmpfs), the file is accessed through the page
+ * cache as usual. Direct I/O does not apply to the write-ahead log, which
+ * is written sequentially in frames that are not block-aligned, and
+ * turns off the "mmap" option, whose mapping lives in the page cache.
+ *
+ * The file is not grown one page at a time. When a page past the end of
+ * the file is written, the file is extended with posix_fallocate by an
+ * extent of at least "extent_size" bytes (1 MiB by default) or
+ * "extent_pct" percent of the file size, whichever is larger. The Pager
+ * keeps track of the logical size of the file (the end of the last page
+ * written), which is what chidb_Pager_getRealDBSize reports, and the file
+ * is truncated to its logical size when it is closed. So that a file that
+ * is not closed properly does not end up with the preallocated pages as
+ * extra (empty) pages, files with a chidb header also keep the number of
+ * pages in the header (at offset 28, as in SQLite), which is updated by
+ * chidb_Pager_flush. When the header is loaded (chidb_Pager_initFreelist),
+ * anything past that many pages is left out of the logical size, and is
+ * truncated when the file is closed.
+ *
+ * Pages that are no longer used can be returned to the pager with
+ * chidb_Pager_freePage, and chidb_Pager_allocatePage reuses them before
+ * growing the file. Free pages are kept in a persistent freelist, laid
+ * out as in SQLite: the file header has the number of the first "trunk"
+ * page (offset 32) and the total number of free pages (offset 36). Each
+ * trunk page has the number of the next trunk page, a count of "leaf"
+ * pages, and the numbers of those leaf pages, which are free pages with
+ * no meaningful content. The freelist is only used for files with a
+ * chidb header, so the B-Tree module enables it (chidb_Pager_initFreelist)
+ * once it has validated the header.
+ *
+ * Since a MemPage is shared by everyone who has the page pinned, changes
+ * done to its data are immediately visible to other users of that page.
+ * They only reach the file when chidb_Pager_writePage is called, though.
+ *
+ * chidb_Pager_writePage does not write to the file right away. It only
+ * marks the page's frame as dirty, so a page that is modified several
+ * times (e.g., during a split) is written once. Dirty pages are written
+ * when chidb_Pager_flush is called (at the end of every statement, and
+ * when the file is closed), sorted by page number, with runs of
+ * consecutive pages written with a single pwritev. A dirty page is also
+ * written if its frame is needed for another page.
+ *
+ * If the file is opened with the "mmap=1" option, the whole file is mapped
+ * into memory, and pages are returned as MemPages that point straight
+ * into the mapping, without going through the buffer pool. The mapping is
+ * private (copy-on-write), so changes done to a MemPage still only reach
+ * the file through chidb_Pager_writePage, just like without mmap. When a
+ * page past the end of the mapping is requested the file is mapped
+ * again, and pages that have been allocated but not written yet (and so
+ * are not in the file) are kept in the buffer pool.
+ *
+ * Opening a file only reads what is needed to find out its size, so it
+ * takes the same time whether the file is small or large. The buffer
+ * pool is set up on the first page read, the MemPages of a mapping are
+ * filled in as their pages are first used, and a compressed file reads
+ * its page map a piece at a time (see backend.c). So opening a database
+ * and doing a first lookup only reads the header and the pages on the
+ * path of the lookup.
+ *
+ * The Pager also watches for runs of ascending page reads (e.g., a cursor
+ * walking the leaves of a table that was filled in key order, whose pages
+ * were allocated one after the other at the end of the file). Once a run
+ * is long enough, the pages after the current one are read ahead: into
+ * the buffer pool, with a single batch, if the backend can batch reads,
+ * or with posix_fadvise(WILLNEED) otherwise, so the OS reads them in the
+ * background. The readahead window starts small and doubles (up to the
+ * "readahead" option, in pages, and to half the buffer pool when pages
+ * are read into it) every time the reader gets halfway
+ * through the previous window, and goes back to nothing as soon as two
+ * reads in a row break the run.
+ *
+ * If the file is opened with the "wal=1" option, pages are not written in
+ * place. They are appended to a write-ahead log instead (see wal.c), and
+ * every chidb_Pager_flush ends with a commit frame. Pages are read from
+ * the log if it has a newer version of them than the file. Once the log
+ * has "wal_autocheckpoint" frames (DEFAULT_WAL_AUTOCHECKPOINT by default),
+ * the latest version of every page in it is copied into the file, and the
+ * log starts over (chidb_Pager_checkpoint). This is also done when the
+ * file is closed, after which the log is deleted. If a log is found when
+ * the file is opened (because the file was not closed properly), it is
+ * checkpointed right away, whether or not the "wal" option is given.
+ *
+ * How long a commit waits for its data to reach the disk is set with the
+ * "synchronous" option. With "full", every commit calls fdatasync (on the
+ * log in WAL mode, on the file otherwise) before returning. With "normal"
+ * (the default), commits return right away, and a background thread
+ * syncs them in groups: all the commits made within "sync_delay"
+ * microseconds of the first unsynced commit share a single fdatasync,
+ * so a crash can only lose the commits of the last few milliseconds.
+ * With "off", the Pager never syncs. Unless synchronous is "off",
+ * checkpoints sync the log before copying it into the file, and sync
+ * the file before starting the log over. (Without a log, there is no
+ * protection against a crash in the middle of a commit: synchronous
+ * only says when a commit is durable.)
+ *
+ * The file (and the log) are never accessed directly, but through a
+ * backend (see backend.c), chosen with the "backend" option. The
+ * default one uses pread/pwritev on a file descriptor; others keep the
+ * file in memory, or count (and slow down) the I/O done by the Pager.
+ *
+ * With the "compress" option, a new file is created as a compressed
+ * file: every page is compressed when it is written to the file, and
+ * takes only as many bytes as it compresses to (see the compressed
+ * layer in backend.c), so less is read from and written to the disk in
+ * exchange for some CPU time. A compressed file is recognized when it is
+ * opened, with or without the option. The Pager itself does not see the
+ * difference: the buffer pool holds uncompressed pages, and the file
+ * size is the size of the uncompressed file. The write-ahead log is not
+ * compressed, and compressed files are not accessed with mmap or
+ * direct I/O.
  *
  */
 
@@ -54,19 +219,354 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/types.h>
-#include <sys/stat.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include <chidb/log.h>
 
 #include "chidbInt.h"
 
 #include "pager.h"
+#include "wal.h"
+#include "util.h"
+
+#define URI_PREFIX "file:"
+
+#define isFrame(pager, p) ((pager)->frames != NULL && \
+                           (PagerFrame *) (p) >= (pager)->frames && \
+                           (PagerFrame *) (p) < (pager)->frames + (pager)->cache_size)
+#define pageTableBucket(shard, npage) (&(shard)->page_table[(npage) & (shard)->page_table_mask])
+
+/* The shard a page belongs to. The page number is hashed (with the
+ * multiplicative constant used by Knuth) so consecutive pages go to
+ * different shards, and its low bits are still spread evenly over the
+ * buckets of the shard's page table. */
+#define pagerShard(pager, npage) (&(pager)->shards[(pager)->shard_bits == 0? 0 : \
+                                  ((uint32_t) (npage) * 2654435761u) >> (32 - (pager)->shard_bits)])
+
+/* Pin count of a frame that is being evicted (sharded pool only) */
+#define PAGER_FRAME_EVICTING (UINT32_MAX)
+
+/* Largest "shards" option */
+#define PAGER_MAX_SHARDS (1024)
+
+#define A1OUT_NONE (UINT32_MAX)
+
+/* Number of frame buffers allocated at once (in a single page-aligned
+ * block of memory, see chidb_Pager_getFreeFrame) */
+#define PAGER_FRAME_SLAB (64)
+
+/* Size of a (transparent) huge page: the pool region is aligned to it */
+#define PAGER_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* Maximum number of pages written at once during a checkpoint */
+#define PAGER_CHECKPOINT_BATCH (256)
+
+/* Readahead: a read is part of a run if it is at most PAGER_READAHEAD_GAP
+ * pages after the previous one, and readahead starts (with a window of
+ * PAGER_READAHEAD_MIN pages) after PAGER_READAHEAD_TRIGGER such reads */
+#define PAGER_READAHEAD_GAP (4)
+#define PAGER_READAHEAD_TRIGGER (4)
+#define PAGER_READAHEAD_MIN (8)
+
+/* Largest "readahead" option, in pages */
+#define PAGER_MAX_READAHEAD (4096)
+
+/* A page in the write-ahead log, and the frame with its latest version */
+typedef struct PagerLogPage
+{
+    npage_t npage;
+    uint32_t frame;
+} PagerLogPage;
+
+/* Forward declarations of auxiliary functions */
+static PagerFrame *chidb_Pager_lookupFrame(Pager *pager, npage_t npage);
+static int chidb_Pager_copyLog(Pager *pager);
+static int chidb_Pager_syncCommit(Pager *pager);
+
+
+/* Parse a decimal option value of at most max */
+static bool chidb_Pager_parseUInt(const char *value, uint32_t max, uint32_t *n)
+{
+    char *end;
+    unsigned long v = strtoul(value, &end, 10);
+
+    if (*value == '\0' || *end != '\0' || v > max)
+        return false;
+    *n = v;
+
+    return true;
+}
+
+
+/* Parse the options in a "file:" URI
+ *
+ * A database can be opened with a plain filename, or with a URI of the
+ * form "file:FILENAME?option=value&option=value". The supported options
+ * are:
+ *
+ * - cache_size: Number of frames in the buffer pool.
+ * - mmap: If 1, read pages through a memory mapping of the file.
+ * - extent_size: Grow the file by at least this many bytes at a time
+ *                (0 to grow it one page at a time).
+ * - extent_pct: Grow the file by at least this percentage of its size.
+ * - wal: If 1, write pages to a write-ahead log instead of in place.
+ * - wal_autocheckpoint: Checkpoint the log when it has this many frames.
+ * - synchronous: off (0), normal (1) or full (2).
+ * - sync_delay: Maximum time (in microseconds) that synchronous=normal
+ *               waits before syncing a commit.
+ * - backend: How the file is accessed: file, mmap, memory, counting
+ *            or uring (see backend.c).
+ * - read_latency, write_latency, sync_latency: Latency (in microseconds)
+ *            added to every operation by the counting backend.
+ * - queue_depth: Reads the uring backend keeps in flight at once.
+ * - readahead: Largest readahead window, in pages (0 to turn it off,
+ *              at most PAGER_MAX_READAHEAD).
+ * - huge_pages: If 1, put the buffer pool in huge pages.
+ * - page_size: Page size (a power of two from MIN_PAGE_SIZE to
+ *              MAX_PAGE_SIZE) of the file, if it is created. An
+ *              existing file keeps the page size in its header.
+ * - direct: If 1, access the file with direct I/O (bypassing the
+ *           OS page cache).
+ * - shards: Number of parts (a power of two) the buffer pool is split
+ *           into, so several threads can read pages at once (not with
+ *           backend=mmap).
+ * - compress: If 1, compress the pages of a new file. An existing file
+ *             must already be compressed.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - uri: Filename or URI passed to chidb_Pager_open
+ * - filename: Out parameter. Used to return the name of the file to open,
+ *             which must be freed by the caller.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EMISUSE: Unknown option, option with an invalid value, or
+ *                  options that cannot be used together
+ */
+static int chidb_Pager_parseURI(Pager *pager, const char *uri, char **filename)
+{
+    char *opts, *opt, *saveptr;
+
+    if (strncmp(uri, URI_PREFIX, strlen(URI_PREFIX)) != 0)
+    {
+        *filename = strdup(uri);
+        return (*filename == NULL)? CHIDB_ENOMEM : CHIDB_OK;
+    }
+
+    *filename = strdup(uri + strlen(URI_PREFIX));
+    if (*filename == NULL)
+        return CHIDB_ENOMEM;
+
+    opts = strchr(*filename, '?');
+    if (opts == NULL)
+        return CHIDB_OK;
+    *opts++ = '\0';
+
+    for(opt = strtok_r(opts, "&", &saveptr); opt != NULL; opt = strtok_r(NULL, "&", &saveptr))
+    {
+        char *value = strchr(opt, '=');
+
+        if (value == NULL)
+            goto bad_option;
+        *value++ = '\0';
+
+        if (!strcmp(opt, "cache_size"))
+        {
+            if (!chidb_Pager_parseUInt(value, UINT32_MAX, &pager->cache_size) || pager->cache_size == 0)
+                goto bad_option;
+        }
+        else if (!strcmp(opt, "extent_size"))
+        {
+            if (!chidb_Pager_parseUInt(value, UINT32_MAX, &pager->extent_size))
+                goto bad_option;
+        }
+        else if (!strcmp(opt, "extent_pct"))
+        {
+            if (!chidb_Pager_parseUInt(value, 100, &pager->extent_pct))
+                goto bad_option;
+        }
+        else if (!strcmp(opt, "mmap"))
+        {
+            if (strcmp(value, "0") && strcmp(value, "1"))
+                goto bad_option;
+            pager->use_mmap = (value[0] == '1');
+        }
+        else if (!strcmp(opt, "huge_pages"))
+        {
+            if (strcmp(value, "0") && strcmp(value, "1"))
+                goto bad_option;
+            pager->huge_pages = (value[0] == '1');
+        }
+        else if (!strcmp(opt, "page_size"))
+        {
+            if (!chidb_Pager_parseUInt(value, MAX_PAGE_SIZE, &pager->new_page_size) ||
+                pager->new_page_size < MIN_PAGE_SIZE || (pager->new_page_size & (pager->new_page_size - 1)) != 0)
+                goto bad_option;
+        }
+        else if (!strcmp(opt, "direct"))
+        {
+            if (strcmp(value, "0") && strcmp(value, "1"))
+                goto bad_option;
+            pager->use_direct = (value[0] == '1');
+        }
+        else if (!strcmp(opt, "compress"))
+        {
+            if (strcmp(value, "0") && strcmp(value, "1"))
+                goto bad_option;
+            pager->compress = (value[0] == '1');
+        }
+        else if (!strcmp(opt, "wal"))
+        {
+            if (strcmp(value, "0") && strcmp(value, "1"))
+                goto bad_option;
+            pager->use_wal = (value[0] == '1');
+        }
+        else if (!strcmp(opt, "synchronous"))
+        {
+            if (!strcmp(value, "off") || !strcmp(value, "0"))
+                pager->synchronous = PAGER_SYNC_OFF;
+            else if (!strcmp(value, "normal") || !strcmp(value, "1"))
+                pager->synchronous = PAGER_SYNC_NORMAL;
+            else if (!strcmp(value, "full") || !strcmp(value, "2"))
+                pager->synchronous = PAGER_SYNC_FULL;
+            else
+                goto bad_option;
+        }
+        else if (!strcmp(opt, "sync_delay"))
+        {
+            if (!chidb_Pager_parseUInt(value, UINT32_MAX, &pager->sync_delay))
+                goto bad_option;
+        }
+        else if (!strcmp(opt, "wal_autocheckpoint"))
+        {
+            if (!chidb_Pager_parseUInt(value, UINT32_MAX, &pager->wal_autocheckpoint) || pager->wal_autocheckpoint == 0)
+                goto bad_option;
+        }
+        else if (!strcmp(opt, "backend"))
+        {
+            if ((pager->backend = chidb_Backend_find(value)) == NULL)
+                goto bad_option;
+        }
+        else if (!strcmp(opt, "read_latency"))
+        {
+            if (!chidb_Pager_parseUInt(value, UINT32_MAX, &pager->backend_options.read_latency))
+                goto bad_option;
+        }
+        else if (!strcmp(opt, "write_latency"))
+        {
+            if (!chidb_Pager_parseUInt(value, UINT32_MAX, &pager->backend_options.write_latency))
+                goto bad_option;
+        }
+        else if (!strcmp(opt, "sync_latency"))
+        {
+            if (!chidb_Pager_parseUInt(value, UINT32_MAX, &pager->backend_options.sync_latency))
+                goto bad_option;
+        }
+        else if (!strcmp(opt, "readahead"))
+        {
+            if (!chidb_Pager_parseUInt(value, PAGER_MAX_READAHEAD, &pager->readahead_max))
+                goto bad_option;
+        }
+        else if (!strcmp(opt, "shards"))
+        {
+            if (!chidb_Pager_parseUInt(value, PAGER_MAX_SHARDS, &pager->n_shards) ||
+                pager->n_shards == 0 || (pager->n_shards & (pager->n_shards - 1)) != 0)
+                goto bad_option;
+        }
+        else if (!strcmp(opt, "queue_depth"))
+        {
+            if (!chidb_Pager_parseUInt(value, 4096, &pager->backend_options.queue_depth) ||
+                pager->backend_options.queue_depth == 0)
+                goto bad_option;
+        }
+        else
+            goto bad_option;
+    }
+
+    /* The mmap backend remaps the file as it grows, under the readers
+     * of a sharded pool */
+    if (pager->n_shards > 1 && pager->backend == &chidb_Backend_mmap)
+    {
+        chilog(ERROR, "The mmap backend cannot be used with a sharded pool");
+        free(*filename);
+        return CHIDB_EMISUSE;
+    }
+
+    return CHIDB_OK;
+
+bad_option:
+    chilog(ERROR, "Invalid option in %s", uri);
+    free(*filename);
+    return CHIDB_EMISUSE;
+}
+
+
+/* Open the write-ahead log of a file
+ *
+ * The log is opened if the file is opened in WAL mode, or if there is
+ * a log left behind by a previous connection. In the latter case, the
+ * log is checkpointed and closed (and so, deleted) right away.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - filename: Name of the database file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the files
+ */
+static int chidb_Pager_openWal(Pager *pager, const char *filename)
+{
+    char *walname;
+    int rc;
+
+    walname = malloc(strlen(filename) + strlen(WAL_SUFFIX) + 1);
+    if (walname == NULL)
+        return CHIDB_ENOMEM;
+    sprintf(walname, "%s%s", filename, WAL_SUFFIX);
+
+    rc = chidb_Wal_open(&pager->wal, pager->backend, walname,
+                        pager->use_wal? PAGER_OPEN_CREATE : 0, &pager->backend_options);
+    free(walname);
+    if (rc == CHIDB_ENOFILE && !pager->use_wal)
+        return CHIDB_OK;
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if (pager->wal->n_frames > 0)
+    {
+        chilog(INFO, "Copying %i frames left in the log into the file", pager->wal->n_frames);
+        rc = chidb_Pager_copyLog(pager);
+    }
+
+    if (rc != CHIDB_OK || !pager->use_wal)
+    {
+        if (chidb_Wal_close(pager->wal) != CHIDB_OK && rc == CHIDB_OK)
+            rc = CHIDB_EIO;
+        pager->wal = NULL;
+    }
+
+    return rc;
+}
+
 
 /* Open a file
  *
- * This function opens a file for paged access.
+ * This function opens a file for paged access. The filename can
+ * also be a "file:" URI with options (see chidb_Pager_parseURI).
+ * If the filename is ":memory:", the database is kept in memory
+ * (with the memory backend) and disappears when it is closed; its
+ * contents can be saved to a file with chidb_Pager_serialize.
  *
  * Parameters
  * - pager: An out parameter. Used to return a pointer to the
@@ -76,216 +576,2610 @@
  * Return
  * - CHIDB_OK: Operation successful
  * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EMISUSE: The URI contains an invalid option
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
 int chidb_Pager_open(Pager **pager, const char *filename)
 {
-    *pager = malloc(sizeof(Pager));
-    if (pager == NULL)
+    off_t size;
+    char *path;
+    int rc;
+
+    *pager = calloc(1, sizeof(Pager));
+    if (*pager == NULL)
         return CHIDB_ENOMEM;
-    (*pager)->f = fopen(filename, "r+");
+    (*pager)->extent_size = DEFAULT_EXTENT_SIZE;
+    (*pager)->wal_autocheckpoint = DEFAULT_WAL_AUTOCHECKPOINT;
+    (*pager)->synchronous = PAGER_SYNC_NORMAL;
+    (*pager)->sync_delay = DEFAULT_SYNC_DELAY;
+    (*pager)->readahead_max = DEFAULT_READAHEAD;
+    (*pager)->n_shards = 1;
+    (*pager)->new_page_size = DEFAULT_PAGE_SIZE;
+    (*pager)->backend = &chidb_Backend_file;
 
-    if ((*pager)->f == NULL)
-        (*pager)->f = fopen(filename, "w+");
+    if ((rc = chidb_Pager_parseURI(*pager, filename, &path)) != CHIDB_OK)
+    {
+        free(*pager);
+        return rc;
+    }
 
-    if ((*pager)->f == NULL)
-        return CHIDB_EIO;
-    else
-        return CHIDB_OK;
+    /* Reading through the mapping and reading ahead keep state that is
+     * shared by every reader, so they are not used by a sharded pool */
+    if ((*pager)->n_shards > 1)
+    {
+        (*pager)->use_mmap = false;
+        (*pager)->readahead_max = 0;
+    }
+
+    /* An in-memory database has nothing to sync, and nothing to
+     * protect with a log */
+    if (!strcmp(path, PAGER_MEMORY_FILENAME))
+    {
+        (*pager)->backend = &chidb_Backend_memory;
+        (*pager)->use_wal = false;
+        (*pager)->synchronous = PAGER_SYNC_OFF;
+        (*pager)->compress = false;
+    }
+
+    if ((*pager)->compress)
+        (*pager)->use_direct = false;
+
+    rc = (*pager)->backend->open((*pager)->backend, path,
+                                 PAGER_OPEN_CREATE | ((*pager)->use_direct? PAGER_OPEN_DIRECT : 0),
+                                 &(*pager)->backend_options, &(*pager)->file);
+    if (rc != CHIDB_OK)
+    {
+        free(path);
+        free(*pager);
+        return (rc == CHIDB_ENOMEM)? rc : CHIDB_EIO;
+    }
+
+    /* A compressed file is accessed through the compressed layer,
+     * whether or not it was opened with the "compress" option */
+    if ((*pager)->compress || chidb_Backend_isCompressed((*pager)->file))
+    {
+        PagerFile *file;
+
+        if ((rc = chidb_Backend_compress((*pager)->file, &file)) != CHIDB_OK)
+        {
+            (*pager)->file->backend->close((*pager)->file, false);
+            free(path);
+            free(*pager);
+            return rc;
+        }
+        (*pager)->file = file;
+        (*pager)->compress = true;
+        (*pager)->use_mmap = false;
+    }
+
+    /* Pages read through the mapping would be cached by the OS again */
+    (*pager)->use_direct = ((*pager)->file->direct_align != 0);
+    if ((*pager)->use_direct)
+        (*pager)->use_mmap = false;
+
+    if ((rc = (*pager)->file->backend->size((*pager)->file, &size)) != CHIDB_OK)
+    {
+        (*pager)->file->backend->close((*pager)->file, false);
+        free(path);
+        free(*pager);
+        return rc;
+    }
+
+    (*pager)->file_size = (*pager)->db_size = size;
+
+    rc = chidb_Pager_openWal(*pager, path);
+    free(path);
+    if (rc != CHIDB_OK)
+    {
+        (*pager)->file->backend->close((*pager)->file, false);
+        free(*pager);
+        return rc;
+    }
+
+    return CHIDB_OK;
 }
 
 
-/* Set the page size
+/* Free the buffer pool
  *
- * This tells the pager what the size of each page is.
- * This function must be called before operating on pages.
- * It will not verify if the page size makes size. If an incorrect
- * page size is provided, this will result in unexpected behaviour.
+ * Frees all the frames and the shards. Any MemPage returned
+ * by the pool is no longer valid after calling this function, and
+ * dirty pages are lost (call chidb_Pager_flush first).
  *
  * Parameters
  * - pager: A Pager.
- * - pagesize: Size of a page (in bytes)
+ */
+static void chidb_Pager_freeCache(Pager *pager)
+{
+    if (pager->shards == NULL)
+        return;
+
+    for(uint32_t i = 0; i < (1u << pager->shard_bits); i++)
+    {
+        PagerShard *shard = &pager->shards[i];
+
+        if (pager->pool == NULL && shard->slabs != NULL)
+            for(uint32_t f = 0; f < shard->n_frames; f += PAGER_FRAME_SLAB)
+                free(shard->slabs[f / PAGER_FRAME_SLAB]);
+        free(shard->slabs);
+        free(shard->a1out);
+        free(shard->a1out_next);
+        free(shard->a1out_table);
+        pthread_mutex_destroy(&shard->lock);
+    }
+
+    if (pager->pool != NULL)
+        munmap(pager->pool, pager->pool_size);
+    else
+    {
+        free(pager->frames);
+        free(pager->shards[0].page_table);
+    }
+    free(pager->shards);
+
+    pager->frames = NULL;
+    pager->shards = NULL;
+    pager->shard_bits = 0;
+    pager->pool = NULL;
+    pager->pool_memory = PAGER_POOL_SLABS;
+    pager->n_dirty = 0;
+}
+
+
+/* Map a region of huge pages for the buffer pool
  *
- * Return
- * - CHIDB_OK: Operation successful
+ * Tries huge pages reserved with hugetlbfs first, and then transparent
+ * huge pages (see the top of this file). Sets pool_memory to the kind of
+ * memory that was used, and leaves pool NULL if no region could be
+ * mapped. The region is zero-filled.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - size: Size of the region, in bytes
  */
-int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize)
+static void chidb_Pager_mapPool(Pager *pager, size_t size)
 {
-    pager->page_size = pagesize;
-    chidb_Pager_getRealDBSize(pager, &pager->n_pages);
+    uint8_t *addr;
 
-    return CHIDB_OK;
+    size = (size + PAGER_HUGE_PAGE_SIZE - 1) & ~((size_t) PAGER_HUGE_PAGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (addr != MAP_FAILED)
+    {
+        pager->pool = addr;
+        pager->pool_size = size;
+        pager->pool_memory = PAGER_POOL_HUGETLB;
+        chilog(TRACE, "Buffer pool in %zu bytes of reserved huge pages", size);
+        return;
+    }
+#endif
+
+    /* Transparent huge pages are only used for aligned 2 MB ranges, so
+     * map more than needed and trim the mapping to an aligned region */
+    addr = mmap(NULL, size + PAGER_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+    {
+        chilog(WARNING, "Could not map the buffer pool: %s", strerror(errno));
+        return;
+    }
+    size_t head = (PAGER_HUGE_PAGE_SIZE - (uintptr_t) addr % PAGER_HUGE_PAGE_SIZE) % PAGER_HUGE_PAGE_SIZE;
+    if (head > 0)
+        munmap(addr, head);
+    munmap(addr + head + size, PAGER_HUGE_PAGE_SIZE - head);
+
+    pager->pool = addr + head;
+    pager->pool_size = size;
+    pager->pool_memory = PAGER_POOL_REGION;
+#ifdef MADV_HUGEPAGE
+    if (madvise(pager->pool, size, MADV_HUGEPAGE) == 0)
+        pager->pool_memory = PAGER_POOL_THP;
+#endif
+    if (pager->pool_memory != PAGER_POOL_THP)
+        chilog(WARNING, "Huge pages are not available. Using regular pages for the buffer pool.");
 }
 
 
-/* Read the chidb file header
+/* Create the buffer pool
  *
- * This function reads in the header of a chidb file and returns it
- * in a byte array. Note that this function can be called even if
- * the page size is unknown, since the chidb header always occupies
- * the first 100 bytes of the file.
+ * Allocates the frame array and splits it among the shards (at most
+ * one per frame), each with its page table and A1out ghost list. The
+ * memory for the pages themselves is only allocated when a frame
+ * is first used (a slab of PAGER_FRAME_SLAB frames at a time). With
+ * huge_pages, the page buffers, the frame array and the page tables
+ * are all laid out in a single region of huge pages instead.
  *
  * Parameters
  * - pager: A Pager.
- * - header: Pointer to a byte array with enough space for 100 bytes.
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_NOHEADER: The file does not have a header. This will
+ * - CHIDB_ENOMEM: Could not allocate memory
  */
-int chidb_Pager_readHeader(Pager *pager, uint8_t *header)
+static int chidb_Pager_initCache(Pager *pager)
 {
-    int count;
-    count = fseek(pager->f, 0, SEEK_SET);
-    count = fread(header, 1, 100, pager->f);
-    if (count != 100)
-        return CHIDB_NOHEADER;
+    uint32_t n_shards = pager->n_shards, per_shard, nbuckets = 1, first = 0;
+    PagerFrame **page_table;
+
+    if (pager->cache_size == 0)
+        pager->cache_size = DEFAULT_CACHE_SIZE;
+
+    while (n_shards > pager->cache_size)
+        n_shards >>= 1;
+    pager->shard_bits = 0;
+    while ((1u << pager->shard_bits) < n_shards)
+        pager->shard_bits++;
+
+    per_shard = (pager->cache_size + n_shards - 1) / n_shards;
+    while (nbuckets < per_shard)
+        nbuckets <<= 1;
+
+    if (posix_memalign((void **) &pager->shards, __alignof__(PagerShard), n_shards * sizeof(PagerShard)) != 0)
+    {
+        pager->shards = NULL;
+        return CHIDB_ENOMEM;
+    }
+    memset(pager->shards, 0, n_shards * sizeof(PagerShard));
+    for(uint32_t i = 0; i < n_shards; i++)
+        pthread_mutex_init(&pager->shards[i].lock, NULL);
+
+    if (pager->huge_pages)
+        chidb_Pager_mapPool(pager, (size_t) pager->cache_size * (pager->page_size + sizeof(PagerFrame)) +
+                                   (size_t) n_shards * nbuckets * sizeof(PagerFrame *));
+    if (pager->pool != NULL)
+    {
+        /* The buffers go first, so they stay aligned to the page size */
+        pager->frames = (PagerFrame *) (pager->pool + (size_t) pager->cache_size * pager->page_size);
+        page_table = (PagerFrame **) (pager->frames + pager->cache_size);
+    }
     else
-        return CHIDB_OK;
+    {
+        pager->frames = calloc(pager->cache_size, sizeof(PagerFrame));
+        page_table = calloc((size_t) n_shards * nbuckets, sizeof(PagerFrame *));
+    }
+    pager->shards[0].page_table = page_table;
+    if (pager->frames == NULL || page_table == NULL)
+        goto nomem;
+
+    for(uint32_t i = 0; i < n_shards; i++)
+    {
+        PagerShard *shard = &pager->shards[i];
+        uint32_t a1out_buckets = 1;
+
+        /* The first cache_size % n_shards shards get an extra frame */
+        shard->max_frames = pager->cache_size / n_shards + (i < pager->cache_size % n_shards);
+        shard->frames = pager->frames + first;
+        first += shard->max_frames;
+        shard->page_table = page_table + (size_t) i * nbuckets;
+        shard->page_table_mask = nbuckets - 1;
+
+        /* Sizes recommended in the 2Q paper: A1in gets 25% of the
+         * frames, and A1out remembers as many pages as half the pool */
+        shard->a1in_max = shard->max_frames / 4 > 0? shard->max_frames / 4 : 1;
+        shard->a1out_size = shard->max_frames / 2 > 0? shard->max_frames / 2 : 1;
+        while (a1out_buckets < shard->a1out_size)
+            a1out_buckets <<= 1;
+        shard->a1out_mask = a1out_buckets - 1;
+
+        shard->slabs = calloc((shard->max_frames + PAGER_FRAME_SLAB - 1) / PAGER_FRAME_SLAB, sizeof(uint8_t *));
+        shard->a1out = calloc(shard->a1out_size, sizeof(npage_t));
+        shard->a1out_next = malloc(shard->a1out_size * sizeof(uint32_t));
+        shard->a1out_table = malloc(a1out_buckets * sizeof(uint32_t));
+        if (shard->slabs == NULL || shard->a1out == NULL || shard->a1out_next == NULL || shard->a1out_table == NULL)
+            goto nomem;
+        memset(shard->a1out_next, 0xff, shard->a1out_size * sizeof(uint32_t));
+        memset(shard->a1out_table, 0xff, a1out_buckets * sizeof(uint32_t));
+    }
+
+    return CHIDB_OK;
+
+nomem:
+    chidb_Pager_freeCache(pager);
+    return CHIDB_ENOMEM;
 }
 
 
-/* Allocate an extra page on the file
+/* Unmap the mappings that are no longer in use
  *
  * Parameters
  * - pager: A Pager.
- * - npage: An out parameter that will contain the page number of the
- *          new page.
- *
- * Return
- * - CHIDB_OK: Operation successful
+ * - all: If true, the current mapping is also unmapped.
  */
-int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
+static void chidb_Pager_unmap(Pager *pager, bool all)
 {
-    /* We simply increment the page number counter. readPage
-     * and writePage take care of the rest. */
-    *npage = ++pager->n_pages;
+    PagerMapping *m, *next;
 
-    return CHIDB_OK;
+    if (pager->map == NULL || pager->map_refs > 0)
+        return;
+
+    m = all? pager->map : pager->map->next;
+    if (all)
+        pager->map = NULL;
+    else
+        pager->map->next = NULL;
+
+    for(; m != NULL; m = next)
+    {
+        next = m->next;
+        pager->file->backend->unmap(pager->file, m->addr, m->size);
+        munmap(m->pages, (size_t) m->n_pages * sizeof(MemPage));
+        free(m);
+    }
 }
 
 
-/* Read a page from file
+/* Map the file into memory
  *
- * This page reads a page from the file, and creates an in-memory copy
- * in a MemPage struct (see header file for more details on this struct).
- * Always use chidb_Pager_releaseMemPage to free the memory allocated for
- * a MemPage created by this function.
- * Any changes done to a MemPage will not be effective until you call
- * chidb_Pager_writePage with that MemPage.
+ * Creates a new mapping covering the whole file, if the file has grown
+ * since the last one. The previous mapping is unmapped, unless some of
+ * its pages are still in use.
  *
  * Parameters
  * - pager: A Pager.
- * - npage: Page number of page to read.
- * - page: Out parameter. Used to return a pointer to newly created MemPage
  *
  * Return
- * - CHIDB_OK: Operation successful
+ * - CHIDB_OK: Operation successful (the file is not necessarily mapped:
+ *             it may be empty, or mmap may have failed, in which case
+ *             pages are read through the buffer pool)
  * - CHIDB_ENOMEM: Could not allocate memory
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
+static int chidb_Pager_remap(Pager *pager)
 {
-    if (npage > pager->n_pages || npage <= 0)
-        return CHIDB_EPAGENO;
-    int n;
+    PagerMapping *m;
+    npage_t npages = pager->db_size / pager->page_size;
 
-    *page = malloc(sizeof(MemPage));
-    if (page == NULL)
+    /* Pages in the write-ahead log are not mapped (see readPageHint) */
+    if (npages == 0 || (pager->map != NULL && pager->map->n_pages >= npages))
+        return CHIDB_OK;
+
+    if (pager->file->backend->map == NULL)
+    {
+        chilog(WARNING, "The %s backend cannot map files. Using the buffer pool instead.", pager->backend->name);
+        pager->use_mmap = false;
+        return CHIDB_OK;
+    }
+
+    m = malloc(sizeof(PagerMapping));
+    if (m == NULL)
         return CHIDB_ENOMEM;
-    (*page)->npage = npage;
-    (*page)->data = calloc(pager->page_size, 1);
-    if ((*page)->data == NULL)
+    m->n_pages = npages;
+    m->size = (size_t) npages * pager->page_size;
+
+    /* The MemPages are only filled in when they are first used (see
+     * readPageHint), and anonymous memory is zeroed by the OS as it is
+     * first touched, so mapping a large file does not go through all
+     * its pages */
+    m->pages = mmap(NULL, (size_t) npages * sizeof(MemPage), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m->pages == MAP_FAILED)
+    {
+        free(m);
         return CHIDB_ENOMEM;
-    fseek(pager->f, (npage - 1) * pager->page_size, SEEK_SET);
-    n = fread((*page)->data, 1, pager->page_size, pager->f);
-    chilog(TRACE, "Read %i bytes from page %i into memory [%x data: %x]", n, npage, *page, (*page)->data);
+    }
+
+    if (pager->file->backend->map(pager->file, m->size, &m->addr) != CHIDB_OK)
+    {
+        chilog(WARNING, "Could not map the file. Using the buffer pool instead.");
+        munmap(m->pages, (size_t) npages * sizeof(MemPage));
+        free(m);
+        pager->use_mmap = false;
+        return CHIDB_OK;
+    }
+
+    chilog(TRACE, "Mapped %i pages into memory", npages);
+    m->next = pager->map;
+    pager->map = m;
+    chidb_Pager_unmap(pager, false);
 
     return CHIDB_OK;
 }
 
 
-/* Write a page to file
+/* Check whether a MemPage points into one of the mappings */
+static bool chidb_Pager_isMapped(Pager *pager, MemPage *page)
+{
+    for(PagerMapping *m = pager->map; m != NULL; m = m->next)
+        if (page >= m->pages && page < m->pages + m->n_pages)
+            return true;
+
+    return false;
+}
+
+
+/* Set the page size
  *
- * This page writes the in-memory copy of a page (stored in a MemPage
- * struct) back to disk.
+ * This tells the pager what the size of each page is.
+ * This function must be called before operating on pages.
+ * It will not verify if the page size makes size. If an incorrect
+ * page size is provided, this will result in unexpected behaviour.
+ * Changing the page size discards the buffer pool (and the mapping
+ * of the file, if any), so it must not be called while there are
+ * pages in use. A sharded pool is created right away.
+ *
+ * With direct I/O, the page size must be a multiple of the block
+ * size that the file is accessed in. A new compressed file is
+ * compressed in blocks of the page size.
  *
  * Parameters
  * - pager: A Pager.
- * - page: In-memory copy of page to write
+ * - pagesize: Size of a page (in bytes)
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EPAGENO: The page has an incorrect page number
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_EMISUSE: The page size does not suit direct I/O on the file
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when writing dirty pages
  */
-int	chidb_Pager_writePage(Pager *pager, MemPage *page)
+int chidb_Pager_setPageSize(Pager *pager, uint32_t pagesize)
 {
-    if (page->npage > pager->n_pages)
-        return CHIDB_EPAGENO;
-    int n;
-    fseek(pager->f, (page->npage - 1) * pager->page_size, SEEK_SET);
-    n = fwrite(page->data, 1, pager->page_size, pager->f);
-    chilog(TRACE, "Wrote %i bytes to page %i", n, page->npage);
+    int rc;
+
+    /* (The backend turns direct_align to 0 if it has to give up on direct I/O) */
+    uint32_t align = pager->file->direct_align;
+    if (align != 0 && pagesize % align != 0)
+    {
+        chilog(ERROR, "Page size %u is not a multiple of the direct I/O block size (%u)", pagesize, align);
+        return CHIDB_EMISUSE;
+    }
+
+    if ((rc = chidb_Pager_flush(pager)) != CHIDB_OK)
+        return rc;
+
+    if (pager->compress)
+        chidb_Backend_setBlockSize(pager->file, pagesize);
+
+    if (pager->page_size != pagesize)
+    {
+        if (pager->wal != NULL && (rc = chidb_Pager_copyLog(pager)) != CHIDB_OK)
+            return rc;
+        chidb_Pager_freeCache(pager);
+        chidb_Pager_unmap(pager, true);
+    }
+
+    pager->page_size = pagesize;
+    chidb_Pager_getRealDBSize(pager, &pager->n_pages);
+
+    /* Readers of a sharded pool must find it already created */
+    if (pager->n_shards > 1 && pager->frames == NULL && (rc = chidb_Pager_initCache(pager)) != CHIDB_OK)
+        return rc;
+
     return CHIDB_OK;
 }
 
 
-/* Release an in-memory copy of a page
+/* Set the size of the buffer pool
+ *
+ * Sets the number of pages that the Pager will keep in memory. If this
+ * function is not called (and no "cache_size" option was given when
+ * opening the file) the pool will have DEFAULT_CACHE_SIZE frames.
+ * Resizing the pool discards it (a sharded pool is created again right
+ * away), so it must not be called while there are pages in use.
  *
  * Parameters
  * - pager: A Pager.
- * - page: In-memory copy of page to write
+ * - nframes: Number of frames in the pool
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EPAGENO: The page has an incorrect page number
+ * - CHIDB_EMISUSE: nframes is zero
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when writing dirty pages
  */
-int	chidb_Pager_releaseMemPage(Pager *pager, MemPage *page)
+int chidb_Pager_setCacheSize(Pager *pager, uint32_t nframes)
 {
-    if (page->npage > pager->n_pages)
-        return CHIDB_EPAGENO;
+    int rc;
+
+    if (nframes == 0)
+        return CHIDB_EMISUSE;
 
-    chilog(TRACE, "Releasing page %i from memory [%x data: %x]", page->npage, page, page->data);
-    free(page->data);
-    free(page);
+    if (pager->cache_size != nframes)
+    {
+        if ((rc = chidb_Pager_flush(pager)) != CHIDB_OK)
+            return rc;
+        chidb_Pager_freeCache(pager);
+    }
+
+    pager->cache_size = nframes;
+
+    if (pager->n_shards > 1 && pager->page_size != 0 && pager->frames == NULL &&
+        (rc = chidb_Pager_initCache(pager)) != CHIDB_OK)
+        return rc;
 
     return CHIDB_OK;
 }
 
 
-/* Computes the number of pages in a file.
+/* Make sure the file is at least a given size
+ *
+ * Grows the file by an extent (see the top of this file), so that
+ * writing up to offset "end" does not have to extend it.
  *
  * Parameters
  * - pager: A Pager.
- * - npages: Out parameter. Number of pages.
+ * - end: Offset of the end of the data about to be written
+ */
+static void chidb_Pager_reserve(Pager *pager, off_t end)
+{
+    off_t grow, size;
+
+    if (end <= pager->file_size || (pager->extent_size == 0 && pager->extent_pct == 0)
+        || pager->file->backend->allocate == NULL)
+        return;
+
+    grow = pager->file_size * pager->extent_pct / 100;
+    if (grow < pager->extent_size)
+        grow = pager->extent_size;
+    size = pager->file_size + grow;
+    if (size < end)
+        size = end;
+
+    /* If this fails, the write itself will extend the file */
+    if (pager->file->backend->allocate(pager->file, pager->file_size, size - pager->file_size) != CHIDB_OK)
+    {
+        chilog(WARNING, "Could not preallocate %li bytes: %s", (long) (size - pager->file_size), strerror(errno));
+        return;
+    }
+
+    chilog(TRACE, "Grew file to %li bytes", (long) size);
+    pager->file_size = size;
+}
+
+
+/* Current time, in nanoseconds (to time calls into the backend) */
+static uint64_t chidb_Pager_clock()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* Update the read counters after a read (or a batch of reads) of npages
+ * pages, totalling bytes bytes, that started at time start */
+static void chidb_Pager_countReads(Pager *pager, uint64_t start, uint32_t npages, uint64_t bytes)
+{
+    STAT_ADD(pager->read_ns, chidb_Pager_clock() - start);
+    STAT_ADD(pager->read_calls, 1);
+    STAT_ADD(pager->pages_read, npages);
+    STAT_ADD(pager->bytes_read, bytes);
+}
+
+
+/* Write a run of buffers to the file at a given offset
+ *
+ * Like the backend's write, but also grows the file (see chidb_Pager_reserve)
+ * and keeps track of its size. The iovec array may be modified.
  *
  * Return
  * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when writing to the file
  */
-int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
+static int chidb_Pager_pwritev(Pager *pager, struct iovec *iov, int iovcnt, off_t offset)
 {
-    struct stat buf;
-    fstat(fileno(pager->f), &buf);
-    *npages = buf.st_size / pager->page_size;
+    off_t end = offset;
+    uint64_t start;
+    int calls;
+
+    for(int i = 0; i < iovcnt; i++)
+        end += iov[i].iov_len;
+    chidb_Pager_reserve(pager, end);
+
+    start = chidb_Pager_clock();
+    calls = pager->file->backend->write(pager->file, iov, iovcnt, offset);
+    STAT_ADD(pager->write_ns, chidb_Pager_clock() - start);
+    if (calls < 0)
+        return CHIDB_EIO;
+    STAT_ADD(pager->write_calls, calls);
+    STAT_ADD(pager->bytes_written, end - offset);
+
+    if (end > pager->file_size)
+        pager->file_size = end;
+    if (end > pager->db_size)
+        pager->db_size = end;
 
     return CHIDB_OK;
 }
 
 
-/* Closes a pager and frees up all resources used by the pager.
- *
- * Parameters
- * - pager: A Pager.
+/* Sync a file, unless synchronous is off
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_EIO: An I/O error has occurred when syncing the file
  */
-int chidb_Pager_close(Pager *pager)
+static int chidb_Pager_sync(Pager *pager, PagerFile *file)
 {
-    fclose(pager->f);
-    free(pager);
+    if (pager->synchronous == PAGER_SYNC_OFF)
+        return CHIDB_OK;
+
+    uint64_t start = chidb_Pager_clock();
+    int rc = file->backend->sync(file);
+
+    STAT_ADD(pager->sync_ns, chidb_Pager_clock() - start);
+    STAT_ADD(pager->syncs, 1);
+    if (rc != CHIDB_OK)
+    {
+        chilog(ERROR, "Sync failed: %s", strerror(errno));
+        return CHIDB_EIO;
+    }
+
+    return CHIDB_OK;
+}
+
+
+static void chidb_Pager_addMicroseconds(struct timespec *ts, uint32_t usec)
+{
+    ts->tv_sec += usec / 1000000;
+    ts->tv_nsec += (long) (usec % 1000000) * 1000;
+    if (ts->tv_nsec >= 1000000000)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+
+static bool chidb_Pager_isBefore(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+
+/* Main loop of the syncer thread
+ *
+ * Waits until there are unsynced commits, and their deadline has
+ * passed (or the syncer is being stopped), and syncs them all.
+ */
+static void *chidb_Pager_syncerMain(void *arg)
+{
+    PagerSyncer *syncer = arg;
+    struct timespec now;
+
+    pthread_mutex_lock(&syncer->lock);
+    while (!syncer->stop || syncer->committed > syncer->synced)
+    {
+        uint64_t target;
+
+        if (syncer->committed == syncer->synced)
+        {
+            pthread_cond_wait(&syncer->cond, &syncer->lock);
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (!syncer->stop && chidb_Pager_isBefore(&now, &syncer->deadline))
+        {
+            pthread_cond_timedwait(&syncer->cond, &syncer->lock, &syncer->deadline);
+            continue;
+        }
+
+        /* Commits made while the sync runs are not covered by it */
+        target = syncer->committed;
+        pthread_mutex_unlock(&syncer->lock);
+        uint64_t start = chidb_Pager_clock();
+        int err = (syncer->file->backend->sync(syncer->file) != CHIDB_OK)? (errno? errno : EIO) : 0;
+        uint64_t elapsed = chidb_Pager_clock() - start;
+        pthread_mutex_lock(&syncer->lock);
+
+        syncer->syncs++;
+        syncer->sync_ns += elapsed;
+        syncer->synced = target;
+        if (err != 0)
+            syncer->error = err;
+        if (syncer->committed > syncer->synced)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &syncer->deadline);
+            chidb_Pager_addMicroseconds(&syncer->deadline, syncer->delay);
+        }
+    }
+    pthread_mutex_unlock(&syncer->lock);
+
+    return NULL;
+}
+
+
+/* Start the syncer thread
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory (or create the thread)
+ */
+static int chidb_Pager_startSyncer(Pager *pager)
+{
+    PagerSyncer *syncer;
+    pthread_condattr_t attr;
+
+    syncer = calloc(1, sizeof(PagerSyncer));
+    if (syncer == NULL)
+        return CHIDB_ENOMEM;
+    syncer->file = (pager->wal != NULL)? pager->wal->file : pager->file;
+    syncer->delay = pager->sync_delay;
+
+    pthread_mutex_init(&syncer->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&syncer->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&syncer->thread, NULL, chidb_Pager_syncerMain, syncer) != 0)
+    {
+        pthread_cond_destroy(&syncer->cond);
+        pthread_mutex_destroy(&syncer->lock);
+        free(syncer);
+        return CHIDB_ENOMEM;
+    }
+
+    pager->syncer = syncer;
+
+    return CHIDB_OK;
+}
+
+
+/* Stop the syncer thread, once it has synced every commit
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: A sync done by the syncer failed
+ */
+static int chidb_Pager_stopSyncer(Pager *pager)
+{
+    PagerSyncer *syncer = pager->syncer;
+    int rc;
+
+    pthread_mutex_lock(&syncer->lock);
+    syncer->stop = true;
+    pthread_cond_signal(&syncer->cond);
+    pthread_mutex_unlock(&syncer->lock);
+    pthread_join(syncer->thread, NULL);
+
+    rc = (syncer->error != 0)? CHIDB_EIO : CHIDB_OK;
+    STAT_ADD(pager->syncs, syncer->syncs);
+    STAT_ADD(pager->sync_ns, syncer->sync_ns);
+    pthread_cond_destroy(&syncer->cond);
+    pthread_mutex_destroy(&syncer->lock);
+    free(syncer);
+    pager->syncer = NULL;
+
+    return rc;
+}
+
+
+/* Make a commit durable, as set by the "synchronous" option
+ *
+ * With synchronous=normal, this only hands the commit over to the
+ * syncer thread. If a sync done by the syncer failed, the error is
+ * reported by the next commit.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not start the syncer
+ * - CHIDB_EIO: An I/O error has occurred when syncing the file
+ */
+static int chidb_Pager_syncCommit(Pager *pager)
+{
+    PagerSyncer *syncer;
+    int rc = CHIDB_OK;
+
+    pager->unsynced = false;
+
+    if (pager->synchronous != PAGER_SYNC_NORMAL)
+        return chidb_Pager_sync(pager, (pager->wal != NULL)? pager->wal->file : pager->file);
+
+    if (pager->syncer == NULL && (rc = chidb_Pager_startSyncer(pager)) != CHIDB_OK)
+        return rc;
+    syncer = pager->syncer;
+
+    pthread_mutex_lock(&syncer->lock);
+    if (syncer->error != 0)
+    {
+        chilog(ERROR, "Sync failed: %s", strerror(syncer->error));
+        syncer->error = 0;
+        rc = CHIDB_EIO;
+    }
+    if (syncer->committed++ == syncer->synced)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &syncer->deadline);
+        chidb_Pager_addMicroseconds(&syncer->deadline, syncer->delay);
+        pthread_cond_signal(&syncer->cond);
+    }
+    pthread_mutex_unlock(&syncer->lock);
+
+    return rc;
+}
+
+
+/* Write pages
+ *
+ * Pages are written in place, with runs of consecutive pages written
+ * with a single pwritev, or appended to the write-ahead log.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - pages: Pages to write (sorted by page number, for the runs of
+ *          consecutive pages to be found)
+ * - n: Number of pages
+ * - commit: Whether this completes a commit (only matters for the
+ *           write-ahead log)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when writing to the file
+ */
+static int chidb_Pager_writePages(Pager *pager, MemPage **pages, uint32_t n, bool commit)
+{
+    struct iovec *iov;
+    int rc = CHIDB_OK;
+
+    if (pager->wal != NULL)
+    {
+        npage_t db_pages = 0;
+
+        if (commit)
+        {
+            chidb_Pager_getRealDBSize(pager, &db_pages);
+            for(uint32_t i = 0; i < n; i++)
+                if (pages[i]->npage > db_pages)
+                    db_pages = pages[i]->npage;
+        }
+
+        chilog(TRACE, "Appending %i pages to the log", n);
+        pager->unsynced = true;
+        uint64_t start = chidb_Pager_clock();
+        rc = chidb_Wal_appendPages(pager->wal, pages, n, pager->page_size, db_pages);
+        STAT_ADD(pager->write_ns, chidb_Pager_clock() - start);
+        if (rc == CHIDB_OK)
+            STAT_ADD(pager->bytes_written, (uint64_t) n * pager->page_size);
+        return rc;
+    }
+
+    iov = malloc((n < IOV_MAX? n : IOV_MAX) * sizeof(struct iovec));
+    if (iov == NULL)
+        return CHIDB_ENOMEM;
+    pager->unsynced = true;
+
+    for(uint32_t start = 0, end; start < n && rc == CHIDB_OK; start = end)
+    {
+        int iovcnt = 0;
+
+        for(end = start; end < n && iovcnt < IOV_MAX; end++, iovcnt++)
+        {
+            if (end > start && pages[end]->npage != pages[end - 1]->npage + 1)
+                break;
+            iov[iovcnt].iov_base = pages[end]->data;
+            iov[iovcnt].iov_len = pager->page_size;
+        }
+
+        chilog(TRACE, "Writing pages %i-%i", pages[start]->npage, pages[end - 1]->npage);
+        if ((rc = chidb_Pager_pwritev(pager, iov, iovcnt, (off_t) (pages[start]->npage - 1) * pager->page_size)) == CHIDB_OK)
+            STAT_ADD(pager->pages_written, iovcnt);
+    }
+
+    free(iov);
+
+    return rc;
+}
+
+
+/* Read the chidb file header
+ *
+ * This function reads in the header of a chidb file and returns it
+ * in a byte array. Note that this function can be called even if
+ * the page size is unknown, since the chidb header always occupies
+ * the first 100 bytes of the file.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - header: Pointer to a byte array with enough space for 100 bytes.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_NOHEADER: The file does not have a header. This will
+ */
+int chidb_Pager_readHeader(Pager *pager, uint8_t *header)
+{
+    PagerFrame *frame;
+    uint32_t nframe;
+    ssize_t count;
+
+    /* Page 1 may not have been written to the file yet */
+    if ((frame = chidb_Pager_lookupFrame(pager, 1)) != NULL && frame->dirty)
+    {
+        memcpy(header, frame->page.data, 100);
+        return CHIDB_OK;
+    }
+
+    if (pager->wal != NULL && chidb_Wal_findFrame(pager->wal, 1, &nframe))
+    {
+        uint8_t *data = malloc(pager->wal->page_size);
+        int rc;
+
+        if (data == NULL)
+            return CHIDB_ENOMEM;
+        if ((rc = chidb_Wal_readFrame(pager->wal, nframe, data)) == CHIDB_OK)
+            memcpy(header, data, 100);
+        free(data);
+        return rc;
+    }
+
+    count = pager->file->backend->read(pager->file, header, 100, 0);
+    if (count != 100)
+        return CHIDB_NOHEADER;
+    else
+        return CHIDB_OK;
+}
+
+
+/* Enable the freelist
+ *
+ * Loads the freelist fields from the file header (which must be
+ * a valid chidb header), so that chidb_Pager_allocatePage and
+ * chidb_Pager_freePage can use the freelist. Also loads the number of
+ * pages in the file: if the file is longer than that (the space it was
+ * preallocated with was not given back, see the top of this file), the
+ * pages past it are not part of the database.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_NOHEADER: The file does not have a header
+ * - CHIDB_ECORRUPTHEADER: The freelist fields of the header are not valid
+ */
+int chidb_Pager_initFreelist(Pager *pager)
+{
+    uint8_t header[100];
+    npage_t trunk;
+    uint32_t count;
+    int rc;
+
+    if ((rc = chidb_Pager_readHeader(pager, header)) != CHIDB_OK)
+        return rc;
+
+    /* Files written before the page count was kept have a 0 there */
+    pager->header_pages = get4byte(header + FILEHEADER_NPAGES_OFFSET);
+    if (pager->header_pages > 0 && (off_t) pager->header_pages * pager->page_size < pager->db_size)
+    {
+        chilog(TRACE, "Leaving out the pages past page %i", pager->header_pages);
+        pager->db_size = (off_t) pager->header_pages * pager->page_size;
+        chidb_Pager_getRealDBSize(pager, &pager->n_pages);
+    }
+
+    trunk = get4byte(header + FILEHEADER_FREELIST_TRUNK_OFFSET);
+    count = get4byte(header + FILEHEADER_FREELIST_COUNT_OFFSET);
+    if (trunk == 1 || trunk > pager->n_pages || count >= pager->n_pages ||
+        (trunk == 0) != (count == 0))
+        return CHIDB_ECORRUPTHEADER;
+
+    pager->use_freelist = true;
+    pager->freelist_trunk = trunk;
+    pager->freelist_count = count;
+
+    return CHIDB_OK;
+}
+
+
+/* Update the page count in the file header */
+static int chidb_Pager_writeNPagesHeader(Pager *pager)
+{
+    MemPage *header;
+    int rc;
+
+    if ((rc = chidb_Pager_readPage(pager, 1, &header)) != CHIDB_OK)
+        return rc;
+    put4byte(header->data + FILEHEADER_NPAGES_OFFSET, pager->n_pages);
+    rc = chidb_Pager_writePage(pager, header);
+    chidb_Pager_releaseMemPage(pager, header);
+    if (rc == CHIDB_OK)
+        pager->header_pages = pager->n_pages;
+
+    return rc;
+}
+
+
+/* Update the freelist fields of the file header */
+static int chidb_Pager_writeFreelistHeader(Pager *pager)
+{
+    MemPage *header;
+    int rc;
+
+    if ((rc = chidb_Pager_readPage(pager, 1, &header)) != CHIDB_OK)
+        return rc;
+    put4byte(header->data + FILEHEADER_FREELIST_TRUNK_OFFSET, pager->freelist_trunk);
+    put4byte(header->data + FILEHEADER_FREELIST_COUNT_OFFSET, pager->freelist_count);
+    rc = chidb_Pager_writePage(pager, header);
+    chidb_Pager_releaseMemPage(pager, header);
+
+    return rc;
+}
+
+
+/* Allocate a page
+ *
+ * Takes a page from the freelist if there are any free pages. Otherwise,
+ * allocates an extra page at the end of the file. Either way, the
+ * contents of the page are undefined until it is written.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: An out parameter that will contain the page number of the
+ *          new page.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPTHEADER: The freelist is corrupted
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
+{
+    MemPage *trunk;
+    uint32_t nleaves;
+    int rc;
+
+    if (!pager->use_freelist || pager->freelist_count == 0)
+    {
+        /* We simply increment the page number counter. readPage
+         * and writePage take care of the rest. */
+        *npage = ++pager->n_pages;
+        return CHIDB_OK;
+    }
+
+    if ((rc = chidb_Pager_readPage(pager, pager->freelist_trunk, &trunk)) != CHIDB_OK)
+        return rc;
+
+    nleaves = get4byte(trunk->data + FREELIST_NLEAVES_OFFSET);
+    if (nleaves > (pager->page_size - FREELIST_LEAVES_OFFSET) / 4)
+    {
+        chidb_Pager_releaseMemPage(pager, trunk);
+        return CHIDB_ECORRUPTHEADER;
+    }
+
+    if (nleaves > 0)
+    {
+        /* Take the last leaf of the first trunk page */
+        *npage = get4byte(trunk->data + FREELIST_LEAVES_OFFSET + (nleaves - 1) * 4);
+        put4byte(trunk->data + FREELIST_NLEAVES_OFFSET, nleaves - 1);
+        rc = chidb_Pager_writePage(pager, trunk);
+    }
+    else
+    {
+        /* The trunk page is empty, so it is the page we hand out */
+        *npage = trunk->npage;
+        pager->freelist_trunk = get4byte(trunk->data + FREELIST_NEXT_OFFSET);
+    }
+    chidb_Pager_releaseMemPage(pager, trunk);
+
+    if (rc != CHIDB_OK)
+        return rc;
+    if (*npage <= 1 || *npage > pager->n_pages)
+        return CHIDB_ECORRUPTHEADER;
+
+    pager->freelist_count--;
+    chilog(TRACE, "Reusing free page %i", *npage);
+
+    return chidb_Pager_writeFreelistHeader(pager);
+}
+
+
+/* Allocate a page at the end of the file
+ *
+ * Same as chidb_Pager_allocatePage, but never takes a page from the
+ * freelist, so pages allocated one after the other are consecutive in
+ * the file (which is what the B-Tree bulk loader wants).
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: An out parameter that will contain the page number of the
+ *          new page.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_appendPage(Pager *pager, npage_t *npage)
+{
+    *npage = ++pager->n_pages;
+    return CHIDB_OK;
+}
+
+
+/* Return a page to the freelist
+ *
+ * The page will be reused by chidb_Pager_allocatePage. The caller must
+ * not be using the page, and there must be no references to it left
+ * in the file.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page to free
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page number is not valid (page 1 can't be freed)
+ * - CHIDB_EMISUSE: The freelist is not enabled
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_freePage(Pager *pager, npage_t npage)
+{
+    MemPage *page, *trunk;
+    uint32_t nleaves;
+    int rc;
+
+    if (!pager->use_freelist)
+        return CHIDB_EMISUSE;
+    if (npage <= 1 || npage > pager->n_pages)
+        return CHIDB_EPAGENO;
+
+    /* Free pages are zeroed out. This also makes sure they are in the
+     * file, even if they were allocated but never written. */
+    if ((rc = chidb_Pager_readPage(pager, npage, &page)) != CHIDB_OK)
+        return rc;
+    memset(page->data, 0, pager->page_size);
+
+    if (pager->freelist_trunk != 0)
+    {
+        if ((rc = chidb_Pager_readPage(pager, pager->freelist_trunk, &trunk)) != CHIDB_OK)
+        {
+            chidb_Pager_releaseMemPage(pager, page);
+            return rc;
+        }
+
+        /* Add the page as a leaf of the first trunk page, if it fits */
+        nleaves = get4byte(trunk->data + FREELIST_NLEAVES_OFFSET);
+        if (nleaves < (pager->page_size - FREELIST_LEAVES_OFFSET) / 4)
+        {
+            put4byte(trunk->data + FREELIST_LEAVES_OFFSET + nleaves * 4, npage);
+            put4byte(trunk->data + FREELIST_NLEAVES_OFFSET, nleaves + 1);
+            if ((rc = chidb_Pager_writePage(pager, trunk)) == CHIDB_OK)
+                rc = chidb_Pager_writePage(pager, page);
+            chidb_Pager_releaseMemPage(pager, trunk);
+            chidb_Pager_releaseMemPage(pager, page);
+            if (rc != CHIDB_OK)
+                return rc;
+
+            pager->freelist_count++;
+            return chidb_Pager_writeFreelistHeader(pager);
+        }
+        chidb_Pager_releaseMemPage(pager, trunk);
+    }
+
+    /* Otherwise, the page becomes the first trunk page */
+    put4byte(page->data + FREELIST_NEXT_OFFSET, pager->freelist_trunk);
+    rc = chidb_Pager_writePage(pager, page);
+    chidb_Pager_releaseMemPage(pager, page);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    pager->freelist_trunk = npage;
+    pager->freelist_count++;
+
+    return chidb_Pager_writeFreelistHeader(pager);
+}
+
+
+/* Find a frame in the buffer pool
+ *
+ * This does not take the lock of the page's shard: frames are never
+ * freed while the pool exists, and the links of the page tables are
+ * read and written atomically, so the worst that can happen (in a
+ * sharded pool) is finding a frame that is being reused for another
+ * page, or missing a frame that is being added. chidb_Pager_pinFrame
+ * tells the first case apart.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number
+ *
+ * Return
+ * - The frame holding page npage, or NULL if it is not in the pool.
+ */
+static PagerFrame *chidb_Pager_lookupFrame(Pager *pager, npage_t npage)
+{
+    PagerFrame *frame;
+
+    if (pager->frames == NULL)
+        return NULL;
+
+    for(frame = __atomic_load_n(pageTableBucket(pagerShard(pager, npage), npage), __ATOMIC_ACQUIRE);
+        frame != NULL; frame = __atomic_load_n(&frame->hash_next, __ATOMIC_ACQUIRE))
+        if (__atomic_load_n(&frame->page.npage, __ATOMIC_RELAXED) == npage)
+            return frame;
+
+    return NULL;
+}
+
+
+/* Pin a frame found with chidb_Pager_lookupFrame (sharded pool only)
+ *
+ * Fails if the frame is being evicted, or if it turns out to hold
+ * another page once it is pinned (it was evicted and reused after it
+ * was found). A pinned frame cannot be evicted, so its page does not
+ * change after this check.
+ *
+ * Parameters
+ * - frame: Frame to pin
+ * - npage: Page that the frame should hold
+ *
+ * Return
+ * - true if the frame was pinned, false otherwise
+ */
+static bool chidb_Pager_pinFrame(PagerFrame *frame, npage_t npage)
+{
+    uint32_t pins = __atomic_load_n(&frame->pin_count, __ATOMIC_RELAXED);
+
+    do
+    {
+        if (pins == PAGER_FRAME_EVICTING)
+            return false;
+    } while (!__atomic_compare_exchange_n(&frame->pin_count, &pins, pins + 1, true,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    if (__atomic_load_n(&frame->page.npage, __ATOMIC_RELAXED) != npage)
+    {
+        __atomic_fetch_sub(&frame->pin_count, 1, __ATOMIC_RELEASE);
+        return false;
+    }
+
+    return true;
+}
+
+
+static void chidb_Pager_listRemove(PagerFrameList *list, PagerFrame *frame)
+{
+    if (frame->prev)
+        frame->prev->next = frame->next;
+    else
+        list->head = frame->next;
+
+    if (frame->next)
+        frame->next->prev = frame->prev;
+    else
+        list->tail = frame->prev;
+
+    frame->prev = frame->next = NULL;
+}
+
+
+static void chidb_Pager_listAppend(PagerFrameList *list, PagerFrame *frame)
+{
+    frame->next = NULL;
+    frame->prev = list->tail;
+    if (list->tail)
+        list->tail->next = frame;
+    else
+        list->head = frame;
+    list->tail = frame;
+}
+
+
+#define frameList(shard, frame) ((frame)->queue == PAGER_QUEUE_AM? &(shard)->am : &(shard)->a1in)
+
+
+/* Remove a page from the A1out ghost list, if it is there
+ *
+ * Return
+ * - true if the page was in A1out, false otherwise
+ */
+static bool chidb_Pager_a1outRemove(PagerShard *shard, npage_t npage)
+{
+    uint32_t *p;
+
+    for(p = &shard->a1out_table[npage & shard->a1out_mask]; *p != A1OUT_NONE; p = &shard->a1out_next[*p])
+        if (shard->a1out[*p] == npage)
+        {
+            uint32_t i = *p;
+            *p = shard->a1out_next[i];
+            shard->a1out_next[i] = A1OUT_NONE;
+            shard->a1out[i] = 0;
+            return true;
+        }
+
+    return false;
+}
+
+
+/* Remember a page that has been evicted from A1in
+ *
+ * A1out is a ring, so this forgets the oldest page in it.
+ */
+static void chidb_Pager_a1outAdd(PagerShard *shard, npage_t npage)
+{
+    uint32_t i = shard->a1out_pos;
+
+    if (shard->a1out[i] != 0)
+        chidb_Pager_a1outRemove(shard, shard->a1out[i]);
+
+    shard->a1out[i] = npage;
+    shard->a1out_next[i] = shard->a1out_table[npage & shard->a1out_mask];
+    shard->a1out_table[npage & shard->a1out_mask] = i;
+    shard->a1out_pos = (i + 1) % shard->a1out_size;
+}
+
+
+/* Add a frame to its shard's page table. The frame's page number must
+ * be set (and, in a sharded pool, its pin count too) beforehand, since
+ * other threads can find it as soon as it is in the table. */
+static void chidb_Pager_pageTableInsert(PagerShard *shard, PagerFrame *frame)
+{
+    PagerFrame **bucket = pageTableBucket(shard, frame->page.npage);
+
+    __atomic_store_n(&frame->hash_next, *bucket, __ATOMIC_RELAXED);
+    __atomic_store_n(bucket, frame, __ATOMIC_RELEASE);
+}
+
+
+/* Remove a frame from its shard's page table. The frame keeps its link
+ * to the next frame in the bucket, so a thread that is looking at it
+ * (see chidb_Pager_lookupFrame) can go on with the rest of the bucket. */
+static void chidb_Pager_pageTableRemove(PagerShard *shard, PagerFrame *frame)
+{
+    PagerFrame **p;
+
+    for(p = pageTableBucket(shard, frame->page.npage); *p != NULL; p = &(*p)->hash_next)
+        if (*p == frame)
+        {
+            __atomic_store_n(p, frame->hash_next, __ATOMIC_RELEASE);
+            break;
+        }
+}
+
+
+/* Take a frame out of the pool, forgetting its page
+ *
+ * The frame must be unpinned and clean. It is removed from its queue
+ * and from the page table, and pages evicted from A1in (other than by
+ * a scan) are remembered in A1out.
+ */
+static void chidb_Pager_evictFrame(Pager *pager, PagerShard *shard, PagerFrame *victim)
+{
+    chilog(TRACE, "Evicting page %i from the buffer pool", victim->page.npage);
+    if (victim->page.npage != 0)
+        STAT_ADD(pager->evictions, 1);
+    chidb_Pager_listRemove(frameList(shard, victim), victim);
+    chidb_Pager_pageTableRemove(shard, victim);
+    if (victim->queue == PAGER_QUEUE_A1IN)
+    {
+        shard->a1in_frames--;
+        if (!victim->scan)
+            chidb_Pager_a1outAdd(shard, victim->page.npage);
+    }
+}
+
+
+/* Pick a frame to evict in a sharded pool
+ *
+ * In a sharded pool, frames stay in their queue while they are pinned
+ * (pinning a frame does not take the shard's lock), and a frame that
+ * is read again only gets its "referenced" flag set. So the queues are
+ * walked from the head, as in CLOCK: a referenced frame gets a second
+ * chance at the tail of Am (which, for a frame in A1in, is the same
+ * promotion as in chidb_Pager_readPageHint), and pinned frames are
+ * moved to the tail of their queue. Dirty frames are skipped too:
+ * writing them here could race with the other threads reading the
+ * file, so they wait for chidb_Pager_flush.
+ *
+ * Must be called with the shard's lock held. The victim is taken out
+ * of the pool with a pin count of PAGER_FRAME_EVICTING, so threads that
+ * found it before it was taken out of the page table cannot pin it.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - shard: Shard to evict from
+ *
+ * Return
+ * - The victim, or NULL if every frame in the shard is pinned or dirty
+ */
+static PagerFrame *chidb_Pager_evictShared(Pager *pager, PagerShard *shard)
+{
+    uint32_t skipped_a1in = 0, skipped_am = 0;
+
+    for(uint32_t tries = 0; tries < 4 * shard->n_frames; tries++)
+    {
+        uint32_t am_frames = shard->n_frames - shard->a1in_frames, unpinned = 0;
+        bool a1in_ok = shard->a1in.head != NULL && skipped_a1in < shard->a1in_frames;
+        bool am_ok = shard->am.head != NULL && skipped_am < am_frames;
+        PagerFrameList *list;
+        PagerFrame *victim;
+
+        if (a1in_ok && (shard->a1in_frames > shard->a1in_max || !am_ok))
+            list = &shard->a1in;
+        else if (am_ok)
+            list = &shard->am;
+        else
+            break;
+        victim = list->head;
+
+        if (__atomic_exchange_n(&victim->referenced, false, __ATOMIC_RELAXED))
+        {
+            chidb_Pager_listRemove(list, victim);
+            if (victim->queue == PAGER_QUEUE_A1IN)
+            {
+                victim->queue = PAGER_QUEUE_AM;
+                victim->scan = false;
+                shard->a1in_frames--;
+            }
+            chidb_Pager_listAppend(&shard->am, victim);
+            continue;
+        }
+
+        if (victim->dirty ||
+            !__atomic_compare_exchange_n(&victim->pin_count, &unpinned, PAGER_FRAME_EVICTING, false,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            chidb_Pager_listRemove(list, victim);
+            chidb_Pager_listAppend(list, victim);
+            if (list == &shard->a1in)
+                skipped_a1in++;
+            else
+                skipped_am++;
+            continue;
+        }
+
+        chidb_Pager_evictFrame(pager, shard, victim);
+        return victim;
+    }
+
+    return NULL;
+}
+
+
+/* Get a frame to read a page into
+ *
+ * Returns an unused frame of the shard if there are any left. Otherwise,
+ * a frame is evicted following the 2Q policy: the oldest unpinned frame
+ * in A1in if A1in is over its target size (or there is nothing else to
+ * evict), and the least recently used unpinned frame in Am otherwise. If
+ * the evicted page is dirty, it is written to the file first. (A sharded
+ * pool approximates this, see chidb_Pager_evictShared.)
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - shard: Shard of the page that will be read into the frame
+ * - frame: Out parameter. A frame that is not in the page table, or NULL
+ *          if every frame is pinned (or there is not enough memory for a
+ *          new frame)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when writing the evicted page
+ */
+static int chidb_Pager_getFreeFrame(Pager *pager, PagerShard *shard, PagerFrame **frame)
+{
+    PagerFrame *victim;
+    int rc;
+
+    *frame = NULL;
+
+    if (shard->n_frames < shard->max_frames)
+    {
+        uint32_t nslab = shard->n_frames / PAGER_FRAME_SLAB;
+        size_t slot = shard->n_frames % PAGER_FRAME_SLAB;
+
+        victim = &shard->frames[shard->n_frames];
+        if (pager->pool != NULL)
+        {
+            victim->page.data = pager->pool + (size_t) (victim - pager->frames) * pager->page_size;
+            shard->n_frames++;
+            *frame = victim;
+            return CHIDB_OK;
+        }
+
+        /* The buffers are aligned to the page size, so a page never
+         * straddles two (OS) pages more than it has to */
+        if (slot == 0)
+        {
+            uint32_t n = shard->max_frames - shard->n_frames;
+            if (n > PAGER_FRAME_SLAB)
+                n = PAGER_FRAME_SLAB;
+            if (posix_memalign((void **) &shard->slabs[nslab], pager->page_size, (size_t) n * pager->page_size) != 0)
+            {
+                shard->slabs[nslab] = NULL;
+                return CHIDB_OK;
+            }
+        }
+
+        victim->page.data = shard->slabs[nslab] + slot * pager->page_size;
+        shard->n_frames++;
+        *frame = victim;
+        return CHIDB_OK;
+    }
+
+    if (pager->shard_bits > 0)
+    {
+        *frame = chidb_Pager_evictShared(pager, shard);
+        return CHIDB_OK;
+    }
+
+    if (shard->a1in.head != NULL && (shard->a1in_frames > shard->a1in_max || shard->am.head == NULL))
+        victim = shard->a1in.head;
+    else
+        victim = shard->am.head;
+
+    if (victim == NULL)
+        return CHIDB_OK;
+
+    if (victim->dirty)
+    {
+        MemPage *page = &victim->page;
+        if ((rc = chidb_Pager_writePages(pager, &page, 1, false)) != CHIDB_OK)
+            return rc;
+        victim->dirty = false;
+        pager->n_dirty--;
+    }
+
+    chidb_Pager_evictFrame(pager, shard, victim);
+    *frame = victim;
+    return CHIDB_OK;
+}
+
+
+/* Allocate a buffer that pages are read into (or written from), aligned
+ * for direct I/O if the file is accessed that way. Freed with free. */
+static void *chidb_Pager_allocBuffer(Pager *pager, size_t size)
+{
+    uint32_t align = pager->file->direct_align;
+    void *buf;
+
+    if (align == 0)
+        return malloc(size);
+
+    return (posix_memalign(&buf, align, size) == 0)? buf : NULL;
+}
+
+
+/* Read a page from the file into a buffer
+ *
+ * Bytes past the end of the file (i.e., pages that have been allocated
+ * but not written yet) are read as zeroes. If the page is in the
+ * write-ahead log, it is read from the log.
+ */
+static int chidb_Pager_readFromFile(Pager *pager, npage_t npage, uint8_t *data)
+{
+    uint64_t start = chidb_Pager_clock();
+    uint32_t frame;
+    ssize_t n;
+    int rc;
+
+    if (pager->wal != NULL && chidb_Wal_findFrame(pager->wal, npage, &frame))
+    {
+        chilog(TRACE, "Reading page %i from frame %i of the log", npage, frame);
+        if ((rc = chidb_Wal_readFrame(pager->wal, frame, data)) == CHIDB_OK)
+            chidb_Pager_countReads(pager, start, 1, pager->page_size);
+        return rc;
+    }
+
+    n = pager->file->backend->read(pager->file, data, pager->page_size, (off_t) (npage - 1) * pager->page_size);
+    if (n < 0)
+        return CHIDB_EIO;
+    chidb_Pager_countReads(pager, start, 1, n);
+    memset(data + n, 0, pager->page_size - n);
+
+    chilog(TRACE, "Read %i bytes from page %i into memory [data: %x]", n, npage, data);
+
+    return CHIDB_OK;
+}
+
+
+/* Read ahead, if npage continues a run of ascending reads
+ *
+ * Called for every page read (see the top of this file).
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page being read
+ */
+static void chidb_Pager_readahead(Pager *pager, npage_t npage)
+{
+    npage_t start, end;
+    uint32_t window;
+
+    if (pager->readahead_max == 0 || pager->use_mmap || npage == pager->ra_last)
+        return;
+
+    if (npage > pager->ra_last && npage <= pager->ra_last + PAGER_READAHEAD_GAP)
+    {
+        pager->ra_run++;
+        pager->ra_stray = false;
+    }
+    else if (pager->ra_run > 0 && !pager->ra_stray)
+    {
+        /* A single read elsewhere (e.g., a cursor going back to the
+         * parent of the leaves it is scanning) does not end the run */
+        pager->ra_stray = true;
+        return;
+    }
+    else
+    {
+        pager->ra_run = 0;
+        pager->ra_stray = false;
+        pager->ra_window = 0;
+        pager->ra_end = 0;
+    }
+    pager->ra_last = npage;
+
+    /* Wait until the run is long enough, and then until the reader
+     * is halfway through the current window */
+    if (pager->ra_run < PAGER_READAHEAD_TRIGGER ||
+        (pager->ra_end != 0 && npage + pager->ra_window / 2 < pager->ra_end))
+        return;
+
+    window = pager->ra_window? pager->ra_window * 2 : PAGER_READAHEAD_MIN;
+    if (window > pager->readahead_max)
+        window = pager->readahead_max;
+    /* (chidb_Pager_prefetchPages reads at most this many pages at once) */
+    if (pager->file->backend->readBatch != NULL && window > pager->cache_size / 2)
+        window = pager->cache_size / 2;
+
+    start = (npage + 1 > pager->ra_end)? npage + 1 : pager->ra_end;
+    if (window == 0 || start > pager->n_pages)
+        return;
+    end = (pager->n_pages - start >= window)? start + window : pager->n_pages + 1;
+
+    pager->ra_window = window;
+    pager->ra_end = end;
+    STAT_ADD(pager->readaheads, 1);
+    STAT_ADD(pager->pages_read_ahead, end - start);
+    chilog(TRACE, "Reading ahead pages %i to %i", start, end - 1);
+
+    /* Readahead is only a hint, so errors are ignored */
+    if (pager->file->backend->readBatch != NULL)
+    {
+        npage_t npages[end - start];
+
+        for(npage_t i = start; i < end; i++)
+            npages[i - start] = i;
+        chidb_Pager_prefetchPages(pager, npages, end - start, PAGER_HINT_SCAN);
+    }
+    else if (pager->file->backend->willNeed != NULL)
+        pager->file->backend->willNeed(pager->file, (off_t) (start - 1) * pager->page_size,
+                                       (off_t) (end - start) * pager->page_size);
+}
+
+
+/* Read a page into a private MemPage, which is freed when it is
+ * released. Used when every frame of the buffer pool is pinned. */
+static int chidb_Pager_readPrivate(Pager *pager, npage_t npage, MemPage **page)
+{
+    int rc;
+
+    *page = malloc(sizeof(MemPage));
+    if (*page == NULL)
+        return CHIDB_ENOMEM;
+    (*page)->npage = npage;
+    (*page)->data = chidb_Pager_allocBuffer(pager, pager->page_size);
+    if ((*page)->data == NULL)
+    {
+        free(*page);
+        return CHIDB_ENOMEM;
+    }
+    if ((rc = chidb_Pager_readFromFile(pager, npage, (*page)->data)) != CHIDB_OK)
+    {
+        free((*page)->data);
+        free(*page);
+        return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Read a page through a sharded buffer pool
+ *
+ * See chidb_Pager_readPageHint. A page that is in the pool is found and
+ * pinned without taking any lock, and a hit only sets the frame's
+ * "referenced" flag (the queues are updated lazily, when the shard
+ * looks for a frame to evict). Otherwise, the page is read into a frame
+ * with the shard's lock held, so two threads that miss on the same page
+ * read it only once, while threads reading pages of other shards go on
+ * unhindered. The frame only goes into the page table once it holds
+ * the page.
+ */
+static int chidb_Pager_readShared(Pager *pager, npage_t npage, pager_hint_t hint, MemPage **page)
+{
+    PagerShard *shard = pagerShard(pager, npage);
+    PagerFrame *frame;
+    int rc;
+
+    if ((frame = chidb_Pager_lookupFrame(pager, npage)) != NULL && chidb_Pager_pinFrame(frame, npage))
+        goto hit;
+
+    pthread_mutex_lock(&shard->lock);
+
+    /* Another thread may have read the page in the meantime (and, with
+     * the lock held, a frame in the page table can always be pinned) */
+    if ((frame = chidb_Pager_lookupFrame(pager, npage)) != NULL && chidb_Pager_pinFrame(frame, npage))
+    {
+        pthread_mutex_unlock(&shard->lock);
+        goto hit;
+    }
+
+    STAT_ADD(shard->cache_misses, 1);
+    if ((rc = chidb_Pager_getFreeFrame(pager, shard, &frame)) != CHIDB_OK || frame == NULL)
+    {
+        pthread_mutex_unlock(&shard->lock);
+        return (rc == CHIDB_OK)? chidb_Pager_readPrivate(pager, npage, page) : rc;
+    }
+
+    if ((rc = chidb_Pager_readFromFile(pager, npage, frame->page.data)) != CHIDB_OK)
+    {
+        __atomic_store_n(&frame->page.npage, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&frame->pin_count, 0, __ATOMIC_RELEASE);
+        frame->queue = PAGER_QUEUE_A1IN;
+        frame->scan = true;
+        shard->a1in_frames++;
+        chidb_Pager_listAppend(&shard->a1in, frame);
+        pthread_mutex_unlock(&shard->lock);
+        return rc;
+    }
+
+    if (hint != PAGER_HINT_SCAN && chidb_Pager_a1outRemove(shard, npage))
+        frame->queue = PAGER_QUEUE_AM;
+    else
+    {
+        frame->queue = PAGER_QUEUE_A1IN;
+        shard->a1in_frames++;
+    }
+    frame->scan = (hint == PAGER_HINT_SCAN);
+    __atomic_store_n(&frame->referenced, false, __ATOMIC_RELAXED);
+    chidb_Pager_listAppend(frameList(shard, frame), frame);
+
+    /* A thread that found the frame under its old page number sees the
+     * new one as soon as it can pin it */
+    __atomic_store_n(&frame->page.npage, npage, __ATOMIC_RELAXED);
+    __atomic_store_n(&frame->pin_count, 1, __ATOMIC_RELEASE);
+    chidb_Pager_pageTableInsert(shard, frame);
+
+    pthread_mutex_unlock(&shard->lock);
+    *page = &frame->page;
+    return CHIDB_OK;
+
+hit:
+    STAT_ADD(shard->cache_hits, 1);
+    if (hint != PAGER_HINT_SCAN && !__atomic_load_n(&frame->referenced, __ATOMIC_RELAXED))
+        __atomic_store_n(&frame->referenced, true, __ATOMIC_RELAXED);
+    *page = &frame->page;
+    return CHIDB_OK;
+}
+
+
+/* Read a page from file
+ *
+ * This page reads a page from the file (or from the buffer pool, if it is
+ * already in memory) and returns a MemPage struct (see header file for more
+ * details on this struct) pinned in the buffer pool.
+ * Always use chidb_Pager_releaseMemPage to unpin a MemPage returned
+ * by this function.
+ * Any changes done to a MemPage will not be effective until you call
+ * chidb_Pager_writePage with that MemPage.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number of page to read.
+ * - page: Out parameter. Used to return a pointer to the MemPage
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
+{
+    return chidb_Pager_readPageHint(pager, npage, PAGER_HINT_NONE, page);
+}
+
+
+/* Read a page from file, with a hint on how it will be used
+ *
+ * Same as chidb_Pager_readPage, but the caller can tell the Pager
+ * that the page is being read as part of a sequential scan
+ * (PAGER_HINT_SCAN). Such pages are kept in the probationary part
+ * of the buffer pool, so they don't push out frequently used pages.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number of page to read.
+ * - hint: PAGER_HINT_NONE or PAGER_HINT_SCAN
+ * - page: Out parameter. Used to return a pointer to the MemPage
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int	chidb_Pager_readPageHint(Pager *pager, npage_t npage, pager_hint_t hint, MemPage **page)
+{
+    PagerShard *shard;
+    PagerFrame *frame;
+    uint32_t nframe;
+    int rc;
+
+    if (npage > pager->n_pages || npage <= 0)
+        return CHIDB_EPAGENO;
+
+    if (pager->frames == NULL && (rc = chidb_Pager_initCache(pager)) != CHIDB_OK)
+        return rc;
+
+    if (pager->shard_bits > 0)
+        return chidb_Pager_readShared(pager, npage, hint, page);
+
+    chidb_Pager_readahead(pager, npage);
+
+    shard = pagerShard(pager, npage);
+    if ((frame = chidb_Pager_lookupFrame(pager, npage)) != NULL)
+    {
+        STAT_ADD(pager->cache_hits, 1);
+        if (frame->pin_count++ == 0)
+            chidb_Pager_listRemove(frameList(shard, frame), frame);
+
+        /* A page in A1in that is referenced again (other than by
+         * a scan) has proven to be worth keeping */
+        if (hint != PAGER_HINT_SCAN && frame->queue == PAGER_QUEUE_A1IN)
+        {
+            frame->queue = PAGER_QUEUE_AM;
+            frame->scan = false;
+            shard->a1in_frames--;
+        }
+        *page = &frame->page;
+        return CHIDB_OK;
+    }
+
+    /* The mapping only has the version of the page that is in the file */
+    if (pager->use_mmap && (pager->wal == NULL || !chidb_Wal_findFrame(pager->wal, npage, &nframe)))
+    {
+        if ((pager->map == NULL || npage > pager->map->n_pages) &&
+            (rc = chidb_Pager_remap(pager)) != CHIDB_OK)
+            return rc;
+
+        if (pager->map != NULL && npage <= pager->map->n_pages)
+        {
+            MemPage *mapped = &pager->map->pages[npage - 1];
+            if (mapped->data == NULL)
+            {
+                mapped->npage = npage;
+                mapped->data = pager->map->addr + (size_t) (npage - 1) * pager->page_size;
+            }
+            pager->map_refs++;
+            *page = mapped;
+            return CHIDB_OK;
+        }
+    }
+
+    STAT_ADD(pager->cache_misses, 1);
+    if ((rc = chidb_Pager_getFreeFrame(pager, shard, &frame)) != CHIDB_OK)
+        return rc;
+    if (frame == NULL)
+        return chidb_Pager_readPrivate(pager, npage, page);
+
+    if ((rc = chidb_Pager_readFromFile(pager, npage, frame->page.data)) != CHIDB_OK)
+    {
+        /* The frame is not in the page table, so it can go
+         * straight back into the list of unpinned frames */
+        frame->page.npage = 0;
+        frame->queue = PAGER_QUEUE_A1IN;
+        frame->scan = true;
+        shard->a1in_frames++;
+        chidb_Pager_listAppend(&shard->a1in, frame);
+        return rc;
+    }
+
+    /* Pages that were evicted from A1in not too long ago go
+     * straight into Am. Everything else starts out in A1in. */
+    if (hint != PAGER_HINT_SCAN && chidb_Pager_a1outRemove(shard, npage))
+        frame->queue = PAGER_QUEUE_AM;
+    else
+    {
+        frame->queue = PAGER_QUEUE_A1IN;
+        shard->a1in_frames++;
+    }
+    frame->scan = (hint == PAGER_HINT_SCAN);
+    frame->page.npage = npage;
+    frame->pin_count = 1;
+    chidb_Pager_pageTableInsert(shard, frame);
+    *page = &frame->page;
+    return CHIDB_OK;
+}
+
+
+/* Read several pages into the buffer pool at once
+ *
+ * Reads the pages that are not in the buffer pool yet with a single
+ * batch of reads, so the backend can have all of them in flight at the
+ * same time (see readBatch in backend.h), instead of reading them one
+ * by one as they are requested. The pages are left unpinned in A1in,
+ * so a later chidb_Pager_readPageHint finds them in the pool.
+ *
+ * This is only a hint: it does nothing if the backend cannot batch
+ * reads, or if the pages are read through the file's mapping. Pages
+ * in the write-ahead log are skipped, and at most half of the buffer
+ * pool is used, so the pages are not evicted before they are read.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npages: Page numbers of the pages to read
+ * - n: Number of pages
+ * - hint: How the pages will be used (see chidb_Pager_readPageHint)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_prefetchPages(Pager *pager, const npage_t *npages, uint32_t n, pager_hint_t hint)
+{
+    PagerReadRequest *reqs;
+    PagerFrame **frames;
+    uint32_t count = 0, nframe;
+    int rc = CHIDB_OK;
+
+    if (pager->file->backend->readBatch == NULL || pager->use_mmap || pager->n_shards > 1)
+        return CHIDB_OK;
+
+    if (pager->frames == NULL && (rc = chidb_Pager_initCache(pager)) != CHIDB_OK)
+        return rc;
+
+    if (n > pager->cache_size / 2)
+        n = pager->cache_size / 2;
+    if (n == 0)
+        return CHIDB_OK;
+
+    reqs = malloc(n * sizeof(PagerReadRequest));
+    frames = malloc(n * sizeof(PagerFrame *));
+    if (reqs == NULL || frames == NULL)
+    {
+        free(reqs);
+        free(frames);
+        return CHIDB_ENOMEM;
+    }
+
+    for(uint32_t i = 0; i < n; i++)
+    {
+        npage_t npage = npages[i];
+        PagerShard *shard = pagerShard(pager, npage);
+        PagerFrame *frame;
+
+        if (npage == 0 || npage > pager->n_pages || chidb_Pager_lookupFrame(pager, npage) != NULL ||
+            (pager->wal != NULL && chidb_Wal_findFrame(pager->wal, npage, &nframe)))
+            continue;
+
+        if ((rc = chidb_Pager_getFreeFrame(pager, shard, &frame)) != CHIDB_OK)
+            break;
+        if (frame == NULL)
+            break;
+
+        /* Put the frame in the page table right away, so a page that is
+         * in npages twice is only read once. The frame is not in any
+         * list, so it cannot be evicted while the batch is built. */
+        frame->page.npage = npage;
+        frame->pin_count = 0;
+        chidb_Pager_pageTableInsert(shard, frame);
+
+        frames[count] = frame;
+        reqs[count].buf = frame->page.data;
+        reqs[count].count = pager->page_size;
+        reqs[count].offset = (off_t) (npage - 1) * pager->page_size;
+        count++;
+    }
+
+    uint64_t start = chidb_Pager_clock(), bytes = 0;
+    if (count > 0 && pager->file->backend->readBatch(pager->file, reqs, count) != CHIDB_OK)
+    {
+        for(uint32_t i = 0; i < count; i++)
+            reqs[i].result = -1;
+        rc = CHIDB_EIO;
+    }
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        PagerFrame *frame = frames[i];
+        PagerShard *shard = pagerShard(pager, frame->page.npage);
+
+        /* Pages that could not be read are dropped (and will be read
+         * again when they are requested) */
+        if (reqs[i].result < 0)
+        {
+            chidb_Pager_pageTableRemove(shard, frame);
+            frame->page.npage = 0;
+            rc = CHIDB_EIO;
+        }
+        else
+        {
+            memset(frame->page.data + reqs[i].result, 0, pager->page_size - reqs[i].result);
+            bytes += reqs[i].result;
+        }
+
+        frame->queue = PAGER_QUEUE_A1IN;
+        frame->scan = (hint == PAGER_HINT_SCAN) || frame->page.npage == 0;
+        shard->a1in_frames++;
+        chidb_Pager_listAppend(&shard->a1in, frame);
+    }
+
+    if (count > 0)
+    {
+        chilog(TRACE, "Prefetched %u pages", count);
+        chidb_Pager_countReads(pager, start, count, bytes);
+        STAT_ADD(pager->read_batches, 1);
+        STAT_ADD(pager->pages_prefetched, count);
+    }
+
+    free(reqs);
+    free(frames);
+
+    return rc;
+}
+
+
+/* Write a page to file
+ *
+ * This page writes the in-memory copy of a page (stored in a MemPage
+ * struct) back to disk. The write is deferred: the page is marked as
+ * dirty in the buffer pool, and will be written by chidb_Pager_flush
+ * (or when its frame is evicted). The MemPage does not have to be one
+ * returned by chidb_Pager_readPage; if it isn't, it is copied into the
+ * buffer pool, or written right away if every frame is pinned.
+ * Pages that point into the file's mapping are also written right away,
+ * so the mapping (which stays in use for that page) never holds an older
+ * version of the page than the one in the file.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - page: In-memory copy of page to write
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page has an incorrect page number
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int	chidb_Pager_writePage(Pager *pager, MemPage *page)
+{
+    PagerShard *shard;
+    PagerFrame *frame;
+    int rc;
+
+    if (page->npage > pager->n_pages || page->npage <= 0)
+        return CHIDB_EPAGENO;
+
+    if (pager->frames == NULL && (rc = chidb_Pager_initCache(pager)) != CHIDB_OK)
+        return rc;
+
+    if (isFrame(pager, page))
+        frame = (PagerFrame *) page;
+    else if ((frame = chidb_Pager_lookupFrame(pager, page->npage)) == NULL)
+    {
+        shard = pagerShard(pager, page->npage);
+        if (chidb_Pager_isMapped(pager, page))
+            frame = NULL;
+        else if ((rc = chidb_Pager_getFreeFrame(pager, shard, &frame)) != CHIDB_OK)
+            return rc;
+
+        if (frame == NULL)
+        {
+            chilog(TRACE, "Writing page %i (not in the buffer pool)", page->npage);
+            return chidb_Pager_writePages(pager, &page, 1, false);
+        }
+
+        frame->page.npage = page->npage;
+        frame->pin_count = 0;
+        frame->queue = PAGER_QUEUE_A1IN;
+        frame->scan = false;
+        frame->referenced = false;
+        frame->dirty = false;
+        chidb_Pager_pageTableInsert(shard, frame);
+        shard->a1in_frames++;
+        chidb_Pager_listAppend(&shard->a1in, frame);
+    }
+
+    if (&frame->page != page)
+        memcpy(frame->page.data, page->data, pager->page_size);
+
+    if (!frame->dirty)
+    {
+        frame->dirty = true;
+        pager->n_dirty++;
+    }
+    chilog(TRACE, "Page %i marked dirty", page->npage);
+
+    return CHIDB_OK;
+}
+
+
+static int chidb_Pager_compareFrames(const void *a, const void *b)
+{
+    npage_t x = (*(PagerFrame **) a)->page.npage, y = (*(PagerFrame **) b)->page.npage;
+
+    return (x > y) - (x < y);
+}
+
+
+/* Write all the dirty pages to the file
+ *
+ * If the file has grown since the last flush, the page count
+ * in the file header is updated first, so it is written along with the
+ * new pages. Dirty pages are written in page number order. Each run of
+ * consecutive pages is written with a single pwritev. In WAL mode, the pages are
+ * appended to the log, and the last frame is marked as a commit frame.
+ * The commit is then synced as set by the "synchronous" option. If the
+ * log has reached its checkpoint threshold, the log is checkpointed.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when writing to the file
+ */
+int chidb_Pager_flush(Pager *pager)
+{
+    PagerFrame **dirty;
+    MemPage **pages;
+    uint32_t n = 0;
+    int rc = CHIDB_OK;
+
+    if (pager->use_freelist && pager->header_pages != pager->n_pages
+        && (rc = chidb_Pager_writeNPagesHeader(pager)) != CHIDB_OK)
+        return rc;
+
+    if (pager->n_dirty > 0)
+    {
+        dirty = malloc(pager->n_dirty * sizeof(PagerFrame *));
+        pages = malloc(pager->n_dirty * sizeof(MemPage *));
+        if (dirty == NULL || pages == NULL)
+        {
+            free(dirty);
+            free(pages);
+            return CHIDB_ENOMEM;
+        }
+
+        for(uint32_t i = 0; i < (1u << pager->shard_bits); i++)
+        {
+            PagerShard *shard = &pager->shards[i];
+
+            for(uint32_t f = 0; f < shard->n_frames; f++)
+                if (shard->frames[f].dirty)
+                    dirty[n++] = &shard->frames[f];
+        }
+        assert(n == pager->n_dirty);
+        qsort(dirty, n, sizeof(PagerFrame *), chidb_Pager_compareFrames);
+        for(uint32_t i = 0; i < n; i++)
+            pages[i] = &dirty[i]->page;
+
+        if ((rc = chidb_Pager_writePages(pager, pages, n, true)) == CHIDB_OK)
+            for(uint32_t i = 0; i < n; i++)
+                dirty[i]->dirty = false;
+        if (rc == CHIDB_OK)
+            pager->n_dirty = 0;
+
+        free(dirty);
+        free(pages);
+    }
+    else if (pager->wal != NULL && pager->wal->n_committed < pager->wal->n_frames)
+    {
+        /* Pages evicted from the buffer pool since the last commit */
+        npage_t db_pages;
+        chidb_Pager_getRealDBSize(pager, &db_pages);
+        rc = chidb_Wal_commit(pager->wal, db_pages);
+    }
+
+    if (rc == CHIDB_OK && pager->unsynced)
+        rc = chidb_Pager_syncCommit(pager);
+
+    if (rc == CHIDB_OK && pager->wal != NULL && pager->wal->n_frames >= pager->wal_autocheckpoint)
+        rc = chidb_Pager_copyLog(pager);
+
+    return rc;
+}
+
+
+static int chidb_Pager_compareLogPages(const void *a, const void *b)
+{
+    npage_t x = ((PagerLogPage *) a)->npage, y = ((PagerLogPage *) b)->npage;
+
+    return (x > y) - (x < y);
+}
+
+
+/* Copy the write-ahead log into the file
+ *
+ * Writes the latest version of every page in the log to the file, in
+ * page number order, and starts the log over. The log must end with a
+ * commit frame. This is not done while there are pages from the file's
+ * mapping in use, since the file is mapped again afterwards (the
+ * mapping may hold an outdated private copy of the pages that were
+ * written through it).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (or deferred)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the files
+ */
+static int chidb_Pager_copyLog(Pager *pager)
+{
+    Wal *wal = pager->wal;
+    uint32_t page_size = wal->page_size;
+    uint32_t n = 0, batch;
+    PagerLogPage *log;
+    struct iovec *iov;
+    uint8_t *buf;
+    int rc = CHIDB_OK;
+
+    if (wal->n_frames == 0)
+        return CHIDB_OK;
+    if (pager->map_refs > 0)
+    {
+        chilog(TRACE, "Checkpoint deferred (mapped pages in use)");
+        return CHIDB_OK;
+    }
+    assert(wal->n_committed == wal->n_frames);
+
+    /* The log must be on disk before the file is overwritten, so
+     * that a crash during the checkpoint can be recovered from */
+    if ((rc = chidb_Pager_sync(pager, wal->file)) != CHIDB_OK)
+        return rc;
+
+    batch = (wal->n_indexed < PAGER_CHECKPOINT_BATCH)? wal->n_indexed : PAGER_CHECKPOINT_BATCH;
+    log = malloc(wal->n_indexed * sizeof(PagerLogPage));
+    iov = malloc(batch * sizeof(struct iovec));
+    buf = chidb_Pager_allocBuffer(pager, (size_t) batch * page_size);
+    if (log == NULL || iov == NULL || buf == NULL)
+    {
+        free(log);
+        free(iov);
+        free(buf);
+        return CHIDB_ENOMEM;
+    }
+
+    for(uint32_t i = 0; i <= wal->index_mask; i++)
+        if (wal->index[i] != 0)
+        {
+            log[n].frame = wal->index[i];
+            log[n].npage = wal->frame_pages[wal->index[i] - 1];
+            n++;
+        }
+    assert(n == wal->n_indexed);
+    qsort(log, n, sizeof(PagerLogPage), chidb_Pager_compareLogPages);
+
+    chilog(TRACE, "Checkpointing %i pages (%i frames)", n, wal->n_frames);
+    for(uint32_t start = 0, end; start < n && rc == CHIDB_OK; start = end)
+    {
+        int iovcnt = 0;
+
+        for(end = start; end < n && iovcnt < batch; end++, iovcnt++)
+        {
+            PagerFrame *frame = chidb_Pager_lookupFrame(pager, log[end].npage);
+
+            if (end > start && log[end].npage != log[end - 1].npage + 1)
+                break;
+            iov[iovcnt].iov_len = page_size;
+
+            /* A clean page in the buffer pool is the same as the
+             * latest version in the log, so it need not be read */
+            if (frame != NULL && !frame->dirty && page_size == pager->page_size)
+                iov[iovcnt].iov_base = frame->page.data;
+            else
+            {
+                uint64_t start_read = chidb_Pager_clock();
+
+                iov[iovcnt].iov_base = buf + (size_t) iovcnt * page_size;
+                if ((rc = chidb_Wal_readFrame(wal, log[end].frame, iov[iovcnt].iov_base)) != CHIDB_OK)
+                    break;
+                chidb_Pager_countReads(pager, start_read, 1, page_size);
+            }
+        }
+
+        if (rc == CHIDB_OK &&
+            (rc = chidb_Pager_pwritev(pager, iov, iovcnt, (off_t) (log[start].npage - 1) * page_size)) == CHIDB_OK)
+            STAT_ADD(pager->pages_written, iovcnt);
+    }
+
+    free(log);
+    free(iov);
+    free(buf);
+
+    if (rc != CHIDB_OK || (rc = chidb_Pager_sync(pager, pager->file)) != CHIDB_OK)
+        return rc;
+
+    chidb_Pager_unmap(pager, true);
+
+    return chidb_Wal_reset(wal);
+}
+
+
+/* Checkpoint the write-ahead log
+ *
+ * Commits the dirty pages, and copies the latest version of every page
+ * in the write-ahead log into the file (see chidb_Pager_copyLog). Does
+ * nothing if the Pager is not in WAL mode.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the files
+ */
+int chidb_Pager_checkpoint(Pager *pager)
+{
+    int rc;
+
+    if ((rc = chidb_Pager_flush(pager)) != CHIDB_OK || pager->wal == NULL)
+        return rc;
+
+    return chidb_Pager_copyLog(pager);
+}
+
+
+/* Save the database to a file
+ *
+ * Writes an image of the database (after committing any pending
+ * changes and checkpointing the log) to a new file, which can then be
+ * opened like any other database file. The image is written with a
+ * single sequential write. This is meant for ":memory:" databases,
+ * but works with any backend.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - filename: File to write the image to. If it exists, it is replaced.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the files
+ */
+int chidb_Pager_serialize(Pager *pager, const char *filename)
+{
+    const PagerBackend *backend = &chidb_Backend_file;
+    PagerFile *file;
+    struct iovec iov;
+    uint8_t *image = NULL;
+    int rc;
+
+    if ((rc = chidb_Pager_checkpoint(pager)) != CHIDB_OK)
+        return rc;
+
+    /* The memory backend's buffer already is the image */
+    if (pager->file->backend == &chidb_Backend_memory)
+        iov.iov_base = ((PagerMemoryFile *) pager->file)->data;
+    else
+    {
+        if (pager->db_size > 0 && (image = chidb_Pager_allocBuffer(pager, pager->db_size)) == NULL)
+            return CHIDB_ENOMEM;
+        if (pager->file->backend->read(pager->file, image, pager->db_size, 0) != pager->db_size)
+        {
+            free(image);
+            return CHIDB_EIO;
+        }
+        iov.iov_base = image;
+    }
+    iov.iov_len = pager->db_size;
+
+    if ((rc = backend->open(backend, filename, PAGER_OPEN_CREATE, NULL, &file)) != CHIDB_OK)
+    {
+        free(image);
+        return (rc == CHIDB_ENOMEM)? rc : CHIDB_EIO;
+    }
+
+    if (backend->truncate(file, 0) != CHIDB_OK ||
+        (iov.iov_len > 0 && backend->write(file, &iov, 1, 0) < 0) ||
+        backend->sync(file) != CHIDB_OK)
+        rc = CHIDB_EIO;
+    if (backend->close(file, false) != CHIDB_OK)
+        rc = CHIDB_EIO;
+
+    chilog(TRACE, "Serialized %li bytes to %s", (long) pager->db_size, filename);
+    free(image);
+
+    return rc;
+}
+
+
+/* Release an in-memory copy of a page
+ *
+ * Unpins a page returned by chidb_Pager_readPage. The page stays in the
+ * buffer pool until its frame is needed for another page.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - page: In-memory copy of page to write
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page has an incorrect page number
+ */
+int	chidb_Pager_releaseMemPage(Pager *pager, MemPage *page)
+{
+    if (page->npage > pager->n_pages)
+        return CHIDB_EPAGENO;
+
+    if (isFrame(pager, page))
+    {
+        PagerFrame *frame = (PagerFrame *) page;
+
+        /* In a sharded pool, unpinned frames never leave their queue */
+        if (pager->shard_bits > 0)
+        {
+            uint32_t pins = __atomic_fetch_sub(&frame->pin_count, 1, __ATOMIC_RELEASE);
+            assert(pins > 0 && pins != PAGER_FRAME_EVICTING);
+            (void) pins;
+        }
+        else
+        {
+            assert(frame->pin_count > 0);
+            if (--frame->pin_count == 0)
+                chidb_Pager_listAppend(frameList(pagerShard(pager, page->npage), frame), frame);
+        }
+    }
+    else if (chidb_Pager_isMapped(pager, page))
+    {
+        assert(pager->map_refs > 0);
+        if (--pager->map_refs == 0)
+            chidb_Pager_unmap(pager, false);
+    }
+    else
+    {
+        chilog(TRACE, "Releasing page %i from memory [%x data: %x]", page->npage, page, page->data);
+        free(page->data);
+        free(page);
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Computes the number of pages in a file.
+ *
+ * This is the logical size of the file, which does not include the
+ * space that has been preallocated for pages that are yet to be written,
+ * but does include pages that are only in the write-ahead log.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npages: Out parameter. Number of pages.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
+{
+    *npages = pager->db_size / pager->page_size;
+    if (pager->wal != NULL && pager->wal->max_page > *npages)
+        *npages = pager->wal->max_page;
 
     return CHIDB_OK;
 }
+
+
+/* Get the Pager's I/O statistics
+ *
+ * Includes the hits and misses counted by the shards of a sharded
+ * buffer pool, the writes to the write-ahead log, and the syncs done
+ * by the syncer thread. Can be called from another thread while the Pager
+ * is in use (each counter is read atomically, but they are not read
+ * all at the same time).
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - stats: Out parameter. Statistics.
+ */
+void chidb_Pager_getStats(Pager *pager, chidb_stats_t *stats)
+{
+    stats->cache_hits = STAT_LOAD(pager->cache_hits);
+    stats->cache_misses = STAT_LOAD(pager->cache_misses);
+    for(uint32_t i = 0; pager->shards != NULL && i < (1u << pager->shard_bits); i++)
+    {
+        stats->cache_hits += STAT_LOAD(pager->shards[i].cache_hits);
+        stats->cache_misses += STAT_LOAD(pager->shards[i].cache_misses);
+    }
+    stats->evictions = STAT_LOAD(pager->evictions);
+    stats->pages_read = STAT_LOAD(pager->pages_read);
+    stats->bytes_read = STAT_LOAD(pager->bytes_read);
+    stats->read_calls = STAT_LOAD(pager->read_calls);
+    stats->read_ns = STAT_LOAD(pager->read_ns);
+    stats->pages_written = STAT_LOAD(pager->pages_written);
+    stats->bytes_written = STAT_LOAD(pager->bytes_written);
+    stats->write_calls = STAT_LOAD(pager->write_calls);
+    stats->write_ns = STAT_LOAD(pager->write_ns);
+    stats->syncs = STAT_LOAD(pager->syncs);
+    stats->sync_ns = STAT_LOAD(pager->sync_ns);
+
+    if (pager->wal != NULL)
+    {
+        stats->pages_written += STAT_LOAD(pager->wal->frames_written);
+        stats->write_calls += STAT_LOAD(pager->wal->write_calls);
+    }
+
+    if (pager->syncer != NULL)
+    {
+        pthread_mutex_lock(&pager->syncer->lock);
+        stats->syncs += pager->syncer->syncs;
+        stats->sync_ns += pager->syncer->sync_ns;
+        pthread_mutex_unlock(&pager->syncer->lock);
+    }
+}
+
+
+/* Set the Pager's I/O statistics back to zero
+ *
+ * Parameters
+ * - pager: A Pager.
+ */
+void chidb_Pager_resetStats(Pager *pager)
+{
+    STAT_RESET(pager->cache_hits);
+    STAT_RESET(pager->cache_misses);
+    for(uint32_t i = 0; pager->shards != NULL && i < (1u << pager->shard_bits); i++)
+    {
+        STAT_RESET(pager->shards[i].cache_hits);
+        STAT_RESET(pager->shards[i].cache_misses);
+    }
+    STAT_RESET(pager->evictions);
+    STAT_RESET(pager->pages_read);
+    STAT_RESET(pager->bytes_read);
+    STAT_RESET(pager->read_calls);
+    STAT_RESET(pager->read_ns);
+    STAT_RESET(pager->pages_written);
+    STAT_RESET(pager->bytes_written);
+    STAT_RESET(pager->write_calls);
+    STAT_RESET(pager->write_ns);
+    STAT_RESET(pager->syncs);
+    STAT_RESET(pager->sync_ns);
+
+    if (pager->wal != NULL)
+    {
+        STAT_RESET(pager->wal->frames_written);
+        STAT_RESET(pager->wal->write_calls);
+    }
+
+    if (pager->syncer != NULL)
+    {
+        pthread_mutex_lock(&pager->syncer->lock);
+        pager->syncer->syncs = 0;
+        pager->syncer->sync_ns = 0;
+        pthread_mutex_unlock(&pager->syncer->lock);
+    }
+}
+
+
+/* Closes a pager and frees up all resources used by the pager.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_close(Pager *pager)
+{
+    int rc;
+
+    rc = chidb_Pager_flush(pager);
+    pager->map_refs = 0;
+    if (pager->wal != NULL && rc == CHIDB_OK)
+        rc = chidb_Pager_copyLog(pager);
+    if (pager->syncer != NULL && chidb_Pager_stopSyncer(pager) != CHIDB_OK && rc == CHIDB_OK)
+        rc = CHIDB_EIO;
+    if (pager->wal != NULL)
+    {
+        if (chidb_Wal_close(pager->wal) != CHIDB_OK && rc == CHIDB_OK)
+            rc = CHIDB_EIO;
+    }
+    chidb_Pager_freeCache(pager);
+    chidb_Pager_unmap(pager, true);
+
+    /* Give back the space preallocated at the end of the file */
+    if (rc == CHIDB_OK && pager->file_size > pager->db_size
+        && pager->file->backend->truncate(pager->file, pager->db_size) != CHIDB_OK)
+        rc = CHIDB_EIO;
+    if (pager->file->backend->close(pager->file, false) != CHIDB_OK)
+        rc = CHIDB_EIO;
+    free(pager);
+
+    return rc;
+}
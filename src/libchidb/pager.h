@@ -40,8 +40,28 @@
 #ifndef PAGER_H_
 #define PAGER_H_
 
-#include <stdio.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <time.h>
+#include <chidb/stats.h>
 #include "chidbInt.h"
+#include "backend.h"
+#include "wal.h"
+
+/* Filename that opens an in-memory database */
+#define PAGER_MEMORY_FILENAME ":memory:"
+
+/* Number of pages in the file, as of the last flush (0 if unknown) */
+#define FILEHEADER_NPAGES_OFFSET (28)
+
+/* Freelist fields of the file header */
+#define FILEHEADER_FREELIST_TRUNK_OFFSET (32)
+#define FILEHEADER_FREELIST_COUNT_OFFSET (36)
+
+/* Freelist trunk page layout */
+#define FREELIST_NEXT_OFFSET (0)
+#define FREELIST_NLEAVES_OFFSET (4)
+#define FREELIST_LEAVES_OFFSET (8)
 
 struct MemPage
 {
@@ -50,21 +70,232 @@ struct MemPage
 };
 typedef struct MemPage MemPage;
 
+/* Hints that a caller can give the Pager about how a page will be used */
+typedef enum pager_hint
+{
+    PAGER_HINT_NONE = 0,  /* Regular access */
+    PAGER_HINT_SCAN = 1   /* Page is read once as part of a sequential scan */
+} pager_hint_t;
+
+/* Durability levels ("synchronous" open option, see pager.c) */
+typedef enum pager_sync
+{
+    PAGER_SYNC_OFF    = 0,  /* Never wait for writes to reach the disk */
+    PAGER_SYNC_NORMAL = 1,  /* Commits are synced in groups, within sync_delay */
+    PAGER_SYNC_FULL   = 2   /* Every commit is synced before it returns */
+} pager_sync_t;
+
+/* Replacement queues of the buffer pool (see pager.c) */
+typedef enum pager_queue
+{
+    PAGER_QUEUE_A1IN = 0,  /* Probationary FIFO for pages read only once */
+    PAGER_QUEUE_AM   = 1   /* LRU for pages that have been re-referenced */
+} pager_queue_t;
+
+/* Memory that holds the page buffers of the buffer pool (see pager.c) */
+typedef enum pager_pool_memory
+{
+    PAGER_POOL_SLABS   = 0,  /* Allocated PAGER_FRAME_SLAB buffers at a time */
+    PAGER_POOL_REGION  = 1,  /* A single region, in regular pages */
+    PAGER_POOL_THP     = 2,  /* A single region, in transparent huge pages */
+    PAGER_POOL_HUGETLB = 3   /* A single region, in reserved huge pages */
+} pager_pool_memory_t;
+
+/* A frame in the Pager's buffer pool. The MemPage must be the first
+ * field, since the Pager hands out pointers to it and needs to get
+ * back to the enclosing frame when the page is written or released. */
+typedef struct PagerFrame
+{
+    MemPage page;                  /* Page held in this frame */
+    uint32_t pin_count;            /* Number of outstanding readPage's (or PAGER_FRAME_EVICTING) */
+    pager_queue_t queue;           /* Queue the frame belongs to */
+    bool scan;                     /* Page was brought in by a scan */
+    bool referenced;               /* Read since it was last considered for eviction (sharded pool only) */
+    bool dirty;                    /* Page has not been written to the file */
+    struct PagerFrame *hash_next;  /* Next frame in the same hash bucket */
+    struct PagerFrame *prev;       /* Position in its queue, if unpinned (or always, in a sharded pool) */
+    struct PagerFrame *next;
+} PagerFrame;
+
+/* A read-only view of the file, mapped with the backend's map. The pager hands out
+ * MemPages that point straight into the mapping. When the file grows,
+ * a new mapping is created; older mappings that still have pages in
+ * use are kept in a list until they are no longer needed. */
+typedef struct PagerMapping
+{
+    uint8_t *addr;
+    size_t size;
+    MemPage *pages;                /* One MemPage per page in the mapping (filled in when first used) */
+    npage_t n_pages;
+    struct PagerMapping *next;     /* Older mappings still in use */
+} PagerMapping;
+
+/* Background thread that syncs commits in groups (PAGER_SYNC_NORMAL).
+ * Commits are counted, and the thread syncs all the commits made so far
+ * once the oldest unsynced commit has waited for "delay" microseconds. */
+typedef struct PagerSyncer
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    PagerFile *file;               /* File to sync */
+    uint32_t delay;
+    uint64_t committed;            /* Commits so far */
+    uint64_t synced;               /* Commits known to be on disk */
+    struct timespec deadline;      /* When the oldest unsynced commit must be synced */
+    bool stop;
+    int error;                     /* errno of a failed sync (0 if none) */
+    uint64_t syncs;                /* Syncs done */
+    uint64_t sync_ns;              /* Time spent in those syncs */
+} PagerSyncer;
+
+/* A list of unpinned frames, in replacement order (head goes first) */
+typedef struct PagerFrameList
+{
+    PagerFrame *head;
+    PagerFrame *tail;
+} PagerFrameList;
+
+/* A part of the buffer pool, with the frames of the pages that hash to
+ * it (see pager.c). Only one thread at a time can look at or change its
+ * replacement state, but (in a sharded pool) its page table can be
+ * searched by any thread without taking the lock. */
+typedef struct PagerShard
+{
+    pthread_mutex_t lock;
+    PagerFrame *frames;            /* This shard's part of the frame array */
+    uint32_t max_frames;
+    uint32_t n_frames;             /* Number of frames handed out so far */
+    uint8_t **slabs;               /* Page buffers of the frames (PAGER_FRAME_SLAB per slab) */
+    PagerFrame **page_table;       /* Hash table: page number -> frame */
+    uint32_t page_table_mask;
+
+    /* 2Q replacement state */
+    PagerFrameList a1in;           /* Unpinned frames in A1in */
+    PagerFrameList am;             /* Unpinned frames in Am */
+    uint32_t a1in_frames;          /* Frames in A1in (pinned or not) */
+    uint32_t a1in_max;             /* Target size of A1in */
+    npage_t *a1out;                /* Ring of pages recently evicted from A1in */
+    uint32_t *a1out_next;          /* Hash chains over a1out (by ring index) */
+    uint32_t *a1out_table;         /* Hash table: page number -> ring index */
+    uint32_t a1out_size;
+    uint32_t a1out_pos;
+    uint32_t a1out_mask;
+
+    /* Hits and misses in a sharded pool (see chidb_Pager_getStats), on
+     * a cache line of their own, so counting a hit does not get in the
+     * way of the threads looking at the shard's page table */
+    uint64_t cache_hits __attribute__((aligned(64)));
+    uint64_t cache_misses;
+} PagerShard;
+
 struct Pager
 {
-    FILE *f;
+    const PagerBackend *backend;   /* "backend" open option */
+    PagerBackendOptions backend_options;
+    PagerFile *file;
     npage_t n_pages;
-    uint16_t page_size;
+    uint32_t page_size;
+    uint32_t new_page_size;        /* Page size of a new file ("page_size" option) */
+
+    /* File size. The file is grown in extents, so it can be larger
+     * than the part of it that has actually been written. */
+    off_t file_size;               /* Physical size, in bytes */
+    off_t db_size;                 /* Logical size (end of the last page written) */
+    uint32_t extent_size;          /* Minimum growth, in bytes (0: page by page) */
+    uint32_t extent_pct;           /* Minimum growth, as a % of file_size */
+
+    /* Buffer pool. The frame array and the shards are created the
+     * first time a page is read, once the page size is known (or, in
+     * a sharded pool, as soon as the page size is set). */
+    uint32_t cache_size;           /* Number of frames (0: not set yet) */
+    PagerFrame *frames;
+    bool huge_pages;               /* Put the page buffers in huge pages ("huge_pages" option) */
+    pager_pool_memory_t pool_memory;
+    uint8_t *pool;                 /* Region with all the page buffers (not PAGER_POOL_SLABS) */
+    size_t pool_size;
+    uint32_t n_shards;             /* "shards" option (a power of two) */
+    uint32_t shard_bits;           /* log2(n_shards) */
+    PagerShard *shards;
+    uint32_t n_dirty;              /* Number of dirty frames */
+
+    /* Freelist (only used once chidb_Pager_initFreelist is called) */
+    bool use_freelist;
+    npage_t freelist_trunk;        /* First trunk page, or 0 */
+    uint32_t freelist_count;       /* Free pages (trunk pages included) */
+    npage_t header_pages;          /* Number of pages stored in the file header */
+
+    /* Direct I/O ("direct" open option). Only set if the backend
+     * actually does direct I/O on the file (see backend.c) */
+    bool use_direct;
+
+    /* Pages are compressed in the file ("compress" open option, or
+     * a compressed file). file is then the compressed layer. */
+    bool compress;
+
+    /* mmap access ("mmap" open option) */
+    bool use_mmap;
+    PagerMapping *map;             /* Current mapping, or NULL */
+    uint32_t map_refs;             /* MemPages from any mapping in use */
+
+    /* Write-ahead log ("wal" open option) */
+    bool use_wal;
+    Wal *wal;                      /* NULL if pages are written in place */
+    uint32_t wal_autocheckpoint;   /* Log size (in frames) that triggers a checkpoint */
+
+    /* Sequential readahead ("readahead" open option) */
+    uint32_t readahead_max;        /* Largest window, in pages (0: off) */
+    npage_t ra_last;               /* Last page read */
+    uint32_t ra_run;               /* Ascending reads in a row */
+    bool ra_stray;                 /* Last read was not part of the run */
+    uint32_t ra_window;            /* Current window, in pages (0: not reading ahead) */
+    npage_t ra_end;                /* First page after the pages read ahead */
+
+    /* Durability ("synchronous" and "sync_delay" open options) */
+    pager_sync_t synchronous;
+    uint32_t sync_delay;           /* Group commit window, in microseconds */
+    bool unsynced;                 /* Pages written since the last commit */
+    PagerSyncer *syncer;           /* Started on the first commit (NORMAL only) */
+
+    /* Counters (updated with STAT_ADD, see chidb_Pager_getStats) */
+    uint64_t cache_hits;           /* (A sharded pool counts these in its shards) */
+    uint64_t cache_misses;
+    uint64_t evictions;
+    uint64_t pages_read;           /* Pages read from the file or the log */
+    uint64_t bytes_read;
+    uint64_t read_calls;
+    uint64_t read_ns;              /* Time spent in those reads */
+    uint64_t pages_written;        /* Pages written to the file */
+    uint64_t bytes_written;        /* Bytes written to the file or the log */
+    uint64_t write_calls;          /* Write system calls */
+    uint64_t write_ns;             /* Time spent writing to the file or the log */
+    uint64_t syncs;                /* Syncs (not counting the syncer's) */
+    uint64_t sync_ns;
+    uint64_t read_batches;         /* Batches of reads (chidb_Pager_prefetchPages) */
+    uint64_t pages_prefetched;     /* Pages read in those batches */
+    uint64_t readaheads;           /* Readahead windows */
+    uint64_t pages_read_ahead;     /* Pages in those windows */
 };
 typedef struct Pager Pager;
 
 int chidb_Pager_open(Pager **pager, const char *filename);
-int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize);
+int chidb_Pager_setPageSize(Pager *pager, uint32_t pagesize);
+int chidb_Pager_setCacheSize(Pager *pager, uint32_t nframes);
 int chidb_Pager_readHeader(Pager *pager, uint8_t *header);
+int chidb_Pager_initFreelist(Pager *pager);
 int chidb_Pager_allocatePage(Pager *pager, npage_t *npage);
+int chidb_Pager_appendPage(Pager *pager, npage_t *npage);
+int chidb_Pager_freePage(Pager *pager, npage_t npage);
 int chidb_Pager_releaseMemPage(Pager *pager, MemPage *page);
 int	chidb_Pager_readPage(Pager *pager, npage_t page_num, MemPage **page);
+int	chidb_Pager_readPageHint(Pager *pager, npage_t page_num, pager_hint_t hint, MemPage **page);
+int chidb_Pager_prefetchPages(Pager *pager, const npage_t *npages, uint32_t n, pager_hint_t hint);
 int chidb_Pager_writePage(Pager *pager, MemPage *page);
+int chidb_Pager_flush(Pager *pager);
+void chidb_Pager_getStats(Pager *pager, chidb_stats_t *stats);
+void chidb_Pager_resetStats(Pager *pager);
+int chidb_Pager_checkpoint(Pager *pager);
+int chidb_Pager_serialize(Pager *pager, const char *filename);
 int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages);
 int chidb_Pager_close(Pager *pager);
 
@@ -99,6 +99,7 @@ int chidb_DBRecord_create_empty(DBRecordBuffer *dbrb, uint8_t nfields)
     dbrb->header_size = 1;
 
     dbrb->dbr->nfields = nfields;
+    dbrb->dbr->view = false;
     dbrb->dbr->types = malloc(dbrb->dbr->nfields * sizeof(uint32_t));
     dbrb->dbr->offsets = malloc(dbrb->dbr->nfields * sizeof(uint32_t));
     dbrb->dbr->data = malloc(dbrb->buf_size);
@@ -270,7 +271,9 @@ int chidb_DBRecord_finalize(DBRecordBuffer *dbrb, DBRecord **dbr)
 }
 
 
-/* Create a DBRecord from a raw binary database record
+/* Parse the header of a raw binary database record
+ *
+ * Fills in everything in a new DBRecord except its data.
  *
  * Parameters
  * - dbr: Out paremeter used to return a pointer to a DBRecord.
@@ -280,17 +283,26 @@ int chidb_DBRecord_finalize(DBRecordBuffer *dbrb, DBRecord **dbr)
  * - CHIDB_OK: Operation successful
  * - CHIDB_ENOMEM: Could not allocate memory
  */
-int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
+static int chidb_DBRecord_unpackHeader(DBRecord **dbr, uint8_t *raw)
 {
     *dbr = malloc(sizeof(DBRecord));
-    if (dbr == NULL)
+    if (*dbr == NULL)
         return CHIDB_ENOMEM;
 
     (*dbr)->nfields = 0;
+    (*dbr)->data = NULL;
+    (*dbr)->offsets = NULL;
+    (*dbr)->view = false;
 
     uint8_t header_size = raw[0];
     uint8_t header_pos = 1;
     (*dbr)->types = malloc(0xFF * sizeof(uint32_t));
+    if ((*dbr)->types == NULL)
+    {
+        free(*dbr);
+        *dbr = NULL;
+        return CHIDB_ENOMEM;
+    }
     while(header_pos < header_size)
     {
         if (raw[header_pos] & 0x80)
@@ -311,7 +323,11 @@ int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
     uint32_t offset = 0;
     (*dbr)->offsets = malloc((*dbr)->nfields * sizeof(uint32_t));
     if ((*dbr)->offsets == NULL)
+    {
+        chidb_DBRecord_destroy(*dbr);
+        *dbr = NULL;
         return CHIDB_ENOMEM;
+    }
     for(int i=0; i<(*dbr)->nfields; i++)
     {
         (*dbr)->offsets[i] = offset;
@@ -334,10 +350,66 @@ int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
 
     (*dbr)->data_len = offset;
     (*dbr)->packed_len = header_size + offset;
-    (*dbr)->data = malloc(offset);
+
+    return CHIDB_OK;
+}
+
+
+/* Create a DBRecord from a raw binary database record
+ *
+ * Parameters
+ * - dbr: Out paremeter used to return a pointer to a DBRecord.
+ * - raw: Pointer to first byte of raw binary database record
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
+{
+    int rc;
+
+    if ((rc = chidb_DBRecord_unpackHeader(dbr, raw)) != CHIDB_OK)
+        return rc;
+
+    (*dbr)->data = malloc((*dbr)->data_len);
     if ((*dbr)->data == NULL)
+    {
+        chidb_DBRecord_destroy(*dbr);
+        *dbr = NULL;
         return CHIDB_ENOMEM;
-    memcpy((*dbr)->data, raw + header_size, (*dbr)->data_len);
+    }
+    memcpy((*dbr)->data, raw + raw[0], (*dbr)->data_len);
+
+    return CHIDB_OK;
+}
+
+
+/* Create a DBRecord that reads its fields from a raw binary database record
+ *
+ * Same as chidb_DBRecord_unpack, but the values are not copied: the
+ * DBRecord reads them straight from the raw record, which is usually
+ * in a page pinned with chidb_Btree_findView. The raw record must not
+ * be released (or modified) until the DBRecord is destroyed, which
+ * does not free it.
+ *
+ * Parameters
+ * - dbr: Out paremeter used to return a pointer to a DBRecord.
+ * - raw: Pointer to first byte of raw binary database record
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_unpackView(DBRecord **dbr, uint8_t *raw)
+{
+    int rc;
+
+    if ((rc = chidb_DBRecord_unpackHeader(dbr, raw)) != CHIDB_OK)
+        return rc;
+
+    (*dbr)->data = raw + raw[0];
+    (*dbr)->view = true;
 
     return CHIDB_OK;
 }
@@ -646,7 +718,8 @@ int chidb_DBRecord_create(DBRecord **dbr, const char *spec, ...)
  */
 int chidb_DBRecord_destroy(DBRecord *dbr)
 {
-    free(dbr->data);
+    if (!dbr->view)
+        free(dbr->data);
     free(dbr->types);
     free(dbr->offsets);
     free(dbr);
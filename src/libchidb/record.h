@@ -50,6 +50,7 @@ struct DBRecord
     uint32_t packed_len;
     uint32_t *types;
     uint32_t *offsets;
+    bool view;          /* data points into a page (see chidb_DBRecord_unpackView) */
 };
 typedef struct DBRecord DBRecord;
 
@@ -74,6 +75,7 @@ int chidb_DBRecord_appendString(DBRecordBuffer *dbrb,  char *v);
 int chidb_DBRecord_finalize(DBRecordBuffer *dbrb, DBRecord **dbr);
 
 int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *);
+int chidb_DBRecord_unpackView(DBRecord **dbr, uint8_t *);
 int chidb_DBRecord_pack(DBRecord *dbr, uint8_t **);
 
 int chidb_DBRecord_getType(DBRecord *dbr, uint8_t field);
@@ -41,6 +41,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
 #include "chidbInt.h"
 #include "util.h"
 #include "record.h"
@@ -92,17 +95,83 @@ int putVarint32(uint8_t *p, uint32_t v)
 }
 
 
+/* Read from a file at a given offset
+ *
+ * Like pread, but retries after interruptions and short reads, so it
+ * only returns less than count bytes at the end of the file.
+ *
+ * Return
+ * - Number of bytes read, or -1 on error
+ */
+ssize_t chidb_pread(int fd, void *buf, size_t count, off_t offset)
+{
+    size_t done = 0;
+
+    while (done < count)
+    {
+        ssize_t n = pread(fd, (uint8_t *) buf + done, count - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        done += n;
+    }
+
+    return done;
+}
+
+/* Write a run of buffers to a file at a given offset
+ *
+ * Like pwritev, but retries after interruptions and short writes.
+ * The iovec array may be modified.
+ *
+ * Return
+ * - Number of write system calls, or -1 on error
+ */
+int chidb_pwritev(int fd, struct iovec *iov, int iovcnt, off_t offset)
+{
+    int calls = 0;
+
+    while (iovcnt > 0)
+    {
+        ssize_t n = pwritev(fd, iov, iovcnt, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        calls++;
+        offset += n;
+
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (uint8_t *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return calls;
+}
+
+
 void chidb_BTree_recordPrinter(BTreeNode *btn, BTreeCell *btc)
 {
     DBRecord *dbr;
 
-    chidb_DBRecord_unpack(&dbr, btc->fields.tableLeaf.data);
+    chidb_DBRecord_unpackView(&dbr, btc->fields.tableLeaf.data);
 
     printf("< %5i >", btc->key);
     chidb_DBRecord_print(dbr);
     printf("\n");
 
-    free(dbr);
+    chidb_DBRecord_destroy(dbr);
 }
 
 void chidb_BTree_stringPrinter(BTreeNode *btn, BTreeCell *btc)
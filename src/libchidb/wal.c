@@ -0,0 +1,637 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module contains the write-ahead log (WAL) that the Pager uses when
+ * a file is opened with the "wal=1" option. Instead of writing pages
+ * in place, the Pager appends page images ("frames") to a log file that
+ * lives alongside the database file (same name, plus "-wal"). Appending
+ * to the log is sequential I/O, no matter how scattered the pages are in
+ * the database file. Every time the Pager commits (chidb_Pager_flush),
+ * the last frame it appends is marked as a commit frame.
+ *
+ * Since the latest version of a page may be in the log, the Pager looks
+ * up every page it reads in the WAL index, which maps page numbers to the
+ * most recent frame holding that page, before going to the database file.
+ * Periodically, the Pager copies the latest version of every page in the
+ * log back into the database file ("checkpoint"), and the log starts over.
+ *
+ * The format of the log is modelled on SQLite's WAL. The log starts with
+ * a 32-byte header:
+ *
+ *    0  Magic number (0x4357414c)
+ *    4  Format version (1)
+ *    8  Page size
+ *   12  Checkpoint sequence number
+ *   16  Salt (two 4-byte values)
+ *   24  Checksum of the first 24 bytes (two 4-byte values)
+ *
+ * followed by frames, each made up of a 24-byte header and a page:
+ *
+ *    0  Page number
+ *    4  For commit frames, the size of the database in pages. 0 otherwise.
+ *    8  Salt (copied from the log header)
+ *   16  Checksum (two 4-byte values)
+ *
+ * All values are big-endian. The checksum is cumulative: it covers the
+ * log header, the first 8 bytes of every frame header, and the page data
+ * of every frame, up to and including the current frame. When the log
+ * starts over after a checkpoint, the salt is changed, so frames left
+ * over from the previous log are not valid anymore.
+ *
+ * When a log is opened, it is scanned to rebuild the WAL index. Frames
+ * are read until the first frame that has the wrong salt or checksum,
+ * and only the frames up to the last valid commit frame are kept. So a
+ * crash while the log is being written (or before the frames have made
+ * it into the database file) loses, at most, the last uncommitted changes.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <chidb/log.h>
+
+#include "chidbInt.h"
+
+#include "pager.h"
+#include "wal.h"
+#include "util.h"
+
+#define frameOffset(wal, frame) (WAL_HEADER_SIZE + (off_t) ((frame) - 1) * (WAL_FRAME_HEADER_SIZE + (wal)->page_size))
+#define indexBucket(wal, npage) (((npage) * 2654435761u) & (wal)->index_mask)
+
+
+/* Update a checksum with a buffer
+ *
+ * The buffer is read as a sequence of big-endian 32-bit words, two
+ * at a time, so its size must be a multiple of 8.
+ */
+static void chidb_Wal_checksum(uint32_t cksum[2], const uint8_t *data, size_t size)
+{
+    uint32_t s1 = cksum[0], s2 = cksum[1];
+
+    for(size_t i = 0; i < size; i += 8)
+    {
+        s1 += get4byte(data + i) + s2;
+        s2 += get4byte(data + i + 4) + s1;
+    }
+
+    cksum[0] = s1;
+    cksum[1] = s2;
+}
+
+
+/* Add a frame to the WAL index
+ *
+ * The frame replaces any earlier frame holding the same page.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+static int chidb_Wal_indexFrame(Wal *wal, uint32_t frame, npage_t npage)
+{
+    uint32_t i;
+
+    if (frame > wal->frame_pages_size)
+    {
+        uint32_t size = wal->frame_pages_size? wal->frame_pages_size * 2 : 256;
+        npage_t *frame_pages = realloc(wal->frame_pages, size * sizeof(npage_t));
+        if (frame_pages == NULL)
+            return CHIDB_ENOMEM;
+        wal->frame_pages = frame_pages;
+        wal->frame_pages_size = size;
+    }
+
+    /* Keep the hash table at most half full */
+    if (wal->index == NULL || (wal->n_indexed + 1) * 2 > wal->index_mask + 1)
+    {
+        uint32_t size = wal->index? (wal->index_mask + 1) * 2 : 512;
+        uint32_t *old = wal->index, old_size = wal->index? wal->index_mask + 1 : 0;
+
+        wal->index = calloc(size, sizeof(uint32_t));
+        if (wal->index == NULL)
+        {
+            wal->index = old;
+            return CHIDB_ENOMEM;
+        }
+        wal->index_mask = size - 1;
+
+        for(uint32_t j = 0; j < old_size; j++)
+            if (old[j] != 0)
+            {
+                for(i = indexBucket(wal, wal->frame_pages[old[j] - 1]); wal->index[i] != 0; i = (i + 1) & wal->index_mask)
+                    ;
+                wal->index[i] = old[j];
+            }
+        free(old);
+    }
+
+    wal->frame_pages[frame - 1] = npage;
+    for(i = indexBucket(wal, npage); wal->index[i] != 0; i = (i + 1) & wal->index_mask)
+        if (wal->frame_pages[wal->index[i] - 1] == npage)
+            break;
+    if (wal->index[i] == 0)
+        wal->n_indexed++;
+    wal->index[i] = frame;
+
+    if (npage > wal->max_page)
+        wal->max_page = npage;
+
+    return CHIDB_OK;
+}
+
+
+/* Empty the WAL index */
+static void chidb_Wal_clearIndex(Wal *wal)
+{
+    if (wal->index != NULL)
+        memset(wal->index, 0, (wal->index_mask + 1) * sizeof(uint32_t));
+    wal->n_indexed = 0;
+    wal->n_frames = 0;
+    wal->n_committed = 0;
+    wal->max_page = 0;
+}
+
+
+/* Pick a new salt, so that frames written before are no longer valid */
+static void chidb_Wal_newSalt(Wal *wal)
+{
+    wal->seq++;
+    wal->salt[0]++;
+    wal->salt[1] = (uint32_t) time(NULL) ^ ((uint32_t) getpid() << 16) ^ wal->seq;
+}
+
+
+/* Write the log header
+ *
+ * Also resets the running checksum to the checksum of the header.
+ */
+static int chidb_Wal_writeHeader(Wal *wal)
+{
+    uint8_t header[WAL_HEADER_SIZE];
+    struct iovec iov = {header, WAL_HEADER_SIZE};
+
+    put4byte(header + WAL_HEADER_MAGIC_OFFSET, WAL_MAGIC);
+    put4byte(header + WAL_HEADER_VERSION_OFFSET, WAL_VERSION);
+    put4byte(header + WAL_HEADER_PAGESIZE_OFFSET, wal->page_size);
+    put4byte(header + WAL_HEADER_SEQ_OFFSET, wal->seq);
+    put4byte(header + WAL_HEADER_SALT_OFFSET, wal->salt[0]);
+    put4byte(header + WAL_HEADER_SALT_OFFSET + 4, wal->salt[1]);
+    wal->cksum[0] = wal->cksum[1] = 0;
+    chidb_Wal_checksum(wal->cksum, header, WAL_HEADER_CKSUM_OFFSET);
+    put4byte(header + WAL_HEADER_CKSUM_OFFSET, wal->cksum[0]);
+    put4byte(header + WAL_HEADER_CKSUM_OFFSET + 4, wal->cksum[1]);
+
+    if (wal->file->backend->write(wal->file, &iov, 1, 0) < 0)
+        return CHIDB_EIO;
+    STAT_ADD(wal->write_calls, 1);
+
+    return CHIDB_OK;
+}
+
+
+/* Rebuild the WAL index from the log file
+ *
+ * See the top of this file for how frames are validated. If the
+ * log does not have a valid header, it is considered empty.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when reading the log
+ */
+static int chidb_Wal_recover(Wal *wal)
+{
+    uint8_t header[WAL_HEADER_SIZE], *frame;
+    uint32_t cksum[2] = {0, 0}, page_size, last_cksum[2];
+    npage_t last_max = 0;
+    ssize_t n;
+    int rc = CHIDB_OK;
+
+    n = wal->file->backend->read(wal->file, header, WAL_HEADER_SIZE, 0);
+    if (n < 0)
+        return CHIDB_EIO;
+    if (n < WAL_HEADER_SIZE)
+        return CHIDB_OK;
+
+    chidb_Wal_checksum(cksum, header, WAL_HEADER_CKSUM_OFFSET);
+    page_size = get4byte(header + WAL_HEADER_PAGESIZE_OFFSET);
+    if (get4byte(header + WAL_HEADER_MAGIC_OFFSET) != WAL_MAGIC ||
+        get4byte(header + WAL_HEADER_VERSION_OFFSET) != WAL_VERSION ||
+        get4byte(header + WAL_HEADER_CKSUM_OFFSET) != cksum[0] ||
+        get4byte(header + WAL_HEADER_CKSUM_OFFSET + 4) != cksum[1] ||
+        page_size < 512 || page_size > MAX_PAGE_SIZE || page_size % 8 != 0)
+    {
+        chilog(WARNING, "Ignoring %s (invalid header)", wal->filename);
+        return CHIDB_OK;
+    }
+
+    wal->page_size = page_size;
+    wal->seq = get4byte(header + WAL_HEADER_SEQ_OFFSET);
+    wal->salt[0] = get4byte(header + WAL_HEADER_SALT_OFFSET);
+    wal->salt[1] = get4byte(header + WAL_HEADER_SALT_OFFSET + 4);
+    memcpy(wal->cksum, cksum, sizeof(cksum));
+    memcpy(last_cksum, cksum, sizeof(cksum));
+
+    frame = malloc(WAL_FRAME_HEADER_SIZE + page_size);
+    if (frame == NULL)
+        return CHIDB_ENOMEM;
+
+    for(uint32_t i = 1; ; i++)
+    {
+        uint8_t *data = frame + WAL_FRAME_HEADER_SIZE;
+        npage_t npage;
+
+        n = wal->file->backend->read(wal->file, frame, WAL_FRAME_HEADER_SIZE + page_size, frameOffset(wal, i));
+        if (n < 0)
+        {
+            rc = CHIDB_EIO;
+            break;
+        }
+        if (n < WAL_FRAME_HEADER_SIZE + page_size)
+            break;
+
+        npage = get4byte(frame + WAL_FRAME_NPAGE_OFFSET);
+        chidb_Wal_checksum(cksum, frame, 8);
+        chidb_Wal_checksum(cksum, data, page_size);
+        if (npage == 0 ||
+            get4byte(frame + WAL_FRAME_SALT_OFFSET) != wal->salt[0] ||
+            get4byte(frame + WAL_FRAME_SALT_OFFSET + 4) != wal->salt[1] ||
+            get4byte(frame + WAL_FRAME_CKSUM_OFFSET) != cksum[0] ||
+            get4byte(frame + WAL_FRAME_CKSUM_OFFSET + 4) != cksum[1])
+            break;
+
+        if ((rc = chidb_Wal_indexFrame(wal, i, npage)) != CHIDB_OK)
+            break;
+        wal->n_frames = i;
+
+        if (get4byte(frame + WAL_FRAME_COMMIT_OFFSET) != 0)
+        {
+            wal->n_committed = i;
+            memcpy(last_cksum, cksum, sizeof(cksum));
+            last_max = wal->max_page;
+        }
+    }
+    free(frame);
+
+    if (rc != CHIDB_OK)
+        return rc;
+
+    /* Drop the frames after the last commit frame */
+    if (wal->n_frames > wal->n_committed)
+    {
+        uint32_t n_committed = wal->n_committed;
+
+        chilog(WARNING, "Discarding %i uncommitted frames from %s", wal->n_frames - n_committed, wal->filename);
+        chidb_Wal_clearIndex(wal);
+        for(uint32_t i = 1; i <= n_committed; i++)
+            chidb_Wal_indexFrame(wal, i, wal->frame_pages[i - 1]);
+        wal->n_frames = wal->n_committed = n_committed;
+        wal->max_page = last_max;
+    }
+    memcpy(wal->cksum, last_cksum, sizeof(last_cksum));
+
+    chilog(TRACE, "Recovered %i frames from %s", wal->n_frames, wal->filename);
+
+    return CHIDB_OK;
+}
+
+
+/* Open a write-ahead log
+ *
+ * Opens (or creates) the log of a database file, and rebuilds the
+ * WAL index from the frames in it. The log is accessed with the same
+ * backend as the database file.
+ *
+ * Parameters
+ * - wal: An out parameter. Used to return a pointer to the new Wal.
+ * - backend: Backend used to access the log file
+ * - filename: Name of the log file (might not exist)
+ * - flags: PAGER_OPEN_CREATE to create the log if it does not exist
+ * - options: Backend options
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOFILE: The log does not exist (and flags does not
+ *                  include PAGER_OPEN_CREATE)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Wal_open(Wal **wal, const PagerBackend *backend, const char *filename,
+                   int flags, const PagerBackendOptions *options)
+{
+    int rc;
+
+    *wal = calloc(1, sizeof(Wal));
+    if (*wal == NULL)
+        return CHIDB_ENOMEM;
+
+    (*wal)->filename = strdup(filename);
+    if ((*wal)->filename == NULL)
+    {
+        free(*wal);
+        *wal = NULL;
+        return CHIDB_ENOMEM;
+    }
+
+    if ((rc = backend->open(backend, filename, flags, options, &(*wal)->file)) != CHIDB_OK)
+    {
+        free((*wal)->filename);
+        free(*wal);
+        *wal = NULL;
+        return rc;
+    }
+
+    if ((rc = chidb_Wal_recover(*wal)) != CHIDB_OK)
+    {
+        (*wal)->file->backend->close((*wal)->file, false);
+        free((*wal)->filename);
+        free((*wal)->frame_pages);
+        free((*wal)->index);
+        free(*wal);
+        *wal = NULL;
+        return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Find the latest version of a page in the log
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - npage: Page number
+ * - frame: Out parameter. Frame holding the latest version of the page.
+ *
+ * Return
+ * - true if the page is in the log, false otherwise
+ */
+bool chidb_Wal_findFrame(Wal *wal, npage_t npage, uint32_t *frame)
+{
+    if (wal->n_frames == 0)
+        return false;
+
+    for(uint32_t i = indexBucket(wal, npage); wal->index[i] != 0; i = (i + 1) & wal->index_mask)
+        if (wal->frame_pages[wal->index[i] - 1] == npage)
+        {
+            *frame = wal->index[i];
+            return true;
+        }
+
+    return false;
+}
+
+
+/* Read the page in a frame
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - frame: Frame number
+ * - data: Buffer with room for a page
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when reading the log
+ */
+int chidb_Wal_readFrame(Wal *wal, uint32_t frame, uint8_t *data)
+{
+    ssize_t n;
+
+    n = wal->file->backend->read(wal->file, data, wal->page_size, frameOffset(wal, frame) + WAL_FRAME_HEADER_SIZE);
+    if (n != wal->page_size)
+        return CHIDB_EIO;
+
+    return CHIDB_OK;
+}
+
+
+/* Append pages to the log
+ *
+ * The frames are written with as few system calls as possible (one,
+ * unless there are more than IOV_MAX / 2 pages), and added to the WAL
+ * index.
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - pages: Pages to append
+ * - n: Number of pages
+ * - page_size: Size of the pages. If the log has frames with a different
+ *              page size, it must be reset before appending pages.
+ * - commit: If not zero, the last frame is a commit frame, and this is
+ *           the size of the database in pages.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The page size does not match the log's page size
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when writing to the log
+ */
+int chidb_Wal_appendPages(Wal *wal, MemPage **pages, uint32_t n, uint32_t page_size, npage_t commit)
+{
+    uint32_t batch = (n < IOV_MAX / 2)? n : IOV_MAX / 2;
+    uint32_t cksum[2];
+    uint8_t *headers;
+    struct iovec *iov;
+    int calls, rc = CHIDB_OK;
+
+    if (n == 0)
+        return CHIDB_OK;
+
+    if (wal->n_frames == 0 && wal->page_size != page_size)
+    {
+        wal->page_size = page_size;
+        chidb_Wal_newSalt(wal);
+        if ((rc = chidb_Wal_writeHeader(wal)) != CHIDB_OK)
+            return rc;
+    }
+    else if (wal->page_size != page_size)
+        return CHIDB_EMISUSE;
+
+    headers = malloc(batch * WAL_FRAME_HEADER_SIZE);
+    iov = malloc(batch * 2 * sizeof(struct iovec));
+    if (headers == NULL || iov == NULL)
+    {
+        free(headers);
+        free(iov);
+        return CHIDB_ENOMEM;
+    }
+
+    memcpy(cksum, wal->cksum, sizeof(cksum));
+    for(uint32_t start = 0; start < n && rc == CHIDB_OK; start += batch)
+    {
+        uint32_t count = (n - start < batch)? n - start : batch;
+
+        for(uint32_t i = 0; i < count; i++)
+        {
+            MemPage *page = pages[start + i];
+            uint8_t *header = headers + i * WAL_FRAME_HEADER_SIZE;
+            bool last = (start + i == n - 1);
+
+            put4byte(header + WAL_FRAME_NPAGE_OFFSET, page->npage);
+            put4byte(header + WAL_FRAME_COMMIT_OFFSET, last? commit : 0);
+            put4byte(header + WAL_FRAME_SALT_OFFSET, wal->salt[0]);
+            put4byte(header + WAL_FRAME_SALT_OFFSET + 4, wal->salt[1]);
+            chidb_Wal_checksum(cksum, header, 8);
+            chidb_Wal_checksum(cksum, page->data, page_size);
+            put4byte(header + WAL_FRAME_CKSUM_OFFSET, cksum[0]);
+            put4byte(header + WAL_FRAME_CKSUM_OFFSET + 4, cksum[1]);
+
+            iov[2 * i].iov_base = header;
+            iov[2 * i].iov_len = WAL_FRAME_HEADER_SIZE;
+            iov[2 * i + 1].iov_base = page->data;
+            iov[2 * i + 1].iov_len = page_size;
+        }
+
+        if ((calls = wal->file->backend->write(wal->file, iov, 2 * count, frameOffset(wal, wal->n_frames + 1))) < 0)
+        {
+            rc = CHIDB_EIO;
+            break;
+        }
+        STAT_ADD(wal->write_calls, calls);
+
+        /* The frames are only part of the log once they have been written */
+        for(uint32_t i = 0; i < count && rc == CHIDB_OK; i++)
+            if ((rc = chidb_Wal_indexFrame(wal, wal->n_frames + 1, pages[start + i]->npage)) == CHIDB_OK)
+            {
+                wal->n_frames++;
+                STAT_ADD(wal->frames_written, 1);
+            }
+        memcpy(wal->cksum, cksum, sizeof(cksum));
+    }
+
+    if (rc == CHIDB_OK && commit != 0)
+        wal->n_committed = wal->n_frames;
+
+    free(headers);
+    free(iov);
+
+    return rc;
+}
+
+
+/* Make sure the last frame in the log is a commit frame
+ *
+ * If there are frames after the last commit frame, the last of them
+ * is appended again as a commit frame.
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - db_pages: Size of the database in pages
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the log
+ */
+int chidb_Wal_commit(Wal *wal, npage_t db_pages)
+{
+    MemPage page, *pages[1] = {&page};
+    int rc;
+
+    if (wal->n_committed == wal->n_frames)
+        return CHIDB_OK;
+
+    page.npage = wal->frame_pages[wal->n_frames - 1];
+    page.data = malloc(wal->page_size);
+    if (page.data == NULL)
+        return CHIDB_ENOMEM;
+
+    if ((rc = chidb_Wal_readFrame(wal, wal->n_frames, page.data)) == CHIDB_OK)
+        rc = chidb_Wal_appendPages(wal, pages, 1, wal->page_size, db_pages);
+    free(page.data);
+
+    return rc;
+}
+
+
+/* Start the log over
+ *
+ * Called once every frame in the log has been copied into the
+ * database file. The log is not truncated: the next frames overwrite
+ * the old ones, which are no longer valid since the salt changes.
+ *
+ * Parameters
+ * - wal: A Wal.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when writing to the log
+ */
+int chidb_Wal_reset(Wal *wal)
+{
+    chidb_Wal_clearIndex(wal);
+
+    if (wal->page_size == 0)
+        return CHIDB_OK;
+
+    chidb_Wal_newSalt(wal);
+
+    return chidb_Wal_writeHeader(wal);
+}
+
+
+/* Close a write-ahead log
+ *
+ * If the log is empty (i.e., everything in it has been checkpointed),
+ * the log file is deleted.
+ *
+ * Parameters
+ * - wal: A Wal.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Wal_close(Wal *wal)
+{
+    int rc;
+
+    rc = wal->file->backend->close(wal->file, wal->n_frames == 0);
+
+    free(wal->filename);
+    free(wal->frame_pages);
+    free(wal->index);
+    free(wal);
+
+    return rc;
+}
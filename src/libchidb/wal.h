@@ -0,0 +1,104 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Write-ahead log header. See wal.c for more details.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WAL_H_
+#define WAL_H_
+
+#include "chidbInt.h"
+#include "backend.h"
+
+/* Suffix added to the database filename to get the log's filename */
+#define WAL_SUFFIX "-wal"
+
+#define WAL_MAGIC (0x4357414c)     /* "CWAL" */
+#define WAL_VERSION (1)
+
+/* Log header layout */
+#define WAL_HEADER_SIZE (32)
+#define WAL_HEADER_MAGIC_OFFSET (0)
+#define WAL_HEADER_VERSION_OFFSET (4)
+#define WAL_HEADER_PAGESIZE_OFFSET (8)
+#define WAL_HEADER_SEQ_OFFSET (12)
+#define WAL_HEADER_SALT_OFFSET (16)
+#define WAL_HEADER_CKSUM_OFFSET (24)
+
+/* Frame header layout */
+#define WAL_FRAME_HEADER_SIZE (24)
+#define WAL_FRAME_NPAGE_OFFSET (0)
+#define WAL_FRAME_COMMIT_OFFSET (4)
+#define WAL_FRAME_SALT_OFFSET (8)
+#define WAL_FRAME_CKSUM_OFFSET (16)
+
+struct MemPage;
+
+typedef struct Wal
+{
+    PagerFile *file;
+    char *filename;
+    uint32_t page_size;            /* 0 if the log has never been written */
+    uint32_t seq;                  /* Checkpoint sequence number */
+    uint32_t salt[2];              /* Identify the frames of the current log */
+    uint32_t cksum[2];             /* Checksum of the log up to the last frame */
+
+    uint32_t n_frames;             /* Frames in the log */
+    uint32_t n_committed;          /* Frames up to the last commit frame */
+    npage_t max_page;              /* Largest page number in the log */
+
+    /* WAL index: where to find the latest version of each page */
+    npage_t *frame_pages;          /* Page held by each frame (frame i at i-1) */
+    uint32_t frame_pages_size;
+    uint32_t *index;               /* Hash table: page number -> frame (0: empty) */
+    uint32_t index_mask;
+    uint32_t n_indexed;            /* Distinct pages in the log */
+
+    /* Counters (updated with STAT_ADD) */
+    uint64_t frames_written;
+    uint64_t write_calls;
+} Wal;
+
+int chidb_Wal_open(Wal **wal, const PagerBackend *backend, const char *filename,
+                   int flags, const PagerBackendOptions *options);
+bool chidb_Wal_findFrame(Wal *wal, npage_t npage, uint32_t *frame);
+int chidb_Wal_readFrame(Wal *wal, uint32_t frame, uint8_t *data);
+int chidb_Wal_appendPages(Wal *wal, struct MemPage **pages, uint32_t n, uint32_t page_size, npage_t commit);
+int chidb_Wal_commit(Wal *wal, npage_t db_pages);
+int chidb_Wal_reset(Wal *wal);
+int chidb_Wal_close(Wal *wal);
+
+#endif /*WAL_H_*/
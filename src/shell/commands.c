@@ -1,10 +1,12 @@
 #include <unistd.h>
 #include <string.h>
+#include <inttypes.h>
 #include <chidb/dbm-file.h>
 #include "shell.h"
 #include "commands.h"
 #include <chisql/chisql.h>
 #include <chidb/utils.h>
+#include <chidb/stats.h>
 
 
 #define COL_SEPARATOR "|"
@@ -20,6 +22,8 @@ struct handler_entry handlers[] =
     		                  "                     column  Left-aligned columns\n"
     		                  "                     list    Values delimited by | (default)"),
     HANDLER_ENTRY (explain,   ".explain on|off    Turn output mode suitable for EXPLAIN on or off."),
+    HANDLER_ENTRY (stats,     ".stats [on|off]    Show I/O statistics since the last statement, or turn\n"
+                              "                   showing them after every statement on or off"),
     HANDLER_ENTRY (help,      ".help              Show this message"),
 
     NULL_ENTRY
@@ -32,6 +36,21 @@ void usage_error(struct handler_entry *e, const char *msg)
     fprintf(stderr, "%s\n", e->help);
 }
 
+void print_stats(chidb_shell_ctx_t *ctx)
+{
+    chidb_stats_t st;
+
+    chidb_stats(ctx->db, &st);
+
+    printf("Buffer pool:  %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " evictions\n",
+           st.cache_hits, st.cache_misses, st.evictions);
+    printf("Reads:        %" PRIu64 " pages, %" PRIu64 " bytes, %" PRIu64 " calls, %.3f ms\n",
+           st.pages_read, st.bytes_read, st.read_calls, st.read_ns / 1e6);
+    printf("Writes:       %" PRIu64 " pages, %" PRIu64 " bytes, %" PRIu64 " calls, %.3f ms\n",
+           st.pages_written, st.bytes_written, st.write_calls, st.write_ns / 1e6);
+    printf("Syncs:        %" PRIu64 ", %.3f ms\n", st.syncs, st.sync_ns / 1e6);
+}
+
 int chidb_shell_handle_cmd(chidb_shell_ctx_t *ctx, const char *cmd)
 {
     int rc = 0;
@@ -90,6 +109,9 @@ int chidb_shell_handle_sql(chidb_shell_ctx_t *ctx, const char *sql)
     int rc;
     chidb_stmt *stmt;
 
+    /* The statistics shown by .stats are the ones of the last statement */
+    chidb_stats_reset(ctx->db);
+
     rc = chidb_prepare(ctx->db, sql, &stmt);
 
     if (rc == CHIDB_OK)
@@ -200,6 +222,9 @@ int chidb_shell_handle_sql(chidb_shell_ctx_t *ctx, const char *sql)
         rc = chidb_finalize(stmt);
         if(rc == CHIDB_EMISUSE)
             printf("API used incorrectly.\n");
+
+        if(ctx->stats)
+            print_stats(ctx);
     }
     else if (rc == CHIDB_EINVALIDSQL)
         printf("SQL syntax error.\n");
@@ -454,3 +479,35 @@ int chidb_shell_handle_cmd_help(chidb_shell_ctx_t *ctx, struct handler_entry *e,
     return CHIDB_OK;
 }
 
+int chidb_shell_handle_cmd_stats(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    if(ntokens > 2)
+    {
+    	usage_error(e, "Invalid arguments");
+    	return 1;
+    }
+
+    if(ntokens == 2)
+    {
+        if(strcmp(tokens[1],"on")==0)
+            ctx->stats = true;
+        else if(strcmp(tokens[1],"off")==0)
+            ctx->stats = false;
+        else
+        {
+        	usage_error(e, "Invalid argument");
+        	return 1;
+        }
+        return CHIDB_OK;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    print_stats(ctx);
+
+    return CHIDB_OK;
+}
@@ -8,6 +8,7 @@ void chidb_shell_init_ctx(chidb_shell_ctx_t *ctx)
 
     ctx->header = false;
     ctx->mode = MODE_LIST;
+    ctx->stats = false;
 }
 
 int chidb_shell_open_db(chidb_shell_ctx_t *ctx, char *file)
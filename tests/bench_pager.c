@@ -0,0 +1,1755 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Pager benchmarks
+ *
+ *  Usage: bench_pager <benchmark> [options]
+ *
+ *  Each benchmark builds its own database in a temporary file,
+ *  so it does not depend on the files in tests/files.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <time.h>
+#include <pthread.h>
+#include <chidb/chidb.h>
+#include "libchidb/chidbInt.h"
+#include "libchidb/btree.h"
+#include "libchidb/pager.h"
+#include "libchidb/dbm-cursor.h"
+#include "libchidb/record.h"
+
+#define BENCH_TMPFILE "/tmp/chidb-bench-XXXXXX"
+
+
+static uint32_t rand_state = 2463534242u;
+
+static uint32_t bench_rand()
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static char *bench_tmpfile()
+{
+    char *fname = strdup(BENCH_TMPFILE);
+    int fd = mkstemp(fname);
+    close(fd);
+    remove(fname);
+    return fname;
+}
+
+
+/* Create a table B-Tree (rooted at page 1) with keys 1..nrows,
+ * inserted in a scrambled order */
+static chidb *bench_create_table(const char *fname, const char *options, uint32_t nrows, uint16_t rowsize)
+{
+    chidb *db = malloc(sizeof(chidb));
+    char *uri = malloc(strlen(fname) + strlen(options) + 8);
+    uint8_t *data = calloc(1, rowsize);
+    int rc;
+
+    sprintf(uri, "file:%s%s", fname, options);
+    if ((rc = chidb_Btree_open(uri, db, &db->bt)) != CHIDB_OK)
+    {
+        fprintf(stderr, "Could not open %s (%i)\n", uri, rc);
+        exit(EXIT_FAILURE);
+    }
+
+    /* 7919 is prime, so this visits every key exactly once
+     * as long as nrows is not a multiple of it */
+    for(uint32_t i = 0; i < nrows; i++)
+    {
+        chidb_key_t key = ((uint64_t) i * 7919) % nrows + 1;
+        memcpy(data, &key, sizeof(key));
+        if ((rc = chidb_Btree_insertInTable(db->bt, 1, key, data, rowsize)) != CHIDB_OK)
+        {
+            fprintf(stderr, "Could not insert key %u (%i)\n", key, rc);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    free(data);
+    free(uri);
+    return db;
+}
+
+
+/*
+ * cache: point lookups running alongside full table scans
+ *
+ * The point lookups go through the internal pages of the table, which
+ * should stay in the buffer pool no matter how many scans are going on.
+ * For every window of scan steps, this prints the hit rate of the
+ * internal pages read by the point lookups. The scans are done either
+ * with a cursor (which reads pages with PAGER_HINT_SCAN) or by walking
+ * the tree with chidb_Btree_getNodeByPage (no hint).
+ *
+ * The Pager is not thread-safe, so the scan and the lookups take turns
+ * in a single thread: every scan step is followed by a lookup.
+ */
+
+typedef struct
+{
+    uint64_t internal_reads;
+    uint64_t internal_hits;
+} lookup_stats_t;
+
+/* Find a key by walking down the tree, keeping track of whether each
+ * internal page came from the buffer pool */
+static void bench_lookup(BTree *bt, chidb_key_t key, lookup_stats_t *stats)
+{
+    npage_t npage = 1;
+    BTreeNode *btn;
+    BTreeCell cell;
+
+    for(;;)
+    {
+        uint64_t hits = bt->pager->cache_hits;
+        chidb_Btree_getNodeByPage(bt, npage, &btn);
+
+        if (btn->type != PGTYPE_TABLE_INTERNAL)
+        {
+            chidb_Btree_freeMemNode(bt, btn);
+            return;
+        }
+
+        stats->internal_reads++;
+        stats->internal_hits += bt->pager->cache_hits - hits;
+
+        npage = btn->right_page;
+        for(ncell_t i = 0; i < btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &cell);
+            if (key <= cell.key)
+            {
+                npage = cell.fields.tableInternal.child_page;
+                break;
+            }
+        }
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+}
+
+/* Unhinted scan: visits the leaves in order, one cell per step */
+typedef struct
+{
+    npage_t *leaves;
+    uint32_t nleaves;
+    uint32_t pos;
+    BTreeNode *btn;
+    ncell_t ncell;
+} manual_scan_t;
+
+static int bench_manual_next(BTree *bt, manual_scan_t *scan)
+{
+    while (scan->btn == NULL || scan->ncell >= scan->btn->n_cells)
+    {
+        if (scan->btn != NULL)
+            chidb_Btree_freeMemNode(bt, scan->btn);
+        scan->btn = NULL;
+        if (scan->pos == scan->nleaves)
+            return CHIDB_DONE;
+        chidb_Btree_getNodeByPage(bt, scan->leaves[scan->pos++], &scan->btn);
+        scan->ncell = 0;
+    }
+    scan->ncell++;
+    return CHIDB_OK;
+}
+
+static void bench_collect_leaves(BTree *bt, npage_t npage, manual_scan_t *scan)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+
+    chidb_Btree_getNodeByPage(bt, npage, &btn);
+    if (btn->type == PGTYPE_TABLE_LEAF)
+    {
+        scan->leaves = realloc(scan->leaves, (scan->nleaves + 1) * sizeof(npage_t));
+        scan->leaves[scan->nleaves++] = npage;
+    }
+    else
+    {
+        for(ncell_t i = 0; i < btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &cell);
+            bench_collect_leaves(bt, cell.fields.tableInternal.child_page, scan);
+        }
+        bench_collect_leaves(bt, btn->right_page, scan);
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+}
+
+static int bench_cache(int argc, char **argv)
+{
+    uint32_t nrows = 20000, cache_size = 64, window = 2000, passes = 4;
+    bool hint = true;
+    char options[64];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:w:p:u")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 'c': cache_size = atoi(optarg); break;
+        case 'w': window = atoi(optarg); break;
+        case 'p': passes = atoi(optarg); break;
+        case 'u': hint = false; break;
+        default:
+            fprintf(stderr, "Usage: bench_pager cache [-n rows] [-c cache_size] [-w window] [-p passes] [-u]\n");
+            return EXIT_FAILURE;
+        }
+
+    char *fname = bench_tmpfile();
+    sprintf(options, "?cache_size=%u", cache_size);
+    chidb *db = bench_create_table(fname, options, nrows, 100);
+    BTree *bt = db->bt;
+
+    chidb_dbm_cursor_t cursor;
+    manual_scan_t scan = {NULL, 0, 0, NULL, 0};
+    if (hint)
+        chidb_dbm_cursor_open(&cursor, CURSOR_READ, bt, 1);
+    else
+        bench_collect_leaves(bt, 1, &scan);
+
+    /* Warm up: the lookups alone */
+    lookup_stats_t stats = {0, 0}, total = {0, 0};
+    for(uint32_t i = 0; i < 10 * window; i++)
+        bench_lookup(bt, bench_rand() % nrows + 1, &stats);
+
+    printf("# %u rows, %u pages, cache_size=%u, %s scan\n", nrows, bt->pager->n_pages,
+           cache_size, hint? "hinted" : "unhinted");
+    printf("# warm-up internal hit rate: %.4f\n", (double) stats.internal_hits / stats.internal_reads);
+    printf("# pass window internal_reads internal_hit_rate pool_hit_rate\n");
+
+    double start = bench_now();
+    for(uint32_t pass = 0; pass < passes; pass++)
+    {
+        int rc = hint? chidb_dbm_cursor_rewind(&cursor) : CHIDB_OK;
+        uint32_t nwindow = 0;
+
+        scan.pos = 0;
+        while (rc == CHIDB_OK)
+        {
+            uint64_t hits = bt->pager->cache_hits, misses = bt->pager->cache_misses;
+
+            memset(&stats, 0, sizeof(stats));
+            for(uint32_t i = 0; i < window && rc == CHIDB_OK; i++)
+            {
+                if (hint)
+                    rc = chidb_dbm_cursor_next(&cursor);
+                else
+                    rc = bench_manual_next(bt, &scan);
+
+                bench_lookup(bt, bench_rand() % nrows + 1, &stats);
+            }
+
+            hits = bt->pager->cache_hits - hits;
+            misses = bt->pager->cache_misses - misses;
+            printf("%u %u %lu %.4f %.4f\n", pass, nwindow++, stats.internal_reads,
+                   (double) stats.internal_hits / stats.internal_reads,
+                   (double) hits / (hits + misses));
+            total.internal_reads += stats.internal_reads;
+            total.internal_hits += stats.internal_hits;
+        }
+    }
+    double elapsed = bench_now() - start;
+
+    printf("# overall internal hit rate: %.4f (%lu reads), %.3f s\n",
+           (double) total.internal_hits / total.internal_reads, total.internal_reads, elapsed);
+
+    if (hint)
+        chidb_dbm_cursor_close(&cursor);
+    free(scan.leaves);
+    chidb_Btree_close(bt);
+    free(db);
+    remove(fname);
+    free(fname);
+
+    return EXIT_SUCCESS;
+}
+
+
+/*
+ * randread: random page reads through the Pager
+ *
+ * Reads pages at random from a large generated database, with a buffer
+ * pool much smaller than the file, so that nearly every read goes to
+ * the file (which will be in the OS page cache after the first pass).
+ */
+static int bench_randread(int argc, char **argv)
+{
+    uint32_t nrows = 100000, cache_size = 16, nreads = 1000000;
+    char options[64];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:r:")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 'c': cache_size = atoi(optarg); break;
+        case 'r': nreads = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: bench_pager randread [-n rows] [-c cache_size] [-r reads]\n");
+            return EXIT_FAILURE;
+        }
+
+    char *fname = bench_tmpfile();
+    sprintf(options, "?cache_size=%u", cache_size);
+    chidb *db = bench_create_table(fname, options, nrows, 100);
+    Pager *pager = db->bt->pager;
+    npage_t npages = pager->n_pages;
+    MemPage *page;
+    uint64_t sum = 0;
+
+    /* One pass over the file, so all of it is in the OS page cache */
+    for(npage_t i = 1; i <= npages; i++)
+    {
+        chidb_Pager_readPage(pager, i, &page);
+        chidb_Pager_releaseMemPage(pager, page);
+    }
+
+    double start = bench_now();
+    for(uint32_t i = 0; i < nreads; i++)
+    {
+        chidb_Pager_readPage(pager, bench_rand() % npages + 1, &page);
+        sum += page->data[0];
+        chidb_Pager_releaseMemPage(pager, page);
+    }
+    double elapsed = bench_now() - start;
+
+    printf("# %u pages of %u bytes, cache_size=%u (checksum %lu)\n", npages, pager->page_size, cache_size, sum);
+    printf("%u reads in %.3f s: %.0f pages/s, %.1f MB/s\n", nreads, elapsed, nreads / elapsed,
+           (double) nreads * pager->page_size / elapsed / (1024 * 1024));
+
+    chidb_Btree_close(db->bt);
+    free(db);
+    remove(fname);
+    free(fname);
+
+    return EXIT_SUCCESS;
+}
+
+
+/*
+ * insert: bulk insert into a table
+ *
+ * Reports how many pages (and write system calls) it takes to insert
+ * a number of rows, including the final write-back when the file is
+ * closed, and how many pages were requested from the Pager (and how
+ * many of those missed the buffer pool) per row. Extra pager options
+ * (e.g. "extent_size=0") can be given with -o.
+ */
+static int bench_insert(int argc, char **argv)
+{
+    uint32_t nrows = 100000, cache_size = DEFAULT_CACHE_SIZE, rowsize = 100;
+    const char *extra = NULL;
+    char options[128];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:s:o:")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 'c': cache_size = atoi(optarg); break;
+        case 's': rowsize = atoi(optarg); break;
+        case 'o': extra = optarg; break;
+        default:
+            fprintf(stderr, "Usage: bench_pager insert [-n rows] [-c cache_size] [-s row size] [-o options]\n");
+            return EXIT_FAILURE;
+        }
+
+    char *fname = bench_tmpfile();
+    snprintf(options, sizeof(options), "?cache_size=%u%s%s", cache_size, extra ? "&" : "", extra ? extra : "");
+
+    double start = bench_now();
+    chidb *db = bench_create_table(fname, options, nrows, rowsize);
+    Pager *pager = db->bt->pager;
+    chidb_stats_t stats;
+    chidb_Pager_getStats(pager, &stats);
+    chidb_Pager_flush(pager);
+    double elapsed = bench_now() - start;
+
+    printf("# %u rows of %u bytes, %s\n", nrows, rowsize, options + 1);
+    printf("%u pages in file, %lu pages written, %lu write calls, %.3f s (%.0f rows/s)\n",
+           pager->n_pages, pager->pages_written, pager->write_calls, elapsed, nrows / elapsed);
+    printf("%.2f pages read per row (%.3f from the file)\n",
+           (double) (stats.cache_hits + stats.cache_misses) / nrows, (double) stats.cache_misses / nrows);
+
+    chidb_Btree_close(db->bt);
+    free(db);
+    remove(fname);
+    free(fname);
+
+    return EXIT_SUCCESS;
+}
+
+
+/*
+ * commit: small transactions
+ *
+ * Inserts a few rows at random positions of an existing table and
+ * commits (chidb_Pager_flush), over and over. Every commit writes a
+ * handful of scattered pages, which is where writing them to the
+ * write-ahead log instead of in place should pay off (compare with
+ * and without -o wal=1).
+ *
+ * sync: the same, at every synchronous level
+ *
+ * Runs the commit benchmark with synchronous=off, normal and full,
+ * with and without the write-ahead log, and prints the number of
+ * commits per second and fdatasync calls for each.
+ */
+
+typedef struct
+{
+    double elapsed;
+    uint64_t pages_written;
+    uint64_t frames_written;
+    uint64_t write_calls;
+    uint64_t syncs;
+} commit_stats_t;
+
+static uint64_t bench_syncs(Pager *pager)
+{
+    uint64_t syncs = pager->syncs;
+
+    if (pager->syncer != NULL)
+    {
+        pthread_mutex_lock(&pager->syncer->lock);
+        syncs += pager->syncer->syncs;
+        pthread_mutex_unlock(&pager->syncer->lock);
+    }
+
+    return syncs;
+}
+
+static void bench_run_commits(const char *options, uint32_t nrows, uint32_t ntx, uint32_t txrows, commit_stats_t *stats)
+{
+    uint8_t data[100] = {0};
+    uint32_t total = ntx * txrows;
+
+    char *fname = bench_tmpfile();
+    chidb *db = bench_create_table(fname, options, nrows, sizeof(data));
+    Pager *pager = db->bt->pager;
+    chidb_Pager_flush(pager);
+
+    commit_stats_t before = {0, pager->pages_written, pager->wal? pager->wal->frames_written : 0,
+                             pager->write_calls + (pager->wal? pager->wal->write_calls : 0), bench_syncs(pager)};
+
+    double start = bench_now();
+    for(uint32_t t = 0; t < ntx; t++)
+    {
+        for(uint32_t i = t * txrows; i < (t + 1) * txrows; i++)
+        {
+            chidb_key_t key = nrows + 1 + ((uint64_t) i * 7919) % total;
+            if (chidb_Btree_insertInTable(db->bt, 1, key, data, sizeof(data)) != CHIDB_OK)
+            {
+                fprintf(stderr, "Could not insert key %u\n", key);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (chidb_Pager_flush(pager) != CHIDB_OK)
+        {
+            fprintf(stderr, "Could not commit\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    stats->elapsed = bench_now() - start;
+
+    stats->pages_written = pager->pages_written - before.pages_written;
+    stats->frames_written = (pager->wal? pager->wal->frames_written : 0) - before.frames_written;
+    stats->write_calls = pager->write_calls + (pager->wal? pager->wal->write_calls : 0) - before.write_calls;
+    stats->syncs = bench_syncs(pager) - before.syncs;
+
+    chidb_Btree_close(db->bt);
+    free(db);
+    remove(fname);
+    free(fname);
+}
+
+static int bench_commit(int argc, char **argv)
+{
+    uint32_t nrows = 20000, ntx = 5000, txrows = 1;
+    const char *extra = NULL;
+    char options[128];
+    commit_stats_t stats;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:r:o:")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 't': ntx = atoi(optarg); break;
+        case 'r': txrows = atoi(optarg); break;
+        case 'o': extra = optarg; break;
+        default:
+            fprintf(stderr, "Usage: bench_pager commit [-n rows] [-t transactions] [-r rows per transaction] [-o options]\n");
+            return EXIT_FAILURE;
+        }
+
+    snprintf(options, sizeof(options), "%s%s", extra ? "?" : "", extra ? extra : "");
+    bench_run_commits(options, nrows, ntx, txrows, &stats);
+
+    printf("# %u transactions of %u rows into a table with %u rows%s%s\n", ntx, txrows, nrows,
+           extra ? ", " : "", extra ? extra : "");
+    printf("%.3f s (%.0f commits/s), %lu pages written in place, %lu log frames, %lu write calls, %lu syncs\n",
+           stats.elapsed, ntx / stats.elapsed, stats.pages_written, stats.frames_written,
+           stats.write_calls, stats.syncs);
+
+    return EXIT_SUCCESS;
+}
+
+static int bench_sync(int argc, char **argv)
+{
+    static const char *levels[] = {"off", "normal", "full"};
+    uint32_t nrows = 20000, ntx = 1000, txrows = 1, delay = DEFAULT_SYNC_DELAY;
+    char options[128];
+    commit_stats_t stats;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:r:d:")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 't': ntx = atoi(optarg); break;
+        case 'r': txrows = atoi(optarg); break;
+        case 'd': delay = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: bench_pager sync [-n rows] [-t transactions] [-r rows per transaction] [-d sync_delay]\n");
+            return EXIT_FAILURE;
+        }
+
+    printf("# %u transactions of %u rows into a table with %u rows, sync_delay=%u\n", ntx, txrows, nrows, delay);
+    printf("# wal synchronous commits/s syncs\n");
+    for(int wal = 0; wal <= 1; wal++)
+        for(int level = 0; level < 3; level++)
+        {
+            snprintf(options, sizeof(options), "?wal=%i&synchronous=%s&sync_delay=%u", wal, levels[level], delay);
+            bench_run_commits(options, nrows, ntx, txrows, &stats);
+            printf("%i %s %.0f %lu\n", wal, levels[level], ntx / stats.elapsed, stats.syncs);
+        }
+
+    return EXIT_SUCCESS;
+}
+
+
+/*
+ * slowdisk: point lookups on a slow disk
+ *
+ * Builds a table, reopens it with the counting backend and a given
+ * read latency, and looks up random keys with buffer pools of several
+ * sizes. For each size, prints the lookups per second and the file
+ * reads per lookup, i.e., how much of the B-Tree has to come from the
+ * (simulated) disk.
+ */
+static int bench_slowdisk(int argc, char **argv)
+{
+    static const uint32_t cache_sizes[] = {8, 32, 128, 512, 2048};
+    uint32_t nrows = 100000, nlookups = 2000, latency = 100;
+    char options[128];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:d:")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 'l': nlookups = atoi(optarg); break;
+        case 'd': latency = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: bench_pager slowdisk [-n rows] [-l lookups] [-d read latency (us)]\n");
+            return EXIT_FAILURE;
+        }
+
+    char *fname = bench_tmpfile();
+    chidb *db = bench_create_table(fname, "", nrows, 100);
+    npage_t npages = db->bt->pager->n_pages;
+    chidb_Btree_close(db->bt);
+
+    printf("# %u rows (%u pages), %u lookups, read_latency=%u us\n", nrows, npages, nlookups, latency);
+    printf("# cache_size lookups/s reads/lookup\n");
+    for(int c = 0; c < sizeof(cache_sizes) / sizeof(cache_sizes[0]); c++)
+    {
+        char *uri = malloc(strlen(fname) + sizeof(options) + 8);
+        PagerCountingFile *file;
+        uint8_t *data;
+        uint16_t size;
+
+        snprintf(options, sizeof(options), "?backend=counting&cache_size=%u&read_latency=%u", cache_sizes[c], latency);
+        sprintf(uri, "file:%s%s", fname, options);
+        if (chidb_Btree_open(uri, db, &db->bt) != CHIDB_OK)
+        {
+            fprintf(stderr, "Could not open %s\n", uri);
+            exit(EXIT_FAILURE);
+        }
+        file = (PagerCountingFile *) db->bt->pager->file;
+        uint64_t reads = file->reads;
+
+        double start = bench_now();
+        for(uint32_t i = 0; i < nlookups; i++)
+        {
+            if (chidb_Btree_find(db->bt, 1, bench_rand() % nrows + 1, &data, &size) != CHIDB_OK)
+            {
+                fprintf(stderr, "Lookup failed\n");
+                exit(EXIT_FAILURE);
+            }
+            free(data);
+        }
+        double elapsed = bench_now() - start;
+
+        printf("%u %.0f %.2f\n", cache_sizes[c], nlookups / elapsed, (double) (file->reads - reads) / nlookups);
+        chidb_Btree_close(db->bt);
+        free(uri);
+    }
+
+    free(db);
+    remove(fname);
+    free(fname);
+
+    return EXIT_SUCCESS;
+}
+
+
+/*
+ * qdepth: table scans at several queue depths
+ *
+ * Generates a large table (400-byte rows, which take up about 1 KB of
+ * the file each once pages are split; the default of 2.5M rows makes a
+ * file of about 2.5 GB), and scans it
+ * with a cursor, first with the file backend, and then with the uring
+ * backend at several queue depths. Cursors read all the children of an
+ * internal node in a single batch, which the uring backend submits to
+ * the device up to queue_depth reads at a time. Before every scan, the
+ * file is dropped from the OS page cache (with posix_fadvise), so the
+ * pages really come from the device. An existing file can be scanned
+ * with -f, which skips generating one.
+ */
+static double bench_scan(const char *fname, const char *options, uint32_t cache_size, uint64_t *rows, uint64_t *batches)
+{
+    chidb db;
+    chidb_dbm_cursor_t cursor;
+    char *uri = malloc(strlen(fname) + strlen(options) + 64);
+    int fd, rc;
+
+    /* Drop the file from the page cache */
+    fd = open(fname, O_RDONLY);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+
+    sprintf(uri, "file:%s?cache_size=%u%s", fname, cache_size, options);
+    if (chidb_Btree_open(uri, &db, &db.bt) != CHIDB_OK)
+    {
+        fprintf(stderr, "Could not open %s\n", uri);
+        exit(EXIT_FAILURE);
+    }
+
+    double start = bench_now();
+    *rows = 0;
+    chidb_dbm_cursor_open(&cursor, CURSOR_READ, db.bt, 1);
+    for(rc = chidb_dbm_cursor_rewind(&cursor); rc == CHIDB_OK; rc = chidb_dbm_cursor_next(&cursor))
+        (*rows)++;
+    chidb_dbm_cursor_close(&cursor);
+    double elapsed = bench_now() - start;
+
+    *batches = db.bt->pager->read_batches;
+    chidb_Btree_close(db.bt);
+    free(uri);
+
+    return elapsed;
+}
+
+static int bench_qdepth(int argc, char **argv)
+{
+    static const uint32_t depths[] = {1, 2, 4, 8, 16, 32, 64, 128};
+    uint32_t nrows = 2500000, cache_size = 512;
+    const char *existing = NULL;
+    char options[64];
+    uint64_t rows, batches;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:f:")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 'c': cache_size = atoi(optarg); break;
+        case 'f': existing = optarg; break;
+        default:
+            fprintf(stderr, "Usage: bench_pager qdepth [-n rows] [-c cache_size] [-f existing file]\n");
+            return EXIT_FAILURE;
+        }
+
+    char *fname = existing? strdup(existing) : bench_tmpfile();
+    if (!existing)
+    {
+        double start = bench_now();
+        chidb *db = bench_create_table(fname, "?synchronous=off", nrows, 400);
+        chidb_Btree_close(db->bt);
+        free(db);
+        fprintf(stderr, "Generated %s in %.1f s\n", fname, bench_now() - start);
+    }
+
+    struct stat st;
+    stat(fname, &st);
+    printf("# Scanning %.2f GB, cache_size=%u\n", st.st_size / 1e9, cache_size);
+    printf("# backend queue_depth rows MB/s batches\n");
+
+    double elapsed = bench_scan(fname, "", cache_size, &rows, &batches);
+    printf("file - %lu %.1f %lu\n", rows, st.st_size / elapsed / 1e6, batches);
+
+    for(int d = 0; d < sizeof(depths) / sizeof(depths[0]); d++)
+    {
+        snprintf(options, sizeof(options), "&backend=uring&queue_depth=%u", depths[d]);
+        elapsed = bench_scan(fname, options, cache_size, &rows, &batches);
+        printf("uring %u %lu %.1f %lu\n", depths[d], rows, st.st_size / elapsed / 1e6, batches);
+    }
+
+    if (!existing)
+        remove(fname);
+    free(fname);
+
+    return EXIT_SUCCESS;
+}
+
+
+/*
+ * readahead: cold table scans with several readahead windows
+ *
+ * Scans a table that was filled in key order (so its leaves are mostly
+ * in file order) after dropping it from the OS page cache, with the
+ * Pager's readahead off and then with growing windows, through the
+ * file backend (posix_fadvise) and the uring backend (batched reads).
+ */
+static int bench_readahead(int argc, char **argv)
+{
+    static const uint32_t windows[] = {0, 8, 32, 128, 512, 2048};
+    static const char *backends[] = {"file", "uring"};
+    uint32_t nrows = 1000000, cache_size = 512;
+    const char *existing = NULL;
+    char options[64];
+    uint64_t rows, batches;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:f:")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 'c': cache_size = atoi(optarg); break;
+        case 'f': existing = optarg; break;
+        default:
+            fprintf(stderr, "Usage: bench_pager readahead [-n rows] [-c cache_size] [-f existing file]\n");
+            return EXIT_FAILURE;
+        }
+
+    char *fname = existing? strdup(existing) : bench_tmpfile();
+    if (!existing)
+    {
+        /* Unlike bench_create_table, insert the keys in order */
+        chidb db;
+        uint8_t data[400] = {0};
+        char *uri = malloc(strlen(fname) + 32);
+
+        sprintf(uri, "file:%s?synchronous=off", fname);
+        if (chidb_Btree_open(uri, &db, &db.bt) != CHIDB_OK)
+        {
+            fprintf(stderr, "Could not open %s\n", uri);
+            exit(EXIT_FAILURE);
+        }
+        for(chidb_key_t key = 1; key <= nrows; key++)
+            if (chidb_Btree_insertInTable(db.bt, 1, key, data, sizeof(data)) != CHIDB_OK)
+            {
+                fprintf(stderr, "Could not insert key %u\n", key);
+                exit(EXIT_FAILURE);
+            }
+        chidb_Btree_close(db.bt);
+        free(uri);
+    }
+
+    struct stat st;
+    stat(fname, &st);
+    printf("# Scanning %.2f GB, cache_size=%u\n", st.st_size / 1e9, cache_size);
+    printf("# backend readahead rows MB/s batches\n");
+
+    for(int b = 0; b < sizeof(backends) / sizeof(backends[0]); b++)
+        for(int w = 0; w < sizeof(windows) / sizeof(windows[0]); w++)
+        {
+            snprintf(options, sizeof(options), "&backend=%s&readahead=%u", backends[b], windows[w]);
+            double elapsed = bench_scan(fname, options, cache_size, &rows, &batches);
+            printf("%s %u %lu %.1f %lu\n", backends[b], windows[w], rows, st.st_size / elapsed / 1e6, batches);
+        }
+
+    if (!existing)
+        remove(fname);
+    free(fname);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * hugepages: random point lookups over a table that fits in the pool
+ *
+ * Loads the whole table into a buffer pool large enough to hold it,
+ * with and without huge_pages, and then times random lookups (with
+ * chidb_Btree_find). Every lookup touches a few pages spread over the
+ * whole pool, so with regular pages most of them need a TLB miss.
+ * Reports the dTLB load misses per lookup (when the CPU's counters are
+ * available through perf_event_open) and how much of the process is
+ * backed by transparent huge pages.
+ */
+
+static int bench_perf_open()
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t bench_anon_huge_kb()
+{
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    char line[256];
+    uint64_t kb = 0;
+
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL)
+        if (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+            break;
+    if (f != NULL)
+        fclose(f);
+    return kb;
+}
+
+static int bench_hugepages(int argc, char **argv)
+{
+    static const char *memory[] = {"slabs", "region", "thp", "hugetlb"};
+    uint32_t nrows = 2000000, nlookups = 2000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 'l': nlookups = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: bench_pager hugepages [-n rows] [-l lookups]\n");
+            return EXIT_FAILURE;
+        }
+
+    char *fname = bench_tmpfile();
+    chidb *db = bench_create_table(fname, "?synchronous=off", nrows, 100);
+    npage_t npages = db->bt->pager->n_pages;
+    chidb_Btree_close(db->bt);
+    free(db);
+
+    printf("# %u rows, %u pages, %u lookups\n", nrows, npages, nlookups);
+    printf("# huge_pages memory ns/lookup dtlb_misses/lookup anon_huge_MB\n");
+
+    for(int huge = 0; huge < 2; huge++)
+    {
+        chidb db;
+        char uri[256];
+        MemPage *page;
+        uint8_t *data;
+        uint16_t size;
+        uint64_t misses = 0;
+
+        snprintf(uri, sizeof(uri), "file:%s?cache_size=%u&huge_pages=%i", fname, npages + 16, huge);
+        if (chidb_Btree_open(uri, &db, &db.bt) != CHIDB_OK)
+        {
+            fprintf(stderr, "Could not open %s\n", uri);
+            exit(EXIT_FAILURE);
+        }
+
+        /* Load the whole table into the pool */
+        for(npage_t i = 1; i <= npages; i++)
+        {
+            chidb_Pager_readPage(db.bt->pager, i, &page);
+            chidb_Pager_releaseMemPage(db.bt->pager, page);
+        }
+
+        int fd = bench_perf_open();
+        if (fd >= 0)
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        double start = bench_now();
+        for(uint32_t i = 0; i < nlookups; i++)
+        {
+            chidb_Btree_find(db.bt, 1, bench_rand() % nrows + 1, &data, &size);
+            free(data);
+        }
+        double elapsed = bench_now() - start;
+        if (fd >= 0)
+        {
+            if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+                misses = 0;
+            close(fd);
+        }
+
+        printf("%i %s %.1f ", huge, memory[db.bt->pager->pool_memory], elapsed * 1e9 / nlookups);
+        if (fd >= 0)
+            printf("%.2f ", (double) misses / nlookups);
+        else
+            printf("n/a ");
+        printf("%.0f\n", bench_anon_huge_kb() / 1024.0);
+
+        chidb_Btree_close(db.bt);
+    }
+
+    remove(fname);
+    free(fname);
+
+    return EXIT_SUCCESS;
+}
+
+
+/*
+ * threads: random page reads from several threads at once
+ *
+ * Reads pages at random, with 1 to N threads sharing a Pager with a
+ * sharded buffer pool, and reports the total throughput for each
+ * number of threads. With the default pool (-c 0), the whole file fits
+ * in the pool and nearly every read is a hit, so this measures how well
+ * the hit path scales; with a smaller pool, the threads also compete
+ * for the shards' locks on misses.
+ */
+typedef struct
+{
+    Pager *pager;
+    npage_t npages;
+    uint32_t nreads;
+    uint32_t seed;
+    uint64_t sum;
+} thread_reads_t;
+
+static void *bench_thread_reads(void *arg)
+{
+    thread_reads_t *t = arg;
+    uint32_t x = t->seed;
+    MemPage *page;
+
+    for(uint32_t i = 0; i < t->nreads; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        if (chidb_Pager_readPage(t->pager, x % t->npages + 1, &page) != CHIDB_OK)
+            continue;
+        t->sum += page->data[0];
+        chidb_Pager_releaseMemPage(t->pager, page);
+    }
+
+    return NULL;
+}
+
+static int bench_threads(int argc, char **argv)
+{
+    uint32_t nrows = 200000, cache_size = 0, shards = 64, nreads = 2000000;
+    uint32_t maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    char options[64];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:s:r:t:")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 'c': cache_size = atoi(optarg); break;
+        case 's': shards = atoi(optarg); break;
+        case 'r': nreads = atoi(optarg); break;
+        case 't': maxthreads = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: bench_pager threads [-n rows] [-c cache_size] [-s shards] [-r reads per thread] [-t threads]\n");
+            return EXIT_FAILURE;
+        }
+
+    char *fname = bench_tmpfile();
+    chidb *db = bench_create_table(fname, "?synchronous=off", nrows, 100);
+    npage_t npages = db->bt->pager->n_pages;
+    chidb_Btree_close(db->bt);
+    free(db);
+
+    if (cache_size == 0)
+        cache_size = npages + 16;
+    snprintf(options, sizeof(options), "?cache_size=%u&shards=%u", cache_size, shards);
+    db = malloc(sizeof(chidb));
+    char *uri = malloc(strlen(fname) + strlen(options) + 8);
+    sprintf(uri, "file:%s%s", fname, options);
+    if (chidb_Btree_open(uri, db, &db->bt) != CHIDB_OK)
+    {
+        fprintf(stderr, "Could not open %s\n", uri);
+        exit(EXIT_FAILURE);
+    }
+    Pager *pager = db->bt->pager;
+
+    /* Warm up the pool (and the OS page cache) */
+    for(npage_t i = 1; i <= npages; i++)
+    {
+        MemPage *page;
+        chidb_Pager_readPage(pager, i, &page);
+        chidb_Pager_releaseMemPage(pager, page);
+    }
+
+    printf("# %u pages, cache_size=%u, shards=%u, %u reads per thread\n", npages, cache_size, shards, nreads);
+    printf("# threads reads/s speedup hit_rate\n");
+
+    double base = 0;
+    for(uint32_t n = 1; n <= maxthreads; n = (n * 2 > maxthreads && n < maxthreads)? maxthreads : n * 2)
+    {
+        pthread_t threads[n];
+        thread_reads_t args[n];
+        uint64_t sum = 0;
+
+        chidb_Pager_resetStats(pager);
+        double start = bench_now();
+        for(uint32_t t = 0; t < n; t++)
+        {
+            args[t] = (thread_reads_t) {pager, npages, nreads, bench_rand() | 1, 0};
+            pthread_create(&threads[t], NULL, bench_thread_reads, &args[t]);
+        }
+        for(uint32_t t = 0; t < n; t++)
+        {
+            pthread_join(threads[t], NULL);
+            sum += args[t].sum;
+        }
+        double elapsed = bench_now() - start;
+        double rate = (double) n * nreads / elapsed;
+
+        chidb_stats_t st;
+        chidb_Pager_getStats(pager, &st);
+        if (n == 1)
+            base = rate;
+        printf("%u %.0f %.2f %.4f (checksum %lu)\n", n, rate, rate / base,
+               (double) st.cache_hits / (st.cache_hits + st.cache_misses), sum);
+    }
+
+    chidb_Btree_close(db->bt);
+    free(db);
+    free(uri);
+    remove(fname);
+    free(fname);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * pagesize: fanout and tree height at every page size
+ *
+ * Builds the same table (100-byte rows by default) with every page size
+ * from MIN_PAGE_SIZE to MAX_PAGE_SIZE, and prints the shape of its
+ * B-Tree: height, average fanout of the internal nodes, and rows per
+ * leaf. Then it times random lookups and a full scan with a cursor,
+ * with a buffer pool of the same size in bytes (-m) for every page
+ * size, so larger pages mean fewer frames. The file is accessed with the
+ * counting backend, so the reads that miss the pool are counted too.
+ */
+typedef struct
+{
+    uint32_t height;
+    uint64_t internal_nodes;
+    uint64_t children;
+    uint64_t leaves;
+    uint64_t rows;
+} tree_shape_t;
+
+static void bench_tree_shape(BTree *bt, npage_t npage, uint32_t depth, tree_shape_t *shape)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+
+    chidb_Btree_getNodeByPage(bt, npage, &btn);
+    if (depth > shape->height)
+        shape->height = depth;
+    if (btn->type == PGTYPE_TABLE_LEAF)
+    {
+        shape->leaves++;
+        shape->rows += btn->n_cells;
+    }
+    else
+    {
+        shape->internal_nodes++;
+        shape->children += btn->n_cells + 1;
+        for(ncell_t i = 0; i < btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &cell);
+            bench_tree_shape(bt, cell.fields.tableInternal.child_page, depth + 1, shape);
+        }
+        bench_tree_shape(bt, btn->right_page, depth + 1, shape);
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+}
+
+static int bench_pagesize(int argc, char **argv)
+{
+    uint32_t nrows = 200000, nlookups = 200000, rowsize = 100, memory = 4;
+    char options[128];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:r:m:")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 'l': nlookups = atoi(optarg); break;
+        case 'r': rowsize = atoi(optarg); break;
+        case 'm': memory = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: bench_pager pagesize [-n rows] [-l lookups] [-r row size] [-m pool size (MB)]\n");
+            return EXIT_FAILURE;
+        }
+
+    printf("# %u rows of %u bytes, %u lookups, %u MB buffer pool\n", nrows, rowsize, nlookups, memory);
+    printf("# page_size pages height fanout rows/leaf lookups/s reads/lookup scan_rows/s\n");
+    for(uint32_t page_size = MIN_PAGE_SIZE; page_size <= MAX_PAGE_SIZE; page_size *= 2)
+    {
+        char *fname = bench_tmpfile();
+        tree_shape_t shape = {0, 0, 0, 0, 0};
+        chidb_dbm_cursor_t cursor;
+        PagerCountingFile *file;
+        uint64_t reads, rows = 0;
+        uint8_t *data;
+        uint16_t size;
+        int rc;
+
+        if ((page_size - 108) / 2 - 10 < rowsize)
+        {
+            printf("%u (rows do not fit)\n", page_size);
+            free(fname);
+            continue;
+        }
+
+        snprintf(options, sizeof(options), "?page_size=%u", page_size);
+        chidb *db = bench_create_table(fname, options, nrows, rowsize);
+        chidb_Btree_close(db->bt);
+
+        snprintf(options, sizeof(options), "?backend=counting&cache_size=%u", (uint32_t) ((uint64_t) memory * 1024 * 1024 / page_size));
+        char *uri = malloc(strlen(fname) + sizeof(options) + 8);
+        sprintf(uri, "file:%s%s", fname, options);
+        if (chidb_Btree_open(uri, db, &db->bt) != CHIDB_OK)
+        {
+            fprintf(stderr, "Could not open %s\n", uri);
+            exit(EXIT_FAILURE);
+        }
+        file = (PagerCountingFile *) db->bt->pager->file;
+        bench_tree_shape(db->bt, 1, 1, &shape);
+
+        reads = file->reads;
+        double start = bench_now();
+        for(uint32_t i = 0; i < nlookups; i++)
+        {
+            if (chidb_Btree_find(db->bt, 1, bench_rand() % nrows + 1, &data, &size) != CHIDB_OK)
+            {
+                fprintf(stderr, "Lookup failed\n");
+                exit(EXIT_FAILURE);
+            }
+            free(data);
+        }
+        double lookup_time = bench_now() - start;
+        reads = file->reads - reads;
+
+        start = bench_now();
+        chidb_dbm_cursor_open(&cursor, CURSOR_READ, db->bt, 1);
+        for(rc = chidb_dbm_cursor_rewind(&cursor); rc == CHIDB_OK; rc = chidb_dbm_cursor_next(&cursor))
+            rows++;
+        chidb_dbm_cursor_close(&cursor);
+        double scan_time = bench_now() - start;
+
+        printf("%u %u %u %.1f %.1f %.0f %.2f %.0f\n", page_size, db->bt->pager->n_pages, shape.height,
+               shape.internal_nodes? (double) shape.children / shape.internal_nodes : 0.0,
+               (double) shape.rows / shape.leaves, nlookups / lookup_time,
+               (double) reads / nlookups, rows / scan_time);
+
+        chidb_Btree_close(db->bt);
+        free(db);
+        free(uri);
+        remove(fname);
+        free(fname);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * compress: the same table in a plain and in a compressed file
+ *
+ * The rows are made of words from a small vocabulary, like text in a
+ * real table, so pages compress reasonably well. For each kind of file,
+ * this prints the size of the file, how fast the rows were inserted,
+ * and the bytes read from the disk (below the compressed layer, with
+ * the counting backend) and the time taken by a cold table scan and by
+ * random lookups.
+ */
+
+static void bench_text_row(chidb_key_t key, uint8_t *data, uint16_t rowsize)
+{
+    static const char *words[] = {"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+                                  "table", "page", "record", "index", "cursor", "commit", "chidb", "data"};
+    uint16_t n = sizeof(key);
+
+    memcpy(data, &key, sizeof(key));
+    while (n < rowsize)
+    {
+        const char *word = words[bench_rand() % 16];
+        for(size_t i = 0; word[i] != '\0' && n < rowsize; i++)
+            data[n++] = word[i];
+        if (n < rowsize)
+            data[n++] = ' ';
+    }
+}
+
+static int bench_compress(int argc, char **argv)
+{
+    uint32_t nrows = 200000, nlookups = 20000, rowsize = 100, cache_size = 256;
+    char options[128];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:r:c:")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 'l': nlookups = atoi(optarg); break;
+        case 'r': rowsize = atoi(optarg); break;
+        case 'c': cache_size = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: bench_pager compress [-n rows] [-l lookups] [-r row size] [-c cache size]\n");
+            return EXIT_FAILURE;
+        }
+
+    printf("# %u rows of %u bytes, %u lookups, %u pages in the buffer pool\n", nrows, rowsize, nlookups, cache_size);
+    printf("# compress file_bytes insert_rows/s scan_rows/s scan_bytes_read lookups/s bytes_read/lookup\n");
+    for(int compress = 0; compress <= 1; compress++)
+    {
+        char *fname = bench_tmpfile();
+        char *uri = malloc(strlen(fname) + sizeof(options) + 8);
+        uint8_t *row = malloc(rowsize), *data;
+        chidb_dbm_cursor_t cursor;
+        PagerCountingFile *file;
+        uint64_t bytes, rows = 0;
+        struct stat st;
+        uint16_t size;
+        chidb db;
+        int fd, rc;
+
+        sprintf(uri, "file:%s?compress=%d", fname, compress);
+        if (chidb_Btree_open(uri, &db, &db.bt) != CHIDB_OK)
+        {
+            fprintf(stderr, "Could not open %s\n", uri);
+            exit(EXIT_FAILURE);
+        }
+        double start = bench_now();
+        for(uint32_t i = 0; i < nrows; i++)
+        {
+            chidb_key_t key = ((uint64_t) i * 7919) % nrows + 1;
+            bench_text_row(key, row, rowsize);
+            if (chidb_Btree_insertInTable(db.bt, 1, key, row, rowsize) != CHIDB_OK)
+            {
+                fprintf(stderr, "Could not insert key %u\n", key);
+                exit(EXIT_FAILURE);
+            }
+        }
+        chidb_Btree_close(db.bt);
+        double insert_time = bench_now() - start;
+        stat(fname, &st);
+
+        /* Drop the file from the page cache */
+        fd = open(fname, O_RDONLY);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+
+        snprintf(options, sizeof(options), "?backend=counting&cache_size=%u", cache_size);
+        sprintf(uri, "file:%s%s", fname, options);
+        if (chidb_Btree_open(uri, &db, &db.bt) != CHIDB_OK)
+        {
+            fprintf(stderr, "Could not open %s\n", uri);
+            exit(EXIT_FAILURE);
+        }
+        /* A compressed file is recognized, and put on top of the counting backend */
+        if (db.bt->pager->compress)
+            file = (PagerCountingFile *) ((PagerCompressedFile *) db.bt->pager->file)->inner;
+        else
+            file = (PagerCountingFile *) db.bt->pager->file;
+
+        bytes = file->bytes_read;
+        start = bench_now();
+        chidb_dbm_cursor_open(&cursor, CURSOR_READ, db.bt, 1);
+        for(rc = chidb_dbm_cursor_rewind(&cursor); rc == CHIDB_OK; rc = chidb_dbm_cursor_next(&cursor))
+            rows++;
+        chidb_dbm_cursor_close(&cursor);
+        double scan_time = bench_now() - start;
+        uint64_t scan_bytes = file->bytes_read - bytes;
+
+        bytes = file->bytes_read;
+        start = bench_now();
+        for(uint32_t i = 0; i < nlookups; i++)
+        {
+            if (chidb_Btree_find(db.bt, 1, bench_rand() % nrows + 1, &data, &size) != CHIDB_OK)
+            {
+                fprintf(stderr, "Lookup failed\n");
+                exit(EXIT_FAILURE);
+            }
+            free(data);
+        }
+        double lookup_time = bench_now() - start;
+
+        printf("%d %lu %.0f %.0f %lu %.0f %.1f\n", compress, (unsigned long) st.st_size, nrows / insert_time,
+               rows / scan_time, scan_bytes, nlookups / lookup_time, (double) (file->bytes_read - bytes) / nlookups);
+
+        chidb_Btree_close(db.bt);
+        remove(fname);
+        free(fname);
+        free(uri);
+        free(row);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * open: time to open a file, and to do the first lookup in it
+ *
+ * Opening a file should only read its header, however large the file
+ * is, and the first lookup should only read the pages on its path.
+ * For tables of growing size (plain, read through mmap, and compressed),
+ * this prints the time taken by chidb_Btree_open and by the first
+ * lookup (averaged over several opens, with the file in the OS page
+ * cache), and the reads done by both, counted by the counting backend.
+ */
+
+static int bench_open(int argc, char **argv)
+{
+    static const char *modes[] = {"plain", "mmap", "compress"};
+    uint32_t nrows = 1000000, nopens = 20, rowsize = 100;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:o:r:")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 'o': nopens = atoi(optarg); break;
+        case 'r': rowsize = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: bench_pager open [-n largest table (rows)] [-o opens] [-r row size]\n");
+            return EXIT_FAILURE;
+        }
+
+    printf("# %u opens of tables of up to %u rows of %u bytes\n", nopens, nrows, rowsize);
+    printf("# rows mode file_bytes open_us first_lookup_us reads bytes_read\n");
+    for(uint32_t rows = nrows / 100; rows <= nrows; rows *= 10)
+    {
+        char *plain = bench_tmpfile(), *compressed = bench_tmpfile();
+        char *uri = malloc(strlen(plain) + strlen(compressed) + 64);
+        chidb *db;
+
+        db = bench_create_table(plain, "", rows, rowsize);
+        chidb_Btree_close(db->bt);
+        free(db);
+        db = bench_create_table(compressed, "?compress=1", rows, rowsize);
+        chidb_Btree_close(db->bt);
+
+        for(int mode = 0; mode < 3; mode++)
+        {
+            const char *fname = (mode == 2)? compressed : plain;
+            double open_time = 0, lookup_time = 0;
+            uint64_t reads = 0, bytes = 0;
+            struct stat st;
+
+            stat(fname, &st);
+            sprintf(uri, "file:%s?backend=counting%s", fname, (mode == 1)? "&mmap=1" : "");
+            for(uint32_t i = 0; i < nopens; i++)
+            {
+                PagerCountingFile *file;
+                uint8_t *data;
+                uint16_t size;
+
+                double start = bench_now();
+                if (chidb_Btree_open(uri, db, &db->bt) != CHIDB_OK)
+                {
+                    fprintf(stderr, "Could not open %s\n", uri);
+                    exit(EXIT_FAILURE);
+                }
+                double opened = bench_now();
+                if (chidb_Btree_find(db->bt, 1, bench_rand() % rows + 1, &data, &size) != CHIDB_OK)
+                {
+                    fprintf(stderr, "Lookup failed\n");
+                    exit(EXIT_FAILURE);
+                }
+                double found = bench_now();
+                free(data);
+
+                if (db->bt->pager->compress)
+                    file = (PagerCountingFile *) ((PagerCompressedFile *) db->bt->pager->file)->inner;
+                else
+                    file = (PagerCountingFile *) db->bt->pager->file;
+                reads += file->reads;
+                bytes += file->bytes_read;
+                open_time += opened - start;
+                lookup_time += found - opened;
+                chidb_Btree_close(db->bt);
+            }
+
+            printf("%u %s %lu %.1f %.1f %.1f %.0f\n", rows, modes[mode], (unsigned long) st.st_size,
+                   open_time / nopens * 1e6, lookup_time / nopens * 1e6,
+                   (double) reads / nopens, (double) bytes / nopens);
+        }
+
+        free(db);
+        remove(plain);
+        remove(compressed);
+        free(plain);
+        free(compressed);
+        free(uri);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * lookup: in-memory point lookups at every page size
+ *
+ * Builds a table of small rows (8 bytes by default, so that pages hold
+ * as many cells as possible) with every page size, in a buffer pool
+ * large enough to hold all of it, and times random lookups with
+ * chidb_Btree_find and with a cursor (chidb_dbm_cursor_seek). No page
+ * is read from the file after the first pass, so this measures how
+ * long it takes to find a key within each node on the way down. The
+ * time taken to build the table (inserts also search every node on
+ * their way down) is printed too.
+ */
+static int bench_lookup_pagesize(int argc, char **argv)
+{
+    uint32_t nrows = 200000, nlookups = 1000000, rowsize = 8;
+    char options[128];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:r:")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 'l': nlookups = atoi(optarg); break;
+        case 'r': rowsize = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: bench_pager lookup [-n rows] [-l lookups] [-r row size]\n");
+            return EXIT_FAILURE;
+        }
+
+    printf("# %u rows of %u bytes, %u lookups\n", nrows, rowsize, nlookups);
+    printf("# page_size height rows/leaf inserts/s lookups/s seeks/s\n");
+    for(uint32_t page_size = MIN_PAGE_SIZE; page_size <= MAX_PAGE_SIZE; page_size *= 2)
+    {
+        char *fname = bench_tmpfile();
+        tree_shape_t shape = {0, 0, 0, 0, 0};
+        chidb_dbm_cursor_t cursor;
+        BTreeCell cell;
+        uint8_t *data;
+        uint16_t size;
+
+        if ((page_size - 108) / 2 - 10 < rowsize)
+        {
+            printf("%u (rows do not fit)\n", page_size);
+            free(fname);
+            continue;
+        }
+
+        /* Twice as many frames as the table needs with half-full leaves */
+        uint32_t cache_size = (uint32_t) ((uint64_t) nrows * (rowsize + 10) * 4 / page_size) + 64;
+        snprintf(options, sizeof(options), "?page_size=%u&cache_size=%u", page_size, cache_size);
+        double start = bench_now();
+        chidb *db = bench_create_table(fname, options, nrows, rowsize);
+        double insert_time = bench_now() - start;
+        bench_tree_shape(db->bt, 1, 1, &shape);
+
+        start = bench_now();
+        for(uint32_t i = 0; i < nlookups; i++)
+        {
+            if (chidb_Btree_find(db->bt, 1, bench_rand() % nrows + 1, &data, &size) != CHIDB_OK)
+            {
+                fprintf(stderr, "Lookup failed\n");
+                exit(EXIT_FAILURE);
+            }
+            free(data);
+        }
+        double lookup_time = bench_now() - start;
+
+        start = bench_now();
+        chidb_dbm_cursor_open(&cursor, CURSOR_READ, db->bt, 1);
+        for(uint32_t i = 0; i < nlookups; i++)
+        {
+            chidb_key_t key = bench_rand() % nrows + 1;
+            if (chidb_dbm_cursor_seek(&cursor, key) != CHIDB_OK
+                || chidb_dbm_cursor_getCell(&cursor, &cell) != CHIDB_OK || cell.key != key)
+            {
+                fprintf(stderr, "Seek failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        chidb_dbm_cursor_close(&cursor);
+        double seek_time = bench_now() - start;
+
+        printf("%u %u %.1f %.0f %.0f %.0f\n", page_size, shape.height, (double) shape.rows / shape.leaves,
+               nrows / insert_time, nlookups / lookup_time, nlookups / seek_time);
+
+        chidb_Btree_close(db->bt);
+        free(db);
+        remove(fname);
+        free(fname);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * record: point reads of records, copied or read in place
+ *
+ * Builds a table of records (an integer and a string of a given length)
+ * in a buffer pool large enough to hold all of it, and times random
+ * point reads of the integer field, first with chidb_Btree_find and
+ * chidb_DBRecord_unpack (which copy the record twice), and then with
+ * chidb_Btree_findView and chidb_DBRecord_unpackView (which read it
+ * from the page).
+ */
+static int bench_record(int argc, char **argv)
+{
+    uint32_t nrows = 100000, nlookups = 1000000, strsize = 100;
+    char options[64];
+    int opt, rc;
+
+    while ((opt = getopt(argc, argv, "n:l:s:")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 'l': nlookups = atoi(optarg); break;
+        case 's': strsize = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: bench_pager record [-n rows] [-l lookups] [-s string length]\n");
+            return EXIT_FAILURE;
+        }
+
+    char *fname = bench_tmpfile();
+    char *uri = malloc(strlen(fname) + sizeof(options) + 8);
+    char *str = malloc(strsize + 1);
+    chidb *db = malloc(sizeof(chidb));
+    DBRecord *dbr;
+    uint8_t *buf;
+
+    memset(str, 'x', strsize);
+    str[strsize] = '\0';
+    snprintf(options, sizeof(options), "?cache_size=%u", (uint32_t) ((uint64_t) nrows * (strsize + 20) * 2 / 1024) + 64);
+    sprintf(uri, "file:%s%s", fname, options);
+    if ((rc = chidb_Btree_open(uri, db, &db->bt)) != CHIDB_OK)
+    {
+        fprintf(stderr, "Could not open %s (%i)\n", uri, rc);
+        return EXIT_FAILURE;
+    }
+    for(uint32_t i = 0; i < nrows; i++)
+    {
+        chidb_key_t key = ((uint64_t) i * 7919) % nrows + 1;
+        chidb_DBRecord_create(&dbr, "|i4|s|", (int32_t) key, str);
+        chidb_DBRecord_pack(dbr, &buf);
+        if ((rc = chidb_Btree_insertInTable(db->bt, 1, key, buf, dbr->packed_len)) != CHIDB_OK)
+        {
+            fprintf(stderr, "Could not insert key %u (%i)\n", key, rc);
+            return EXIT_FAILURE;
+        }
+        chidb_DBRecord_destroy(dbr);
+        free(buf);
+    }
+
+    printf("# %u rows with a %u-byte string, %u lookups\n", nrows, strsize, nlookups);
+    printf("# method reads/s\n");
+    for(int view = 0; view <= 1; view++)
+    {
+        double start = bench_now();
+        for(uint32_t i = 0; i < nlookups; i++)
+        {
+            chidb_key_t key = bench_rand() % nrows + 1;
+            BTreeView v;
+            uint8_t *data;
+            uint16_t size;
+            int32_t val;
+
+            if (view)
+            {
+                rc = chidb_Btree_findView(db->bt, 1, key, &v);
+                if (rc == CHIDB_OK)
+                    chidb_DBRecord_unpackView(&dbr, v.data);
+            }
+            else
+            {
+                rc = chidb_Btree_find(db->bt, 1, key, &data, &size);
+                if (rc == CHIDB_OK)
+                    chidb_DBRecord_unpack(&dbr, data);
+            }
+            if (rc != CHIDB_OK || chidb_DBRecord_getInt32(dbr, 0, &val) != CHIDB_OK || val != (int32_t) key)
+            {
+                fprintf(stderr, "Lookup failed\n");
+                exit(EXIT_FAILURE);
+            }
+            chidb_DBRecord_destroy(dbr);
+            if (view)
+                chidb_Btree_releaseView(db->bt, &v);
+            else
+                free(data);
+        }
+        printf("%s %.0f\n", view? "findView+unpackView" : "find+unpack", nlookups / (bench_now() - start));
+    }
+
+    chidb_Btree_close(db->bt);
+    free(db);
+    remove(fname);
+    free(fname);
+    free(uri);
+    free(str);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * bulkload: building a table with inserts or with the bulk loader
+ *
+ * Builds the same table (100-byte rows by default) one row at a time
+ * with chidb_Btree_insertInTable, with the keys in a scrambled and in
+ * increasing order, and then with the bulk loader (chidb_Btree_loadInit)
+ * at a few fill factors. For each, prints how long it took (including
+ * writing the file), how many pages the table takes, and the shape of
+ * its B-Tree.
+ */
+static int bench_bulkload(int argc, char **argv)
+{
+    uint32_t nrows = 200000, rowsize = 100;
+    const char *methods[] = {"insert-scrambled", "insert-sorted", "load-100", "load-90", "load-70"};
+    uint8_t fills[] = {0, 0, 100, 90, 70};
+    int opt, rc;
+
+    while ((opt = getopt(argc, argv, "n:r:")) != -1)
+        switch (opt)
+        {
+        case 'n': nrows = atoi(optarg); break;
+        case 'r': rowsize = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: bench_pager bulkload [-n rows] [-r row size]\n");
+            return EXIT_FAILURE;
+        }
+
+    uint8_t *data = calloc(1, rowsize);
+    printf("# %u rows of %u bytes\n", nrows, rowsize);
+    printf("# method rows/s pages height rows/leaf\n");
+    for(int m = 0; m < 5; m++)
+    {
+        char *fname = bench_tmpfile();
+        char uri[128];
+        chidb *db;
+        tree_shape_t shape = {0, 0, 0, 0, 0};
+        BTreeLoader loader;
+
+        double start = bench_now();
+        if (m == 0)
+            db = bench_create_table(fname, "", nrows, rowsize);
+        else
+        {
+            db = malloc(sizeof(chidb));
+            snprintf(uri, sizeof(uri), "file:%s", fname);
+            if ((rc = chidb_Btree_open(uri, db, &db->bt)) != CHIDB_OK)
+            {
+                fprintf(stderr, "Could not open %s (%i)\n", uri, rc);
+                return EXIT_FAILURE;
+            }
+            if (fills[m] > 0 && (rc = chidb_Btree_loadInit(db->bt, 1, fills[m], &loader)) != CHIDB_OK)
+            {
+                fprintf(stderr, "Could not start the load (%i)\n", rc);
+                return EXIT_FAILURE;
+            }
+            for(chidb_key_t key = 1; key <= nrows; key++)
+            {
+                memcpy(data, &key, sizeof(key));
+                rc = (fills[m] > 0)? chidb_Btree_loadInTable(&loader, key, data, rowsize)
+                                   : chidb_Btree_insertInTable(db->bt, 1, key, data, rowsize);
+                if (rc != CHIDB_OK)
+                {
+                    fprintf(stderr, "Could not insert key %u (%i)\n", key, rc);
+                    return EXIT_FAILURE;
+                }
+            }
+            if (fills[m] > 0)
+                chidb_Btree_loadFinish(&loader);
+        }
+        chidb_Pager_flush(db->bt->pager);
+        double elapsed = bench_now() - start;
+
+        bench_tree_shape(db->bt, 1, 1, &shape);
+        printf("%s %.0f %u %u %.1f\n", methods[m], nrows / elapsed, db->bt->pager->n_pages, shape.height,
+               (double) shape.rows / shape.leaves);
+
+        chidb_Btree_close(db->bt);
+        free(db);
+        remove(fname);
+        free(fname);
+    }
+    free(data);
+
+    return EXIT_SUCCESS;
+}
+
+typedef struct
+{
+    const char *name;
+    int (*run)(int argc, char **argv);
+    const char *description;
+} benchmark_t;
+
+static benchmark_t benchmarks[] =
+{
+    {"cache", bench_cache, "Point lookups alongside full table scans"},
+    {"randread", bench_randread, "Random page reads from a large database"},
+    {"insert", bench_insert, "Bulk insert into a table"},
+    {"commit", bench_commit, "Small transactions, each followed by a commit"},
+    {"sync", bench_sync, "Small transactions at every synchronous level"},
+    {"slowdisk", bench_slowdisk, "Point lookups through a slow (simulated) disk"},
+    {"qdepth", bench_qdepth, "Table scans with the uring backend at several queue depths"},
+    {"readahead", bench_readahead, "Cold table scans with several readahead windows"},
+    {"hugepages", bench_hugepages, "Random lookups over a pool with and without huge pages"},
+    {"threads", bench_threads, "Random page reads from several threads over a sharded pool"},
+    {"pagesize", bench_pagesize, "Tree height, fanout, lookups and scans at every page size"},
+    {"compress", bench_compress, "File size and bytes read with and without compressed pages"},
+    {"open", bench_open, "Time (and reads) to open tables of growing size and do a first lookup"},
+    {"lookup", bench_lookup_pagesize, "In-memory lookups (find and cursor seek) at every page size"},
+    {"record", bench_record, "Point reads of records, copied or read in place"},
+    {"bulkload", bench_bulkload, "Building a table with inserts or with the bulk loader"},
+    {NULL, NULL, NULL}
+};
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2)
+        for(benchmark_t *b = benchmarks; b->name != NULL; b++)
+            if (!strcmp(argv[1], b->name))
+                return b->run(argc - 1, argv + 1);
+
+    fprintf(stderr, "Usage: %s <benchmark> [options]\n\nBenchmarks:\n", argv[0]);
+    for(benchmark_t *b = benchmarks; b->name != NULL; b++)
+        fprintf(stderr, "  %-10s %s\n", b->name, b->description);
+
+    return EXIT_FAILURE;
+}
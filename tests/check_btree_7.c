@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <check.h>
 #include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+#include "libchidb/record.h"
 
 START_TEST (test_7_1)
 {
@@ -70,12 +72,289 @@ START_TEST (test_7_3)
 END_TEST
 
 
+START_TEST (test_7_4)
+{
+    chidb *db;
+    int rc;
+    uint8_t *big = malloc(MAX_PAGE_SIZE);
+    uint8_t *data;
+    uint16_t size;
+
+    memset(big, 0xAB, MAX_PAGE_SIZE);
+    for(uint32_t page_size = MIN_PAGE_SIZE; page_size <= MAX_PAGE_SIZE; page_size *= 2)
+    {
+        /* The largest record that can be inserted: two of them fit in page 1 */
+        uint16_t maxsize = (page_size - 108) / 2 - 10;
+        char *fname = create_tmp_file();
+        char uri[128];
+        uint8_t header[18];
+        FILE *f;
+
+        sprintf(uri, "file:%s?page_size=%u", fname, page_size);
+        db = malloc(sizeof(chidb));
+        rc = chidb_Btree_open(uri, db, &db->bt);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(db->bt->pager->page_size == page_size);
+
+        for(int i=0; i<bigfile_nvalues; i++)
+            insert_bigfile(db, i);
+        rc = chidb_Btree_insertInTable(db->bt, 1, 1, big, maxsize + 1);
+        ck_assert(rc == CHIDB_ENOMEM);
+        rc = chidb_Btree_insertInTable(db->bt, 1, 1, big, maxsize);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Btree_close(db->bt);
+
+        /* 65536 is stored as 1 */
+        f = fopen(fname, "r");
+        ck_assert(fread(header, 1, sizeof(header), f) == sizeof(header));
+        fclose(f);
+        ck_assert(get2byte(header + 16) == (page_size == MAX_PAGE_SIZE? 1 : page_size));
+
+        /* The page size in the header wins over the option */
+        sprintf(uri, "file:%s?page_size=%u", fname, page_size == MIN_PAGE_SIZE? MAX_PAGE_SIZE : MIN_PAGE_SIZE);
+        rc = chidb_Btree_open(uri, db, &db->bt);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(db->bt->pager->page_size == page_size);
+
+        test_bigfile(db);
+        rc = chidb_Btree_find(db->bt, 1, 1, &data, &size);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(size == maxsize);
+        ck_assert(!memcmp(data, big, maxsize));
+        free(data);
+
+        chidb_Btree_close(db->bt);
+        delete_tmp_file(fname);
+        free(db);
+    }
+
+    /* Page sizes that are not a power of two, or out of range */
+    char *fname = create_tmp_file();
+    const char *bad[] = {"512", "3072", "131072"};
+    for(int i = 0; i < 3; i++)
+    {
+        char uri[128];
+        sprintf(uri, "file:%s?page_size=%s", fname, bad[i]);
+        db = malloc(sizeof(chidb));
+        rc = chidb_Btree_open(uri, db, &db->bt);
+        ck_assert(rc == CHIDB_EMISUSE);
+        free(db);
+    }
+    delete_tmp_file(fname);
+    free(big);
+}
+END_TEST
+
+
+/* Seek a cursor to every key (and to every gap between keys) in a
+ * table and in an index with several levels */
+START_TEST (test_7_5)
+{
+    chidb *db;
+    int rc;
+    uint8_t data[64] = {0};
+    chidb_dbm_cursor_t cursor;
+    BTreeCell cell;
+    npage_t index_nroot;
+    const chidb_key_t nkeys = 2000;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Btree_newNode(db->bt, &index_nroot, PGTYPE_INDEX_LEAF);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Even keys only, in a scrambled order */
+    for(chidb_key_t i = 0; i < nkeys; i++)
+    {
+        chidb_key_t key = 2 * ((i * 7919) % nkeys + 1);
+        rc = chidb_Btree_insertInTable(db->bt, 1, key, data, sizeof(data));
+        ck_assert(rc == CHIDB_OK);
+        rc = chidb_Btree_insertInIndex(db->bt, index_nroot, key, key + 1);
+        ck_assert(rc == CHIDB_OK);
+    }
+    rc = chidb_Btree_insertInTable(db->bt, 1, 2, data, sizeof(data));
+    ck_assert(rc == CHIDB_EDUPLICATE);
+
+    npage_t roots[] = {1, index_nroot};
+    for(int r = 0; r < 2; r++)
+    {
+        chidb_dbm_cursor_open(&cursor, CURSOR_READ, db->bt, roots[r]);
+        for(chidb_key_t key = 0; key <= 2 * nkeys; key++)
+        {
+            rc = chidb_dbm_cursor_seek(&cursor, key);
+            ck_assert(rc == CHIDB_OK);
+            rc = chidb_dbm_cursor_getCell(&cursor, &cell);
+            ck_assert(rc == CHIDB_OK);
+            ck_assert(cell.key == (key == 0? 2 : key + key % 2));
+
+            /* The cursor can move on from where it landed */
+            rc = chidb_dbm_cursor_next(&cursor);
+            if (cell.key == 2 * nkeys)
+                ck_assert(rc == CHIDB_DONE);
+            else
+            {
+                ck_assert(rc == CHIDB_OK);
+                chidb_dbm_cursor_getCell(&cursor, &cell);
+                ck_assert(cell.key == (key == 0? 4 : key + key % 2 + 2));
+            }
+        }
+        rc = chidb_dbm_cursor_seek(&cursor, 2 * nkeys + 1);
+        ck_assert(rc == CHIDB_DONE);
+        chidb_dbm_cursor_close(&cursor);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Point reads through views, decoding records in place */
+START_TEST (test_7_6)
+{
+    chidb *db;
+    int rc;
+    BTreeView view;
+    DBRecord *dbr;
+    uint8_t *buf;
+    int32_t val;
+    npage_t index_nroot;
+    const chidb_key_t nkeys = 1000;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Btree_newNode(db->bt, &index_nroot, PGTYPE_INDEX_LEAF);
+    ck_assert(rc == CHIDB_OK);
+
+    for(chidb_key_t i = 0; i < nkeys; i++)
+    {
+        chidb_key_t key = (i * 7919) % nkeys + 1;
+        chidb_DBRecord_create(&dbr, "|i4|s|", (int32_t) key * 3, "view");
+        chidb_DBRecord_pack(dbr, &buf);
+        rc = chidb_Btree_insertInTable(db->bt, 1, key, buf, dbr->packed_len);
+        ck_assert(rc == CHIDB_OK);
+        rc = chidb_Btree_insertInIndex(db->bt, index_nroot, key, key + 1);
+        ck_assert(rc == CHIDB_OK);
+        chidb_DBRecord_destroy(dbr);
+        free(buf);
+    }
+
+    for(chidb_key_t key = 1; key <= nkeys; key++)
+    {
+        rc = chidb_Btree_findView(db->bt, 1, key, &view);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(view.data >= view.btn->page->data);
+        ck_assert(view.data + view.size <= view.btn->page->data + db->bt->pager->page_size);
+        chidb_DBRecord_unpackView(&dbr, view.data);
+        ck_assert(dbr->packed_len == view.size);
+        chidb_DBRecord_getInt32(dbr, 0, &val);
+        ck_assert(val == (int32_t) key * 3);
+        chidb_DBRecord_destroy(dbr);
+        chidb_Btree_releaseView(db->bt, &view);
+        ck_assert(view.btn == NULL);
+
+        rc = chidb_Btree_findView(db->bt, index_nroot, key, &view);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(view.size == 4);
+        ck_assert(get4byte(view.data) == key + 1);
+        chidb_Btree_releaseView(db->bt, &view);
+    }
+
+    rc = chidb_Btree_findView(db->bt, 1, nkeys + 1, &view);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+    rc = chidb_Btree_findView(db->bt, index_nroot, 0, &view);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Bulk loads of the big file, at several fill factors */
+START_TEST (test_7_7)
+{
+    chidb *db;
+    int rc;
+    BTreeLoader loader;
+    uint8_t buf[192];
+    npage_t inserted_npages;
+    uint8_t fills[] = {100, 50, 1};
+
+    /* Pages taken by the same table with one insertion at a time */
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+    inserted_npages = db->bt->pager->n_pages;
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+
+    for(int f = 0; f < 3; f++)
+    {
+        fname = create_tmp_file();
+        rc = chidb_Btree_open(fname, db, &db->bt);
+        ck_assert(rc == CHIDB_OK);
+
+        rc = chidb_Btree_loadInit(db->bt, 1, fills[f], &loader);
+        ck_assert(rc == CHIDB_OK);
+        for(int i=0; i<bigfile_nvalues; i++)
+        {
+            for(int j=0; j<48; j++)
+                put4byte(buf + (4*j), bigfile_ikeys[i]);
+            rc = chidb_Btree_loadInTable(&loader, bigfile_pkeys[i], buf, ((bigfile_pkeys[i] % 3) + 1) * 64);
+            ck_assert(rc == CHIDB_OK);
+        }
+        rc = chidb_Btree_loadInTable(&loader, bigfile_pkeys[bigfile_nvalues - 1], buf, 64);
+        ck_assert(rc == CHIDB_EDUPLICATE);
+        rc = chidb_Btree_loadInTable(&loader, 1, buf, 64);
+        ck_assert(rc == CHIDB_EMISUSE);
+        rc = chidb_Btree_loadInIndex(&loader, bigfile_pkeys[bigfile_nvalues - 1] + 1, 1);
+        ck_assert(rc == CHIDB_EMISUSE);
+        rc = chidb_Btree_loadFinish(&loader);
+        ck_assert(rc == CHIDB_OK);
+
+        if (fills[f] == 100)
+            ck_assert(db->bt->pager->n_pages < inserted_npages);
+        test_bigfile(db);
+
+        /* Only empty B-Trees can be loaded */
+        rc = chidb_Btree_loadInit(db->bt, 1, 100, &loader);
+        ck_assert(rc == CHIDB_EMISUSE);
+
+        /* The B-Tree can still be inserted into */
+        rc = chidb_Btree_insertInTable(db->bt, 1, 10000, buf, 192);
+        ck_assert(rc == CHIDB_OK);
+        rc = chidb_Btree_insertInTable(db->bt, 1, 7, buf, 192);
+        ck_assert(rc == CHIDB_OK);
+        test_bigfile(db);
+
+        chidb_Btree_close(db->bt);
+        delete_tmp_file(fname);
+    }
+    free(db);
+}
+END_TEST
+
+
 TCase* make_btree_7_tc(void)
 {
     TCase *tc = tcase_create ("Step 7: Insertion with splitting");
     tcase_add_test (tc, test_7_1);
     tcase_add_test (tc, test_7_2);
     tcase_add_test (tc, test_7_3);
+    tcase_add_test (tc, test_7_4);
+    tcase_add_test (tc, test_7_5);
+    tcase_add_test (tc, test_7_6);
+    tcase_add_test (tc, test_7_7);
 
     return tc;
 }
@@ -85,12 +85,66 @@ START_TEST (test_8_3)
 END_TEST
 
 
+static int cmp_bigfile_ikeys(const void *a, const void *b)
+{
+    chidb_key_t ka = bigfile_ikeys[*(const int *) a], kb = bigfile_ikeys[*(const int *) b];
+
+    return (ka > kb) - (ka < kb);
+}
+
+START_TEST (test_8_4)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    BTreeLoader loader;
+    int order[bigfile_nvalues];
+    uint8_t fills[] = {100, 50, 1};
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        order[i] = i;
+    qsort(order, bigfile_nvalues, sizeof(int), cmp_bigfile_ikeys);
+
+    for(int f = 0; f < 3; f++)
+    {
+        char *fname = create_tmp_file();
+        db = malloc(sizeof(chidb));
+        rc = chidb_Btree_open(fname, db, &db->bt);
+        ck_assert(rc == CHIDB_OK);
+
+        for(int i=0; i<bigfile_nvalues; i++)
+            insert_bigfile(db, i);
+
+        chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+        rc = chidb_Btree_loadInit(db->bt, npage, fills[f], &loader);
+        ck_assert(rc == CHIDB_OK);
+        for(int i=0; i<bigfile_nvalues; i++)
+        {
+            rc = chidb_Btree_loadInIndex(&loader, bigfile_ikeys[order[i]], bigfile_pkeys[order[i]]);
+            ck_assert(rc == CHIDB_OK);
+        }
+        rc = chidb_Btree_loadInTable(&loader, 10000, NULL, 0);
+        ck_assert(rc == CHIDB_EMISUSE);
+        rc = chidb_Btree_loadFinish(&loader);
+        ck_assert(rc == CHIDB_OK);
+
+        test_index_bigfile(db, npage);
+
+        chidb_Btree_close(db->bt);
+        delete_tmp_file(fname);
+        free(db);
+    }
+}
+END_TEST
+
+
 TCase* make_btree_8_tc(void)
 {
     TCase *tc = tcase_create ("Step 8: Supporting index B-Trees");
     tcase_add_test (tc, test_8_1);
     tcase_add_test (tc, test_8_2);
     tcase_add_test (tc, test_8_3);
+    tcase_add_test (tc, test_8_4);
 
     return tc;
 }
@@ -1,5 +1,9 @@
 #include <stdlib.h>
 #include <check.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "check_common.h"
 #include "libchidb/pager.h"
 
@@ -9,6 +13,9 @@
 #define TESTFILE ("32k-of-zeroes.dat")
 #define MAXPAGES (8)
 
+/* A page size that is a multiple of every device's block size */
+#define DIRECT_PAGE_SIZE (8 * PAGE_SIZE)
+
 #define NMULT (6)
 uint8_t pagemult[] = {1,2,4,8,16,32};
 
@@ -145,6 +152,1477 @@ START_TEST (test_readwrite)
 }
 END_TEST
 
+START_TEST (test_cache)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page, *page2, *pinned[MAXPAGES];
+
+    char *fname = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 32);
+    sprintf(uri, "file:%s?cache_size=2", fname);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert(pg->cache_size == 2);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        memset(page->data, j, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    /* A page that is already pinned is shared */
+    chidb_Pager_readPage(pg, 1, &page);
+    chidb_Pager_readPage(pg, 1, &page2);
+    ck_assert(page == page2);
+    chidb_Pager_releaseMemPage(pg, page2);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    /* Cycling through more pages than the pool can hold */
+    for(int k=0; k<3; k++)
+        for(int j=1; j<=MAXPAGES; j++)
+        {
+            rc = chidb_Pager_readPage(pg, j, &page);
+            ck_assert(rc == CHIDB_OK);
+            ck_assert(page->data[0] == j && page->data[PAGE_SIZE-1] == j);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+
+    /* Pinning more pages than there are frames */
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        rc = chidb_Pager_readPage(pg, j, &pinned[j-1]);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(pinned[j-1]->data[0] == j);
+    }
+    for(int j=1; j<=MAXPAGES; j++)
+        chidb_Pager_releaseMemPage(pg, pinned[j-1]);
+
+    chidb_Pager_close(pg);
+    free(uri);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_cache_scan)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    uint64_t misses;
+
+    char *fname = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 32);
+    sprintf(uri, "file:%s?cache_size=8", fname);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    for(int j=1; j<=4*MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        memset(page->data, j, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    /* Pages 1-4 are used more than once, so they should stay in the pool */
+    for(int k=0; k<2; k++)
+        for(int j=1; j<=4; j++)
+        {
+            chidb_Pager_readPage(pg, j, &page);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+
+    /* ...even after a couple of scans over the rest of the file */
+    for(int k=0; k<2; k++)
+        for(int j=5; j<=4*MAXPAGES; j++)
+        {
+            rc = chidb_Pager_readPageHint(pg, j, PAGER_HINT_SCAN, &page);
+            ck_assert(rc == CHIDB_OK);
+            ck_assert(page->data[0] == j);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+
+    misses = pg->cache_misses;
+    for(int j=1; j<=4; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        ck_assert(page->data[0] == j);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    ck_assert(pg->cache_misses == misses);
+
+    chidb_Pager_close(pg);
+    free(uri);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_cache_buffers)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *pages[3 * NVALUES / 2];
+
+    char *fname = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 32);
+    sprintf(uri, "file:%s?cache_size=%i", fname, 3 * NVALUES / 2);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* Every frame gets its own page-aligned buffer, even though
+     * they are allocated several at a time */
+    for(int j=0; j<3*NVALUES/2; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        rc = chidb_Pager_readPage(pg, npage, &pages[j]);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert((uintptr_t) pages[j]->data % PAGE_SIZE == 0);
+        memset(pages[j]->data, j, PAGE_SIZE);
+    }
+    for(int j=0; j<3*NVALUES/2; j++)
+    {
+        ck_assert(pages[j]->data[0] == (uint8_t) j && pages[j]->data[PAGE_SIZE-1] == (uint8_t) j);
+        chidb_Pager_releaseMemPage(pg, pages[j]);
+    }
+
+    chidb_Pager_close(pg);
+    free(uri);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_cache_hugepages)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *pages[3 * NVALUES / 2];
+
+    char *fname = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 64);
+    sprintf(uri, "file:%s?cache_size=%i&huge_pages=1", fname, 3 * NVALUES / 2);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* Every buffer is carved out of a single region, one page
+     * after the other, and is still page-aligned */
+    for(int j=0; j<3*NVALUES/2; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        rc = chidb_Pager_readPage(pg, npage, &pages[j]);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert((uintptr_t) pages[j]->data % PAGE_SIZE == 0);
+        memset(pages[j]->data, j, PAGE_SIZE);
+    }
+
+    /* Some kind of region is always available */
+    ck_assert(pg->pool_memory != PAGER_POOL_SLABS && pg->pool != NULL);
+    ck_assert(pages[0]->data == pg->pool);
+    ck_assert(pages[3*NVALUES/2-1]->data + PAGE_SIZE <= pg->pool + pg->pool_size);
+
+    for(int j=0; j<3*NVALUES/2; j++)
+    {
+        ck_assert(pages[j]->data[0] == (uint8_t) j && pages[j]->data[PAGE_SIZE-1] == (uint8_t) j);
+        chidb_Pager_releaseMemPage(pg, pages[j]);
+    }
+
+    chidb_Pager_close(pg);
+    free(uri);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+#define NTHREADS (4)
+#define NSHARDPAGES (8 * MAXPAGES)
+#define NTHREADREADS (20000)
+
+static void *read_shared_pages(void *arg)
+{
+    Pager *pg = arg;
+    MemPage *page;
+    unsigned int seed = (uintptr_t) &page;
+    uintptr_t errors = 0;
+
+    for(int i=0; i<NTHREADREADS; i++)
+    {
+        npage_t npage = 1 + rand_r(&seed) % NSHARDPAGES;
+
+        if (chidb_Pager_readPage(pg, npage, &page) != CHIDB_OK)
+        {
+            errors++;
+            continue;
+        }
+        if (page->npage != npage || page->data[0] != npage || page->data[PAGE_SIZE-1] != npage)
+            errors++;
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    return (void *) errors;
+}
+
+START_TEST (test_cache_shards)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page, *pinned[NSHARDPAGES];
+    pthread_t threads[NTHREADS];
+    chidb_stats_t st;
+
+    char *fname = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 64);
+
+    sprintf(uri, "file:%s?shards=3", fname);
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_EMISUSE);
+
+    sprintf(uri, "file:%s?cache_size=%i&shards=4", fname, 2 * MAXPAGES);
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* Dirty frames are not evicted in a sharded pool, so once every
+     * frame is dirty, pages are written straight to the file */
+    for(int j=1; j<=NSHARDPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        memset(page->data, j, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    ck_assert(pg->shard_bits == 2);
+    for(int j=1; j<=NSHARDPAGES; j++)
+    {
+        rc = chidb_Pager_readPage(pg, j, &page);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(page->data[0] == j && page->data[PAGE_SIZE-1] == j);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+
+    /* Pinning more pages than there are frames */
+    for(int j=1; j<=NSHARDPAGES; j++)
+    {
+        rc = chidb_Pager_readPage(pg, j, &pinned[j-1]);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(pinned[j-1]->data[0] == j);
+    }
+    for(int j=1; j<=NSHARDPAGES; j++)
+        chidb_Pager_releaseMemPage(pg, pinned[j-1]);
+
+    /* Several threads reading (and evicting) pages at once */
+    chidb_Pager_resetStats(pg);
+    for(int t=0; t<NTHREADS; t++)
+        ck_assert(pthread_create(&threads[t], NULL, read_shared_pages, pg) == 0);
+    for(int t=0; t<NTHREADS; t++)
+    {
+        void *errors;
+        pthread_join(threads[t], &errors);
+        ck_assert(errors == NULL);
+    }
+    chidb_Pager_getStats(pg, &st);
+    ck_assert(st.cache_hits + st.cache_misses == NTHREADS * NTHREADREADS);
+    ck_assert(st.evictions > 0);
+
+    /* Every frame is unpinned once the threads are done */
+    for(uint32_t i=0; i<pg->cache_size; i++)
+        ck_assert(pg->frames[i].pin_count == 0);
+
+    chidb_Pager_close(pg);
+    free(uri);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_cache_shards_cold)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    PagerCountingFile *file;
+    pthread_t threads[NTHREADS];
+    chidb_stats_t st;
+    uint64_t reads;
+
+    char *fname = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 64);
+
+    sprintf(uri, "file:%s?shards=4&backend=mmap", fname);
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_EMISUSE);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=NSHARDPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        memset(page->data, j, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    /* The pool is ready as soon as the page size is set, so the
+     * threads can start reading an existing file right away */
+    sprintf(uri, "file:%s?cache_size=%i&shards=4&backend=counting", fname, 2 * MAXPAGES);
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert(pg->frames != NULL && pg->shard_bits == 2);
+
+    file = (PagerCountingFile *) pg->file;
+    reads = file->reads;
+    for(int t=0; t<NTHREADS; t++)
+        ck_assert(pthread_create(&threads[t], NULL, read_shared_pages, pg) == 0);
+    for(int t=0; t<NTHREADS; t++)
+    {
+        void *errors;
+        pthread_join(threads[t], &errors);
+        ck_assert(errors == NULL);
+    }
+
+    /* Every miss is one read, and no read is lost in the count */
+    chidb_Pager_getStats(pg, &st);
+    ck_assert(st.cache_hits + st.cache_misses == NTHREADS * NTHREADREADS);
+    ck_assert(file->reads - reads == st.cache_misses);
+
+    chidb_Pager_close(pg);
+    free(uri);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_writeback)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* Writes are deferred, and a page written twice is only written once */
+    for(int k=0; k<2; k++)
+        for(int j=1; j<=MAXPAGES; j++)
+        {
+            if (k == 0)
+                chidb_Pager_allocatePage(pg, &npage);
+            chidb_Pager_readPage(pg, j, &page);
+            memset(page->data, j + k, PAGE_SIZE);
+            chidb_Pager_writePage(pg, page);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+    ck_assert(pg->n_dirty == MAXPAGES);
+    ck_assert(pg->write_calls == 0);
+    chidb_Pager_getRealDBSize(pg, &npage);
+    ck_assert(npage == 0);
+
+    /* Consecutive pages are written together */
+    rc = chidb_Pager_flush(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->n_dirty == 0);
+    ck_assert(pg->write_calls == 1);
+    ck_assert(pg->pages_written == MAXPAGES);
+    chidb_Pager_getRealDBSize(pg, &npage);
+    ck_assert(npage == MAXPAGES);
+
+    /* Pages 5, 2 and 3 (in that order) take two writes */
+    for(int j=5; j>=2; j--)
+    {
+        if (j == 4)
+            continue;
+        chidb_Pager_readPage(pg, j, &page);
+        memset(page->data, 0x42, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_flush(pg);
+    ck_assert(pg->write_calls == 3);
+    ck_assert(pg->pages_written == MAXPAGES + 3);
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_open(&pg, fname);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        uint8_t v = (j == 2 || j == 3 || j == 5)? 0x42 : j + 1;
+        chidb_Pager_readPage(pg, j, &page);
+        ck_assert(page->data[0] == v && page->data[PAGE_SIZE-1] == v);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_freelist)
+{
+    int rc;
+    npage_t npage, nfree = 300;
+    Pager *pg;
+    MemPage *page;
+    bool *used;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* Page 1 is all zeroes, which is an empty freelist */
+    chidb_Pager_allocatePage(pg, &npage);
+    chidb_Pager_readPage(pg, npage, &page);
+    memset(page->data, 0, PAGE_SIZE);
+    chidb_Pager_writePage(pg, page);
+    chidb_Pager_releaseMemPage(pg, page);
+    ck_assert(chidb_Pager_freePage(pg, 1) == CHIDB_EMISUSE);
+    rc = chidb_Pager_initFreelist(pg);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int j=2; j<=2*nfree; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+    ck_assert(pg->n_pages == 2*nfree);
+
+    /* Free every other page (more than fit in one trunk page) */
+    ck_assert(chidb_Pager_freePage(pg, 1) == CHIDB_EPAGENO);
+    for(int j=2; j<=2*nfree; j+=2)
+    {
+        rc = chidb_Pager_freePage(pg, j);
+        ck_assert(rc == CHIDB_OK);
+    }
+    ck_assert(pg->freelist_count == nfree);
+    chidb_Pager_close(pg);
+
+    /* The freelist is persistent, and allocation draws from it */
+    rc = chidb_Pager_open(&pg, fname);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    rc = chidb_Pager_initFreelist(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->freelist_count == nfree);
+
+    used = calloc(2*nfree + 1, sizeof(bool));
+    for(int j=0; j<nfree; j++)
+    {
+        rc = chidb_Pager_allocatePage(pg, &npage);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(npage % 2 == 0 && npage <= 2*nfree);
+        ck_assert(!used[npage]);
+        used[npage] = true;
+    }
+    ck_assert(pg->freelist_count == 0 && pg->freelist_trunk == 0);
+    ck_assert(pg->n_pages == 2*nfree);
+
+    chidb_Pager_allocatePage(pg, &npage);
+    ck_assert(npage == 2*nfree + 1);
+
+    free(used);
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_extents)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    struct stat st;
+
+    char *fname = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 32);
+    sprintf(uri, "file:%s?extent_size=%u", fname, 4 * PAGE_SIZE);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* The file grows by whole extents, but only the pages that have
+     * been written count towards its size */
+    for(int j=1; j<=MAXPAGES+1; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        memset(page->data, j, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+        chidb_Pager_flush(pg);
+
+        chidb_Pager_getRealDBSize(pg, &npage);
+        ck_assert(npage == j);
+        stat(fname, &st);
+        ck_assert(st.st_size == ((j + 3) / 4) * 4 * PAGE_SIZE);
+    }
+
+    /* The preallocated space is given back when the file is closed */
+    rc = chidb_Pager_close(pg);
+    ck_assert(rc == CHIDB_OK);
+    stat(fname, &st);
+    ck_assert(st.st_size == (MAXPAGES + 1) * PAGE_SIZE);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert(pg->n_pages == MAXPAGES + 1);
+    chidb_Pager_readPage(pg, MAXPAGES + 1, &page);
+    ck_assert(page->data[0] == MAXPAGES + 1);
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_close(pg);
+
+    /* Bad options */
+    sprintf(uri, "file:%s?extent_pct=101", fname);
+    ck_assert(chidb_Pager_open(&pg, uri) == CHIDB_EMISUSE);
+
+    free(uri);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_extents_crash)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    struct stat st;
+
+    char *fname = create_tmp_file();
+    char *crash = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 32);
+    sprintf(uri, "file:%s?extent_size=%u", fname, 8 * PAGE_SIZE);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* Page 1 is all zeroes, which is a header with no page count */
+    chidb_Pager_allocatePage(pg, &npage);
+    chidb_Pager_readPage(pg, npage, &page);
+    memset(page->data, 0, PAGE_SIZE);
+    chidb_Pager_writePage(pg, page);
+    chidb_Pager_releaseMemPage(pg, page);
+    rc = chidb_Pager_initFreelist(pg);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int j=2; j<=MAXPAGES/2+1; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        memset(page->data, j, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    rc = chidb_Pager_flush(pg);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Take a snapshot of the file, as if the program had crashed here,
+     * with the rest of the extent still preallocated */
+    stat(fname, &st);
+    ck_assert(st.st_size == 8 * PAGE_SIZE);
+    ck_assert(copy(fname, crash) != NULL);
+    chidb_Pager_close(pg);
+
+    /* The preallocated pages are not pages of the database... */
+    rc = chidb_Pager_open(&pg, crash);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    rc = chidb_Pager_initFreelist(pg);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_getRealDBSize(pg, &npage);
+    ck_assert(npage == MAXPAGES/2+1);
+    ck_assert(pg->n_pages == MAXPAGES/2+1);
+    chidb_Pager_readPage(pg, MAXPAGES/2+1, &page);
+    ck_assert(page->data[0] == MAXPAGES/2+1);
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_allocatePage(pg, &npage);
+    ck_assert(npage == MAXPAGES/2+2);
+
+    /* ...and they are given back when the file is closed */
+    rc = chidb_Pager_close(pg);
+    ck_assert(rc == CHIDB_OK);
+    stat(crash, &st);
+    ck_assert(st.st_size == (MAXPAGES/2+1) * PAGE_SIZE);
+
+    free(uri);
+    delete_tmp_file(fname);
+    delete_tmp_file(crash);
+}
+END_TEST
+
+
+START_TEST (test_wal)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+
+    char *fname = create_tmp_file();
+    char *crash = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 64);
+    char *wal = malloc(strlen(fname) + 8), *crash_wal = malloc(strlen(crash) + 8);
+    sprintf(uri, "file:%s?wal=1&cache_size=2", fname);
+    sprintf(wal, "%s-wal", fname);
+    sprintf(crash_wal, "%s-wal", crash);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->wal != NULL);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        memset(page->data, j, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    rc = chidb_Pager_checkpoint(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->wal->n_frames == 0);
+    ck_assert(pg->db_size == MAXPAGES * PAGE_SIZE);
+
+    /* Committed pages go to the log, not to the file, and are read back
+     * from the log (the buffer pool is too small to hold them) */
+    for(int j=1; j<=MAXPAGES/2; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        memset(page->data, j + 100, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    rc = chidb_Pager_flush(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->wal->n_frames >= MAXPAGES/2);
+    ck_assert(pg->wal->n_committed == pg->wal->n_frames);
+    ck_assert(pg->wal->n_indexed == MAXPAGES/2);
+    ck_assert(pg->db_size == MAXPAGES * PAGE_SIZE);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        ck_assert(page->data[0] == (j <= MAXPAGES/2? j + 100 : j));
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    /* Take a snapshot of the files, as if the program had crashed here */
+    ck_assert(copy(fname, crash) != NULL);
+    ck_assert(copy(wal, crash_wal) != NULL);
+
+    /* Closing the file checkpoints and deletes the log */
+    rc = chidb_Pager_close(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(access(wal, F_OK) != 0);
+
+    /* A log left behind is recovered when the file is opened */
+    rc = chidb_Pager_open(&pg, crash);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->wal == NULL);
+    ck_assert(access(crash_wal, F_OK) != 0);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        ck_assert(page->data[0] == (j <= MAXPAGES/2? j + 100 : j));
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    /* The log is checkpointed once it reaches wal_autocheckpoint frames */
+    sprintf(uri, "file:%s?wal=1&wal_autocheckpoint=2", fname);
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=2; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        memset(page->data, j + 200, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+        chidb_Pager_flush(pg);
+    }
+    ck_assert(pg->wal->n_frames == 0);
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_open(&pg, fname);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_readPage(pg, 2, &page);
+    ck_assert(page->data[0] == 202);
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_close(pg);
+
+    free(uri);
+    free(wal);
+    free(crash_wal);
+    delete_tmp_file(crash);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_sync)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    const char *levels[] = {"off", "full", "normal"};
+
+    char *fname = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 64);
+
+    for(int l=0; l<3; l++)
+    {
+        sprintf(uri, "file:%s?synchronous=%s&sync_delay=10000000", fname, levels[l]);
+        rc = chidb_Pager_open(&pg, uri);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+        for(int j=1; j<=MAXPAGES; j++)
+        {
+            if (l == 0)
+                chidb_Pager_allocatePage(pg, &npage);
+            chidb_Pager_readPage(pg, j, &page);
+            memset(page->data, j, PAGE_SIZE);
+            chidb_Pager_writePage(pg, page);
+            chidb_Pager_releaseMemPage(pg, page);
+            rc = chidb_Pager_flush(pg);
+            ck_assert(rc == CHIDB_OK);
+        }
+
+        /* off never syncs, full syncs every commit, and normal
+         * leaves the commits to the syncer (which is not due yet) */
+        switch (pg->synchronous)
+        {
+        case PAGER_SYNC_OFF:
+            ck_assert(pg->syncs == 0 && pg->syncer == NULL);
+            break;
+        case PAGER_SYNC_FULL:
+            ck_assert(pg->syncs == MAXPAGES && pg->syncer == NULL);
+            break;
+        case PAGER_SYNC_NORMAL:
+            ck_assert(pg->syncs == 0 && pg->syncer != NULL);
+            ck_assert(pg->syncer->committed == MAXPAGES);
+            break;
+        }
+
+        /* Closing the file waits for the pending commits to be synced */
+        rc = chidb_Pager_close(pg);
+        ck_assert(rc == CHIDB_OK);
+    }
+
+    sprintf(uri, "file:%s?synchronous=sometimes", fname);
+    ck_assert(chidb_Pager_open(&pg, uri) == CHIDB_EMISUSE);
+
+    free(uri);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_mmap)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page, *pinned;
+
+    char *fname = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 32);
+    sprintf(uri, "file:%s?mmap=1", fname);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->use_mmap);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* Pages that are not in the file yet come from the buffer pool */
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        memset(page->data, j, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert(pg->n_pages == MAXPAGES);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        rc = chidb_Pager_readPage(pg, j, &page);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(page->data == pg->map->addr + (j-1) * PAGE_SIZE);
+        ck_assert(page->data[0] == j && page->data[PAGE_SIZE-1] == j);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    /* Changes to a mapped page reach the file when it is written */
+    chidb_Pager_readPage(pg, 2, &page);
+    memset(page->data, 0x42, PAGE_SIZE);
+    chidb_Pager_writePage(pg, page);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    /* Grow the file */
+    chidb_Pager_allocatePage(pg, &npage);
+    chidb_Pager_readPage(pg, npage, &page);
+    memset(page->data, 0x43, PAGE_SIZE);
+    chidb_Pager_writePage(pg, page);
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert(pg->n_pages == MAXPAGES + 1);
+    chidb_Pager_readPage(pg, 1, &pinned);
+    chidb_Pager_readPage(pg, 2, &page);
+    ck_assert(page->data[0] == 0x42 && page->data[PAGE_SIZE-1] == 0x42);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    /* Remapping does not invalidate pages that are in use */
+    chidb_Pager_allocatePage(pg, &npage);
+    chidb_Pager_readPage(pg, npage, &page);
+    memset(page->data, 0x44, PAGE_SIZE);
+    chidb_Pager_writePage(pg, page);
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_flush(pg);
+    chidb_Pager_getRealDBSize(pg, &npage);
+    ck_assert(npage == MAXPAGES + 2);
+    chidb_Pager_readPage(pg, MAXPAGES + 1, &page);
+    ck_assert(page->data[0] == 0x43);
+    chidb_Pager_releaseMemPage(pg, page);
+    ck_assert(pinned->data[0] == 1 && pinned->data[PAGE_SIZE-1] == 1);
+    chidb_Pager_releaseMemPage(pg, pinned);
+
+    chidb_Pager_close(pg);
+    free(uri);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_backends)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    PagerCountingFile *cf;
+    const char *backends[] = {"file", "mmap", "counting", "memory"};
+
+    char *fname = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 128);
+
+    for(int b=0; b<4; b++)
+    {
+        bool memory = !strcmp(backends[b], "memory");
+
+        for(int wal=0; wal<2; wal++)
+        {
+            sprintf(uri, "file:%s?backend=%s&cache_size=2&wal=%i&synchronous=full", fname, backends[b], wal);
+            rc = chidb_Pager_open(&pg, uri);
+            ck_assert(rc == CHIDB_OK);
+            ck_assert(!strcmp(pg->file->backend->name, backends[b]));
+            chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+            for(int j=1; j<=MAXPAGES; j++)
+            {
+                if (pg->n_pages < MAXPAGES)
+                    chidb_Pager_allocatePage(pg, &npage);
+                chidb_Pager_readPage(pg, j, &page);
+                memset(page->data, j + wal, PAGE_SIZE);
+                chidb_Pager_writePage(pg, page);
+                chidb_Pager_releaseMemPage(pg, page);
+            }
+            rc = chidb_Pager_flush(pg);
+            ck_assert(rc == CHIDB_OK);
+
+            /* Only two frames, so the pages are read back from the file (or the log) */
+            for(int j=1; j<=MAXPAGES; j++)
+            {
+                rc = chidb_Pager_readPage(pg, j, &page);
+                ck_assert(rc == CHIDB_OK);
+                ck_assert(page->data[0] == j + wal && page->data[PAGE_SIZE-1] == j + wal);
+                chidb_Pager_releaseMemPage(pg, page);
+            }
+
+            if (!strcmp(backends[b], "counting"))
+            {
+                cf = (PagerCountingFile *) (pg->wal? pg->wal->file : pg->file);
+                ck_assert(cf->reads >= MAXPAGES - 2);
+                ck_assert(cf->writes > 0 && cf->bytes_written >= MAXPAGES * PAGE_SIZE);
+                ck_assert(cf->syncs == 1);
+            }
+
+            rc = chidb_Pager_close(pg);
+            ck_assert(rc == CHIDB_OK);
+        }
+
+        /* Everything but the memory backend keeps the pages */
+        sprintf(uri, "file:%s?backend=%s", fname, backends[b]);
+        rc = chidb_Pager_open(&pg, uri);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(pg, PAGE_SIZE);
+        chidb_Pager_getRealDBSize(pg, &npage);
+        ck_assert(npage == (memory? 0 : MAXPAGES));
+        if (!memory)
+        {
+            chidb_Pager_readPage(pg, MAXPAGES, &page);
+            ck_assert(page->data[0] == MAXPAGES + 1);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+        chidb_Pager_close(pg);
+    }
+
+    /* The memory backend cannot map files */
+    sprintf(uri, "file:%s?backend=memory&mmap=1&cache_size=1", fname);
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=2; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        memset(page->data, j, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_flush(pg);
+    rc = chidb_Pager_readPage(pg, 1, &page);
+    ck_assert(rc == CHIDB_OK && page->data[0] == 1);
+    chidb_Pager_releaseMemPage(pg, page);
+    ck_assert(!pg->use_mmap);
+    chidb_Pager_close(pg);
+
+    sprintf(uri, "file:%s?backend=tape", fname);
+    ck_assert(chidb_Pager_open(&pg, uri) == CHIDB_EMISUSE);
+
+    free(uri);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_memory)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, ":memory:");
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->file->backend == &chidb_Backend_memory);
+    ck_assert(pg->wal == NULL && pg->synchronous == PAGER_SYNC_OFF);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        memset(page->data, j, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    /* Nothing is written to disk until the database is serialized */
+    ck_assert(access(":memory:", F_OK) != 0);
+    rc = chidb_Pager_serialize(pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Pager_close(pg);
+    ck_assert(rc == CHIDB_OK);
+
+    struct stat st;
+    stat(fname, &st);
+    ck_assert(st.st_size == MAXPAGES * PAGE_SIZE);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert(pg->n_pages == MAXPAGES);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        ck_assert(page->data[0] == j && page->data[PAGE_SIZE-1] == j);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_uring)
+{
+    int rc;
+    npage_t npage, npages[2 * MAXPAGES];
+    Pager *pg;
+    MemPage *page;
+    PagerUringFile *f;
+
+    char *fname = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 64);
+    sprintf(uri, "file:%s?backend=uring&queue_depth=4&cache_size=%i", fname, 4 * MAXPAGES);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        memset(page->data, j, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* Every page is read once, in a single batch (pages past the end
+     * of the file and repeated pages are skipped) */
+    for(int j=0; j<2*MAXPAGES; j++)
+        npages[j] = (j % (MAXPAGES + 1)) + 1;
+    rc = chidb_Pager_prefetchPages(pg, npages, 2 * MAXPAGES, PAGER_HINT_SCAN);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->read_batches == 1 && pg->pages_prefetched == MAXPAGES);
+
+    f = (PagerUringFile *) pg->file;
+    ck_assert(f->batches == 1);
+    if (f->ring_fd >= 0)
+        ck_assert(f->reads == MAXPAGES && f->submits >= MAXPAGES / 4);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        ck_assert(page->data[0] == j && page->data[PAGE_SIZE-1] == j);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    ck_assert(pg->cache_hits == MAXPAGES && pg->cache_misses == 0);
+
+    /* Pages already in the pool are not read again */
+    chidb_Pager_prefetchPages(pg, npages, MAXPAGES, PAGER_HINT_NONE);
+    ck_assert(pg->read_batches == 1);
+    chidb_Pager_close(pg);
+
+    /* Backends that cannot batch reads ignore the hint */
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_prefetchPages(pg, npages, MAXPAGES, PAGER_HINT_NONE);
+    ck_assert(pg->read_batches == 0);
+    chidb_Pager_close(pg);
+
+    free(uri);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_direct)
+{
+    int rc;
+    npage_t npage;
+    uint32_t align;
+    Pager *pg;
+    MemPage *page, *pinned[3];
+    uint8_t header[100];
+    struct iovec iov;
+
+    char *fname = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 64);
+    sprintf(uri, "file:%s?direct=1&mmap=1&cache_size=2", fname);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Direct I/O may not be supported where the tests run, in which
+     * case the file is accessed through the page cache */
+    align = pg->file->direct_align;
+    ck_assert(pg->use_direct == (align != 0));
+    if (pg->use_direct)
+    {
+        ck_assert(!pg->use_mmap);
+        ck_assert((align & (align - 1)) == 0 && DIRECT_PAGE_SIZE % align == 0);
+        if (align > 1)
+            ck_assert(chidb_Pager_setPageSize(pg, DIRECT_PAGE_SIZE + align / 2) == CHIDB_EMISUSE);
+    }
+    else
+        align = 1;
+    ck_assert(chidb_Pager_setPageSize(pg, DIRECT_PAGE_SIZE) == CHIDB_OK);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        ck_assert((uintptr_t) page->data % align == 0);
+        memset(page->data, j, DIRECT_PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, DIRECT_PAGE_SIZE);
+    ck_assert(pg->n_pages == MAXPAGES);
+
+    /* The header is smaller than a block */
+    ck_assert(chidb_Pager_readHeader(pg, header) == CHIDB_OK);
+    ck_assert(header[0] == 1 && header[99] == 1);
+
+    /* Once every frame is pinned, pages are read into private
+     * buffers, which are aligned too */
+    for(int j=1; j<=3; j++)
+    {
+        rc = chidb_Pager_readPage(pg, j, &pinned[j-1]);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert((uintptr_t) pinned[j-1]->data % align == 0);
+        ck_assert(pinned[j-1]->data[0] == j && pinned[j-1]->data[DIRECT_PAGE_SIZE-1] == j);
+    }
+    memset(pinned[2]->data, 0x42, DIRECT_PAGE_SIZE);
+    ck_assert(chidb_Pager_writePage(pg, pinned[2]) == CHIDB_OK);
+    for(int j=1; j<=3; j++)
+        chidb_Pager_releaseMemPage(pg, pinned[j-1]);
+
+    /* A write the backend cannot do with direct I/O makes it go back
+     * to the page cache */
+    iov.iov_base = header;
+    iov.iov_len = sizeof(header);
+    ck_assert(pg->file->backend->write(pg->file, &iov, 1, 0) >= 0);
+    ck_assert(pg->file->direct_align == 0);
+    chidb_Pager_close(pg);
+
+    /* The file reads the same without direct I/O */
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, DIRECT_PAGE_SIZE);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        ck_assert(page->data[0] == (j == 3? 0x42 : j));
+        ck_assert(page->data[DIRECT_PAGE_SIZE-1] == (j == 3? 0x42 : j));
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    free(uri);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_compress)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    struct stat st;
+    uint32_t seed = 1;
+
+    char *fname = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 64);
+    sprintf(uri, "file:%s?compress=1&cache_size=4", fname);
+
+    /* Pages that compress well */
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->compress);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=4*MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        memset(page->data, j, PAGE_SIZE);
+        for(int k=0; k<16; k++)
+            page->data[pagepos[k]] = values[k];
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    ck_assert(stat(fname, &st) == 0);
+    ck_assert(st.st_size < 4 * MAXPAGES * PAGE_SIZE / 2);
+
+    /* A compressed file is recognized without the option. Half the pages
+     * are rewritten with data that does not compress. */
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->compress);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert(pg->n_pages == 4 * MAXPAGES);
+
+    /* The page map is only read as pages are read, and all of it
+     * once the file is modified */
+    PagerCompressedFile *file = (PagerCompressedFile *) pg->file;
+    ck_assert(file->chunk_loaded != NULL && !file->chunk_loaded[0]);
+    for(int j=1; j<=4*MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        ck_assert(file->chunk_loaded[0]);
+        ck_assert(page->data[0] == j && page->data[PAGE_SIZE-1] == j);
+        for(int k=0; k<16; k++)
+            ck_assert(page->data[pagepos[k]] == values[k]);
+        if (j % 2 == 0)
+        {
+            for(int k=1; k<PAGE_SIZE; k++)
+                page->data[k] = (seed = seed * 1103515245 + 12345) >> 16;
+            chidb_Pager_writePage(pg, page);
+        }
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_flush(pg);
+    ck_assert(file->chunk_loaded == NULL);
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    seed = 1;
+    for(int j=1; j<=4*MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        ck_assert(page->data[0] == j);
+        if (j % 2 == 0)
+            for(int k=1; k<PAGE_SIZE; k++)
+                ck_assert(page->data[k] == (uint8_t) ((seed = seed * 1103515245 + 12345) >> 16));
+        else
+            ck_assert(page->data[PAGE_SIZE-1] == j && page->data[pagepos[0]] == values[0]);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    /* Pages that did not compress are stored as they are */
+    ck_assert(stat(fname, &st) == 0);
+    ck_assert(st.st_size > 2 * MAXPAGES * PAGE_SIZE);
+    ck_assert(st.st_size < 4 * MAXPAGES * PAGE_SIZE);
+
+    /* A file that is not compressed cannot be opened as one */
+    char *plain = create_copy(TESTFILE, "pager-test-compress.dat");
+    sprintf(uri, "file:%s?compress=1", plain);
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_EMISUSE);
+    delete_copy(plain);
+
+    free(uri);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_readahead)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+
+    char *fname = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 96);
+    sprintf(uri, "file:%s?backend=uring&cache_size=%i", fname, 8 * MAXPAGES);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=4*MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        memset(page->data, j, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    /* Once a few pages have been read in order, the following pages
+     * are read ahead, so most reads are served from the pool */
+    sprintf(uri, "file:%s?backend=uring&cache_size=%i&readahead=%i", fname, 8 * MAXPAGES, 2 * MAXPAGES);
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=4*MAXPAGES; j++)
+    {
+        rc = chidb_Pager_readPage(pg, j, &page);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(page->data[0] == j && page->data[PAGE_SIZE-1] == j);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    ck_assert(pg->readaheads > 1);
+    ck_assert(pg->pages_read_ahead == pg->cache_hits);
+    ck_assert(pg->cache_misses <= MAXPAGES);
+    chidb_Pager_close(pg);
+
+    /* Reads that are not in order do not trigger it */
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=0; j<4*MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, (j * 7) % (4 * MAXPAGES) + 1, &page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    ck_assert(pg->readaheads == 0 && pg->cache_misses == 4 * MAXPAGES);
+    chidb_Pager_close(pg);
+
+    /* ...and it can be turned off */
+    sprintf(uri, "file:%s?backend=uring&readahead=0", fname);
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=4*MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    ck_assert(pg->readaheads == 0 && pg->read_batches == 0);
+    chidb_Pager_close(pg);
+
+    /* The window is bounded, and never more than half the pool */
+    sprintf(uri, "file:%s?backend=uring&readahead=100000000", fname);
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_EMISUSE);
+
+    sprintf(uri, "file:%s?backend=uring&cache_size=%i&readahead=4096", fname, MAXPAGES);
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=4*MAXPAGES; j++)
+    {
+        rc = chidb_Pager_readPage(pg, j, &page);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(page->data[0] == j);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    ck_assert(pg->readaheads > 0);
+    ck_assert(pg->pages_read_ahead <= pg->readaheads * (MAXPAGES / 2));
+    chidb_Pager_close(pg);
+
+    free(uri);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_stats)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    chidb_stats_t st;
+
+    char *fname = create_tmp_file();
+    char *uri = malloc(strlen(fname) + 64);
+    sprintf(uri, "file:%s?cache_size=%i&readahead=0", fname, MAXPAGES / 2);
+
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        memset(page->data, j, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_flush(pg);
+
+    /* Half of the pages had to be evicted (and written) to make room
+     * for the other half */
+    chidb_Pager_getStats(pg, &st);
+    ck_assert(st.evictions == MAXPAGES / 2);
+    ck_assert(st.pages_written == MAXPAGES);
+    ck_assert(st.bytes_written == MAXPAGES * PAGE_SIZE);
+    ck_assert(st.write_calls >= 1);
+
+    chidb_Pager_resetStats(pg);
+    chidb_Pager_getStats(pg, &st);
+    ck_assert(st.cache_hits == 0 && st.cache_misses == 0 && st.evictions == 0);
+    ck_assert(st.pages_written == 0 && st.bytes_written == 0 && st.write_ns == 0);
+
+    /* Reading every page twice: the second time, only the last half
+     * of the pages are still in the pool */
+    for(int k=0; k<2; k++)
+        for(int j=1; j<=MAXPAGES; j++)
+        {
+            chidb_Pager_readPage(pg, j, &page);
+            ck_assert(page->data[0] == j);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+    chidb_Pager_getStats(pg, &st);
+    ck_assert(st.cache_hits + st.cache_misses == 2 * MAXPAGES);
+    ck_assert(st.pages_read == st.cache_misses && st.read_calls == st.pages_read);
+    ck_assert(st.bytes_read == st.pages_read * PAGE_SIZE);
+    ck_assert(st.pages_written == 0 && st.syncs == 0);
+    chidb_Pager_close(pg);
+
+    /* Writes to the write-ahead log count too */
+    sprintf(uri, "file:%s?wal=1&synchronous=full", fname);
+    rc = chidb_Pager_open(&pg, uri);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_readPage(pg, 1, &page);
+    chidb_Pager_writePage(pg, page);
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_resetStats(pg);
+    chidb_Pager_flush(pg);
+    chidb_Pager_getStats(pg, &st);
+    ck_assert(st.pages_written == 1 && st.bytes_written == PAGE_SIZE);
+    ck_assert(st.syncs >= 1);
+    chidb_Pager_close(pg);
+
+    free(uri);
+    delete_tmp_file(fname);
+}
+END_TEST
+
 
 Suite* make_pager_suite (void)
 {
@@ -162,6 +1640,56 @@ Suite* make_pager_suite (void)
     tcase_add_test (tc_readwrite, test_readwrite);
     suite_add_tcase (s, tc_readwrite);
 
+    TCase *tc_cache = tcase_create ("Buffer pool");
+    tcase_add_test (tc_cache, test_cache);
+    tcase_add_test (tc_cache, test_cache_scan);
+    tcase_add_test (tc_cache, test_cache_buffers);
+    tcase_add_test (tc_cache, test_cache_hugepages);
+    tcase_add_test (tc_cache, test_cache_shards);
+    tcase_add_test (tc_cache, test_cache_shards_cold);
+    suite_add_tcase (s, tc_cache);
+
+    TCase *tc_writeback = tcase_create ("Deferred writes");
+    tcase_add_test (tc_writeback, test_writeback);
+    suite_add_tcase (s, tc_writeback);
+
+    TCase *tc_freelist = tcase_create ("Freelist");
+    tcase_add_test (tc_freelist, test_freelist);
+    suite_add_tcase (s, tc_freelist);
+
+    TCase *tc_extents = tcase_create ("File preallocation");
+    tcase_add_test (tc_extents, test_extents);
+    tcase_add_test (tc_extents, test_extents_crash);
+    suite_add_tcase (s, tc_extents);
+
+    TCase *tc_wal = tcase_create ("Write-ahead log");
+    tcase_add_test (tc_wal, test_wal);
+    suite_add_tcase (s, tc_wal);
+
+    TCase *tc_sync = tcase_create ("Durability");
+    tcase_add_test (tc_sync, test_sync);
+    suite_add_tcase (s, tc_sync);
+
+    TCase *tc_mmap = tcase_create ("Memory-mapped file");
+    tcase_add_test (tc_mmap, test_mmap);
+    suite_add_tcase (s, tc_mmap);
+
+    TCase *tc_backends = tcase_create ("Backends");
+    tcase_add_test (tc_backends, test_backends);
+    tcase_add_test (tc_backends, test_memory);
+    tcase_add_test (tc_backends, test_uring);
+    tcase_add_test (tc_backends, test_direct);
+    tcase_add_test (tc_backends, test_compress);
+    suite_add_tcase (s, tc_backends);
+
+    TCase *tc_readahead = tcase_create ("Readahead");
+    tcase_add_test (tc_readahead, test_readahead);
+    suite_add_tcase (s, tc_readahead);
+
+    TCase *tc_stats = tcase_create ("Statistics");
+    tcase_add_test (tc_stats, test_stats);
+    suite_add_tcase (s, tc_stats);
+
     return s;
 }
 